@@ -0,0 +1,425 @@
+#include <stdlib.h>
+
+#include "aot.h"
+#include "peephole.h"
+#include "vm.h"
+
+/**
+ * Ahead-of-time translation of Lox to C: `clox --emit-c script.lox` compiles the script and writes every function of
+ * it as one C function, an instruction at a time. The output is built with `-DAOT_RUNTIME` and linked against every
+ * source of clox but `main.c` into a standalone executable (`make aot SCRIPT=script.lox`).
+ *
+ * - Stack slots, locals, globals, upvalues, jumps, and number arithmetic and comparisons become inline C on the stack
+ *   of the VM, jumps become `goto`.
+ * - Any other instruction, and any operand the inline code doesn't handle, runs that one instruction with the handlers
+ *   of the interpreter (`stepInstruction()`), which also report the runtime errors.
+ * - A call or a return switches frames in the VM and leaves the C function, `runAot()` in `vm.c` enters the code of
+ *   the new running frame at `frame->ip`: a label after every call.
+ *
+ * The source is embedded and compiled again at startup, which rebuilds the constants, the bytecode that stepped
+ * instructions and error lines need, and the global slots exactly as they were translated. `attachAot()` hands the C
+ * functions to the compiled functions in the same order as `emitC()` visits them.
+ */
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Translation
+
+static int readShort(Chunk *chunk, int offset)
+{
+    return (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+}
+
+/**
+ * @return target of the jump at `offset`, -1 when the instruction does not jump
+ */
+static int branchTarget(Chunk *chunk, int offset)
+{
+    switch (chunk->code[offset])
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_LOOP_LONG:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+        return jumpTarget(chunk, offset);
+    default:
+        return -1;
+    }
+}
+
+static bool switchesFrames(Chunk *chunk, int offset)
+{
+    uint8_t instruction = chunk->code[chunk->code[offset] == OP_WIDE ? offset + 1 : offset];
+    return instruction == OP_CALL || instruction == OP_INVOKE || instruction == OP_SUPER_INVOKE;
+}
+
+/**
+ * Mark the offsets that get a label: jump targets, and where the C function is entered, the start and after calls
+ */
+static bool *findLabels(Chunk *chunk)
+{
+    bool *labels = calloc(chunk->count + 1, sizeof(bool));
+    if (labels == NULL)
+    {
+        exit(1);
+    }
+
+    labels[0] = true;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        int target = branchTarget(chunk, offset);
+        if (target >= 0)
+        {
+            labels[target] = true;
+        }
+        if (switchesFrames(chunk, offset))
+        {
+            labels[offset + instructionLength(chunk, offset)] = true;
+        }
+    }
+    return labels;
+}
+
+static void emitInstruction(FILE *out, Chunk *chunk, int offset)
+{
+    uint8_t *ip = &chunk->code[offset];
+    int next = offset + instructionLength(chunk, offset);
+    int target = branchTarget(chunk, offset);
+    switch (*ip)
+    {
+    case OP_CONSTANT:
+        fprintf(out, "    AOT_PUSH(constants[%d]);\n", ip[1]);
+        break;
+    case OP_CONSTANT_LONG:
+        fprintf(out, "    AOT_PUSH(constants[%d]);\n", readLong(&ip[1]));
+        break;
+    case OP_NIL:
+        fprintf(out, "    AOT_PUSH(NIL_VAL);\n");
+        break;
+    case OP_TRUE:
+        fprintf(out, "    AOT_PUSH(BOOL_VAL(true));\n");
+        break;
+    case OP_FALSE:
+        fprintf(out, "    AOT_PUSH(BOOL_VAL(false));\n");
+        break;
+    case OP_POP:
+        fprintf(out, "    sp--;\n");
+        break;
+    case OP_GET_LOCAL:
+        fprintf(out, "    AOT_PUSH(slots[%d]);\n", ip[1]);
+        break;
+    case OP_SET_LOCAL:
+        fprintf(out, "    slots[%d] = sp[-1];\n", ip[1]);
+        break;
+    case OP_GET_GLOBAL:
+        fprintf(out, "    if (IS_UNDEFINED(vm->globalValues.values[%d]))\n", readShort(chunk, offset));
+        fprintf(out, "        AOT_STEP(%d, %d);\n", offset, next);
+        fprintf(out, "    else\n");
+        fprintf(out, "        AOT_PUSH(vm->globalValues.values[%d]);\n", readShort(chunk, offset));
+        break;
+    case OP_DEFINE_GLOBAL:
+        fprintf(out, "    vm->globalValues.values[%d] = *--sp;\n", readShort(chunk, offset));
+        break;
+    case OP_SET_GLOBAL:
+        fprintf(out, "    if (IS_UNDEFINED(vm->globalValues.values[%d]))\n", readShort(chunk, offset));
+        fprintf(out, "        AOT_STEP(%d, %d);\n", offset, next);
+        fprintf(out, "    else\n");
+        fprintf(out, "        vm->globalValues.values[%d] = sp[-1];\n", readShort(chunk, offset));
+        break;
+    case OP_GET_UPVALUE:
+        fprintf(out, "    AOT_PUSH(*frame->closure->upvalues[%d]->location);\n", ip[1]);
+        break;
+    case OP_SET_UPVALUE:
+        fprintf(out, "    overwriteBarrier(*frame->closure->upvalues[%d]->location);\n", ip[1]);
+        fprintf(out, "    *frame->closure->upvalues[%d]->location = sp[-1];\n", ip[1]);
+        fprintf(out, "    writeBarrier((Obj *)frame->closure->upvalues[%d], sp[-1]);\n", ip[1]);
+        break;
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+        fprintf(out, "    sp[-2] = BOOL_VAL(%svaluesEqual(sp[-2], sp[-1]));\n", *ip == OP_EQUAL ? "" : "!");
+        fprintf(out, "    sp--;\n");
+        break;
+    case OP_GREATER:
+        fprintf(out, "    AOT_BINARY(BOOL_VAL, >, %d, %d);\n", offset, next);
+        break;
+    case OP_LESS:
+        fprintf(out, "    AOT_BINARY(BOOL_VAL, <, %d, %d);\n", offset, next);
+        break;
+    case OP_GREATER_EQUAL:
+        fprintf(out, "    AOT_BINARY(AOT_NOT_BOOL_VAL, <, %d, %d);\n", offset, next);
+        break;
+    case OP_LESS_EQUAL:
+        fprintf(out, "    AOT_BINARY(AOT_NOT_BOOL_VAL, >, %d, %d);\n", offset, next);
+        break;
+    case OP_ADD: // strings are concatenated by the interpreter
+        fprintf(out, "    AOT_BINARY(NUMBER_VAL, +, %d, %d);\n", offset, next);
+        break;
+    case OP_SUBTRACT:
+        fprintf(out, "    AOT_BINARY(NUMBER_VAL, -, %d, %d);\n", offset, next);
+        break;
+    case OP_MULTIPLY:
+        fprintf(out, "    AOT_BINARY(NUMBER_VAL, *, %d, %d);\n", offset, next);
+        break;
+    case OP_DIVIDE:
+        fprintf(out, "    AOT_BINARY(NUMBER_VAL, /, %d, %d);\n", offset, next);
+        break;
+    case OP_NOT:
+        fprintf(out, "    sp[-1] = BOOL_VAL(aotFalsey(sp[-1]));\n");
+        break;
+    case OP_NEGATE:
+        fprintf(out, "    if (IS_NUMBER(sp[-1]))\n");
+        fprintf(out, "        sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));\n");
+        fprintf(out, "    else\n");
+        fprintf(out, "        AOT_STEP(%d, %d);\n", offset, next);
+        break;
+    case OP_JUMP:
+    case OP_LOOP:
+    case OP_JUMP_LONG:
+    case OP_LOOP_LONG:
+        fprintf(out, "    goto L%d;\n", target);
+        break;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+        fprintf(out, "    if (aotFalsey(sp[-1]))\n");
+        fprintf(out, "        goto L%d;\n", target);
+        break;
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+        fprintf(out, "    sp -= 2;\n");
+        fprintf(out, "    if (%svaluesEqual(sp[0], sp[1]))\n", *ip == OP_JUMP_IF_EQUAL ? "" : "!");
+        fprintf(out, "        goto L%d;\n", target);
+        break;
+    case OP_JUMP_IF_LESS:
+        fprintf(out, "    AOT_COMPARE_JUMP(<, true, L%d, %d, %d);\n", target, offset, next);
+        break;
+    case OP_JUMP_IF_NOT_LESS:
+        fprintf(out, "    AOT_COMPARE_JUMP(<, false, L%d, %d, %d);\n", target, offset, next);
+        break;
+    case OP_JUMP_IF_GREATER:
+        fprintf(out, "    AOT_COMPARE_JUMP(>, true, L%d, %d, %d);\n", target, offset, next);
+        break;
+    case OP_JUMP_IF_NOT_GREATER:
+        fprintf(out, "    AOT_COMPARE_JUMP(>, false, L%d, %d, %d);\n", target, offset, next);
+        break;
+    case OP_ADD_CONSTANT_TO_LOCAL:
+        fprintf(out, "    if (IS_NUMBER(slots[%d]))\n", ip[1]);
+        fprintf(out, "        slots[%d] = NUMBER_VAL(AS_NUMBER(slots[%d]) + AS_NUMBER(constants[%d]));\n", ip[1], ip[1],
+                ip[2]);
+        fprintf(out, "    else\n");
+        fprintf(out, "        AOT_STEP(%d, %d);\n", offset, next);
+        break;
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_FRAME: // a method is bound by the interpreter
+        fprintf(out, "    AOT_GET_PROPERTY(%d, %d, %d);\n", readShort(chunk, offset + 1), offset, next);
+        break;
+    case OP_SET_PROPERTY:
+        fprintf(out, "    AOT_SET_PROPERTY(%d, %d, %d);\n", readShort(chunk, offset + 1), offset, next);
+        break;
+    case OP_CALL:
+        fprintf(out, "    AOT_CALL(%d, %d, %d);\n", ip[1], offset, next);
+        break;
+    case OP_INVOKE:
+        fprintf(out, "    AOT_INVOKE(%d, %d, %d, %d);\n", ip[2], readShort(chunk, offset + 2), offset, next);
+        break;
+    case OP_RETURN:
+        fprintf(out, "    AOT_RETURN(%d);\n", offset);
+        break;
+    default: // other property accesses and calls, closures, classes, `print` and wide instructions
+        fprintf(out, "    AOT_STEP(%d, %d);\n", offset, next);
+        break;
+    }
+}
+
+static void emitFunction(FILE *out, ObjFunction *function, int index)
+{
+    Chunk *chunk = &function->chunk;
+    bool *labels = findLabels(chunk);
+
+    fprintf(out, "// %s\n", function->name == NULL ? "<script>" : function->name->chars);
+    fprintf(out, "static int function%d(CallFrame *frame)\n{\n", index);
+    fprintf(out, "    uint8_t *code = frame->closure->function->chunk.code;\n");
+    fprintf(out, "    Value *constants = frame->closure->function->chunk.constants.values;\n");
+    fprintf(out, "    InlineCache *caches = frame->closure->function->chunk.caches;\n");
+    fprintf(out, "    Value *slots = frame->slots;\n");
+    fprintf(out, "    Value *sp = vm->stackTop;\n");
+    fprintf(out, "    int frameCount = vm->frameCount;\n");
+    fprintf(out, "    (void)constants;\n");
+    fprintf(out, "    (void)caches;\n");
+    fprintf(out, "    (void)slots;\n\n");
+
+    fprintf(out, "    switch (frame->ip - code)\n    {\n");
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        if (offset == 0 || switchesFrames(chunk, offset))
+        {
+            int resume = offset == 0 ? 0 : offset + instructionLength(chunk, offset);
+            fprintf(out, "    case %d:\n        goto L%d;\n", resume, resume);
+        }
+    }
+    fprintf(out, "    default:\n        return AOT_INTERPRET;\n    }\n\n");
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        if (labels[offset])
+        {
+            fprintf(out, "L%d:\n", offset);
+        }
+        emitInstruction(out, chunk, offset);
+    }
+    fprintf(out, "}\n\n");
+    free(labels);
+}
+
+/**
+ * Emit `function` and the functions among its constants, depth first
+ *
+ * @return index of the next function
+ */
+static int emitFunctions(FILE *out, ObjFunction *function, int index)
+{
+    emitFunction(out, function, index++);
+    for (int i = 0; i < function->chunk.constants.count; i++)
+    {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_FUNCTION(constant))
+        {
+            index = emitFunctions(out, AS_FUNCTION(constant), index);
+        }
+    }
+    return index;
+}
+
+static int emitTable(FILE *out, ObjFunction *function, int index)
+{
+    fprintf(out, "    {function%d, %d},\n", index++, function->chunk.count);
+    for (int i = 0; i < function->chunk.constants.count; i++)
+    {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_FUNCTION(constant))
+        {
+            index = emitTable(out, AS_FUNCTION(constant), index);
+        }
+    }
+    return index;
+}
+
+/**
+ * Emit `source` as a C string literal, a line of source per line of C
+ */
+static void emitSource(FILE *out, const char *source)
+{
+    fprintf(out, "static const char source[] =\n    \"");
+    for (const char *c = source; *c != '\0'; c++)
+    {
+        switch (*c)
+        {
+        case '\n':
+            fprintf(out, c[1] == '\0' ? "\\n" : "\\n\"\n    \"");
+            break;
+        case '"':
+        case '\\':
+            fprintf(out, "\\%c", *c);
+            break;
+        default:
+            if ((unsigned char)*c < ' ' || (unsigned char)*c >= 0x7f)
+            {
+                fprintf(out, "\\%03o", (unsigned char)*c);
+            }
+            else if (*c == '?' && c[1] == '?')
+            {
+                fprintf(out, "?\\"); // no trigraphs
+            }
+            else
+            {
+                fputc(*c, out);
+            }
+            break;
+        }
+    }
+    fprintf(out, "\";\n\n");
+}
+
+void emitC(FILE *out, const char *source, ObjFunction *script)
+{
+    fprintf(out, "// Generated by `clox --emit-c`, build with `-DAOT_RUNTIME` and every source of clox but `main.c`.\n\n");
+    fprintf(out, "#include \"aot.h\"\n\n");
+    emitSource(out, source);
+    int count = emitFunctions(out, script, 0);
+
+    fprintf(out, "const AotFunction aotFunctions[] = {\n");
+    emitTable(out, script, 0);
+    fprintf(out, "};\n");
+    fprintf(out, "const int aotFunctionCount = %d;\n\n", count);
+    fprintf(out, "int main()\n{\n    return aotMain(source);\n}\n");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Runtime
+
+#ifdef AOT_RUNTIME
+
+/**
+ * Visit `function` and its functions in the order of `emitFunctions()`, attach their C code with `commit`
+ *
+ * @return index of the next function, -1 when one doesn't match
+ */
+static int attach(ObjFunction *function, int index, bool commit)
+{
+    if (index >= aotFunctionCount || aotFunctions[index].codeSize != function->chunk.count)
+    {
+        return -1;
+    }
+
+    if (commit)
+    {
+        function->aot = &aotFunctions[index];
+    }
+    index++;
+
+    for (int i = 0; i < function->chunk.constants.count && index >= 0; i++)
+    {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_FUNCTION(constant))
+        {
+            index = attach(AS_FUNCTION(constant), index, commit);
+        }
+    }
+    return index;
+}
+
+bool attachAot(ObjFunction *script)
+{
+    if (attach(script, 0, false) != aotFunctionCount)
+    {
+        return false;
+    }
+
+    attach(script, 0, true);
+    return true;
+}
+
+int aotMain(const char *source)
+{
+    VM *instance = newVM();
+    InterpretResult result = interpret(instance, source);
+    freeVM(instance);
+
+    if (result == INTERPRET_COMPILE_ERROR)
+    {
+        return 65;
+    }
+    if (result == INTERPRET_RUNTIME_ERROR)
+    {
+        return 70;
+    }
+    return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef clox_aot_h
+#define clox_aot_h
+
+#include <stdio.h>
+
+#include "common.h"
+#include "object.h"
+
+/**
+ * Write the C translation of `script` and of every function it contains to `out` (`clox --emit-c`), see `aot.c`
+ *
+ * @param source the source `script` was compiled from, embedded in the output
+ */
+void emitC(FILE *out, const char *source, ObjFunction *script);
+
+#ifdef AOT_RUNTIME
+
+#include "jit.h"
+#include "memory.h"
+#include "vm.h"
+
+/**
+ * Returned by the C code of a function entered at an offset it has no label for, the interpreter runs the frame
+ */
+#define AOT_INTERPRET (-2)
+
+/**
+ * C code of a function, entered with the running frame and resumed at `frame->ip`
+ *
+ * @return `JIT_CONTINUE` when the running frame changed, `AOT_INTERPRET`, or the `InterpretResult` that ends `run()`
+ */
+typedef int (*AotEntry)(CallFrame *frame);
+
+typedef struct AotFunction
+{
+    AotEntry entry;
+    /**
+     * Size of the bytecode the function was translated from, checked against the compiled script
+     */
+    int codeSize;
+} AotFunction;
+
+/**
+ * Functions of the translated script in the order of `emitC()`, defined by the generated code
+ */
+extern const AotFunction aotFunctions[];
+extern const int aotFunctionCount;
+
+/**
+ * Attach the C code of every function of `script`, compiled from the embedded source
+ *
+ * @return false when the functions don't match the generated code, which leaves them all interpreted
+ */
+bool attachAot(ObjFunction *script);
+/**
+ * `main()` of a translated script: run `source` like `clox <path>` does
+ */
+int aotMain(const char *source);
+
+static inline bool aotFalsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * Run the instruction at `offset` with the interpreter, then go on at `next` unless it switched frames or jumped
+ */
+#define AOT_STEP(offset, next)                                          \
+    do                                                                  \
+    {                                                                   \
+        frame->ip = code + (offset);                                    \
+        vm->stackTop = sp;                                              \
+        int stepResult = stepInstruction();                             \
+        if (stepResult != JIT_CONTINUE)                                 \
+        {                                                               \
+            return stepResult;                                          \
+        }                                                               \
+        if (vm->frameCount != frameCount || frame->ip != code + (next)) \
+        {                                                               \
+            return JIT_CONTINUE;                                        \
+        }                                                               \
+        sp = vm->stackTop;                                              \
+        slots = frame->slots;                                           \
+    } while (false)
+
+#define AOT_PUSH(value) (*sp++ = (value))
+
+/**
+ * `a op b` on the top two numbers, the interpreter reports the error when one is not a number
+ */
+#define AOT_BINARY(valueType, op, offset, next)                         \
+    do                                                                  \
+    {                                                                   \
+        if (IS_NUMBER(sp[-1]) && IS_NUMBER(sp[-2]))                     \
+        {                                                               \
+            sp[-2] = valueType(AS_NUMBER(sp[-2]) op AS_NUMBER(sp[-1])); \
+            sp--;                                                       \
+        }                                                               \
+        else                                                            \
+        {                                                               \
+            AOT_STEP(offset, next);                                     \
+        }                                                               \
+    } while (false)
+
+#define AOT_NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+/**
+ * `goto target` when `a op b` of the top two numbers is `jumpIf`, both are popped
+ */
+#define AOT_COMPARE_JUMP(op, jumpIf, target, offset, next)        \
+    do                                                            \
+    {                                                             \
+        if (IS_NUMBER(sp[-1]) && IS_NUMBER(sp[-2]))               \
+        {                                                         \
+            sp -= 2;                                              \
+            if ((AS_NUMBER(sp[0]) op AS_NUMBER(sp[1])) == jumpIf) \
+            {                                                     \
+                goto target;                                      \
+            }                                                     \
+        }                                                         \
+        else                                                      \
+        {                                                         \
+            AOT_STEP(offset, next);                               \
+        }                                                         \
+    } while (false)
+
+/**
+ * The shape-cached field of the instance on top of the stack, when the first entry of its inline cache holds it
+ */
+static inline bool aotCachedField(Value receiver, InlineCache *cache, ObjInstance **instance, int *field)
+{
+    if (!IS_INSTANCE(receiver) || cache->count == 0)
+    {
+        return false;
+    }
+
+    *instance = AS_INSTANCE(receiver);
+    InlineCacheEntry *entry = &cache->entries[0];
+    *field = entry->field;
+    return entry->shape == (*instance)->shape && entry->field >= 0 && entry->transition == NULL;
+}
+
+/**
+ * `call()` of `callee` when it is a closure with C code and the frames and the stack have room for it: push its frame,
+ * then leave to switch to it. `call()` grows them otherwise.
+ */
+#define AOT_CALL_CLOSURE(callee, argCount, next)                                                                   \
+    do                                                                                                             \
+    {                                                                                                              \
+        ObjClosure *closure = (callee);                                                                            \
+        if (closure->function->arity == (argCount) && closure->function->aot != NULL &&                            \
+            vm->frameCount < vm->frameCapacity && sp - (argCount)-1 + closure->function->maxStack <= vm->stackEnd) \
+        {                                                                                                          \
+            frame->ip = code + (next);                                                                             \
+            vm->stackTop = sp;                                                                                     \
+            CallFrame *calleeFrame = &vm->frames[vm->frameCount++];                                                \
+            calleeFrame->closure = closure;                                                                        \
+            calleeFrame->ip = closure->function->chunk.code;                                                       \
+            calleeFrame->slots = sp - (argCount)-1;                                                                \
+            return JIT_CONTINUE;                                                                                   \
+        }                                                                                                          \
+    } while (false)
+
+#define AOT_GET_PROPERTY(cache, offset, next)                          \
+    do                                                                 \
+    {                                                                  \
+        ObjInstance *instance;                                         \
+        int field;                                                     \
+        if (aotCachedField(sp[-1], &caches[cache], &instance, &field)) \
+        {                                                              \
+            sp[-1] = instance->fields[field];                          \
+        }                                                              \
+        else                                                           \
+        {                                                              \
+            AOT_STEP(offset, next);                                    \
+        }                                                              \
+    } while (false)
+
+#define AOT_SET_PROPERTY(cache, offset, next)                          \
+    do                                                                 \
+    {                                                                  \
+        ObjInstance *instance;                                         \
+        int field;                                                     \
+        if (aotCachedField(sp[-2], &caches[cache], &instance, &field)) \
+        {                                                              \
+            overwriteBarrier(instance->fields[field]);                 \
+            instance->fields[field] = sp[-1];                          \
+            writeBarrier((Obj *)instance, sp[-1]);                     \
+            sp[-2] = sp[-1];                                           \
+            sp--;                                                      \
+        }                                                              \
+        else                                                           \
+        {                                                              \
+            AOT_STEP(offset, next);                                    \
+        }                                                              \
+    } while (false)
+
+#define AOT_CALL(argCount, offset, next)                                     \
+    do                                                                       \
+    {                                                                        \
+        if (IS_CLOSURE(sp[-(argCount)-1]))                                   \
+        {                                                                    \
+            AOT_CALL_CLOSURE(AS_CLOSURE(sp[-(argCount)-1]), argCount, next); \
+        }                                                                    \
+        AOT_STEP(offset, next);                                              \
+    } while (false)
+
+/**
+ * Call the method cached by the first entry of the inline cache of `OP_INVOKE`
+ */
+#define AOT_INVOKE(argCount, cache, offset, next)                             \
+    do                                                                        \
+    {                                                                         \
+        Value receiver = sp[-(argCount)-1];                                   \
+        InlineCacheEntry *entry = &caches[cache].entries[0];                  \
+        if (IS_INSTANCE(receiver) && caches[cache].count > 0 &&               \
+            entry->shape == AS_INSTANCE(receiver)->shape && entry->field < 0) \
+        {                                                                     \
+            AOT_CALL_CLOSURE(AS_CLOSURE(entry->method), argCount, next);      \
+        }                                                                     \
+        AOT_STEP(offset, next);                                               \
+    } while (false)
+
+/**
+ * `OP_RETURN` to a caller when there is no upvalue to close
+ */
+#define AOT_RETURN(offset)                                                      \
+    do                                                                          \
+    {                                                                           \
+        if ((vm->openUpvalues == NULL || vm->openUpvalues->location < slots) && \
+            vm->frameCount > 1)                                                 \
+        {                                                                       \
+            vm->frameCount--;                                                   \
+            slots[0] = sp[-1];                                                  \
+            vm->stackTop = slots + 1;                                           \
+            return JIT_CONTINUE;                                                \
+        }                                                                       \
+        AOT_STEP(offset, offset + 1);                                           \
+        return JIT_CONTINUE;                                                    \
+    } while (false)
+
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+#define _DEFAULT_SOURCE // clock_gettime() is not in strict C17 mode
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "vm.h"
+
+/**
+ * A distinct source, compiled once in a VM of its own that never runs it. The VM is frozen, every job runs its code and
+ * shares its strings, read-only.
+ */
+typedef struct
+{
+    const char *source;
+    VM *owner;
+    /**
+     * The compiled script, NULL when the source doesn't compile
+     */
+    ObjFunction *script;
+} Program;
+
+typedef struct
+{
+    const char *path;
+    Program *program;
+    InterpretResult result;
+    double milliseconds;
+} Job;
+
+/**
+ * Jobs shared by the workers, each takes the next one until none is left
+ */
+typedef struct
+{
+    Job *jobs;
+    int count;
+    int gcThreads;
+    atomic_int next;
+} Queue;
+
+static double now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+static InterpretResult runJob(Program *program, int gcThreads)
+{
+    if (program->script == NULL)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    VM *instance = newSharingVM(program->owner);
+    instance->gcThreads = gcThreads;
+    InterpretResult result = interpretFunction(instance, program->script);
+    freeVM(instance);
+    return result;
+}
+
+static void *work(void *queue)
+{
+    Queue *jobs = (Queue *)queue;
+    for (int i = atomic_fetch_add(&jobs->next, 1); i < jobs->count; i = atomic_fetch_add(&jobs->next, 1))
+    {
+        Job *job = &jobs->jobs[i];
+        double start = now();
+        job->result = runJob(job->program, jobs->gcThreads);
+        job->milliseconds = now() - start;
+    }
+    return NULL;
+}
+
+static void report(Job *jobs, int count, int programCount, int threadCount, double milliseconds)
+{
+    static const char *results[] = {"ok", "compile error", "runtime error"};
+    fprintf(stderr, "%6s  %10s  %-13s  %s\n", "job", "latency", "result", "script");
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(stderr, "%6d  %7.2f ms  %-13s  %s\n", i + 1, jobs[i].milliseconds, results[jobs[i].result],
+                jobs[i].path);
+    }
+    fprintf(stderr, "%d jobs of %d scripts on %d threads in %.2f ms, %.1f jobs/s\n", count, programCount, threadCount,
+            milliseconds, count * 1000.0 / milliseconds);
+}
+
+int runBatch(int threadCount, int gcThreads, int scriptCount, const char *paths[], const char *sources[])
+{
+    Program *programs = (Program *)malloc(sizeof(Program) * scriptCount);
+    Job *jobs = (Job *)malloc(sizeof(Job) * scriptCount);
+    if (programs == NULL || jobs == NULL)
+    {
+        exit(1);
+    }
+
+    double start = now();
+    int programCount = 0;
+    for (int i = 0; i < scriptCount; i++)
+    {
+        Program *program = NULL;
+        for (int j = 0; j < programCount && program == NULL; j++)
+        {
+            if (strcmp(programs[j].source, sources[i]) == 0)
+            {
+                program = &programs[j];
+            }
+        }
+
+        if (program == NULL)
+        {
+            program = &programs[programCount++];
+            program->source = sources[i];
+            program->owner = newVM();
+            program->script = compileSource(program->owner, sources[i]); // nothing allocates in the VM from now on
+            freezeVM(program->owner);
+        }
+        jobs[i].path = paths[i];
+        jobs[i].program = program;
+    }
+
+    // the main thread is a worker too, a thread that can't start only costs parallelism
+    Queue queue = {jobs, scriptCount, gcThreads, 0};
+    if (threadCount > scriptCount)
+    {
+        threadCount = scriptCount;
+    }
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * threadCount);
+    int started = 0;
+    while (threads != NULL && started < threadCount - 1 && pthread_create(&threads[started], NULL, work, &queue) == 0)
+    {
+        started++;
+    }
+    work(&queue);
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    report(jobs, scriptCount, programCount, started + 1, now() - start);
+
+    int status = 0;
+    for (int i = 0; i < scriptCount; i++)
+    {
+        if (jobs[i].result == INTERPRET_COMPILE_ERROR)
+        {
+            status = 65;
+        }
+        else if (jobs[i].result == INTERPRET_RUNTIME_ERROR && status == 0)
+        {
+            status = 70;
+        }
+    }
+
+    for (int i = 0; i < programCount; i++)
+    {
+        freeVM(programs[i].owner);
+    }
+    free(programs);
+    free(jobs);
+    return status;
+}
@@ -0,0 +1,16 @@
+#ifndef clox_batch_h
+#define clox_batch_h
+
+/**
+ * Run each of the `scriptCount` scripts as a job in a VM of its own, on `threadCount` worker threads
+ * (`clox --jobs N script...`), then report the latency of every job on stderr. Each VM of a job marks with `gcThreads`
+ * GC threads (`VM.gcThreads`).
+ *
+ * @details A source given more than once is compiled once, in a VM frozen then (`freezeVM()`), and each of its jobs runs
+ * the compiled functions in place, in a VM sharing them and their strings (`newSharingVM()`).
+ *
+ * @return exit code of the batch: 65 when a script doesn't compile, 70 when a job had a runtime error, else 0
+ */
+int runBatch(int threadCount, int gcThreads, int scriptCount, const char *paths[], const char *sources[]);
+
+#endif
@@ -0,0 +1,423 @@
+#define _DEFAULT_SOURCE // mmap(), mkdir() and getpid() are not in strict C17 mode
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "memory.h"
+#include "vm.h"
+
+#define BYTECODE_MAGIC "LOXC"
+#define BYTE_ORDER_MARK 0x01020304u
+
+/**
+ * Header of a `.loxc` file. The names of the global slots follow in slot order, then the script function, every item
+ * padded to 4 bytes so line tables are aligned in place:
+ *
+ * - string: `uint32_t` length, the bytes and a terminating NUL
+ * - function: `uint32_t` arity, upvalue count, most stack slots, inline cache count, code length, constant count and
+ *   1 when a name string follows, then the line table, the code and the constants, each a `uint32_t` tag and a raw
+ *   `Value`, a string or a function
+ *
+ * @note Bytecode isn't verified when it is loaded, a `.loxc` file is trusted like the script it comes from.
+ */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t globalCount;
+    uint64_t sourceHash;
+} BytecodeHeader;
+
+typedef enum
+{
+    CONSTANT_VALUE,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION
+} ConstantTag;
+
+/**
+ * Cursor over a mapped file
+ */
+typedef struct
+{
+    uint8_t *current;
+    uint8_t *end;
+} Reader;
+
+/**
+ * `FNV-1a` hashing, 64 bits since it names the cached file
+ */
+uint64_t hashSource(const char *source)
+{
+    uint64_t hash = 14695981039346656037u;
+    for (const char *c = source; *c != '\0'; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+static void writeU32(FILE *file, uint32_t value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+static void writePadded(FILE *file, const void *bytes, size_t size)
+{
+    static const uint8_t zeros[4] = {0};
+    fwrite(bytes, 1, size, file);
+    fwrite(zeros, 1, (4 - size % 4) % 4, file);
+}
+
+static void writeString(FILE *file, ObjString *string)
+{
+    writeU32(file, string->length);
+    writePadded(file, string->chars, string->length + 1);
+}
+
+static bool writeFunction(FILE *file, ObjFunction *function)
+{
+    Chunk *chunk = &function->chunk;
+    if (function->lazySource != NULL) // only the source of the body is known
+    {
+        return false;
+    }
+    writeU32(file, function->arity);
+    writeU32(file, function->upvalueCount);
+    writeU32(file, function->maxStack);
+    writeU32(file, chunk->cacheCount);
+    writeU32(file, chunk->count);
+    writeU32(file, chunk->constants.count);
+    writeU32(file, function->name != NULL);
+    if (function->name != NULL)
+    {
+        writeString(file, function->name);
+    }
+    writePadded(file, chunk->lines, sizeof(int) * chunk->count);
+    writePadded(file, chunk->code, chunk->count);
+
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant))
+        {
+            writeU32(file, CONSTANT_STRING);
+            writeString(file, AS_STRING(constant));
+        }
+        else if (IS_FUNCTION(constant))
+        {
+            writeU32(file, CONSTANT_FUNCTION);
+            if (!writeFunction(file, AS_FUNCTION(constant)))
+            {
+                return false;
+            }
+        }
+        else if (!IS_OBJ(constant))
+        {
+            writeU32(file, CONSTANT_VALUE);
+            writePadded(file, &constant, sizeof(Value));
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write `script`, just compiled from `source`, to `path`. The file is written aside and renamed, so a process loading
+ * it never sees half of it.
+ */
+bool saveBytecode(const char *path, const char *source, ObjFunction *script)
+{
+    char temporary[4096];
+    if (snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof(temporary))
+    {
+        return false;
+    }
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    BytecodeHeader header = {BYTECODE_MAGIC, BYTECODE_VERSION, BYTE_ORDER_MARK, vm->globalNames.count,
+                             hashSource(source)};
+    fwrite(&header, sizeof(header), 1, file);
+    for (int i = 0; i < vm->globalNames.count; i++)
+    {
+        writeString(file, AS_STRING(vm->globalNames.values[i]));
+    }
+    bool written = writeFunction(file, script);
+    written = !ferror(file) && fclose(file) == 0 && written;
+
+    if (!written || rename(temporary, path) != 0)
+    {
+        remove(temporary);
+        return false;
+    }
+    return true;
+}
+
+static bool readU32(Reader *reader, uint32_t *value)
+{
+    if (reader->end - reader->current < (ptrdiff_t)sizeof(uint32_t))
+    {
+        return false;
+    }
+    memcpy(value, reader->current, sizeof(uint32_t));
+    reader->current += sizeof(uint32_t);
+    return true;
+}
+
+/**
+ * @return the next `size` bytes in place, NULL past the end of the file
+ */
+static void *readPadded(Reader *reader, size_t size)
+{
+    size_t padded = size + (4 - size % 4) % 4;
+    if ((size_t)(reader->end - reader->current) < padded)
+    {
+        return NULL;
+    }
+    void *bytes = reader->current;
+    reader->current += padded;
+    return bytes;
+}
+
+static ObjString *readString(Reader *reader)
+{
+    uint32_t length;
+    if (!readU32(reader, &length) || length >= INT32_MAX)
+    {
+        return NULL;
+    }
+
+    const char *chars = (const char *)readPadded(reader, (size_t)length + 1);
+    if (chars == NULL || chars[length] != '\0')
+    {
+        return NULL;
+    }
+    return mapString(chars, (int)length);
+}
+
+static ObjFunction *readFunction(Reader *reader)
+{
+    uint32_t fields[7];
+    for (int i = 0; i < 7; i++)
+    {
+        if (!readU32(reader, &fields[i]))
+        {
+            return NULL;
+        }
+    }
+
+    ObjFunction *function = newFunction();
+    push(OBJ_VAL(function)); // keep the function reachable while its name and constants are allocated
+    function->arity = (int)fields[0];
+    function->upvalueCount = (int)fields[1];
+    function->maxStack = (int)fields[2];
+    bool read = fields[4] > 0 && fields[4] <= INT32_MAX && fields[3] <= fields[4];
+    if (read && fields[6])
+    {
+        function->name = readString(reader);
+        rememberObject((Obj *)function); // allocations may have promoted the function
+        read = function->name != NULL;
+    }
+
+    Chunk *chunk = &function->chunk;
+    int *lines = read ? (int *)readPadded(reader, sizeof(int) * fields[4]) : NULL;
+    uint8_t *code = lines != NULL ? (uint8_t *)readPadded(reader, fields[4]) : NULL;
+    read = code != NULL;
+    if (read)
+    {
+        chunk->code = code;
+        chunk->lines = lines;
+        chunk->count = (int)fields[4];
+        chunk->capacity = (int)fields[4];
+        for (uint32_t i = 0; i < fields[3]; i++)
+        {
+            addInlineCache(chunk);
+        }
+    }
+
+    for (uint32_t i = 0; read && i < fields[5]; i++)
+    {
+        uint32_t tag;
+        Value constant = NIL_VAL;
+        read = readU32(reader, &tag);
+        if (read && tag == CONSTANT_VALUE)
+        {
+            void *bytes = readPadded(reader, sizeof(Value));
+            read = bytes != NULL;
+            if (read)
+            {
+                memcpy(&constant, bytes, sizeof(Value));
+            }
+        }
+        else if (read && tag == CONSTANT_STRING)
+        {
+            ObjString *string = readString(reader);
+            read = string != NULL;
+            constant = OBJ_VAL(string);
+        }
+        else if (read && tag == CONSTANT_FUNCTION)
+        {
+            ObjFunction *nested = readFunction(reader);
+            read = nested != NULL;
+            constant = OBJ_VAL(nested);
+        }
+        else
+        {
+            read = false;
+        }
+
+        if (read)
+        {
+            addConstant(chunk, constant);
+            writeBarrier((Obj *)function, constant);
+        }
+    }
+
+    pop();
+    return read ? function : NULL;
+}
+
+/**
+ * Map the `.loxc` file at `path` and load the script it holds into the VM of the thread. Code, line tables and string
+ * bytes stay in the file: it is mapped private and writable, so quickening only copies the pages it rewrites.
+ *
+ * @param source the source the file must have been compiled from, NULL to accept any
+ * @return NULL if the file is missing, of another version or source, or doesn't fit the globals of the VM
+ */
+ObjFunction *loadBytecode(const char *path, const char *source)
+{
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0)
+    {
+        return NULL;
+    }
+
+    struct stat status;
+    void *start = MAP_FAILED;
+    if (fstat(descriptor, &status) == 0 && (size_t)status.st_size >= sizeof(BytecodeHeader))
+    {
+        start = mmap(NULL, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    }
+    close(descriptor);
+    if (start == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    BytecodeHeader *header = (BytecodeHeader *)start;
+    if (memcmp(header->magic, BYTECODE_MAGIC, sizeof(header->magic)) != 0 || header->version != BYTECODE_VERSION ||
+        header->byteOrder != BYTE_ORDER_MARK || (source != NULL && header->sourceHash != hashSource(source)))
+    {
+        munmap(start, status.st_size);
+        return NULL;
+    }
+
+    // from here on, objects may point into the file: it stays mapped until the VM is freed
+    MappedFile *file = ALLOCATE(MappedFile, 1);
+    file->start = start;
+    file->size = status.st_size;
+    file->next = vm->mappedFiles;
+    vm->mappedFiles = file;
+
+    Reader reader = {(uint8_t *)start + sizeof(BytecodeHeader), (uint8_t *)start + status.st_size};
+    for (uint32_t i = 0; i < header->globalCount; i++)
+    {
+        // the code indexes globals by slot, the VM must give every name the slot it had when the script compiled
+        ObjString *name = readString(&reader);
+        if (name == NULL || globalSlot(name) != (int)i)
+        {
+            return NULL;
+        }
+    }
+    return readFunction(&reader);
+}
+
+/**
+ * @return the path of the cached bytecode of `source`, in `CACHE_DIRECTORY` next to the script, created if missing
+ */
+static char *cachePath(const char *scriptPath, const char *source)
+{
+    const char *slash = strrchr(scriptPath, '/');
+    int directoryLength = slash == NULL ? 1 : (int)(slash - scriptPath);
+    const char *directory = slash == NULL ? "." : scriptPath;
+
+    size_t size = directoryLength + sizeof("/" CACHE_DIRECTORY "/0123456789abcdef.loxc");
+    char *path = (char *)malloc(size);
+    if (path == NULL)
+    {
+        exit(1);
+    }
+    snprintf(path, size, "%.*s/%s", directoryLength, directory, CACHE_DIRECTORY);
+    mkdir(path, 0777);
+    snprintf(path, size, "%.*s/%s/%016llx.loxc", directoryLength, directory, CACHE_DIRECTORY,
+             (unsigned long long)hashSource(source));
+    return path;
+}
+
+/**
+ * Compile the script at `scriptPath`, loading its bytecode from the cache when `source` didn't change since it was
+ * cached, else compiling it and caching the result. A cache that can't be written only costs the next run.
+ */
+ObjFunction *compileCached(const char *scriptPath, const char *source)
+{
+    char *path = cachePath(scriptPath, source);
+    ObjFunction *script = loadBytecode(path, source);
+    if (script == NULL)
+    {
+        script = compile(source);
+        if (script != NULL)
+        {
+            saveBytecode(path, source, script);
+        }
+    }
+    free(path);
+    return script;
+}
+
+/**
+ * @return whether `pointer` points into a file mapped by the VM of the thread, memory its owner must not free
+ */
+bool isMapped(const void *pointer)
+{
+    for (MappedFile *file = vm->mappedFiles; file != NULL; file = file->next)
+    {
+        if ((const uint8_t *)pointer >= (uint8_t *)file->start &&
+            (const uint8_t *)pointer < (uint8_t *)file->start + file->size)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Unmap the files of the VM of the thread, once no object is left to point into them
+ */
+void unmapBytecode()
+{
+    while (vm->mappedFiles != NULL)
+    {
+        MappedFile *file = vm->mappedFiles;
+        vm->mappedFiles = file->next;
+        munmap(file->start, file->size);
+        FREE(MappedFile, file);
+    }
+}
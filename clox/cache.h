@@ -0,0 +1,35 @@
+#ifndef clox_cache_h
+#define clox_cache_h
+
+#include <stdint.h>
+
+#include "common.h"
+#include "object.h"
+
+/**
+ * Directory of the cached bytecode of the scripts next to it, one file per source keyed by its hash
+ */
+#define CACHE_DIRECTORY "__loxcache__"
+/**
+ * Version of the `.loxc` format, bump it whenever the format or the bytecode the compiler emits changes
+ */
+#define BYTECODE_VERSION 2
+
+/**
+ * A `.loxc` file mapped in memory, its code, lines and string bytes are used in place by the functions loaded from it
+ */
+typedef struct MappedFile
+{
+    struct MappedFile *next;
+    void *start;
+    size_t size;
+} MappedFile;
+
+uint64_t hashSource(const char *source);
+bool saveBytecode(const char *path, const char *source, ObjFunction *script);
+ObjFunction *loadBytecode(const char *path, const char *source);
+ObjFunction *compileCached(const char *scriptPath, const char *source);
+bool isMapped(const void *pointer);
+void unmapBytecode();
+
+#endif
@@ -1,3 +1,4 @@
+#include "cache.h"
 #include "chunk.h"
 #include "memory.h"
 #include "vm.h"
@@ -8,14 +9,24 @@ void initChunk(Chunk *chunk)
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&(chunk->constants));
+    chunk->caches = NULL;
+    chunk->cacheCount = 0;
+    chunk->cacheCapacity = 0;
+    chunk->deoptCount = 0;
 }
 
 void freeChunk(Chunk *chunk)
 {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    if (!isMapped(chunk->code)) // code loaded from the bytecode cache stays in the file
+    {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    }
     freeValueArray(&(chunk->constants));
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCapacity);
+    lockHeap();
     initChunk(chunk);
+    unlockHeap();
 }
 
 void writeChunk(Chunk *chunk, uint8_t byte, int line)
@@ -39,4 +50,25 @@ int addConstant(Chunk *chunk, Value value)
     writeValueArray(&(chunk->constants), value);
     pop();
     return chunk->constants.count - 1;
+}
+
+/**
+ * @return index of a new empty inline cache
+ */
+int addInlineCache(Chunk *chunk)
+{
+    if (chunk->cacheCapacity < chunk->cacheCount + 1)
+    {
+        int oldCapacity = chunk->cacheCapacity;
+        chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+    }
+
+    lockHeap(); // the marking thread reads the caches up to the count
+    InlineCache *cache = &chunk->caches[chunk->cacheCount];
+    cache->count = 0;
+    cache->megamorphic = false;
+    int index = chunk->cacheCount++;
+    unlockHeap();
+    return index;
 }
\ No newline at end of file
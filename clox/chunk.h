@@ -17,7 +17,7 @@ typedef enum
     OP_POP,
     OP_GET_LOCAL,
     OP_SET_LOCAL,
-    OP_GET_GLOBAL,
+    OP_GET_GLOBAL,    // 2-byte operand: slot of the global variable (see `vm->globalSlots`)
     OP_DEFINE_GLOBAL, // define global variable
     OP_SET_GLOBAL,
     OP_GET_UPVALUE, // resolve upvalue for a closure
@@ -47,8 +47,106 @@ typedef enum
     OP_CLASS,
     OP_INHERIT, // define inheritance
     OP_METHOD,  // define method for a class
+
+    //> Superinstructions, only emitted by the peephole pass (see `peephole.c`)
+    OP_NOT_EQUAL,             // OP_EQUAL, OP_NOT
+    OP_GREATER_EQUAL,         // OP_LESS, OP_NOT
+    OP_LESS_EQUAL,            // OP_GREATER, OP_NOT
+    OP_JUMP_IF_EQUAL,         // OP_NOT_EQUAL, OP_JUMP_IF_FALSE, OP_POP
+    OP_JUMP_IF_NOT_EQUAL,     // OP_EQUAL, OP_JUMP_IF_FALSE, OP_POP
+    OP_JUMP_IF_LESS,          // OP_GREATER_EQUAL, OP_JUMP_IF_FALSE, OP_POP
+    OP_JUMP_IF_NOT_LESS,      // OP_LESS, OP_JUMP_IF_FALSE, OP_POP
+    OP_JUMP_IF_GREATER,       // OP_LESS_EQUAL, OP_JUMP_IF_FALSE, OP_POP
+    OP_JUMP_IF_NOT_GREATER,   // OP_GREATER, OP_JUMP_IF_FALSE, OP_POP
+    OP_ADD_CONSTANT_TO_LOCAL, // OP_GET_LOCAL, OP_CONSTANT (a number), OP_ADD, OP_SET_LOCAL, OP_POP
+    //<
+
+    //> Quickened forms, only written by the VM over their generic instruction while it runs
+    OP_ADD_NUMBER,               // OP_ADD
+    OP_ADD_STRING,               // OP_ADD
+    OP_EQUAL_NUMBER,             // OP_EQUAL
+    OP_NOT_EQUAL_NUMBER,         // OP_NOT_EQUAL
+    OP_JUMP_IF_EQUAL_NUMBER,     // OP_JUMP_IF_EQUAL
+    OP_JUMP_IF_NOT_EQUAL_NUMBER, // OP_JUMP_IF_NOT_EQUAL
+    //<
+
+    //> Frame-bound forms, only written by the escape analysis over their generic instruction (see `escape.c`)
+    OP_GET_PROPERTY_FRAME, // OP_GET_PROPERTY whose bound method never outlives the frame, it lives in a frame cell
+    //<
+
+    //> Wide operands, emitted only when an operand doesn't fit its short form
+    OP_CONSTANT_LONG,      // OP_CONSTANT with a 3-byte constant index
+    OP_JUMP_LONG,          // OP_JUMP with a 3-byte offset
+    OP_JUMP_IF_FALSE_LONG, // OP_JUMP_IF_FALSE with a 3-byte offset
+    OP_LOOP_LONG,          // OP_LOOP with a 3-byte offset
+    /**
+     * Prefix of an instruction whose constant, local slot and upvalue indexes are 3-byte operands instead of 1-byte
+     * ones: `OP_GET_LOCAL`, `OP_SET_LOCAL`, `OP_GET_UPVALUE`, `OP_SET_UPVALUE`, `OP_GET_PROPERTY`, `OP_SET_PROPERTY`,
+     * `OP_GET_SUPER`, `OP_INVOKE`, `OP_SUPER_INVOKE`, `OP_CLOSURE` (the function and every upvalue index), `OP_CLASS`
+     * and `OP_METHOD`. Other operands, argument counts and inline cache indexes, keep their width.
+     */
+    OP_WIDE,
+    //<
 } OpCode;
 
+/**
+ * What each upvalue operand of `OP_CLOSURE` captures, the byte before its index
+ */
+typedef enum
+{
+    CAPTURE_UPVALUE, // upvalue `index` of the enclosing closure
+    CAPTURE_LOCAL,   // local slot `index` of the enclosing frame, into an `ObjUpvalue` on the heap
+    /**
+     * Local slot `index` into the frame cell of the slot: no closure capturing that slot outlives the frame, see
+     * `escape.c`
+     */
+    CAPTURE_FRAME_LOCAL,
+} CaptureKind;
+
+/**
+ * Number of failed guards of quickened instructions after which a chunk stops quickening
+ */
+#define QUICKEN_MAX_DEOPTS 16
+
+/**
+ * Number of receiver classes an inline cache remembers before it goes megamorphic
+ */
+#define INLINE_CACHE_SIZE 4
+
+/**
+ * What a property access resolved to for receivers of one shape
+ */
+typedef struct
+{
+    ObjShape *shape;
+    /**
+     * Slot of the field in the receiver, or -1 when the property is `method`
+     */
+    int field;
+    /**
+     * Method of the class of the receiver, no field of `shape` shadows it
+     */
+    Value method;
+    /**
+     * Shape of the receiver once `OP_SET_PROPERTY` adds the field at `field`, NULL when the field exists
+     */
+    ObjShape *transition;
+} InlineCacheEntry;
+
+/**
+ * Inline cache of one `OP_GET_PROPERTY`, `OP_SET_PROPERTY` or `OP_INVOKE`, keyed on the shape of the receiver.
+ * Every class has its own root shape, so the shape also pins the class and its methods.
+ *
+ * @details A cache starts empty, is monomorphic with one entry and polymorphic with up to `INLINE_CACHE_SIZE` entries.
+ * A miss on a full cache makes it megamorphic: its entries are dropped and the access always takes the slow path.
+ */
+typedef struct
+{
+    InlineCacheEntry entries[INLINE_CACHE_SIZE];
+    int count;
+    bool megamorphic;
+} InlineCache;
+
 /**
  * Sequences of bytecode
  */
@@ -62,6 +160,16 @@ typedef struct
      * Constant pool
      */
     ValueArray constants;
+    /**
+     * Inline caches of the property accesses, indexed by the 2-byte operand of the instruction
+     */
+    InlineCache *caches;
+    int cacheCount;
+    int cacheCapacity;
+    /**
+     * Number of quickened instructions that went back to their generic form, see `QUICKEN()` in `vm.c`
+     */
+    int deoptCount;
 
 } Chunk;
 
@@ -69,5 +177,6 @@ void initChunk(Chunk *chunk);
 void freeChunk(Chunk *chunk);
 void writeChunk(Chunk *chunk, uint8_t byte, int line);
 int addConstant(Chunk *chunk, Value value);
+int addInlineCache(Chunk *chunk);
 
 #endif
\ No newline at end of file
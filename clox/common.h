@@ -7,6 +7,10 @@
 
 /// @brief Enable nan boxing
 #define NAN_BOXING
+/**
+ * Debug flags are on by default, building with `-DNDEBUG` turns them off (used by `make bench`).
+ */
+#ifndef NDEBUG
 /**
  * `Stress test” mode for the garbage collector. When this flag is defined, the GC runs as often as it possibly can.
  */
@@ -14,8 +18,76 @@
 #define DEBUG_LOG_GC
 #define DEBUG_PRINT_CODE
 #define DEBUG_TRACE_EXECUTION
+#endif
+
+/**
+ * Bytecode dispatch engines of `run()`, selected at build time with `-DDISPATCH_ENGINE=...`.
+ *
+ * - `DISPATCH_SWITCH`: one `switch` on the opcode at the top of the interpreter loop.
+ * - `DISPATCH_COMPUTED_GOTO`: every handler jumps straight to the next one through a table of label
+ *   addresses (`&&label`, a GCC/Clang extension), so each handler gets its own indirect branch.
+ * - `DISPATCH_TAIL_CALL`: every handler is a function that tail-calls the next handler through a table
+ *   of function pointers (`musttail` on Clang), which lets the compiler keep the VM state in argument registers.
+ *
+ * Define `DEBUG_COUNT_DISPATCH` to count dispatched instructions, the count is printed to stderr by `freeVM()`.
+ */
+#define DISPATCH_SWITCH 0
+#define DISPATCH_COMPUTED_GOTO 1
+#define DISPATCH_TAIL_CALL 2
+
+#ifndef DISPATCH_ENGINE
+#define DISPATCH_ENGINE DISPATCH_SWITCH
+#endif
+
+/**
+ * Baseline JIT compiler, built in with `-DBASELINE_JIT` (`make JIT=BASELINE`). A function that is called or loops back
+ * `JIT_THRESHOLD` times is compiled to x86-64 code (see `jit.c`), building with `-DJIT_THRESHOLD=1` runs every function
+ * with its native code from the first call.
+ */
+#ifdef BASELINE_JIT
+#if !defined(__x86_64__) || !defined(__unix__) || !defined(NAN_BOXING)
+#error "BASELINE_JIT requires x86-64, mmap() and NAN_BOXING."
+#endif
+#ifndef JIT_THRESHOLD
+#define JIT_THRESHOLD 1000
+#endif
+#endif
+
+/**
+ * Tracing JIT compiler, built in with `-DTRACING_JIT` (`make JIT=TRACING`). A loop whose back-edge is taken
+ * `TRACE_THRESHOLD` times has its next iteration recorded and compiled to x86-64 code, as does a side exit of a trace
+ * taken as many times (see `trace.c`).
+ */
+#ifdef TRACING_JIT
+#if !defined(__x86_64__) || !defined(__unix__) || !defined(NAN_BOXING)
+#error "TRACING_JIT requires x86-64, mmap() and NAN_BOXING."
+#endif
+#ifdef BASELINE_JIT
+#error "BASELINE_JIT and TRACING_JIT can't be built in together."
+#endif
+#ifndef TRACE_THRESHOLD
+#define TRACE_THRESHOLD 50
+#endif
+#endif
+
+/**
+ * Runtime of a script translated to C by `clox --emit-c`, built in with `-DAOT_RUNTIME` (`make aot SCRIPT=...`). Its
+ * functions run their C code instead of their bytecode (see `aot.c`).
+ */
+#if defined(AOT_RUNTIME) && (defined(BASELINE_JIT) || defined(TRACING_JIT))
+#error "AOT_RUNTIME can't be built in with a JIT."
+#endif
+
+/**
+ * Concurrent marking, built in with `-DCONCURRENT_GC` (`make GC=CONCURRENT`). A major collection is marked by a
+ * background thread while the program runs, instead of in slices on its allocations (see `memory.c`).
+ */
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+/**
+ * Largest 3-byte operand: a constant index of `OP_CONSTANT_LONG` and `OP_WIDE`, or the offset of a long jump
+ */
+#define UINT24_MAX 0xffffff
 
 /**
  * Common field for dynamic array struct
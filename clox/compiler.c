@@ -4,11 +4,14 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "escape.h"
 #include "memory.h"
+#include "peephole.h"
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 #include "scanner.h"
+#include "vm.h"
 
 typedef struct
 {
@@ -65,7 +68,7 @@ typedef struct
  */
 typedef struct
 {
-    uint8_t index;
+    int index;
     bool isLocal;
 } Upvalue;
 
@@ -123,33 +126,50 @@ typedef struct Compiler
     /**
      * Save local variable to resolve local variable at compile time
      */
-    Local locals[UINT8_COUNT];
+    Local *locals;
     /**
      * Tracking how many locals are in scope—how many of those array slots are in use.
      */
     int localCount;
+    int localCapacity;
     /**
-     * Save upvalue to resolve it at compile time
+     * Save upvalue to resolve it at compile time, `function->upvalueCount` of them are in use
      */
-    Upvalue upvalues[UINT8_COUNT];
+    Upvalue *upvalues;
+    int upvalueCapacity;
     /**
      * This is the number of blocks surrounding the current bit of code we’re compiling.
      * Zero is the global scope, one is the first top-level block, two is inside that.
      */
     int scopeDepth;
     ScopeCompiler *currentScope;
+    /**
+     * Names of the upvalues of a function compiled by `compileLazily()`, which has no enclosing compiler to resolve
+     * them in. NULL otherwise.
+     */
+    ValueArray *upvalueNames;
 } Compiler;
 
+/**
+ * Most locals of a function, and most upvalues of a closure. Past 256 their indexes are 3-byte operands after
+ * `OP_WIDE`.
+ */
+#define LOCALS_MAX (UINT16_MAX + 1)
+
 typedef struct ClassCompiler
 {
     struct ClassCompiler *enclosing;
     bool hasSuperclass;
 } ClassCompiler;
 
-Parser parser;
-Compiler *current = NULL;
-ClassCompiler *currentClass = NULL;
-Chunk *compileChunk;
+_Thread_local Parser parser;
+_Thread_local Compiler *current = NULL;
+_Thread_local ClassCompiler *currentClass = NULL;
+_Thread_local Chunk *compileChunk;
+/**
+ * Source of the script being compiled, copied to the heap for the bodies left to `compileLazily()`
+ */
+_Thread_local ObjString *sourceString = NULL;
 
 static void advance();
 static void consume(TokenType type, const char *message);
@@ -190,15 +210,16 @@ static void literal(bool canAssign);
 static void grouping(bool canAssign);
 static void unary(bool canAssign);
 static void parsePrecedence(Precedence precedence);
-static uint8_t parseVariable(const char *errorMessage);
-static void defineVariable(uint8_t global);
+static uint16_t parseVariable(const char *errorMessage);
+static void defineVariable(uint16_t global);
 static void and_(bool canAssign);
 static void or_(bool canAssign);
-static uint8_t identifierConstant(Token *name);
+static int identifierConstant(Token *name);
+static uint16_t globalVariable(Token *name);
 static bool identifiersEqual(Token *a, Token *b);
 static int resolveLocal(Compiler *compiler, Token *name);
 static int resolveUpvalue(Compiler *compiler, Token *name);
-static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal);
+static int addUpvalue(Compiler *compiler, int index, bool isLocal);
 static void declareVariable();
 static void addLocal(Token name);
 static void markInitialized();
@@ -213,10 +234,18 @@ static void this_(bool canAssign);
 static void expression();
 static void block();
 static void function(FunctionType type);
+static void parameters(FunctionType type);
+static ObjFunction *skimBody(FunctionType type, const char *start, int line);
+static void captureName(Token name);
 static void emitReturn();
-static uint8_t makeConstant(Value value);
+static void emitInlineCache();
+static int makeConstant(Value value);
 static void emitConstant(Value value);
+static void emitOperand(int operand, bool wide);
+static void emitIndexed(uint8_t instruction, int index);
 static void initCompiler(Compiler *compiler, FunctionType type);
+static void beginCompiler(Compiler *compiler, FunctionType type, ObjFunction *function);
+static void freeCompiler(Compiler *compiler);
 static Chunk *currentChunk();
 static void errorAtCurrent(const char *message);
 static void error(const char *message);
@@ -274,7 +303,14 @@ ParseRule rules[] = {
  */
 ObjFunction *compile(const char *source)
 {
-    initScanner(source);
+    sourceString = NULL;
+    if (vm->lazyCompile)
+    {
+        sourceString = copyString(source, (int)strlen(source));
+        source = sourceString->chars;
+    }
+
+    initScanner(source, 1);
     Compiler compiler;
     initCompiler(&compiler, TYPE_SCRIPT);
 
@@ -290,15 +326,66 @@ ObjFunction *compile(const char *source)
 
     consume(TOKEN_EOF, "Expect end of expression.");
     ObjFunction *function = endCompiler();
+    freeCompiler(&compiler);
+    sourceString = NULL;
     return parser.hadError ? NULL : function;
 }
 
+/**
+ * Compile the body of `function` that `skimBody()` skipped, on its first call. Its upvalues are resolved by name, it
+ * captured every variable of its enclosing functions it names.
+ *
+ * @return false on a compile error, reported like the ones of `compile()`. The function stays uncompiled then.
+ */
+bool compileLazily(ObjFunction *function)
+{
+    sourceString = function->lazySource;
+    initScanner(sourceString->chars + function->lazyStart, function->lazyLine);
+    parser.hadError = false;
+    parser.panicMode = false;
+
+    ClassCompiler classCompiler;
+    classCompiler.enclosing = NULL;
+    classCompiler.hasSuperclass = function->lazyClass == 1;
+    currentClass = function->lazyClass == -1 ? NULL : &classCompiler;
+
+    int arity = function->arity;
+    function->arity = 0;
+    Compiler compiler;
+    beginCompiler(&compiler, (FunctionType)function->lazyType, function);
+    compiler.upvalueNames = &function->upvalueNames;
+
+    advance();
+    parameters(compiler.type);
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block();
+    clearScopeCompiler();
+    endCompiler();
+    freeCompiler(&compiler);
+    currentClass = NULL;
+    sourceString = NULL;
+
+    if (parser.hadError)
+    {
+        freeChunk(&function->chunk);
+        function->arity = arity;
+        return false;
+    }
+
+    function->lazySource = NULL;
+    freeValueArray(&function->upvalueNames);
+    return true;
+}
+
 void markCompilerRoots()
 {
+    markObject((Obj *)sourceString);
+
     Compiler *compiler = current;
     while (compiler != NULL)
     {
         markObject((Obj *)compiler->function);
+        rememberObject((Obj *)compiler->function); // the compiler writes to it without write barriers
         compiler = compiler->enclosing;
     }
 }
@@ -360,27 +447,42 @@ static void emitBytes(uint8_t byte1, uint8_t byte2)
     emitByte(byte2);
 }
 
+/**
+ * Emit a 3-byte operand, most significant byte first
+ */
+static void emitLong(int operand)
+{
+    emitByte((operand >> 16) & 0xff);
+    emitByte((operand >> 8) & 0xff);
+    emitByte(operand & 0xff);
+}
+
+/**
+ * @note Every jump is emitted in its long form with a 3-byte offset, `optimizeChunk()` turns the ones that fit into
+ * their 2-byte form once the function is compiled and every target is known.
+ */
 static void emitLoop(int loopStart)
 {
-    emitByte(OP_LOOP);
+    emitByte(OP_LOOP_LONG);
 
-    int offset = currentChunk()->count - loopStart + 2; // calculate jump offset to the first bytecode of loop. The `+ 2` is to take into account the size of the OP_LOOP instruction’s own operands which we also need to jump over.
-    if (offset > UINT16_MAX)
+    int offset = currentChunk()->count - loopStart + 3; // calculate jump offset to the first bytecode of loop. The `+ 3` is to take into account the size of the OP_LOOP_LONG instruction’s own operands which we also need to jump over.
+    if (offset > UINT24_MAX)
     {
         error("Loop body too large.");
     }
 
-    emitByte((offset >> 8) & 0xff);
-    emitByte(offset & 0xff);
+    emitLong(offset);
 }
 
+/**
+ * @param instruction `OP_JUMP` or `OP_JUMP_IF_FALSE`, emitted in its long form (see `emitLoop()`)
+ */
 static int emitJump(uint8_t instruction)
 {
-    emitByte(instruction);
-    // emit placeholder for 16 bits (2 bytes) jump offset that is patched later.
-    emitByte(0xff);                   // left-most 8 bits of jump offset.
-    emitByte(0xff);                   // right-most 8 bits of jump offset.
-    return currentChunk()->count - 2; // index of jump bytecode.
+    emitByte(instruction == OP_JUMP ? OP_JUMP_LONG : OP_JUMP_IF_FALSE_LONG);
+    // emit placeholder for 24 bits (3 bytes) jump offset that is patched later.
+    emitLong(UINT24_MAX);
+    return currentChunk()->count - 3; // index of jump bytecode.
 }
 
 static int emitBreak()
@@ -412,9 +514,8 @@ static int emitContinue()
     inst->type = FCS_CONTINUE;
 
     emitByte(0xff);
-    emitByte(0xff);
-    emitByte(0xff);
-    inst->jumpOffset = currentChunk()->count - 3; // index of jump bytecode.
+    emitLong(UINT24_MAX);
+    inst->jumpOffset = currentChunk()->count - 4; // index of jump bytecode.
 
     inst->next = cur->jumpInstructions;
     cur->jumpInstructions = inst;
@@ -430,15 +531,16 @@ static void patchBreakStatement(int offset)
 static void patchContinueStatement(int jumpInstOffset,
                                    int offset)
 {
-    int jump = jumpInstOffset - offset + 3; // calculate jump
-    if (jump > UINT16_MAX)
+    int jump = jumpInstOffset - offset + 4; // calculate jump
+    if (jump > UINT24_MAX)
     {
         error("Too much code to jump over.");
     }
 
-    currentChunk()->code[jumpInstOffset] = OP_LOOP;                // loop instruction
-    currentChunk()->code[jumpInstOffset + 1] = (jump >> 8) & 0xff; // left-most 8 bits of jump offset.
-    currentChunk()->code[jumpInstOffset + 2] = jump & 0xff;        // right-most 8 bits of jump offset.
+    currentChunk()->code[jumpInstOffset] = OP_LOOP_LONG;            // loop instruction
+    currentChunk()->code[jumpInstOffset + 1] = (jump >> 16) & 0xff; // left-most 8 bits of jump offset.
+    currentChunk()->code[jumpInstOffset + 2] = (jump >> 8) & 0xff;
+    currentChunk()->code[jumpInstOffset + 3] = jump & 0xff; // right-most 8 bits of jump offset.
 }
 
 /**
@@ -446,17 +548,18 @@ static void patchContinueStatement(int jumpInstOffset,
  */
 static void patchJump(int offset)
 {
-    // -2 to adjust for the bytecode for the jump offset itself.
-    int jump = currentChunk()->count - offset - 2;
+    // -3 to adjust for the bytecode for the jump offset itself.
+    int jump = currentChunk()->count - offset - 3;
 
-    if (jump > UINT16_MAX)
+    if (jump > UINT24_MAX)
     {
         error("Too much code to jump over.");
     }
 
     // Patching jump offset.
-    currentChunk()->code[offset] = (jump >> 8) & 0xff; // left-most 8 bits of jump offset.
-    currentChunk()->code[offset + 1] = jump & 0xff;    // right-most 8 bits of jump offset.
+    currentChunk()->code[offset] = (jump >> 16) & 0xff; // left-most 8 bits of jump offset.
+    currentChunk()->code[offset + 1] = (jump >> 8) & 0xff;
+    currentChunk()->code[offset + 2] = jump & 0xff; // right-most 8 bits of jump offset.
 }
 
 static ObjFunction *endCompiler()
@@ -464,6 +567,13 @@ static ObjFunction *endCompiler()
     emitReturn();
     ObjFunction *function = current->function;
 
+    if (!parser.hadError)
+    {
+        optimizeChunk(currentChunk()); // every jump of the function is patched by now
+        function->maxStack = stackDepth(currentChunk(), function->arity + 1);
+        analyzeEscapes(function);
+    }
+
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError)
     {
@@ -473,6 +583,7 @@ static ObjFunction *endCompiler()
     }
 #endif
 
+    rememberObject((Obj *)function); // its constants were added without write barriers
     current = current->enclosing;
     return function;
 }
@@ -602,11 +713,11 @@ static void classDeclaration()
 {
     consume(TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(&parser.previous);
+    int nameConstant = identifierConstant(&parser.previous);
     declareVariable();
 
-    emitBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant);
+    emitIndexed(OP_CLASS, nameConstant);
+    defineVariable(current->scopeDepth > 0 ? 0 : globalVariable(&className));
 
     ClassCompiler classCompiler;
     classCompiler.hasSuperclass = false;
@@ -655,7 +766,7 @@ static void classDeclaration()
 static void method()
 {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+    int constant = identifierConstant(&parser.previous);
 
     FunctionType type = TYPE_METHOD;
     if (parser.previous.length == 4 &&
@@ -665,12 +776,12 @@ static void method()
     }
 
     function(type);
-    emitBytes(OP_METHOD, constant);
+    emitIndexed(OP_METHOD, constant);
 }
 
 static void funcDeclaration()
 {
-    uint8_t global = parseVariable("Expect function name");
+    uint16_t global = parseVariable("Expect function name");
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global);
@@ -678,7 +789,7 @@ static void funcDeclaration()
 
 static void varDeclaration()
 {
-    uint8_t global = parseVariable("Expect variable name");
+    uint16_t global = parseVariable("Expect variable name");
 
     if (match(TOKEN_EQUAL))
     {
@@ -942,6 +1053,49 @@ static void function(FunctionType type)
     Compiler compiler;
     initCompiler(&compiler, type);
 
+    const char *start = parser.current.start;
+    int line = parser.current.line;
+    parameters(type);
+
+    ObjFunction *function;
+    if (vm->lazyCompile)
+    {
+        function = skimBody(type, start, line);
+    }
+    else
+    {
+        consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+        block();
+        clearScopeCompiler();
+        function = endCompiler();
+    }
+    int constant = makeConstant(OBJ_VAL(function));
+
+    bool wide = constant > UINT8_MAX; // one wide operand makes the function and every upvalue index wide
+    for (int i = 0; i < function->upvalueCount; i++)
+    {
+        wide = wide || compiler.upvalues[i].index > UINT8_MAX;
+    }
+    if (wide)
+    {
+        emitByte(OP_WIDE);
+    }
+    emitByte(OP_CLOSURE);
+    emitOperand(constant, wide);
+
+    for (int i = 0; i < function->upvalueCount; i++)
+    {
+        emitByte(compiler.upvalues[i].isLocal ? CAPTURE_LOCAL : CAPTURE_UPVALUE);
+        emitOperand(compiler.upvalues[i].index, wide);
+    }
+    freeCompiler(&compiler);
+}
+
+/**
+ * Open the scope of the function `current` compiles and declare its parameters
+ */
+static void parameters(FunctionType type)
+{
     ScopeType scopeType = SCOPE_FUNCTION;
     if (type == TYPE_SCRIPT)
         scopeType = SCOPE_GLOBAL;
@@ -958,24 +1112,78 @@ static void function(FunctionType type)
             {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
-            uint8_t constant = parseVariable("Expect parameter name.");
-            defineVariable(constant); // Define parameter as local variable
+            parseVariable("Expect parameter name.");
+            defineVariable(0); // Define parameter as local variable
         } while (match(TOKEN_COMMA));
         //<
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+}
+
+/**
+ * Skip the body of the function `current` compiles, its parameter list starts at `start`, and leave it to
+ * `compileLazily()`. Only braces are matched, and every name in the body that resolves to a variable of an enclosing
+ * function is captured: more upvalues than the body uses when it shadows them, never fewer.
+ */
+static ObjFunction *skimBody(FunctionType type, const char *start, int line)
+{
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block();
+    for (int depth = 1; depth > 0; advance())
+    {
+        if (check(TOKEN_EOF))
+        {
+            errorAtCurrent("Expect '}' after block.");
+            break;
+        }
 
+        if (check(TOKEN_LEFT_BRACE))
+        {
+            depth++;
+        }
+        else if (check(TOKEN_RIGHT_BRACE))
+        {
+            depth--;
+        }
+        else if (check(TOKEN_SUPER))
+        {
+            captureName(syntheticToken("this"));
+            captureName(syntheticToken("super"));
+        }
+        else if ((check(TOKEN_IDENTIFIER) || check(TOKEN_THIS)) && parser.previous.type != TOKEN_DOT)
+        {
+            captureName(parser.current);
+        }
+    }
     clearScopeCompiler();
 
-    ObjFunction *function = endCompiler();
-    emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+    ObjFunction *function = current->function;
+    function->lazySource = sourceString;
+    function->lazyStart = (int)(start - sourceString->chars);
+    function->lazyLine = line;
+    function->lazyType = (uint8_t)type;
+    function->lazyClass = currentClass == NULL ? -1 : currentClass->hasSuperclass;
+    rememberObject((Obj *)function); // its upvalue names were added without write barriers
+    current = current->enclosing;
+    return function;
+}
 
-    for (int i = 0; i < function->upvalueCount; i++)
+/**
+ * Capture `name` into the function `current` compiles if it is a variable of an enclosing function
+ */
+static void captureName(Token name)
+{
+    if (resolveLocal(current, &name) != -1)
+    {
+        return;
+    }
+
+    ValueArray *names = &current->function->upvalueNames;
+    if (resolveUpvalue(current, &name) == names->count) // a new upvalue
     {
-        emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upvalues[i].index);
+        ObjString *string = copyString(name.start, name.length);
+        push(OBJ_VAL(string)); // keep the name reachable while the array grows
+        writeValueArray(names, OBJ_VAL(string));
+        pop();
     }
 }
 
@@ -1077,12 +1285,13 @@ static void call(bool canAssign)
 static void dot(bool canAssign)
 {
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
+    int name = identifierConstant(&parser.previous);
 
     if (canAssign && match(TOKEN_EQUAL))
     {
         expression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitIndexed(OP_SET_PROPERTY, name);
+        emitInlineCache();
     }
     else if (match(TOKEN_LEFT_PAREN))
     {
@@ -1093,12 +1302,14 @@ static void dot(bool canAssign)
          */
 
         uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
+        emitIndexed(OP_INVOKE, name);
         emitByte(argCount);
+        emitInlineCache();
     }
     else
     {
-        emitBytes(OP_GET_PROPERTY, name);
+        emitIndexed(OP_GET_PROPERTY, name);
+        emitInlineCache();
     }
 }
 
@@ -1178,21 +1389,28 @@ static void namedVariable(Token name, bool canAssign)
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     }
-    else // global variable
+    else // global variable, its operand is a 2-byte slot
     {
-        arg = identifierConstant(&name);
+        arg = globalVariable(&name);
         setOp = OP_SET_GLOBAL;
         getOp = OP_GET_GLOBAL;
     }
 
+    uint8_t op = getOp;
     if (canAssign && match(TOKEN_EQUAL))
     {
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        op = setOp;
+    }
+
+    if (getOp == OP_GET_GLOBAL)
+    {
+        emitByte(op);
+        emitBytes((arg >> 8) & 0xff, arg & 0xff);
     }
     else
     {
-        emitBytes(getOp, (uint8_t)arg);
+        emitIndexed(op, arg);
     }
 }
 
@@ -1222,20 +1440,20 @@ static void super_(bool canAssign)
 
     consume(TOKEN_DOT, "Expect '.' after 'super'.");
     consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous);
+    int name = identifierConstant(&parser.previous);
 
     namedVariable(syntheticToken("this"), false); // push `this` to stack
     if (match(TOKEN_LEFT_PAREN))
     {
         uint8_t argCount = argumentList();
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_SUPER_INVOKE, name);
+        emitIndexed(OP_SUPER_INVOKE, name);
         emitByte(argCount);
     }
     else
     {
         namedVariable(syntheticToken("super"), false); // push `super` to stack
-        emitBytes(OP_GET_SUPER, name);
+        emitIndexed(OP_GET_SUPER, name);
     }
 }
 
@@ -1277,7 +1495,7 @@ static void unary(bool canAssign)
     }
 }
 
-static void defineVariable(uint8_t global)
+static void defineVariable(uint16_t global)
 {
     if (current->scopeDepth > 0)
     {
@@ -1285,7 +1503,8 @@ static void defineVariable(uint8_t global)
         return;
     }
 
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitByte(OP_DEFINE_GLOBAL);
+    emitBytes((global >> 8) & 0xff, global & 0xff);
 }
 
 static void and_(bool canAssign)
@@ -1310,7 +1529,10 @@ static void or_(bool canAssign)
     patchJump(endJump);
 }
 
-static uint8_t parseVariable(const char *errorMessage)
+/**
+ * @return slot of the variable if it is global, 0 for a local variable
+ */
+static uint16_t parseVariable(const char *errorMessage)
 {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
@@ -1320,14 +1542,29 @@ static uint8_t parseVariable(const char *errorMessage)
         return 0;
     }
 
-    return identifierConstant(&parser.previous); // save identifier name in constant table and refer to the name by its index in the table
+    return globalVariable(&parser.previous);
 }
 
-static uint8_t identifierConstant(Token *name)
+static int identifierConstant(Token *name)
 {
     return makeConstant(OBJ_VAL(copyString(name->start, name->length))); // save identifier name in constant table and refer to the name by its index in the table
 }
 
+/**
+ * Resolve a global variable to its slot in the VM, the same name gets the same slot in every `compile()`
+ */
+static uint16_t globalVariable(Token *name)
+{
+    int slot = globalSlot(copyString(name->start, name->length));
+    if (slot > UINT16_MAX)
+    {
+        error("Too many global variables.");
+        return 0;
+    }
+
+    return (uint16_t)slot;
+}
+
 static bool identifiersEqual(Token *a, Token *b)
 {
     if (a->length != b->length)
@@ -1375,6 +1612,14 @@ static int resolveUpvalue(Compiler *compiler, Token *name)
 {
     if (compiler->enclosing == NULL)
     {
+        for (int i = 0; compiler->upvalueNames != NULL && i < compiler->upvalueNames->count; i++)
+        {
+            ObjString *upvalue = AS_STRING(compiler->upvalueNames->values[i]);
+            if (upvalue->length == name->length && memcmp(upvalue->chars, name->start, name->length) == 0)
+            {
+                return i;
+            }
+        }
         return -1;
     }
 
@@ -1382,21 +1627,21 @@ static int resolveUpvalue(Compiler *compiler, Token *name)
     if (local != -1)
     {
         compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true);
+        return addUpvalue(compiler, local, true);
     }
 
     //< Recursive resolve upvalue from parent scope of parent scope
     int upvalue = resolveUpvalue(compiler->enclosing, name);
     if (upvalue != -1)
     {
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(compiler, upvalue, false);
     }
     //>
 
     return -1;
 }
 
-static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal)
+static int addUpvalue(Compiler *compiler, int index, bool isLocal)
 {
     int upvalueCount = compiler->function->upvalueCount;
 
@@ -1409,12 +1654,19 @@ static int addUpvalue(Compiler *compiler, uint8_t index, bool isLocal)
         }
     }
 
-    if (upvalueCount == UINT8_COUNT)
+    if (upvalueCount == LOCALS_MAX)
     {
         error("Too many closure variables in function.");
         return 0;
     }
 
+    if (compiler->upvalueCapacity < upvalueCount + 1)
+    {
+        int oldCapacity = compiler->upvalueCapacity;
+        compiler->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, oldCapacity, compiler->upvalueCapacity);
+    }
+
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
     return compiler->function->upvalueCount++;
@@ -1445,15 +1697,30 @@ static void declareVariable()
     addLocal(*name);
 }
 
+/**
+ * @return a new slot at the end of the locals of `compiler`
+ */
+static Local *pushLocal(Compiler *compiler)
+{
+    if (compiler->localCapacity < compiler->localCount + 1)
+    {
+        int oldCapacity = compiler->localCapacity;
+        compiler->localCapacity = GROW_CAPACITY(oldCapacity);
+        compiler->locals = GROW_ARRAY(Local, compiler->locals, oldCapacity, compiler->localCapacity);
+    }
+
+    return &compiler->locals[compiler->localCount++];
+}
+
 static void addLocal(Token name)
 {
-    if (current->localCount >= UINT8_COUNT)
+    if (current->localCount >= LOCALS_MAX)
     {
         error("Too many local variables in function.");
         return;
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = pushLocal(current);
     local->name = name;
     local->depth = -1;
     local->isCaptured = false;
@@ -1521,28 +1788,92 @@ static void emitReturn()
     emitByte(OP_RETURN);
 }
 
+/**
+ * Emit the 2-byte index of a new inline cache of the current chunk, the operand of a property access
+ */
+static void emitInlineCache()
+{
+    int cache = addInlineCache(currentChunk());
+    if (cache > UINT16_MAX)
+    {
+        error("Too many property accesses in one function.");
+    }
+
+    emitBytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
 static void emitConstant(Value value)
 {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    int constant = makeConstant(value);
+    if (constant <= UINT8_MAX)
+    {
+        emitBytes(OP_CONSTANT, (uint8_t)constant);
+    }
+    else
+    {
+        emitByte(OP_CONSTANT_LONG);
+        emitLong(constant);
+    }
+}
+
+/**
+ * Emit a constant, local slot or upvalue index, 3 bytes when the instruction is prefixed with `OP_WIDE`
+ */
+static void emitOperand(int operand, bool wide)
+{
+    if (wide)
+    {
+        emitLong(operand);
+    }
+    else
+    {
+        emitByte((uint8_t)operand);
+    }
+}
+
+/**
+ * Emit `instruction` with its index operand, in the short form when the index fits in a byte
+ */
+static void emitIndexed(uint8_t instruction, int index)
+{
+    bool wide = index > UINT8_MAX;
+    if (wide)
+    {
+        emitByte(OP_WIDE);
+    }
+    emitByte(instruction);
+    emitOperand(index, wide);
 }
 
 static void initCompiler(Compiler *compiler, FunctionType type)
+{
+    beginCompiler(compiler, type, newFunction());
+}
+
+/**
+ * Start compiling into `function`, named after the previous token unless it has a name
+ */
+static void beginCompiler(Compiler *compiler, FunctionType type, ObjFunction *function)
 {
     compiler->enclosing = current;
-    compiler->function = NULL;
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth = 0;
     compiler->currentScope = NULL;
-    compiler->function = newFunction();
+    compiler->upvalueNames = NULL;
+    compiler->function = function;
     current = compiler;
-    if (type != TYPE_SCRIPT)
+    if (type != TYPE_SCRIPT && function->name == NULL)
     {
         current->function->name = copyString(parser.previous.start,
                                              parser.previous.length);
     }
 
-    Local *local = &current->locals[current->localCount++];
+    Local *local = pushLocal(current);
     local->depth = 0;
     local->isCaptured = false;
     if (type != TYPE_FUNCTION)
@@ -1557,16 +1888,25 @@ static void initCompiler(Compiler *compiler, FunctionType type)
     }
 }
 
-static uint8_t makeConstant(Value value)
+/**
+ * Release the locals and upvalues of a compiler that `endCompiler()` finished
+ */
+static void freeCompiler(Compiler *compiler)
+{
+    FREE_ARRAY(Local, compiler->locals, compiler->localCapacity);
+    FREE_ARRAY(Upvalue, compiler->upvalues, compiler->upvalueCapacity);
+}
+
+static int makeConstant(Value value)
 {
     int constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX) /** OP_CONSTANT instruction uses a single byte for the index operand, we can store and load only up to 256 constants in a chunk. */
+    if (constant > UINT24_MAX) /** The first 256 constants are loaded with a 1-byte index, `OP_CONSTANT_LONG` and `OP_WIDE` reach the others with a 3-byte one. */
     {
         error("Too many constants in one chunk.");
         return 0;
     }
 
-    return (uint8_t)constant;
+    return constant;
 }
 
 static Chunk *currentChunk()
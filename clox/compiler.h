@@ -5,6 +5,7 @@
 #include "vm.h"
 
 ObjFunction *compile(const char *source);
+bool compileLazily(ObjFunction *function);
 void markCompilerRoots();
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "debug.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk *chunk, const char *name)
 {
@@ -27,15 +28,52 @@ static int byteInstruction(const char *name, Chunk *chunk, int offset)
     return offset + 2;
 }
 
-static int invokeInstruction(const char *name, Chunk *chunk,
+/**
+ * @param hasInlineCache whether the instruction ends with the 2-byte index of its inline cache
+ */
+static int invokeInstruction(const char *name, bool hasInlineCache, Chunk *chunk,
                              int offset)
 {
     uint8_t constant = chunk->code[offset + 1];
     uint8_t argCount = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
-    printf("'\n");
-    return offset + 3;
+    if (!hasInlineCache)
+    {
+        printf("'\n");
+        return offset + 3;
+    }
+
+    printf("' ic %d\n", (chunk->code[offset + 3] << 8) | chunk->code[offset + 4]);
+    return offset + 5;
+}
+
+/**
+ * A property access, its name constant then the 2-byte index of its inline cache
+ */
+static int propertyInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t constant = chunk->code[offset + 1];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", (chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+    return offset + 4;
+}
+
+/**
+ * @return how an upvalue operand of `OP_CLOSURE` of kind `kind` is printed, see `CaptureKind`
+ */
+static const char *captureName(int kind)
+{
+    switch (kind)
+    {
+    case CAPTURE_UPVALUE:
+        return "upvalue";
+    case CAPTURE_LOCAL:
+        return "local";
+    default:
+        return "frame local";
+    }
 }
 
 static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
@@ -47,6 +85,31 @@ static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
     return offset + 3;
 }
 
+/**
+ * `OP_ADD_CONSTANT_TO_LOCAL`, a local slot then a constant
+ */
+static int addConstantInstruction(const char *name, Chunk *chunk, int offset)
+{
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 2];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+/**
+ * A global variable access, its 2-byte slot then the name of the variable
+ */
+static int globalInstruction(const char *name, Chunk *chunk, int offset)
+{
+    int slot = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    printf("%-16s %4d '", name, slot);
+    printValue(vm->globalNames.values[slot]);
+    printf("'\n");
+    return offset + 3;
+}
+
 static int constantInstruction(const char *name, Chunk *chunk,
                                int offset)
 {
@@ -57,6 +120,106 @@ static int constantInstruction(const char *name, Chunk *chunk,
     return offset + 2;
 }
 
+/**
+ * A 3-byte operand of a long or wide instruction
+ */
+static int readLongOperand(Chunk *chunk, int offset)
+{
+    return (chunk->code[offset] << 16) | (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+}
+
+static int longConstantInstruction(const char *name, Chunk *chunk, int offset)
+{
+    int constant = readLongOperand(chunk, offset + 1);
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+static int longJumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
+{
+    int jump = readLongOperand(chunk, offset + 1);
+    printf("%-16s %4d -> %d\n", name, offset, offset + 4 + sign * jump);
+    return offset + 4;
+}
+
+/**
+ * `OP_WIDE` and the instruction it prefixes, printed as one line with the name of the prefixed instruction
+ */
+static int wideInstruction(Chunk *chunk, int offset)
+{
+    uint8_t instruction = chunk->code[offset + 1];
+    int operand = readLongOperand(chunk, offset + 2);
+    switch (instruction)
+    {
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+        printf("%-16s %4d\n", instruction == OP_GET_LOCAL     ? "OP_WIDE GET_LOCAL"
+                               : instruction == OP_SET_LOCAL   ? "OP_WIDE SET_LOCAL"
+                               : instruction == OP_GET_UPVALUE ? "OP_WIDE GET_UPVALUE"
+                                                               : "OP_WIDE SET_UPVALUE",
+               operand);
+        return offset + 5;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+        printf("%-16s %4d '", instruction == OP_GET_PROPERTY ? "OP_WIDE GET_PROPERTY" : "OP_WIDE SET_PROPERTY",
+               operand);
+        printValue(chunk->constants.values[operand]);
+        printf("' ic %d\n", (chunk->code[offset + 5] << 8) | chunk->code[offset + 6]);
+        return offset + 7;
+    case OP_INVOKE:
+    case OP_SUPER_INVOKE:
+    {
+        bool hasInlineCache = instruction == OP_INVOKE;
+        printf("%-16s (%d args) %4d '", hasInlineCache ? "OP_WIDE INVOKE" : "OP_WIDE SUPER_INVOKE",
+               chunk->code[offset + 5], operand);
+        printValue(chunk->constants.values[operand]);
+        if (!hasInlineCache)
+        {
+            printf("'\n");
+            return offset + 6;
+        }
+
+        printf("' ic %d\n", (chunk->code[offset + 6] << 8) | chunk->code[offset + 7]);
+        return offset + 8;
+    }
+    case OP_CLOSURE:
+    {
+        printf("%-16s %4d ", "OP_WIDE CLOSURE", operand);
+        printValue(chunk->constants.values[operand]);
+        printf("\n");
+
+        offset += 5;
+        ObjFunction *function = AS_FUNCTION(chunk->constants.values[operand]);
+        for (int j = 0; j < function->upvalueCount; j++)
+        {
+            int kind = chunk->code[offset];
+            int index = readLongOperand(chunk, offset + 1);
+            printf("%04d      |                     %s %d\n", offset, captureName(kind), index);
+            offset += 4;
+        }
+
+        return offset;
+    }
+    case OP_GET_SUPER:
+    case OP_CLASS:
+    case OP_METHOD:
+        printf("%-16s %4d '", instruction == OP_GET_SUPER ? "OP_WIDE GET_SUPER"
+                              : instruction == OP_CLASS   ? "OP_WIDE CLASS"
+                                                          : "OP_WIDE METHOD",
+               operand);
+        printValue(chunk->constants.values[operand]);
+        printf("'\n");
+        return offset + 5;
+    default:
+        printf("Unknown wide opcode %d\n", instruction);
+        return offset + 2;
+    }
+}
+
 int disassembleInstruction(Chunk *chunk, int offset)
 {
     printf("%04d ", offset);
@@ -82,20 +245,20 @@ int disassembleInstruction(Chunk *chunk, int offset)
     case OP_SET_LOCAL:
         return byteInstruction("OP_SET_LOCAL", chunk, offset);
     case OP_GET_GLOBAL:
-        return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+        return globalInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_DEFINE_GLOBAL:
-        return constantInstruction("OP_DEFINE_GLOBAL", chunk,
-                                   offset);
+        return globalInstruction("OP_DEFINE_GLOBAL", chunk,
+                                 offset);
     case OP_SET_GLOBAL:
-        return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        return globalInstruction("OP_SET_GLOBAL", chunk, offset);
     case OP_GET_UPVALUE:
         return byteInstruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
         return byteInstruction("OP_SET_UPVALUE", chunk, offset);
     case OP_GET_PROPERTY:
-        return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+        return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:
-        return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+        return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
     case OP_GET_SUPER:
         return constantInstruction("OP_GET_SUPER", chunk, offset);
     case OP_EQUAL:
@@ -133,9 +296,9 @@ int disassembleInstruction(Chunk *chunk, int offset)
     case OP_CALL:
         return byteInstruction("OP_CALL", chunk, offset);
     case OP_INVOKE:
-        return invokeInstruction("OP_INVOKE", chunk, offset);
+        return invokeInstruction("OP_INVOKE", true, chunk, offset);
     case OP_SUPER_INVOKE:
-        return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
+        return invokeInstruction("OP_SUPER_INVOKE", false, chunk, offset);
     case OP_CLOSURE:
     {
         offset++;
@@ -148,10 +311,10 @@ int disassembleInstruction(Chunk *chunk, int offset)
             chunk->constants.values[constant]);
         for (int j = 0; j < function->upvalueCount; j++)
         {
-            int isLocal = chunk->code[offset++];
+            int kind = chunk->code[offset++];
             int index = chunk->code[offset++];
             printf("%04d      |                     %s %d\n",
-                   offset - 2, isLocal ? "local" : "upvalue", index);
+                   offset - 2, captureName(kind), index);
         }
 
         return offset;
@@ -166,6 +329,50 @@ int disassembleInstruction(Chunk *chunk, int offset)
         return simpleInstruction("OP_INHERIT", offset);
     case OP_METHOD:
         return constantInstruction("OP_METHOD", chunk, offset);
+    case OP_NOT_EQUAL:
+        return simpleInstruction("OP_NOT_EQUAL", offset);
+    case OP_GREATER_EQUAL:
+        return simpleInstruction("OP_GREATER_EQUAL", offset);
+    case OP_LESS_EQUAL:
+        return simpleInstruction("OP_LESS_EQUAL", offset);
+    case OP_JUMP_IF_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_EQUAL", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_EQUAL:
+        return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+    case OP_JUMP_IF_LESS:
+        return jumpInstruction("OP_JUMP_IF_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_LESS:
+        return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_GREATER:
+        return jumpInstruction("OP_JUMP_IF_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+        return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+    case OP_ADD_CONSTANT_TO_LOCAL:
+        return addConstantInstruction("OP_ADD_CONSTANT_TO_LOCAL", chunk, offset);
+    case OP_ADD_NUMBER:
+        return simpleInstruction("OP_ADD_NUMBER", offset);
+    case OP_ADD_STRING:
+        return simpleInstruction("OP_ADD_STRING", offset);
+    case OP_EQUAL_NUMBER:
+        return simpleInstruction("OP_EQUAL_NUMBER", offset);
+    case OP_NOT_EQUAL_NUMBER:
+        return simpleInstruction("OP_NOT_EQUAL_NUMBER", offset);
+    case OP_JUMP_IF_EQUAL_NUMBER:
+        return jumpInstruction("OP_JUMP_IF_EQUAL_NUMBER", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_EQUAL_NUMBER:
+        return jumpInstruction("OP_JUMP_IF_NOT_EQUAL_NUMBER", 1, chunk, offset);
+    case OP_GET_PROPERTY_FRAME:
+        return propertyInstruction("OP_GET_PROPERTY_FRAME", chunk, offset);
+    case OP_CONSTANT_LONG:
+        return longConstantInstruction("OP_CONSTANT_LONG", chunk, offset);
+    case OP_JUMP_LONG:
+        return longJumpInstruction("OP_JUMP_LONG", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE_LONG:
+        return longJumpInstruction("OP_JUMP_IF_FALSE_LONG", 1, chunk, offset);
+    case OP_LOOP_LONG:
+        return longJumpInstruction("OP_LOOP_LONG", -1, chunk, offset);
+    case OP_WIDE:
+        return wideInstruction(chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
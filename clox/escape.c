@@ -0,0 +1,586 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "escape.h"
+#include "peephole.h"
+
+/**
+ * Allocation sites of one chunk the analysis follows, the values of the sites past them are left on the heap
+ */
+#define ESCAPE_MAX_SITES 64
+
+/**
+ * Allocation sites whose values a stack slot may hold, bit `i` for `Escape.sites[i]`
+ */
+typedef uint64_t SiteSet;
+
+/**
+ * State of one run of the analysis over a chunk
+ */
+typedef struct
+{
+    Chunk *chunk;
+    /**
+     * Slots of the abstract stack, the most the frame uses
+     */
+    int depth;
+    /**
+     * Site of every offset of the code, -1 for instructions that allocate nothing the analysis follows
+     */
+    int *siteAt;
+    /**
+     * Offset of every site: `OP_CLOSURE` and `OP_GET_PROPERTY`
+     */
+    int sites[ESCAPE_MAX_SITES];
+    /**
+     * Slot every site pushes its value to, -1 for a site no path reaches
+     */
+    int births[ESCAPE_MAX_SITES];
+    int siteCount;
+    /**
+     * Sites a value of which may outlive the frame
+     */
+    SiteSet escaped;
+    /**
+     * Local slots some closure of the chunk captures
+     */
+    bool *captured;
+    /**
+     * Jump targets of the code, where paths meet
+     */
+    bool *targets;
+    /**
+     * Abstract stack and its height at every jump target a path reached, NULL for the others
+     */
+    SiteSet **states;
+    int *heights;
+    int *pending;
+    int pendingCount;
+    bool *queued;
+
+    //> Abstract stack of the path being walked
+    SiteSet *stack;
+    int height;
+    //<
+} Escape;
+
+/**
+ * @return length of the `OP_CLOSURE` at `offset` before its upvalue operands, the `OP_WIDE` prefix included, 0 for any
+ * other instruction
+ *
+ * @param wide whether its operands are 3 bytes
+ */
+static int closureHeader(Chunk *chunk, int offset, bool *wide)
+{
+    *wide = chunk->code[offset] == OP_WIDE;
+    if (*wide)
+    {
+        return chunk->code[offset + 1] == OP_CLOSURE ? 5 : 0;
+    }
+    return chunk->code[offset] == OP_CLOSURE ? 2 : 0;
+}
+
+/**
+ * @return the function of the `OP_CLOSURE` at `offset`
+ */
+static ObjFunction *closureFunction(Chunk *chunk, int offset, bool wide)
+{
+    int constant = wide ? readLong(&chunk->code[offset + 2]) : chunk->code[offset + 1];
+    return AS_FUNCTION(chunk->constants.values[constant]);
+}
+
+/**
+ * @return whether `function` hands its upvalue `upvalue` on to a closure of its own, which could outlive it. An
+ * uncompiled body may do anything.
+ */
+static bool recapturesUpvalue(ObjFunction *function, int upvalue)
+{
+    if (function->lazySource != NULL)
+    {
+        return true;
+    }
+
+    Chunk *chunk = &function->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        bool wide;
+        int operand = offset + closureHeader(chunk, offset, &wide);
+        if (operand == offset)
+        {
+            continue;
+        }
+
+        ObjFunction *nested = closureFunction(chunk, offset, wide);
+        for (int i = 0; i < nested->upvalueCount; i++, operand += wide ? 4 : 2)
+        {
+            int index = wide ? readLong(&chunk->code[operand + 1]) : chunk->code[operand + 1];
+            if (chunk->code[operand] == CAPTURE_UPVALUE && index == upvalue)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Number the allocation sites of the chunk, find the slots closures capture and the jump targets
+ */
+static void findSites(Escape *e)
+{
+    Chunk *chunk = e->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        uint8_t instruction = chunk->code[offset];
+        if (isBranch(instruction) && jumpTarget(chunk, offset) < chunk->count)
+        {
+            e->targets[jumpTarget(chunk, offset)] = true;
+        }
+
+        bool wide;
+        int operand = offset + closureHeader(chunk, offset, &wide);
+        if (operand == offset && instruction != OP_GET_PROPERTY)
+        {
+            continue;
+        }
+
+        if (e->siteCount < ESCAPE_MAX_SITES)
+        {
+            e->siteAt[offset] = e->siteCount;
+            e->sites[e->siteCount] = offset;
+            e->births[e->siteCount] = -1;
+            e->siteCount++;
+        }
+
+        if (operand == offset)
+        {
+            continue;
+        }
+
+        ObjFunction *function = closureFunction(chunk, offset, wide);
+        for (int i = 0; i < function->upvalueCount; i++, operand += wide ? 4 : 2)
+        {
+            int index = wide ? readLong(&chunk->code[operand + 1]) : chunk->code[operand + 1];
+            if (chunk->code[operand] != CAPTURE_UPVALUE && index < e->depth)
+            {
+                e->captured[index] = true;
+            }
+        }
+    }
+}
+
+/**
+ * Write `values` to `slot`. They escape when the slot is below the one they were pushed to, as that slot may outlive
+ * the frame cell, or when a closure captures the slot.
+ */
+static void place(Escape *e, int slot, SiteSet values)
+{
+    for (int i = 0; i < e->siteCount; i++)
+    {
+        if ((values & ((SiteSet)1 << i)) != 0 && (slot < e->births[i] || e->captured[slot]))
+        {
+            e->escaped |= (SiteSet)1 << i;
+        }
+    }
+    e->stack[slot] = values;
+}
+
+static void push(Escape *e, SiteSet values)
+{
+    place(e, e->height, values);
+    e->height++;
+}
+
+/**
+ * Pop `count` values used in place, like an operand of a comparison or a callee
+ */
+static void drop(Escape *e, int count)
+{
+    e->height -= count;
+}
+
+/**
+ * Pop `count` values handed to code the analysis doesn't see, like arguments or a returned value
+ */
+static void consume(Escape *e, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        e->escaped |= e->stack[--e->height];
+    }
+}
+
+/**
+ * Push the value of the site at `offset`, nothing the analysis follows if it is not one
+ */
+static void pushSite(Escape *e, int offset)
+{
+    int site = e->siteAt[offset];
+    if (site < 0)
+    {
+        push(e, 0);
+        return;
+    }
+
+    e->births[site] = e->height;
+    push(e, (SiteSet)1 << site);
+}
+
+/**
+ * Run the `OP_WIDE` instruction at `offset` on the abstract stack
+ */
+static void stepWide(Escape *e, int offset)
+{
+    uint8_t *ip = &e->chunk->code[offset];
+    int index = readLong(&ip[2]);
+    switch (ip[1])
+    {
+    case OP_GET_LOCAL:
+        push(e, e->stack[index]);
+        break;
+    case OP_SET_LOCAL:
+        place(e, index, e->stack[e->height - 1]);
+        break;
+    case OP_GET_UPVALUE:
+    case OP_CLASS:
+        push(e, 0);
+        break;
+    case OP_SET_UPVALUE:
+        e->escaped |= e->stack[e->height - 1];
+        break;
+    case OP_GET_PROPERTY:
+        consume(e, 1);
+        push(e, 0);
+        break;
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:
+        consume(e, 2);
+        push(e, 0);
+        break;
+    case OP_INVOKE:
+        consume(e, ip[5] + 1);
+        push(e, 0);
+        break;
+    case OP_SUPER_INVOKE:
+        consume(e, ip[5] + 2);
+        push(e, 0);
+        break;
+    case OP_CLOSURE:
+        pushSite(e, offset);
+        break;
+    case OP_METHOD:
+        consume(e, 1);
+        break;
+    }
+}
+
+/**
+ * Run the instruction at `offset` on the abstract stack
+ */
+static void step(Escape *e, int offset)
+{
+    uint8_t *ip = &e->chunk->code[offset];
+    switch (ip[0])
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_GLOBAL:
+    case OP_GET_UPVALUE:
+    case OP_CLASS:
+    case OP_CONSTANT_LONG:
+        push(e, 0);
+        break;
+    case OP_POP:
+    case OP_PRINT:
+    case OP_CLOSE_UPVALUE: // a captured slot holds nothing that didn't escape
+        drop(e, 1);
+        break;
+    case OP_GET_LOCAL:
+        push(e, e->stack[ip[1]]);
+        break;
+    case OP_SET_LOCAL:
+        place(e, ip[1], e->stack[e->height - 1]);
+        break;
+    case OP_DEFINE_GLOBAL:
+    case OP_METHOD:
+    case OP_RETURN:
+        consume(e, 1);
+        break;
+    case OP_SET_GLOBAL:
+    case OP_SET_UPVALUE:
+        e->escaped |= e->stack[e->height - 1];
+        break;
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_FRAME:
+        consume(e, 1);
+        pushSite(e, offset);
+        break;
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:  // the superclass and `this`
+    case OP_INHERIT:    // the superclass stays as `super`
+        consume(e, 2);
+        push(e, 0);
+        break;
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+    case OP_ADD_NUMBER:
+    case OP_ADD_STRING:
+    case OP_EQUAL_NUMBER:
+    case OP_NOT_EQUAL_NUMBER:
+        drop(e, 2);
+        push(e, 0);
+        break;
+    case OP_NOT:
+    case OP_NEGATE:
+        drop(e, 1);
+        push(e, 0);
+        break;
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_EQUAL_NUMBER:
+    case OP_JUMP_IF_NOT_EQUAL_NUMBER:
+        drop(e, 2);
+        break;
+    case OP_ADD_CONSTANT_TO_LOCAL:
+        e->stack[ip[1]] = 0;
+        break;
+    case OP_CALL:
+        consume(e, ip[1]);
+        drop(e, 1); // the callee only runs, its slot gets the result
+        push(e, 0);
+        break;
+    case OP_INVOKE:
+        consume(e, ip[2] + 1);
+        push(e, 0);
+        break;
+    case OP_SUPER_INVOKE:
+        consume(e, ip[2] + 2);
+        push(e, 0);
+        break;
+    case OP_CLOSURE:
+        pushSite(e, offset);
+        break;
+    case OP_WIDE:
+        stepWide(e, offset);
+        break;
+    default: // jumps
+        break;
+    }
+}
+
+/**
+ * Merge the abstract stack into the state of the jump target `target`, to walk from there again when it grew
+ */
+static void flow(Escape *e, int target)
+{
+    if (target >= e->chunk->count)
+    {
+        return;
+    }
+
+    bool changed = false;
+    if (e->states[target] == NULL)
+    {
+        e->states[target] = calloc(e->depth, sizeof(SiteSet));
+        e->heights[target] = e->height;
+        changed = true;
+    }
+
+    SiteSet *state = e->states[target];
+    for (int i = 0; i < e->heights[target] && i < e->height; i++)
+    {
+        changed = changed || (state[i] | e->stack[i]) != state[i];
+        state[i] |= e->stack[i];
+    }
+
+    if (changed && !e->queued[target])
+    {
+        e->queued[target] = true;
+        e->pending[e->pendingCount++] = target;
+    }
+}
+
+/**
+ * Walk every path of the chunk from its first instruction until the sets of the stack slots stop growing, the
+ * compiler only jumps between points of equal height
+ */
+static void walk(Escape *e, int base)
+{
+    e->height = base;
+    memset(e->stack, 0, sizeof(SiteSet) * e->depth);
+    e->targets[0] = true;
+    flow(e, 0);
+
+    while (e->pendingCount > 0)
+    {
+        int offset = e->pending[--e->pendingCount];
+        e->queued[offset] = false;
+        e->height = e->heights[offset];
+        memcpy(e->stack, e->states[offset], sizeof(SiteSet) * e->height);
+
+        for (;;)
+        {
+            step(e, offset);
+            uint8_t instruction = e->chunk->code[offset];
+            if (instruction == OP_RETURN)
+            {
+                break;
+            }
+
+            if (isBranch(instruction))
+            {
+                flow(e, jumpTarget(e->chunk, offset));
+                if (instruction == OP_JUMP || instruction == OP_JUMP_LONG || instruction == OP_LOOP ||
+                    instruction == OP_LOOP_LONG)
+                {
+                    break;
+                }
+            }
+
+            offset += instructionLength(e->chunk, offset);
+            if (offset >= e->chunk->count)
+            {
+                break;
+            }
+            if (e->targets[offset])
+            {
+                flow(e, offset);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Rewrite the instructions whose objects don't escape: a method bound by `OP_GET_PROPERTY` goes to the frame cell of
+ * its slot, and so do the upvalues of a captured slot when every closure that captures it stays in the frame and keeps
+ * the upvalue to itself.
+ */
+static void rewrite(Escape *e)
+{
+    Chunk *chunk = e->chunk;
+    bool *inFrame = malloc(sizeof(bool) * e->depth);
+    memcpy(inFrame, e->captured, sizeof(bool) * e->depth);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+        {
+            bool wide;
+            int operand = offset + closureHeader(chunk, offset, &wide);
+            if (operand == offset)
+            {
+                continue;
+            }
+
+            int site = e->siteAt[offset];
+            bool stays = site >= 0 && (e->escaped & ((SiteSet)1 << site)) == 0;
+            ObjFunction *function = closureFunction(chunk, offset, wide);
+            for (int i = 0; i < function->upvalueCount; i++, operand += wide ? 4 : 2)
+            {
+                int index = wide ? readLong(&chunk->code[operand + 1]) : chunk->code[operand + 1];
+                if (chunk->code[operand] == CAPTURE_UPVALUE || index >= e->depth)
+                {
+                    continue;
+                }
+
+                if (pass == 0 && (!stays || recapturesUpvalue(function, i)))
+                {
+                    inFrame[index] = false;
+                }
+                else if (pass == 1 && inFrame[index])
+                {
+                    chunk->code[operand] = CAPTURE_FRAME_LOCAL;
+                }
+            }
+        }
+    }
+
+    for (int site = 0; site < e->siteCount; site++)
+    {
+        int offset = e->sites[site];
+        if (chunk->code[offset] == OP_GET_PROPERTY && e->births[site] >= 0 &&
+            (e->escaped & ((SiteSet)1 << site)) == 0)
+        {
+            chunk->code[offset] = OP_GET_PROPERTY_FRAME;
+        }
+    }
+
+    free(inFrame);
+}
+
+/**
+ * Escape analysis pass, find the closures, upvalues and bound methods that never outlive the frame.
+ *
+ * @details Abstract interpretation of the bytecode: every stack slot holds the set of allocation sites whose values it
+ * may hold. A value is used in place when it is called, compared, printed, tested or popped, and copied to any slot at
+ * or above the one it was pushed to. It escapes when it is passed as an argument or receiver, returned, stored into a
+ * global, an upvalue or a field, written below its slot or into a slot a closure captures: code the analysis doesn't
+ * see could keep it.
+ *
+ * A value that never escapes is dead once the stack drops below its slot, so the object can live in the frame cell of
+ * that slot (see `FrameCell`): the next object pushed there by the same frame or a callee reuses the cell. Closures
+ * themselves stay on the heap, the tracing JIT guards calls on the identity of the closure and a reused cell would
+ * pass the guard, but the upvalues they capture can move. Instances stay on the heap too: what class `OP_CALL`
+ * instantiates is only known when it runs.
+ *
+ * @note Runs at `endCompiler()` after the peephole pass, when the functions nested in this one are already compiled.
+ */
+void analyzeEscapes(ObjFunction *function)
+{
+    Chunk *chunk = &function->chunk;
+    Escape e;
+    e.chunk = chunk;
+    e.depth = function->maxStack;
+    e.siteAt = malloc(sizeof(int) * chunk->count);
+    e.siteCount = 0;
+    e.escaped = 0;
+    e.captured = calloc(e.depth, sizeof(bool));
+    e.targets = calloc(chunk->count, sizeof(bool));
+    for (int i = 0; i < chunk->count; i++)
+    {
+        e.siteAt[i] = -1;
+    }
+
+    findSites(&e);
+    if (e.siteCount > 0)
+    {
+        e.states = calloc(chunk->count, sizeof(SiteSet *));
+        e.heights = malloc(sizeof(int) * chunk->count);
+        e.pending = malloc(sizeof(int) * chunk->count);
+        e.pendingCount = 0;
+        e.queued = calloc(chunk->count, sizeof(bool));
+        e.stack = malloc(sizeof(SiteSet) * e.depth);
+
+        walk(&e, function->arity + 1);
+        rewrite(&e);
+
+        for (int i = 0; i < chunk->count; i++)
+        {
+            free(e.states[i]);
+        }
+        free(e.states);
+        free(e.heights);
+        free(e.pending);
+        free(e.queued);
+        free(e.stack);
+    }
+
+    free(e.siteAt);
+    free(e.captured);
+    free(e.targets);
+}
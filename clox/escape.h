@@ -0,0 +1,11 @@
+#ifndef clox_escape_h
+#define clox_escape_h
+
+#include "object.h"
+
+/**
+ * Escape analysis of the finished chunk of `function`, moves the objects that never outlive its frame to frame cells
+ */
+void analyzeEscapes(ObjFunction *function);
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * Two VMs on two threads at once, through the embedding API of `vm.h`: each thread compiles the same script in its own
+ * VM, then calls into it while the other one does. `make embed` builds and runs it, it fails if the VMs see each other's
+ * globals or objects.
+ */
+#include <pthread.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+#define ROUNDS 200
+
+static const char *script = "var calls = 0;\n"
+                            "fun fib(n) { calls = calls + 1; if (n < 2) return n; return fib(n - 2) + fib(n - 1); }\n"
+                            "fun garbage(n) { var s = \"\"; for (var i = 0; i < n; i = i + 1) s = s + \"x\"; return s; }\n";
+
+typedef struct
+{
+    int id;
+    /**
+     * The thread got what its own VM should hold
+     */
+    bool ok;
+} Worker;
+
+static bool expectNumber(VM *instance, const char *name, double expected)
+{
+    Value value;
+    return getGlobal(instance, name, &value) && IS_NUMBER(value) && AS_NUMBER(value) == expected;
+}
+
+static void *runWorker(void *argument)
+{
+    Worker *worker = argument;
+    VM *instance = newVM();
+
+    // The id is defined by a script of its own, compiled and run in two steps
+    char idSource[32];
+    snprintf(idSource, sizeof(idSource), "var id = %d;", worker->id);
+    ObjFunction *idScript = compileSource(instance, idSource);
+    worker->ok = idScript != NULL && interpretFunction(instance, idScript) == INTERPRET_OK &&
+                 interpret(instance, script) == INTERPRET_OK;
+
+    // fib(15) makes 1973 calls, both VMs count them in their own `calls`
+    for (int round = 0; worker->ok && round < ROUNDS; round++)
+    {
+        Value n = NUMBER_VAL(100);
+        Value result;
+        worker->ok = callGlobal(instance, "garbage", 1, &n, &result) == INTERPRET_OK;
+        n = NUMBER_VAL(15);
+        worker->ok = worker->ok && callGlobal(instance, "fib", 1, &n, &result) == INTERPRET_OK &&
+                     IS_NUMBER(result) && AS_NUMBER(result) == 610;
+    }
+    worker->ok = worker->ok && expectNumber(instance, "id", worker->id) &&
+                 expectNumber(instance, "calls", ROUNDS * 1973.0);
+
+    freeVM(instance);
+    return NULL;
+}
+
+int main()
+{
+    Worker workers[2] = {{.id = 1}, {.id = 2}};
+    pthread_t threads[2];
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_create(&threads[i], NULL, runWorker, &workers[i]);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (!workers[i].ok)
+        {
+            fprintf(stderr, "VM %d: wrong result.\n", workers[i].id);
+            return 1;
+        }
+    }
+    printf("Two VMs ran on two threads.\n");
+    return 0;
+}
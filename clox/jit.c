@@ -0,0 +1,776 @@
+#include <stdlib.h>
+
+#include "jit.h"
+#include "peephole.h"
+#include "x64.h"
+
+#ifdef BASELINE_JIT
+
+/**
+ * Baseline JIT: every instruction of the bytecode is translated on its own into a template of x86-64 code, with no
+ * analysis across instructions. The templates work on the same stack as the interpreter, they only remove the
+ * dispatch, the decoding of operands and the boxing checks of the common case:
+ *
+ * - stack and local slot accesses, globals, upvalues, jumps and number arithmetic and comparisons run inline.
+ * - property accesses and invocations run inline when the first entry of their inline cache hits.
+ * - calls of closures that have native code push the frame inline, returns pop it inline when there is no upvalue to
+ *   close. Both go on in the native code of the new running frame, or leave to `run()` when it has none.
+ * - everything else, and every guard that fails, spills the state and calls `stepInstruction()`, which runs the
+ *   instruction with the handlers of the interpreter (`callValue()`, `invoke()`, `concatenate()`, `runtimeError()`...).
+ *
+ * Registers of the native code, all callee-saved so they survive calls into the VM:
+ *
+ * - `rbx`: stack pointer, the `sp` of `run()`
+ * - `r12`: first stack slot of the frame
+ * - `r13`: the frame
+ * - `r14`: `QNAN`, tested against values by the number guards
+ */
+
+/**
+ * Jump to an instruction of the bytecode, patched once every instruction has its native offset
+ */
+typedef struct
+{
+    /**
+     * Offset of the 32-bit displacement in the native code
+     */
+    int offset;
+    /**
+     * Offset of the jump target in the bytecode
+     */
+    int target;
+} PendingJump;
+
+typedef struct
+{
+    Assembler as;
+    ObjFunction *function;
+    /**
+     * Native offset of every offset of the bytecode that starts an instruction
+     */
+    int *starts;
+    PendingJump *jumps;
+    int jumpCount;
+    /**
+     * Native offset of the epilogue, which returns `eax` to `run()`
+     */
+    int exit;
+    /**
+     * Native offset of the code that goes on with the running frame after a call or a return (see `emitPrologue()`)
+     */
+    int switchFrame;
+    /**
+     * Native offset past the register saves of the prologue
+     */
+    int resume;
+    /**
+     * Table read by the prologue to resume at `frame->ip`, filled once the code is mapped
+     */
+    uint8_t **entries;
+} JitCompiler;
+
+/**
+ * Jump to the instruction at `target` in the bytecode
+ */
+static void jumpToBytecode(JitCompiler *compiler, int condition, int target)
+{
+    Assembler *as = &compiler->as;
+    PendingJump *jump = &compiler->jumps[compiler->jumpCount++];
+    jump->offset = emitJump(as, condition);
+    jump->target = target;
+}
+
+/**
+ * Move the stack pointer by `delta` bytes, `add rbx, imm8`
+ */
+static void moveStackPointer(Assembler *as, int8_t delta)
+{
+    emitBytes(as, "\x48\x83\xc3", 3);
+    emitByte(as, (uint8_t)delta);
+}
+
+static void pushRegister(Assembler *as, Register src)
+{
+    store(as, RBX, 0, src);
+    moveStackPointer(as, sizeof(Value));
+}
+
+static void pushImmediate(Assembler *as, Value value)
+{
+    movImmediate(as, RAX, value);
+    pushRegister(as, RAX);
+}
+
+/**
+ * Run the instruction at `offset` with `stepInstruction()`, the result is left in `eax`
+ */
+static void emitStep(JitCompiler *compiler, int offset)
+{
+    Assembler *as = &compiler->as;
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&compiler->function->chunk.code[offset]);
+    store(as, R13, offsetof(CallFrame, ip), RAX);
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->stackTop);
+    store(as, RAX, 0, RBX);
+    callAddress(as, stepInstruction);
+}
+
+/**
+ * Slow path of an instruction that falls through to the next one
+ */
+static void stepAndContinue(JitCompiler *compiler, int offset)
+{
+    Assembler *as = &compiler->as;
+    emitStep(compiler, offset);
+    compareContinue(as);
+    patchJump(as, emitJump(as, CC_NE), compiler->exit);
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->stackTop);
+    load(as, RBX, RAX, 0);
+}
+
+/**
+ * Slow path of an instruction that can jump or change the running frame, the native code resumes at `frame->ip` of the
+ * running frame
+ */
+static void stepAndSwitch(JitCompiler *compiler, int offset)
+{
+    Assembler *as = &compiler->as;
+    emitStep(compiler, offset);
+    compareContinue(as);
+    patchJump(as, emitJump(as, CC_NE), compiler->exit);
+    patchJump(as, emitJump(as, -1), compiler->switchFrame);
+}
+
+/**
+ * Load the two operands of a binary instruction, `a` in `rax` and `b` in `rdx`, into `xmm0` and `xmm1`
+ *
+ * @param slow the jumps taken when one of them is not a number
+ */
+static void loadNumbers(Assembler *as, int slow[2])
+{
+    load(as, RAX, RBX, -2 * (int)sizeof(Value));
+    load(as, RDX, RBX, -(int)sizeof(Value));
+    slow[0] = jumpIfNotNumber(as, RAX);
+    slow[1] = jumpIfNotNumber(as, RDX);
+    movToXmm(as, 0, RAX);
+    movToXmm(as, 1, RDX);
+}
+
+/**
+ * Close a fast path, the slow path that follows it runs the instruction with `stepInstruction()`
+ */
+static void slowPath(JitCompiler *compiler, int offset, int *slow, int slowCount)
+{
+    Assembler *as = &compiler->as;
+    int done = emitJump(as, -1);
+    for (int i = 0; i < slowCount; i++)
+    {
+        patchJumpHere(as, slow[i]);
+    }
+    stepAndContinue(compiler, offset);
+    patchJumpHere(as, done);
+}
+
+static void arithmetic(JitCompiler *compiler, int offset, SseOp op)
+{
+    Assembler *as = &compiler->as;
+    int slow[2];
+    loadNumbers(as, slow);
+    sseRegisters(as, op, 0, 1);
+    movFromXmm(as, RAX, 0);
+    store(as, RBX, -2 * (int)sizeof(Value), RAX);
+    moveStackPointer(as, -(int)sizeof(Value));
+    slowPath(compiler, offset, slow, 2);
+}
+
+/**
+ * `a < b` is `ucomisd b, a` and `CC_A`, which is false when unordered like in C. The negated comparisons of
+ * `OP_GREATER_EQUAL` and `OP_LESS_EQUAL` use `CC_BE`, which is true when unordered like `!(a < b)`.
+ *
+ * @param swap compare `b` with `a`
+ */
+static void comparison(JitCompiler *compiler, int offset, bool swap, Condition condition)
+{
+    Assembler *as = &compiler->as;
+    int slow[2];
+    loadNumbers(as, slow);
+    compareXmm(as, swap ? 1 : 0, swap ? 0 : 1);
+    setCondition(as, condition, RAX);
+    boxBool(as);
+    store(as, RBX, -2 * (int)sizeof(Value), RAX);
+    moveStackPointer(as, -(int)sizeof(Value));
+    slowPath(compiler, offset, slow, 2);
+}
+
+/**
+ * `valuesEqual()`: numbers compare as doubles, any other value is equal only to itself
+ */
+static void equality(Assembler *as, bool negate)
+{
+    int bits[2];
+    load(as, RAX, RBX, -2 * (int)sizeof(Value));
+    load(as, RDX, RBX, -(int)sizeof(Value));
+    moveStackPointer(as, -(int)sizeof(Value));
+    bits[0] = jumpIfNotNumber(as, RAX);
+    bits[1] = jumpIfNotNumber(as, RDX);
+    movToXmm(as, 0, RAX);
+    movToXmm(as, 1, RDX);
+    compareXmm(as, 0, 1);
+    setCondition(as, negate ? CC_NE : CC_E, RAX);
+    setCondition(as, negate ? CC_P : CC_NP, RCX);
+    aluRegisters(as, negate ? ALU_OR : ALU_AND, RAX, RCX);
+    int done = emitJump(as, -1);
+
+    patchJumpHere(as, bits[0]);
+    patchJumpHere(as, bits[1]);
+    aluRegisters(as, ALU_CMP, RAX, RDX);
+    setCondition(as, negate ? CC_NE : CC_E, RAX);
+
+    patchJumpHere(as, done);
+    boxBool(as);
+    store(as, RBX, -(int)sizeof(Value), RAX);
+}
+
+static void compareAndJump(JitCompiler *compiler, int offset, int target, bool swap, Condition condition)
+{
+    Assembler *as = &compiler->as;
+    int slow[2];
+    loadNumbers(as, slow);
+    moveStackPointer(as, -2 * (int)sizeof(Value));
+    compareXmm(as, swap ? 1 : 0, swap ? 0 : 1);
+    jumpToBytecode(compiler, condition, target);
+    int done = emitJump(as, -1);
+
+    patchJumpHere(as, slow[0]);
+    patchJumpHere(as, slow[1]);
+    stepAndSwitch(compiler, offset); // always a runtime error
+    patchJumpHere(as, done);
+}
+
+static void equalAndJump(JitCompiler *compiler, int target, bool negate)
+{
+    Assembler *as = &compiler->as;
+    int bits[2];
+    load(as, RAX, RBX, -2 * (int)sizeof(Value));
+    load(as, RDX, RBX, -(int)sizeof(Value));
+    moveStackPointer(as, -2 * (int)sizeof(Value));
+    bits[0] = jumpIfNotNumber(as, RAX);
+    bits[1] = jumpIfNotNumber(as, RDX);
+    movToXmm(as, 0, RAX);
+    movToXmm(as, 1, RDX);
+    compareXmm(as, 0, 1);
+    if (negate)
+    {
+        jumpToBytecode(compiler, CC_P, target);
+        jumpToBytecode(compiler, CC_NE, target);
+    }
+    else
+    {
+        int unordered = emitJump(as, CC_P);
+        jumpToBytecode(compiler, CC_E, target);
+        patchJumpHere(as, unordered);
+    }
+    int done = emitJump(as, -1);
+
+    patchJumpHere(as, bits[0]);
+    patchJumpHere(as, bits[1]);
+    aluRegisters(as, ALU_CMP, RAX, RDX);
+    jumpToBytecode(compiler, negate ? CC_NE : CC_E, target);
+    patchJumpHere(as, done);
+}
+
+/**
+ * Jump to `target` when the value in `rax` is falsey, `rcx` is clobbered
+ */
+static void jumpIfFalsey(JitCompiler *compiler, int condition, int target)
+{
+    Assembler *as = &compiler->as;
+    movImmediate(as, RCX, NIL_VAL);
+    aluRegisters(as, ALU_CMP, RAX, RCX);
+    jumpToBytecode(compiler, CC_E, target);
+    movImmediate(as, RCX, FALSE_VAL);
+    aluRegisters(as, ALU_CMP, RAX, RCX);
+    jumpToBytecode(compiler, condition, target);
+}
+
+/**
+ * Probe the first entry of the inline cache `cache` with the shape of the instance in `rax`, like `isCachedField()` or
+ * `isCachedMethod()`. Only monomorphic sites hit inline, other ones take the slow path.
+ *
+ * A field leaves its slot in `rcx` and the fields of the instance in `rax`, a method leaves its closure in `rax`.
+ *
+ * @param slow the jumps taken on a miss
+ * @return number of jumps in `slow`
+ */
+static int probeFirstEntry(JitCompiler *compiler, int cache, bool method, int *slow)
+{
+    Assembler *as = &compiler->as;
+    InlineCache *address = &compiler->function->chunk.caches[cache];
+    load(as, RDX, RAX, offsetof(ObjInstance, shape));
+    movImmediate(as, RSI, (uint64_t)(uintptr_t)address);
+    compareMemory(as, false, RSI, offsetof(InlineCache, count), 0);
+    slow[0] = emitJump(as, CC_E);
+    emitMemory(as, true, 0x3b, RDX, RSI, offsetof(InlineCacheEntry, shape)); // cmp rdx, [rsi + shape]
+    slow[1] = emitJump(as, CC_NE);
+    emitMemory(as, true, 0x63, RCX, RSI, offsetof(InlineCacheEntry, field)); // movsxd rcx, [rsi + field]
+    emitBytes(as, "\x85\xc9", 2);                                         // test ecx, ecx
+    if (method)
+    {
+        slow[2] = emitJump(as, CC_NS);
+        load(as, RAX, RSI, offsetof(InlineCacheEntry, method));
+        movImmediate(as, RCX, ~(SIGN_BIT | QNAN));
+        aluRegisters(as, ALU_AND, RAX, RCX);
+        return 3;
+    }
+    else
+    {
+        slow[2] = emitJump(as, CC_S);
+        compareMemory(as, true, RSI, offsetof(InlineCacheEntry, transition), 0);
+        slow[3] = emitJump(as, CC_NE);
+        load(as, RAX, RAX, offsetof(ObjInstance, fields));
+        return 4;
+    }
+}
+
+static void emitGetProperty(JitCompiler *compiler, int offset, int cache)
+{
+    Assembler *as = &compiler->as;
+    int slow[6];
+    load(as, RAX, RBX, -(int)sizeof(Value));
+    loadObject(as, OBJ_INSTANCE, slow);
+    probeFirstEntry(compiler, cache, false, &slow[2]);
+    emitBytes(as, "\x48\x8b\x04\xc8", 4); // mov rax, [rax + rcx * 8]
+    store(as, RBX, -(int)sizeof(Value), RAX);
+    slowPath(compiler, offset, slow, 6);
+}
+
+static void emitSetProperty(JitCompiler *compiler, int offset, int cache)
+{
+    Assembler *as = &compiler->as;
+    int slow[8];
+    load(as, RAX, RBX, -2 * (int)sizeof(Value));
+    loadObject(as, OBJ_INSTANCE, slow);
+    load(as, RDI, RBX, -(int)sizeof(Value));
+    guardWriteBarrier(as, RAX, RDI, &slow[2]); // the interpreter runs the barrier
+    probeFirstEntry(compiler, cache, false, &slow[4]);
+    load(as, RDX, RBX, -(int)sizeof(Value));
+    emitBytes(as, "\x48\x89\x14\xc8", 4); // mov [rax + rcx * 8], rdx
+    store(as, RBX, -2 * (int)sizeof(Value), RDX);
+    moveStackPointer(as, -(int)sizeof(Value));
+    slowPath(compiler, offset, slow, 8);
+}
+
+/**
+ * `call()` of the closure in `rax` when its function already has native code, then switch to it. A wrong arity, a
+ * function to interpret, or frames or a stack too small for the call take the slow path, where `call()` grows them.
+ *
+ * @param slow the four jumps taken then
+ */
+static void callClosure(JitCompiler *compiler, int offset, int argCount, int slow[4])
+{
+    Assembler *as = &compiler->as;
+    load(as, RCX, RAX, offsetof(ObjClosure, function));
+    emitMemory(as, false, 0x81, 7, RCX, offsetof(ObjFunction, arity)); // cmp dword [rcx + arity], imm32
+    emit32(as, (uint32_t)argCount);
+    slow[0] = emitJump(as, CC_NE);
+    load(as, RDX, RCX, offsetof(ObjFunction, jit));
+    emitBytes(as, "\x48\x85\xd2", 3); // test rdx, rdx
+    slow[1] = emitJump(as, CC_E);
+    movImmediate(as, RSI, (uint64_t)(uintptr_t)&vm->frameCount);
+    emitMemory(as, false, 0x8b, RDI, RSI, 0); // mov edi, [rsi]
+    movImmediate(as, R8, (uint64_t)(uintptr_t)&vm->frameCapacity);
+    emitMemory(as, false, 0x3b, RDI, R8, 0); // cmp edi, [r8]
+    slow[2] = emitJump(as, CC_GE);
+    emitMemory(as, true, 0x8d, R8, RBX, -(argCount + 1) * (int)sizeof(Value)); // lea r8, [rbx - slots]
+    emitMemory(as, true, 0x63, R9, RCX, offsetof(ObjFunction, maxStack));      // movsxd r9, [rcx + maxStack]
+    emitBytes(as, "\x4f\x8d\x0c\xc8", 4);                                       // lea r9, [r8 + r9 * 8]
+    movImmediate(as, R10, (uint64_t)(uintptr_t)&vm->stackEnd);
+    emitMemory(as, true, 0x3b, R9, R10, 0); // cmp r9, [r10]
+    slow[3] = emitJump(as, CC_A);
+
+    emitMemory(as, false, 0x83, 0, RSI, 0); // add dword [rsi], 1
+    emitByte(as, 1);
+    emitBytes(as, "\x48\x63\xff", 3); // movsxd rdi, edi
+    emitBytes(as, "\x48\x6b\xff", 3); // imul rdi, rdi, sizeof(CallFrame)
+    emitByte(as, sizeof(CallFrame));
+    movImmediate(as, RSI, (uint64_t)(uintptr_t)&vm->frames);
+    load(as, RSI, RSI, 0);
+    aluRegisters(as, ALU_ADD, RDI, RSI);
+    store(as, RDI, offsetof(CallFrame, closure), RAX);
+    store(as, RDI, offsetof(CallFrame, slots), R8);
+    load(as, R8, RCX, offsetof(ObjFunction, chunk) + offsetof(Chunk, code));
+    store(as, RDI, offsetof(CallFrame, ip), R8);
+
+    movImmediate(as, R8, (uint64_t)(uintptr_t)&compiler->function->chunk.code[offset + instructionLength(&compiler->function->chunk, offset)]);
+    store(as, R13, offsetof(CallFrame, ip), R8);
+    movImmediate(as, R8, (uint64_t)(uintptr_t)&vm->stackTop);
+    store(as, R8, 0, RBX);
+    load(as, RAX, RDX, offsetof(JitCode, resume));
+    emitBytes(as, "\xff\xe0", 2); // jmp rax
+}
+
+/**
+ * Close the fast path of a call, the slow path calls with `stepInstruction()`
+ */
+static void slowCall(JitCompiler *compiler, int offset, int *slow, int slowCount)
+{
+    Assembler *as = &compiler->as;
+    for (int i = 0; i < slowCount; i++)
+    {
+        patchJumpHere(as, slow[i]);
+    }
+    stepAndSwitch(compiler, offset);
+}
+
+static void emitCall(JitCompiler *compiler, int offset, int argCount)
+{
+    Assembler *as = &compiler->as;
+    int slow[6];
+    load(as, RAX, RBX, -(argCount + 1) * (int)sizeof(Value));
+    loadObject(as, OBJ_CLOSURE, slow);
+    callClosure(compiler, offset, argCount, &slow[2]);
+    slowCall(compiler, offset, slow, 6);
+}
+
+static void emitInvoke(JitCompiler *compiler, int offset, int argCount, int cache)
+{
+    Assembler *as = &compiler->as;
+    int slow[9];
+    load(as, RAX, RBX, -(argCount + 1) * (int)sizeof(Value));
+    loadObject(as, OBJ_INSTANCE, slow);
+    int count = 2 + probeFirstEntry(compiler, cache, true, &slow[2]);
+    callClosure(compiler, offset, argCount, &slow[count]);
+    slowCall(compiler, offset, slow, count + 4);
+}
+
+/**
+ * `OP_RETURN` to a caller when there is no upvalue to close, returning from the script and closing upvalues take the
+ * slow path
+ */
+static void emitReturn(JitCompiler *compiler, int offset)
+{
+    Assembler *as = &compiler->as;
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->openUpvalues);
+    load(as, RAX, RAX, 0);
+    emitBytes(as, "\x48\x85\xc0", 3); // test rax, rax
+    int noUpvalues = emitJump(as, CC_E);
+    load(as, RCX, RAX, offsetof(ObjUpvalue, location));
+    aluRegisters(as, ALU_CMP, RCX, R12);
+    int closeUpvalues = emitJump(as, CC_AE);
+    patchJumpHere(as, noUpvalues);
+
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->frameCount);
+    compareMemory(as, false, RAX, 0, 1);
+    int lastFrame = emitJump(as, CC_E);
+    emitMemory(as, false, 0xff, 1, RAX, 0); // dec dword [rax]
+    load(as, RCX, RBX, -(int)sizeof(Value));
+    store(as, R12, 0, RCX);
+    emitMemory(as, true, 0x8d, RBX, R12, sizeof(Value)); // lea rbx, [r12 + 8]
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->stackTop);
+    store(as, RAX, 0, RBX);
+    patchJump(as, emitJump(as, -1), compiler->switchFrame);
+
+    patchJumpHere(as, closeUpvalues);
+    patchJumpHere(as, lastFrame);
+    stepAndSwitch(compiler, offset);
+}
+
+static void compileInstruction(JitCompiler *compiler, int offset)
+{
+    Assembler *as = &compiler->as;
+    Chunk *chunk = &compiler->function->chunk;
+    uint8_t *ip = &chunk->code[offset];
+
+    switch (genericOpcode(ip[0]))
+    {
+    case OP_CONSTANT:
+        pushImmediate(as, chunk->constants.values[ip[1]]);
+        break;
+    case OP_CONSTANT_LONG:
+        pushImmediate(as, chunk->constants.values[readLong(&ip[1])]);
+        break;
+    case OP_NIL:
+        pushImmediate(as, NIL_VAL);
+        break;
+    case OP_TRUE:
+        pushImmediate(as, TRUE_VAL);
+        break;
+    case OP_FALSE:
+        pushImmediate(as, FALSE_VAL);
+        break;
+    case OP_POP:
+        moveStackPointer(as, -(int)sizeof(Value));
+        break;
+    case OP_GET_LOCAL:
+        load(as, RAX, R12, ip[1] * (int)sizeof(Value));
+        pushRegister(as, RAX);
+        break;
+    case OP_SET_LOCAL:
+        load(as, RAX, RBX, -(int)sizeof(Value));
+        store(as, R12, ip[1] * (int)sizeof(Value), RAX);
+        break;
+    case OP_GET_GLOBAL:
+    {
+        int undefined = loadGlobal(as, readShort(ip));
+        pushRegister(as, RAX);
+        slowPath(compiler, offset, &undefined, 1);
+        break;
+    }
+    case OP_DEFINE_GLOBAL:
+        movImmediate(as, RDX, (uint64_t)(uintptr_t)&vm->globalValues.values);
+        load(as, RDX, RDX, 0);
+        load(as, RAX, RBX, -(int)sizeof(Value));
+        store(as, RDX, readShort(ip) * (int)sizeof(Value), RAX);
+        moveStackPointer(as, -(int)sizeof(Value));
+        break;
+    case OP_SET_GLOBAL:
+    {
+        int undefined = loadGlobal(as, readShort(ip));
+        load(as, RAX, RBX, -(int)sizeof(Value));
+        store(as, RDX, readShort(ip) * (int)sizeof(Value), RAX);
+        slowPath(compiler, offset, &undefined, 1);
+        break;
+    }
+    case OP_GET_UPVALUE:
+        loadUpvalueLocation(as, ip[1]);
+        load(as, RAX, RAX, 0);
+        pushRegister(as, RAX);
+        break;
+    case OP_SET_UPVALUE:
+    {
+        loadUpvalue(as, ip[1]);
+        load(as, RDX, RBX, -(int)sizeof(Value));
+        int barrier[2];
+        guardWriteBarrier(as, RAX, RDX, barrier);
+        load(as, RAX, RAX, offsetof(ObjUpvalue, location));
+        store(as, RAX, 0, RDX);
+        slowPath(compiler, offset, barrier, 2);
+        break;
+    }
+    case OP_EQUAL:
+        equality(as, false);
+        break;
+    case OP_NOT_EQUAL:
+        equality(as, true);
+        break;
+    case OP_GREATER:
+        comparison(compiler, offset, false, CC_A);
+        break;
+    case OP_LESS:
+        comparison(compiler, offset, true, CC_A);
+        break;
+    case OP_GREATER_EQUAL:
+        comparison(compiler, offset, true, CC_BE);
+        break;
+    case OP_LESS_EQUAL:
+        comparison(compiler, offset, false, CC_BE);
+        break;
+    case OP_ADD:
+        arithmetic(compiler, offset, SSE_ADD);
+        break;
+    case OP_SUBTRACT:
+        arithmetic(compiler, offset, SSE_SUB);
+        break;
+    case OP_MULTIPLY:
+        arithmetic(compiler, offset, SSE_MUL);
+        break;
+    case OP_DIVIDE:
+        arithmetic(compiler, offset, SSE_DIV);
+        break;
+    case OP_NOT:
+    {
+        load(as, RAX, RBX, -(int)sizeof(Value));
+        movImmediate(as, RDX, TRUE_VAL);
+        movImmediate(as, RCX, NIL_VAL);
+        aluRegisters(as, ALU_CMP, RAX, RCX);
+        int isNil = emitJump(as, CC_E);
+        movImmediate(as, RCX, FALSE_VAL);
+        aluRegisters(as, ALU_CMP, RAX, RCX);
+        int isFalse = emitJump(as, CC_E);
+        movImmediate(as, RDX, FALSE_VAL);
+        patchJumpHere(as, isNil);
+        patchJumpHere(as, isFalse);
+        store(as, RBX, -(int)sizeof(Value), RDX);
+        break;
+    }
+    case OP_NEGATE:
+    {
+        load(as, RAX, RBX, -(int)sizeof(Value));
+        int slow = jumpIfNotNumber(as, RAX);
+        emitBytes(as, "\x48\x0f\xba\xf8\x3f", 5); // btc rax, 63
+        store(as, RBX, -(int)sizeof(Value), RAX);
+        slowPath(compiler, offset, &slow, 1);
+        break;
+    }
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+        jumpToBytecode(compiler, -1, jumpTarget(chunk, offset));
+        break;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+        load(as, RAX, RBX, -(int)sizeof(Value));
+        jumpIfFalsey(compiler, CC_E, jumpTarget(chunk, offset));
+        break;
+    case OP_JUMP_IF_EQUAL:
+        equalAndJump(compiler, jumpTarget(chunk, offset), false);
+        break;
+    case OP_JUMP_IF_NOT_EQUAL:
+        equalAndJump(compiler, jumpTarget(chunk, offset), true);
+        break;
+    case OP_JUMP_IF_LESS:
+        compareAndJump(compiler, offset, jumpTarget(chunk, offset), true, CC_A);
+        break;
+    case OP_JUMP_IF_NOT_LESS:
+        compareAndJump(compiler, offset, jumpTarget(chunk, offset), true, CC_BE);
+        break;
+    case OP_JUMP_IF_GREATER:
+        compareAndJump(compiler, offset, jumpTarget(chunk, offset), false, CC_A);
+        break;
+    case OP_JUMP_IF_NOT_GREATER:
+        compareAndJump(compiler, offset, jumpTarget(chunk, offset), false, CC_BE);
+        break;
+    case OP_ADD_CONSTANT_TO_LOCAL:
+    {
+        load(as, RAX, R12, ip[1] * (int)sizeof(Value));
+        int slow = jumpIfNotNumber(as, RAX);
+        movToXmm(as, 0, RAX);
+        movImmediate(as, RDX, chunk->constants.values[ip[2]]);
+        movToXmm(as, 1, RDX);
+        sseRegisters(as, SSE_ADD, 0, 1);
+        movFromXmm(as, RAX, 0);
+        store(as, R12, ip[1] * (int)sizeof(Value), RAX);
+        slowPath(compiler, offset, &slow, 1);
+        break;
+    }
+    case OP_GET_PROPERTY:
+        emitGetProperty(compiler, offset, readShort(&ip[1]));
+        break;
+    case OP_SET_PROPERTY:
+        emitSetProperty(compiler, offset, readShort(&ip[1]));
+        break;
+    case OP_RETURN:
+        emitReturn(compiler, offset);
+        break;
+    case OP_CALL:
+        emitCall(compiler, offset, ip[1]);
+        break;
+    case OP_INVOKE:
+        emitInvoke(compiler, offset, ip[2], readShort(&ip[2]));
+        break;
+    case OP_SUPER_INVOKE:
+    case OP_WIDE: // may call
+        stepAndSwitch(compiler, offset);
+        break;
+    default:
+        stepAndContinue(compiler, offset);
+        break;
+    }
+}
+
+/**
+ * Save the registers the native code owns, load the frame and jump to the instruction at `frame->ip`.
+ *
+ * @details After a call or a return, the native code switches straight to the native code of the new running frame:
+ * it jumps past the register saves of its prologue, so the registers are restored once by whichever function leaves
+ * to `run()` at last.
+ */
+static void emitPrologue(JitCompiler *compiler)
+{
+    Assembler *as = &compiler->as;
+    emitBytes(as, "\x55\x53\x41\x54\x41\x55\x41\x56", 8); // push rbp, rbx, r12, r13, r14, the stack stays aligned
+
+    compiler->resume = as->count;
+    movRegister(as, R13, RDI);
+    load(as, R12, R13, offsetof(CallFrame, slots));
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->stackTop);
+    load(as, RBX, RAX, 0);
+    movImmediate(as, R14, QNAN);
+
+    load(as, RAX, R13, offsetof(CallFrame, ip));
+    movImmediate(as, RCX, (uint64_t)(uintptr_t)compiler->function->chunk.code);
+    aluRegisters(as, ALU_SUB, RAX, RCX);
+    movImmediate(as, RCX, (uint64_t)(uintptr_t)compiler->entries);
+    emitBytes(as, "\xff\x24\xc1", 3); // jmp [rcx + rax * 8]
+
+    compiler->switchFrame = as->count;
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->frameCount);
+    emitMemory(as, true, 0x63, RAX, RAX, 0); // movsxd rax, [rax]
+    emitBytes(as, "\x48\x6b\xc0", 3);      // imul rax, rax, sizeof(CallFrame)
+    emitByte(as, sizeof(CallFrame));
+    movImmediate(as, RDI, (uint64_t)(uintptr_t)&vm->frames);
+    load(as, RDI, RDI, 0);
+    aluRegisters(as, ALU_ADD, RDI, RAX);
+    emitMemory(as, true, 0x8d, RDI, RDI, -(int)sizeof(CallFrame)); // lea rdi, [rdi - sizeof(CallFrame)]
+    load(as, RAX, RDI, offsetof(CallFrame, closure));
+    load(as, RAX, RAX, offsetof(ObjClosure, function));
+    load(as, RAX, RAX, offsetof(ObjFunction, jit));
+    emitBytes(as, "\x48\x85\xc0", 3); // test rax, rax
+    int interpreted = emitJump(as, CC_E);
+    load(as, RAX, RAX, offsetof(JitCode, resume));
+    emitBytes(as, "\xff\xe0", 2); // jmp rax
+
+    patchJumpHere(as, interpreted);
+    emitByte(as, 0xb8); // mov eax, JIT_CONTINUE
+    emit32(as, (uint32_t)JIT_CONTINUE);
+    compiler->exit = as->count;
+    emitBytes(as, "\x41\x5e\x41\x5d\x41\x5c\x5b\x5d\xc3", 9); // pop r14, r13, r12, rbx, rbp and ret
+}
+
+void jitCompile(ObjFunction *function)
+{
+    Chunk *chunk = &function->chunk;
+    JitCompiler compiler;
+    initAssembler(&compiler.as);
+    compiler.function = function;
+    compiler.starts = malloc(sizeof(int) * chunk->count);
+    compiler.jumps = malloc(sizeof(PendingJump) * chunk->count * 3); // no instruction emits more than three jumps to the bytecode
+    compiler.jumpCount = 0;
+    compiler.entries = calloc(chunk->count, sizeof(uint8_t *));
+
+    emitPrologue(&compiler);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        compiler.starts[offset] = compiler.as.count;
+        compileInstruction(&compiler, offset);
+    }
+
+    for (int i = 0; i < compiler.jumpCount; i++)
+    {
+        patchJump(&compiler.as, compiler.jumps[i].offset, compiler.starts[compiler.jumps[i].target]);
+    }
+
+    uint8_t *code = mapCode(&compiler.as);
+    if (code == NULL)
+    {
+        free(compiler.entries);
+    }
+    else
+    {
+        for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+        {
+            compiler.entries[offset] = code + compiler.starts[offset];
+        }
+
+        JitCode *jit = malloc(sizeof(JitCode));
+        jit->entry = (JitEntry)(void *)code;
+        jit->resume = code + compiler.resume;
+        jit->code = code;
+        jit->size = compiler.as.count;
+        jit->entries = compiler.entries;
+        function->jit = jit;
+    }
+
+    freeAssembler(&compiler.as);
+    free(compiler.starts);
+    free(compiler.jumps);
+}
+
+void jitFree(JitCode *jit)
+{
+    unmapCode(jit->code, jit->size);
+    free(jit->entries);
+    free(jit);
+}
+
+#endif
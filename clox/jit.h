@@ -0,0 +1,81 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+#if defined(BASELINE_JIT) || defined(TRACING_JIT) || defined(AOT_RUNTIME)
+
+/**
+ * Returned by native code and by `stepInstruction()` when the interpreter goes on with the running frame, any other
+ * result is the `InterpretResult` that ends `run()`.
+ */
+#define JIT_CONTINUE (-1)
+
+/**
+ * Execute the instruction at `frame->ip` of the running frame with the interpreter, the slow path of the native code.
+ * The state of the frame must be spilled to `frame->ip` and `vm->stackTop`, it is spilled back when the instruction
+ * is done.
+ *
+ * @return `JIT_CONTINUE`, or `INTERPRET_OK` and `INTERPRET_RUNTIME_ERROR` when the instruction ends the program
+ */
+int stepInstruction();
+
+#endif
+
+#ifdef BASELINE_JIT
+
+/**
+ * Native code of a function, entered with the running frame and resumed at `frame->ip`
+ */
+typedef int (*JitEntry)(CallFrame *frame);
+
+/**
+ * Machine code of a function compiled by the baseline JIT
+ */
+typedef struct JitCode
+{
+    JitEntry entry;
+    /**
+     * Address past the register saves of `entry`, native code jumps there with the frame in `rdi` to switch frames
+     */
+    uint8_t *resume;
+    /**
+     * Executable mapping holding the code
+     */
+    uint8_t *code;
+    size_t size;
+    /**
+     * Native address of every offset of the bytecode that starts an instruction, the native code resumes through it
+     */
+    uint8_t **entries;
+} JitCode;
+
+/**
+ * Compile `function` to machine code and store it in `function->jit`, left NULL when the code can't be mapped.
+ *
+ * @note Only `malloc()` and `mmap()` are used, so compiling never triggers a garbage collection.
+ */
+void jitCompile(ObjFunction *function);
+void jitFree(JitCode *jit);
+
+#endif
+
+#ifdef TRACING_JIT
+
+/**
+ * Execute the call at `frame->ip` of the running frame like `stepInstruction()`, then run the frame it pushed, if any,
+ * with the interpreter until it returns: traces treat calls as single instructions.
+ */
+int callInstruction();
+/**
+ * Run the frames above `frameCount`, pushed by a call, with the interpreter until the call returns
+ *
+ * @return `JIT_CONTINUE`, or the `InterpretResult` that ends `run()`
+ */
+int finishCall(int frameCount);
+
+#endif
+
+#endif
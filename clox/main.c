@@ -2,12 +2,16 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "aot.h"
+#include "batch.h"
+#include "cache.h"
 #include "common.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
 #include "vm.h"
 
-static void repl()
+static void repl(VM *instance)
 {
     char line[1024];
     for (;;)
@@ -20,7 +24,7 @@ static void repl()
             break;
         }
 
-        interpret(line);
+        interpret(instance, line);
     }
 }
 
@@ -56,10 +60,49 @@ static char *readFile(const char *path)
     return buffer;
 }
 
-static void runFile(const char *path)
+/**
+ * @return whether `path` ends with `extension`
+ */
+static bool hasExtension(const char *path, const char *extension)
 {
-    char *source = readFile(path);
-    InterpretResult result = interpret(source);
+    size_t length = strlen(path);
+    size_t extensionLength = strlen(extension);
+    return length > extensionLength && strcmp(path + length - extensionLength, extension) == 0;
+}
+
+/**
+ * @return `path` with `extension` instead of `.lox`, to free
+ */
+static char *withExtension(const char *path, const char *extension)
+{
+    size_t length = strlen(path);
+    if (hasExtension(path, ".lox"))
+    {
+        length -= 4;
+    }
+    char *result = (char *)malloc(length + strlen(extension) + 1);
+    if (result == NULL)
+    {
+        exit(74);
+    }
+    memcpy(result, path, length);
+    strcpy(result + length, extension);
+    return result;
+}
+
+/**
+ * Run the script at `path`, a `.loxc` file from `--compile` or a source whose bytecode is cached in `CACHE_DIRECTORY`
+ */
+static void runFile(VM *instance, const char *path)
+{
+    char *source = hasExtension(path, ".loxc") ? NULL : readFile(path);
+    ObjFunction *script = loadScript(instance, path, source);
+    if (script == NULL && source == NULL)
+    {
+        fprintf(stderr, "Could not load bytecode \"%s\".\n", path);
+    }
+
+    InterpretResult result = script == NULL ? INTERPRET_COMPILE_ERROR : interpretFunction(instance, script);
     free(source);
 
     if (result == INTERPRET_COMPILE_ERROR)
@@ -72,25 +115,177 @@ static void runFile(const char *path)
     }
 }
 
+/**
+ * Translate the script at `path` to C, written to `outPath`: the script path ending with `.c` instead of `.lox` unless
+ * given
+ */
+static void emitFile(VM *instance, const char *path, const char *outPath)
+{
+    char *source = readFile(path);
+    ObjFunction *function = compileSource(instance, source);
+    if (function == NULL)
+    {
+        exit(65);
+    }
+
+    char *defaultPath = NULL;
+    if (outPath == NULL)
+    {
+        defaultPath = withExtension(path, ".c");
+        outPath = defaultPath;
+    }
+
+    FILE *file = fopen(outPath, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open file \"%s\".\n", outPath);
+        exit(74);
+    }
+    emitC(file, source, function);
+    fclose(file);
+
+    free(defaultPath);
+    free(source);
+}
+
+/**
+ * Compile the script at `path` to bytecode, written to `outPath`: the script path ending with `.loxc` instead of `.lox`
+ * unless given
+ */
+static void compileFile(VM *instance, const char *path, const char *outPath)
+{
+    char *source = readFile(path);
+    ObjFunction *function = compileSource(instance, source);
+    if (function == NULL)
+    {
+        exit(65);
+    }
+
+    char *defaultPath = NULL;
+    if (outPath == NULL)
+    {
+        defaultPath = withExtension(path, ".loxc");
+        outPath = defaultPath;
+    }
+
+    if (!saveScript(instance, outPath, source, function))
+    {
+        fprintf(stderr, "Could not write file \"%s\".\n", outPath);
+        exit(74);
+    }
+
+    free(defaultPath);
+    free(source);
+}
+
+/**
+ * Run the scripts at `paths` concurrently on `threads` threads, each in a VM with `gcThreads` GC threads, and exit with
+ * the status of the batch
+ */
+static void batchFiles(const char *threads, int gcThreads, int count, const char *paths[])
+{
+    int threadCount = atoi(threads);
+    if (threadCount < 1)
+    {
+        fprintf(stderr, "Expected a number of jobs, got \"%s\".\n", threads);
+        exit(64);
+    }
+
+    const char **sources = (const char **)malloc(sizeof(const char *) * count);
+    if (sources == NULL)
+    {
+        exit(74);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        sources[i] = readFile(paths[i]);
+    }
+
+    int status = runBatch(threadCount, gcThreads, count, paths, sources);
+    for (int i = 0; i < count; i++)
+    {
+        free((char *)sources[i]);
+    }
+    free(sources);
+    exit(status);
+}
+
+/**
+ * Exit with a usage error when `option` was given to a mode it doesn't apply to
+ */
+static void rejectOption(bool given, const char *option, const char *mode, const char *reason)
+{
+    if (given)
+    {
+        fprintf(stderr, "%s can't be used with %s: %s.\n", option, mode, reason);
+        exit(64);
+    }
+}
+
 int main(int argc, const char *argv[])
 {
-    initVM();
+    VM *instance = newVM();
+    for (;;) // the options come before the mode, in any order
+    {
+        if (argc >= 2 && strcmp(argv[1], "--lazy") == 0)
+        {
+            instance->lazyCompile = true;
+            argc--;
+            argv++;
+        }
+        else if (argc >= 3 && strcmp(argv[1], "--gc-threads") == 0)
+        {
+            instance->gcThreads = atoi(argv[2]);
+            if (instance->gcThreads < 1)
+            {
+                fprintf(stderr, "Expected a number of GC threads, got \"%s\".\n", argv[2]);
+                exit(64);
+            }
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+    bool lazy = instance->lazyCompile;
+    bool manyGcThreads = instance->gcThreads != 1;
 
     if (argc == 1)
     {
-        repl();
+        repl(instance);
     }
     else if (argc == 2)
     {
-        runFile(argv[1]);
+        runFile(instance, argv[1]);
+    }
+    else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--emit-c") == 0)
+    {
+        rejectOption(lazy, "--lazy", "--emit-c", "every function body is translated");
+        rejectOption(manyGcThreads, "--gc-threads", "--emit-c", "it only applies to running a script");
+        emitFile(instance, argv[2], argc == 4 ? argv[3] : NULL);
+    }
+    else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--compile") == 0)
+    {
+        rejectOption(lazy, "--lazy", "--compile", "uncompiled function bodies can't be written to bytecode");
+        rejectOption(manyGcThreads, "--gc-threads", "--compile", "it only applies to running a script");
+        compileFile(instance, argv[2], argc == 4 ? argv[3] : NULL);
+    }
+    else if (argc >= 4 && strcmp(argv[1], "--jobs") == 0)
+    {
+        rejectOption(lazy, "--lazy", "--jobs", "jobs run code compiled up front");
+        int jobGcThreads = instance->gcThreads;
+        freeVM(instance);
+        batchFiles(argv[2], jobGcThreads, argc - 3, argv + 3);
     }
     else
     {
-        fprintf(stderr, "Usage: clox [path]\n");
+        fprintf(stderr, "Usage: clox [--lazy] [--gc-threads N] [path]\n       clox --emit-c path [out.c]\n       clox --compile path [out.loxc]\n       clox [--gc-threads N] --jobs N path...\n");
         exit(64);
     }
 
-    freeVM();
+    freeVM(instance);
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
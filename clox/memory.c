@@ -1,6 +1,14 @@
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include "cache.h"
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
+#include "trace.h"
 #include "vm.h"
 #ifdef DEBUG_LOG_GC
 #include <stdio.h>
@@ -10,22 +18,75 @@
 #define GC_HEAP_GROW_FACTOR 2
 
 static void freeObject(Obj *object);
+static void markArray(ValueArray *array);
+static void markCaches(InlineCache *caches, int count);
+static void blackenObject(Obj *object);
+static void sweepOld(int count);
+
+#ifdef CONCURRENT_GC
+/**
+ * Free `pointer` once marking ends, the marking thread may be reading it
+ */
+static void deferFree(void *pointer)
+{
+    if (vm->deferredCapacity < vm->deferredCount + 1)
+    {
+        vm->deferredCapacity = GROW_CAPACITY(vm->deferredCapacity);
+        vm->deferredFrees = realloc(vm->deferredFrees, sizeof(void *) * vm->deferredCapacity);
+        if (vm->deferredFrees == NULL)
+            exit(1);
+    }
+
+    vm->deferredFrees[vm->deferredCount++] = pointer;
+}
+
+/**
+ * `reallocate()` while the marking thread runs: the block moves to a new one, the old one is freed after marking
+ */
+static void *moveAllocation(void *pointer, size_t oldSize, size_t newSize)
+{
+    void *result = NULL;
+    if (newSize > 0)
+    {
+        result = malloc(newSize);
+        if (result == NULL)
+        {
+            exit(EXIT_FAILURE);
+        }
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+    }
+
+    deferFree(pointer);
+    return result;
+}
+#endif
 
 void *reallocate(void *pointer, size_t oldSize, size_t newSize)
 {
-    vm.bytesAllocated += newSize - oldSize;
+    vm->bytesAllocated += newSize - oldSize;
     if (newSize > oldSize)
     {
 #ifdef DEBUG_STRESS_GC
         collectGarbage();
 #endif
 
-        if (vm.bytesAllocated > vm.nextGC)
+        if (vm->sweepCursor != NULL)
+        {
+            sweepOld(GC_SWEEP_SLICE);
+        }
+        if (vm->marking || vm->bytesAllocated > vm->youngLimit || vm->bytesAllocated > vm->nextGC)
         {
             collectGarbage();
         }
     }
 
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently && pointer != NULL)
+    {
+        return moveAllocation(pointer, oldSize, newSize);
+    }
+#endif
+
     if (newSize == 0)
     {
         free(pointer);
@@ -41,26 +102,74 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize)
     return result;
 }
 
+/**
+ * Frame cells of live slots may be left marked by the last collection and are never swept, unmark them so the ones
+ * still in use are traced again
+ */
+static void unmarkFrameCells()
+{
+    int slotCount = (int)(vm->stackTop - vm->stack);
+    for (int block = 0; block < vm->frameCellBlocks && block * FRAME_CELL_BLOCK < slotCount; block++)
+    {
+        FrameCell *cells = vm->frameCells[block];
+        for (int i = 0; cells != NULL && i < FRAME_CELL_BLOCK && block * FRAME_CELL_BLOCK + i < slotCount; i++)
+        {
+            atomic_store_explicit(&cells[i].upvalue.obj.markBit, !vm->markBit, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Trace the frame cells of live slots that the roots marked. The program reuses cells while marking goes on, so mark
+ * slices leave them alone and they are traced with the roots instead, when marking starts and when it ends.
+ */
+static void traceFrameCells()
+{
+    int slotCount = (int)(vm->stackTop - vm->stack);
+    for (int block = 0; block < vm->frameCellBlocks && block * FRAME_CELL_BLOCK < slotCount; block++)
+    {
+        FrameCell *cells = vm->frameCells[block];
+        for (int i = 0; cells != NULL && i < FRAME_CELL_BLOCK && block * FRAME_CELL_BLOCK + i < slotCount; i++)
+        {
+            if (isMarked(&cells[i].upvalue.obj))
+            {
+                blackenObject(&cells[i].upvalue.obj);
+            }
+        }
+    }
+}
+
+/**
+ * @note `vm->stackTop` and `frame->ip` are only written back by `run()` at its spill points, every allocation is one
+ * of them, so the stack seen here holds every live value of the interpreter.
+ */
 static void markRoots()
 {
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+    unmarkFrameCells();
+
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
     {
         markValue(*slot);
     }
 
-    for (int i = 0; i < vm.frameCount; i++)
+    for (int i = 0; i < vm->frameCount; i++)
     {
-        markObject((Obj *)vm.frames[i].closure);
+        markObject((Obj *)vm->frames[i].closure);
     }
 
-    for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+    for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
     {
         markObject((Obj *)upvalue);
     }
 
-    markTable(&vm.globals);
+    markTable(&vm->globalSlots); // its keys are the names of `vm->globalNames`
+    markArray(&vm->globalValues);
     markCompilerRoots();
-    markObject((Obj *)vm.initString);
+    markObject((Obj *)vm->initString);
+    markCaches(vm->sharedCaches, vm->sharedCacheCount); // no write barrier, like the other roots
+#ifdef TRACING_JIT
+    markTraceRoots();
+#endif
 }
 
 static void markArray(ValueArray *array)
@@ -71,6 +180,22 @@ static void markArray(ValueArray *array)
     }
 }
 
+/**
+ * Inline caches keep their shapes and methods alive
+ */
+static void markCaches(InlineCache *caches, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < caches[i].count; j++)
+        {
+            markObject((Obj *)caches[i].entries[j].shape);
+            markValue(caches[i].entries[j].method);
+            markObject((Obj *)caches[i].entries[j].transition);
+        }
+    }
+}
+
 static void blackenObject(Obj *object)
 {
 #ifdef DEBUG_LOG_GC
@@ -93,6 +218,7 @@ static void blackenObject(Obj *object)
         ObjClass *klass = (ObjClass *)object;
         markObject((Obj *)klass->name);
         markTable(&(klass->methods));
+        markObject((Obj *)klass->rootShape);
         break;
     }
     case OBJ_CLOSURE:
@@ -109,14 +235,38 @@ static void blackenObject(Obj *object)
     {
         ObjFunction *function = (ObjFunction *)object;
         markObject((Obj *)function->name);
+        markObject((Obj *)function->lazySource);
+        markArray(&function->upvalueNames);
         markArray(&function->chunk.constants);
+        markCaches(function->chunk.caches, function->chunk.cacheCount);
+#ifdef TRACING_JIT
+        markTraces(function);
+#endif
         break;
     }
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
         markObject((Obj *)instance->klass);
-        markTable(&(instance->fields));
+        if (instance->shape != NULL)
+        {
+            markObject((Obj *)instance->shape);
+            for (int i = 0; i < instance->shape->slotCount; i++)
+            {
+                markValue(instance->fields[i]);
+            }
+        }
+        if (instance->dictionary != NULL) // both are set while the instance moves to dictionary mode
+        {
+            markTable(instance->dictionary);
+        }
+        break;
+    }
+    case OBJ_SHAPE:
+    {
+        ObjShape *shape = (ObjShape *)object;
+        markTable(&(shape->slots));
+        markTable(&(shape->transitions));
         break;
     }
     case OBJ_UPVALUE:
@@ -130,20 +280,394 @@ static void blackenObject(Obj *object)
     }
 }
 
+/**
+ * Circular array of a gray deque, it doubles when full
+ */
+typedef struct GrayBuffer
+{
+    int64_t capacity; // a power of 2
+    struct GrayBuffer *retired; // the buffer it replaced, a thief may still read it, freed after the trace
+    _Atomic(Obj *) objects[];
+} GrayBuffer;
+
+/**
+ * Gray objects of a GC thread (a Chase-Lev deque): the thread pushes and takes them at the bottom, the other GC threads
+ * steal them at the top
+ */
+typedef struct
+{
+    _Atomic(int64_t) top;
+    _Atomic(int64_t) bottom;
+    _Atomic(GrayBuffer *) buffer;
+} GrayDeque;
+
+typedef struct
+{
+    GrayDeque deque;
+    pthread_t thread;
+    struct MarkPool *pool;
+    uint32_t seed; // picks the deques it steals from
+} MarkWorker;
+
+/**
+ * GC threads of the parallel marking: the collecting thread is `workers[0]`, the others wait for a trace to start
+ */
+typedef struct MarkPool
+{
+    VM *vm;
+    int count;
+    MarkWorker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int trace;    // number of the current trace, the helpers start one when it changes
+    int busy;     // helpers not done with the current trace
+    bool quit;
+    atomic_int idle; // GC threads that found no work, once they all are the trace is done
+} MarkPool;
+
+/**
+ * The GC thread the calling thread is while a parallel trace runs, `grayObject()` pushes to its deque
+ */
+static _Thread_local MarkWorker *markWorker = NULL;
+
+static GrayBuffer *newGrayBuffer(int64_t capacity)
+{
+    GrayBuffer *buffer = malloc(sizeof(GrayBuffer) + sizeof(_Atomic(Obj *)) * capacity);
+    if (buffer == NULL)
+        exit(1);
+    buffer->capacity = capacity;
+    buffer->retired = NULL;
+    return buffer;
+}
+
+static void pushGray(GrayDeque *deque, Obj *object)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    GrayBuffer *buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    if (bottom - top > buffer->capacity - 1)
+    {
+        GrayBuffer *grown = newGrayBuffer(buffer->capacity * 2);
+        for (int64_t i = top; i < bottom; i++)
+        {
+            Obj *gray = atomic_load_explicit(&buffer->objects[i & (buffer->capacity - 1)], memory_order_relaxed);
+            atomic_store_explicit(&grown->objects[i & (grown->capacity - 1)], gray, memory_order_relaxed);
+        }
+        grown->retired = buffer;
+        atomic_store_explicit(&deque->buffer, grown, memory_order_release);
+        buffer = grown;
+    }
+    atomic_store_explicit(&buffer->objects[bottom & (buffer->capacity - 1)], object, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+/**
+ * @return the object last pushed on the deque of the calling GC thread, NULL if it is empty
+ */
+static Obj *takeGray(GrayDeque *deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    GrayBuffer *buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom)
+    {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Obj *object = atomic_load_explicit(&buffer->objects[bottom & (buffer->capacity - 1)], memory_order_relaxed);
+    if (top == bottom) // the last one, a thief may be taking it too
+    {
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed))
+        {
+            object = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return object;
+}
+
+/**
+ * @return the object first pushed on the deque of another GC thread, NULL if it is empty or another thief won it
+ */
+static Obj *stealGray(GrayDeque *deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+        return NULL;
+
+    GrayBuffer *buffer = atomic_load_explicit(&deque->buffer, memory_order_acquire);
+    Obj *object = atomic_load_explicit(&buffer->objects[top & (buffer->capacity - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return object;
+}
+
+static bool isDequeEmpty(GrayDeque *deque)
+{
+    return atomic_load_explicit(&deque->top, memory_order_acquire) >=
+           atomic_load_explicit(&deque->bottom, memory_order_acquire);
+}
+
+/**
+ * Steal from the deques of the other GC threads, starting at a random one so thieves spread out
+ */
+static Obj *stealWork(MarkPool *pool, MarkWorker *self)
+{
+    self->seed ^= self->seed << 13;
+    self->seed ^= self->seed >> 17;
+    self->seed ^= self->seed << 5;
+    int first = (int)(self->seed % (uint32_t)pool->count);
+    for (int i = 0; i < pool->count; i++)
+    {
+        MarkWorker *victim = &pool->workers[(first + i) % pool->count];
+        if (victim == self)
+            continue;
+        Obj *object = stealGray(&victim->deque);
+        if (object != NULL)
+            return object;
+    }
+    return NULL;
+}
+
+static bool hasWork(MarkPool *pool)
+{
+    for (int i = 0; i < pool->count; i++)
+    {
+        if (!isDequeEmpty(&pool->workers[i].deque))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Trace the deque of `self`, steal when it runs dry. A GC thread out of work counts itself idle until it sees work
+ * again: once all of them are idle every deque is empty, since only a tracing thread pushes.
+ */
+static void traceShare(MarkPool *pool, MarkWorker *self)
+{
+    for (;;)
+    {
+        Obj *object;
+        while ((object = takeGray(&self->deque)) != NULL)
+        {
+            blackenObject(object);
+        }
+        if ((object = stealWork(pool, self)) != NULL)
+        {
+            blackenObject(object);
+            continue;
+        }
+
+        atomic_fetch_add(&pool->idle, 1);
+        while (!hasWork(pool))
+        {
+            if (atomic_load(&pool->idle) == pool->count)
+                return;
+            sched_yield();
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+    }
+}
+
+static void *runMarkWorker(void *argument)
+{
+    MarkWorker *self = argument;
+    MarkPool *pool = self->pool;
+    vm = pool->vm;
+    markWorker = self;
+
+    int seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;)
+    {
+        while (pool->trace == seen && !pool->quit)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit)
+            break;
+        seen = pool->trace;
+        pthread_mutex_unlock(&pool->lock);
+
+        traceShare(pool, self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Start `vm->gcThreads` - 1 helper threads, fewer if the system refuses some
+ */
+static MarkPool *startMarkPool()
+{
+    MarkPool *pool = malloc(sizeof(MarkPool));
+    MarkWorker *workers = malloc(sizeof(MarkWorker) * vm->gcThreads);
+    if (pool == NULL || workers == NULL)
+        exit(1);
+
+    pool->vm = vm;
+    pool->workers = workers;
+    pool->trace = 0;
+    pool->busy = 0;
+    pool->quit = false;
+    atomic_init(&pool->idle, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 0; i < vm->gcThreads; i++)
+    {
+        atomic_init(&workers[i].deque.top, 0);
+        atomic_init(&workers[i].deque.bottom, 0);
+        atomic_init(&workers[i].deque.buffer, newGrayBuffer(1024));
+        workers[i].pool = pool;
+        workers[i].seed = 2463534242u + (uint32_t)i;
+    }
+
+    pool->count = 1;
+    while (pool->count < vm->gcThreads &&
+           pthread_create(&workers[pool->count].thread, NULL, runMarkWorker, &workers[pool->count]) == 0)
+    {
+        pool->count++;
+    }
+    for (int i = pool->count; i < vm->gcThreads; i++)
+    {
+        free(atomic_load(&workers[i].deque.buffer));
+    }
+    vm->markPool = pool;
+    return pool;
+}
+
+static void stopMarkPool(MarkPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->count; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->count; i++)
+    {
+        free(atomic_load(&pool->workers[i].deque.buffer));
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+/**
+ * Trace the gray stack with every GC thread. Its objects, the roots, are dealt across the deques, then each thread
+ * traces its own and steals from the others. Two threads may reach the same object, `markObject()` lets the one that
+ * flips its mark bit first trace it.
+ */
+static void traceInParallel()
+{
+    MarkPool *pool = vm->markPool != NULL ? vm->markPool : startMarkPool();
+    for (int i = 0; i < vm->grayCount; i++)
+    {
+        pushGray(&pool->workers[i % pool->count].deque, vm->grayStack[i]);
+    }
+    vm->grayCount = 0;
+
+    atomic_store(&pool->idle, 0);
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->count - 1;
+    pool->trace++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    markWorker = &pool->workers[0];
+    traceShare(pool, markWorker);
+    markWorker = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->count; i++)
+    {
+        GrayDeque *deque = &pool->workers[i].deque;
+        GrayBuffer *buffer = atomic_load(&deque->buffer);
+        while (buffer->retired != NULL)
+        {
+            GrayBuffer *retired = buffer->retired;
+            buffer->retired = retired->retired;
+            free(retired);
+        }
+    }
+}
+
+/**
+ * Trace the gray stack until every object reachable from it is marked. The marking of a major collection uses all
+ * `vm->gcThreads`.
+ */
 static void traceReferences()
 {
-    while (vm.grayCount > 0)
+    if (vm->marking && vm->gcThreads > 1)
+    {
+        traceInParallel();
+        return;
+    }
+
+    while (vm->grayCount > 0)
     {
-        Obj *object = vm.grayStack[--vm.grayCount];
+        Obj *object = vm->grayStack[--vm->grayCount];
         blackenObject(object);
     }
 }
 
+/**
+ * Push `object` on the gray stack, marked or not
+ */
+static void grayObject(Obj *object)
+{
+    if (markWorker != NULL)
+    {
+        pushGray(&markWorker->deque, object);
+        return;
+    }
+
+    if (vm->grayCapacity < vm->grayCount + 1)
+    {
+        vm->grayCapacity = GROW_CAPACITY(vm->grayCapacity);
+        vm->grayStack = (Obj **)realloc(vm->grayStack, sizeof(Obj *) * vm->grayCapacity);
+        if (vm->grayStack == NULL)
+            exit(1);
+    }
+
+    vm->grayStack[vm->grayCount++] = object;
+}
+
 void markObject(Obj *object)
 {
     if (object == NULL)
         return;
-    if (object->isMarked)
+    if (isMarked(object))
+        return;
+    if (object->generation == GEN_SHARED) // other threads read it, see freezeObjects()
         return;
 
 #ifdef DEBUG_LOG_GC
@@ -152,19 +676,16 @@ void markObject(Obj *object)
     printf("\n");
 #endif
 
-    object->isMarked = true;
-
-    //> Keep track all marked objects by push them into grayStack
-    if (vm.grayCapacity < vm.grayCount + 1)
+    if (markWorker != NULL)
     {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack = (Obj **)realloc(vm.grayStack, sizeof(Obj *) * vm.grayCapacity);
-        if (vm.grayStack == NULL)
-            exit(1);
+        if (atomic_exchange_explicit(&object->markBit, vm->markBit, memory_order_relaxed) == vm->markBit)
+            return; // another GC thread claimed it
     }
-
-    vm.grayStack[vm.grayCount++] = object;
-    //<
+    else
+    {
+        atomic_store_explicit(&object->markBit, vm->markBit, memory_order_relaxed);
+    }
+    grayObject(object); // Keep track all marked objects by push them into grayStack
 }
 
 void markValue(Value value)
@@ -175,58 +696,331 @@ void markValue(Value value)
     }
 }
 
+#ifdef CONCURRENT_GC
+/**
+ * Hand the objects the program shaded to the gray stack of the marking thread
+ */
+static void flushShadeBuffer()
+{
+    lockHeap();
+    for (int i = 0; i < vm->shadeCount; i++)
+    {
+        atomic_store_explicit(&vm->shadeBuffer[i]->markBit, vm->markBit, memory_order_relaxed);
+        grayObject(vm->shadeBuffer[i]);
+    }
+    vm->shadeCount = 0;
+    unlockHeap();
+}
+#endif
+
+/**
+ * Mark `object` for a write barrier and trace it, even if it is marked already. While the marking thread runs, the
+ * object waits in `vm->shadeBuffer` so the barrier doesn't take the heap lock.
+ */
+void shadeObject(Obj *object)
+{
+    if (object->generation == GEN_SHARED)
+    {
+        return;
+    }
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        vm->shadeBuffer[vm->shadeCount++] = object;
+        if (vm->shadeCount == SHADE_BUFFER_SIZE)
+        {
+            flushShadeBuffer();
+        }
+        return;
+    }
+#endif
+
+    atomic_store_explicit(&object->markBit, vm->markBit, memory_order_relaxed);
+    grayObject(object);
+}
+
+void rememberOldObject(Obj *object)
+{
+    if (vm->rememberedCapacity < vm->rememberedCount + 1)
+    {
+        vm->rememberedCapacity = GROW_CAPACITY(vm->rememberedCapacity);
+        vm->rememberedSet = (Obj **)realloc(vm->rememberedSet, sizeof(Obj *) * vm->rememberedCapacity);
+        if (vm->rememberedSet == NULL)
+            exit(1);
+    }
+
+    object->generation = GEN_REMEMBERED;
+    vm->rememberedSet[vm->rememberedCount++] = object;
+}
+
+/**
+ * Trace the remembered objects, the only old objects a minor collection looks into
+ */
+static void markRememberedSet()
+{
+    for (int i = 0; i < vm->rememberedCount; i++)
+    {
+        blackenObject(vm->rememberedSet[i]);
+    }
+}
+
+static void forgetRememberedSet()
+{
+    for (int i = 0; i < vm->rememberedCount; i++)
+    {
+        vm->rememberedSet[i]->generation = GEN_OLD;
+    }
+    vm->rememberedCount = 0;
+}
+
 /**
- * @brief Sweeping unused objects
+ * Promote the marked young objects to the old ones and free the others
  */
-static void sweep()
+static void sweepYoung()
 {
-    Obj *previous = NULL;
-    Obj *object = vm.objects;
+    Obj *object = vm->youngObjects;
     while (object != NULL)
     {
-        if (object->isMarked)
+        Obj *next = object->next;
+        if (isMarked(object))
         {
-            object->isMarked = false; // Mark object is not marked, preparing for next gc cycle.
-            previous = object;
-            object = object->next;
+            object->generation = GEN_OLD; // it stays marked, minor collections don't look into it anymore
+            object->next = vm->objects;
+            vm->objects = object;
         }
         else
         {
-            Obj *unreached = object;
-            object = object->next;
-            if (previous != NULL)
-            {
-                previous->next = object;
-            }
-            else
-            {
-                vm.objects = object;
-            }
+            freeObject(object);
+        }
+        object = next;
+    }
+    vm->youngObjects = NULL;
+}
 
-            freeObject(unreached);
+/**
+ * Sweep up to `count` old objects from `vm->sweepCursor` and free the unmarked ones. Past the last one, the heap holds
+ * what the major collection kept, and it sets the threshold of the next one.
+ */
+static void sweepOld(int count)
+{
+    size_t before = vm->bytesAllocated;
+    for (int i = 0; i < count && *vm->sweepCursor != NULL; i++)
+    {
+        Obj *object = *vm->sweepCursor;
+        if (isMarked(object))
+        {
+            vm->sweepCursor = &object->next; // it stays marked until the next major collection
+        }
+        else
+        {
+            *vm->sweepCursor = object->next;
+            freeObject(object);
         }
     }
+
+    size_t freed = before - vm->bytesAllocated; // not new room for the nursery
+    vm->youngLimit = vm->youngLimit > freed ? vm->youngLimit - freed : 0;
+    if (*vm->sweepCursor == NULL)
+    {
+        vm->sweepCursor = NULL;
+        vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR;
+    }
 }
 
-void collectGarbage()
+/**
+ * Minor collection, it frees the young objects unreachable from the roots and the remembered set
+ */
+static void collectYoung()
 {
-#ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
-    size_t before = vm.bytesAllocated;
+    markRoots();
+    markRememberedSet();
+    traceReferences();
+    forgetRememberedSet();
+    tableRemoveWhite(&vm->strings);
+    sweepYoung();
+    vm->youngLimit = vm->bytesAllocated + GC_NURSERY_SIZE;
+}
+
+/**
+ * Trace up to `GC_MARK_SLICE` gray objects
+ *
+ * @return whether the gray stack is empty
+ */
+static bool markSlice()
+{
+    for (int i = 0; i < GC_MARK_SLICE && vm->grayCount > 0; i++)
+    {
+        Obj *object = vm->grayStack[--vm->grayCount];
+        if (object->generation != GEN_FRAME) // see traceFrameCells()
+        {
+            blackenObject(object);
+        }
+    }
+    return vm->grayCount == 0;
+}
+
+#ifdef CONCURRENT_GC
+/**
+ * Body of the marking thread: it traces the gray stack a slice at a time, holding the heap lock, until it finds it empty
+ */
+static void *markConcurrently(void *instance)
+{
+    vm = instance;
+    bool empty = false;
+    while (!empty)
+    {
+        pthread_mutex_lock(&vm->heapLock);
+        empty = markSlice();
+        pthread_mutex_unlock(&vm->heapLock);
+    }
+    atomic_store(&vm->markThreadDone, true);
+    return NULL;
+}
+
+static void startMarkThread()
+{
+    atomic_store(&vm->markThreadDone, false);
+    vm->markingConcurrently = true;
+    if (pthread_create(&vm->markThread, NULL, markConcurrently, vm) != 0)
+    {
+        vm->markingConcurrently = false; // slices on allocations mark instead
+    }
+}
+
+/**
+ * Wait for the marking thread, then hand the gray stack the objects shaded since the last flush and free the blocks the
+ * thread may have been reading
+ */
+static void stopMarkThread()
+{
+    pthread_join(vm->markThread, NULL);
+    vm->markingConcurrently = false;
+    flushShadeBuffer();
+    for (int i = 0; i < vm->deferredCount; i++)
+    {
+        free(vm->deferredFrees[i]);
+    }
+    vm->deferredCount = 0;
+}
 #endif
 
+/**
+ * @return whether marking is done: after a slice of it, or once the marking thread found the gray stack empty
+ */
+static bool markStep()
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        return atomic_load(&vm->markThreadDone);
+    }
+#endif
+    return markSlice();
+}
+
+/**
+ * Start the marking of a major collection. After a minor collection every object is old and marked, flipping the mark
+ * bit unmarks them all, then the roots are marked. The flip would mark the dead objects the last major collection left
+ * to sweep, so they are swept first.
+ */
+static void beginMarking()
+{
+    if (vm->sweepCursor != NULL)
+    {
+        sweepOld(INT_MAX);
+    }
+    collectYoung();
+    vm->markBit = !vm->markBit;
+    vm->marking = true;
+    markRoots();
+    traceFrameCells();
+}
+
+/**
+ * End a major collection: the roots, which have no write barrier, are marked again and traced, then the young objects
+ * are swept. The old ones are swept by the allocations that follow, see `sweepOld()`.
+ */
+static void finishMarking()
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        stopMarkThread();
+    }
+#endif
     markRoots();
     traceReferences();
-    tableRemoveWhite(&vm.strings);
-    sweep();
+    vm->marking = false;
+    forgetRememberedSet();
+    tableRemoveWhite(&vm->strings);
+    sweepYoung();
+    vm->sweepCursor = &vm->objects;
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    vm->nextGC = vm->bytesAllocated * GC_HEAP_GROW_FACTOR; // lowered once the sweep is done
+    vm->youngLimit = vm->bytesAllocated + GC_NURSERY_SIZE;
+}
+
+/**
+ * @details The heap has two generations and objects never move: a minor collection only frees young objects, a major
+ * one, started when the heap has grown past `vm->nextGC`, frees any object. Marks are sticky: old objects stay marked,
+ * so marking stops at them, and a minor collection reaches the young objects they reference through the remembered
+ * set, which the write barriers of `memory.h` fill.
+ *
+ * A major collection marks incrementally, a slice on each allocation, and no minor collection runs meanwhile. The
+ * write barriers keep it from missing an object the program stores into one it already traced. Its last slice marks
+ * the roots again and sweeps.
+ *
+ * Built with `CONCURRENT_GC`, a background thread traces the slices instead, and the allocation after it found the gray
+ * stack empty marks the roots again and sweeps. The thread traces the heap as it was when marking started (snapshot at
+ * the beginning): objects allocated meanwhile are born marked, and `overwriteBarrier()` marks any value the program
+ * overwrites. The thread and the program share the heap lock: the thread holds it while it traces a slice, the program
+ * while it replaces an array or changes the shape of an instance, and blocks freed meanwhile are freed after marking.
+ *
+ * With `vm->gcThreads` above 1, a major collection is marked in a single pause instead, traced by that many threads
+ * (see `traceInParallel()`).
+ *
+ * Dead old objects are swept lazily: each allocation after a major collection sweeps `GC_SWEEP_SLICE` objects of
+ * `vm->objects`, so the pause that ends marking only sweeps the young objects. Nothing can reach a dead object, and the
+ * interned strings table drops them when marking ends, so the program never sees one before it is freed.
+ */
+void collectGarbage()
+{
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin (%s)\n", vm->marking ? "mark slice" : vm->bytesAllocated > vm->nextGC ? "major" : "minor");
+    size_t before = vm->bytesAllocated;
+#endif
+
+    if (vm->marking)
+    {
+        if (markStep())
+        {
+            finishMarking();
+        }
+    }
+    else if (vm->bytesAllocated > vm->nextGC)
+    {
+        beginMarking();
+        if (vm->gcThreads > 1)
+        {
+            finishMarking(); // the GC threads trace the whole heap in this pause
+        }
+#ifdef CONCURRENT_GC
+        else
+        {
+            startMarkThread();
+        }
+#endif
+    }
+    else
+    {
+        collectYoung();
+    }
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
-           before - vm.bytesAllocated, before, vm.bytesAllocated,
-           vm.nextGC);
+           before - vm->bytesAllocated, before, vm->bytesAllocated,
+           vm->nextGC);
 #endif
 }
 
@@ -271,15 +1065,41 @@ static void freeObject(Obj *object)
     case OBJ_FUNCTION:
     {
         ObjFunction *function = (ObjFunction *)object;
+#ifdef BASELINE_JIT
+        if (function->jit != NULL)
+        {
+            jitFree(function->jit);
+        }
+#endif
+#ifdef TRACING_JIT
+        freeTraces(function);
+#endif
         freeChunk(&function->chunk);
+        freeValueArray(&function->upvalueNames);
         FREE(ObjFunction, object);
         break;
     }
     case OBJ_INSTANCE:
     {
         ObjInstance *instance = (ObjInstance *)object;
-        freeTable(&(instance->fields)); // NOTE: Entries of `instance->fields` will be free by GC.
-        FREE(ObjInstance, object);
+        if (instance->fields != instance->inlineFields)
+        {
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity); // NOTE: Field values will be free by GC.
+        }
+        if (instance->dictionary != NULL)
+        {
+            freeTable(instance->dictionary);
+            FREE(Table, instance->dictionary);
+        }
+        reallocate(object, sizeof(ObjInstance) + sizeof(Value) * instance->inlineCapacity, 0);
+        break;
+    }
+    case OBJ_SHAPE:
+    {
+        ObjShape *shape = (ObjShape *)object;
+        freeTable(&(shape->slots));
+        freeTable(&(shape->transitions));
+        FREE(ObjShape, object);
         break;
     }
     case OBJ_NATIVE:
@@ -290,7 +1110,10 @@ static void freeObject(Obj *object)
     case OBJ_STRING:
     {
         ObjString *string = (ObjString *)object;
-        FREE_ARRAY(char, string->chars, string->length + 1);
+        if (!isMapped(string->chars))
+        {
+            FREE_ARRAY(char, string->chars, string->length + 1);
+        }
         FREE(ObjString, object);
         break;
     }
@@ -302,15 +1125,71 @@ static void freeObject(Obj *object)
     }
 }
 
-void freeObjects()
+static void freeList(Obj *object)
 {
-    Obj *object = vm.objects;
     while (object != NULL)
     {
         Obj *next = object->next;
         freeObject(object);
         object = next;
     }
+}
+
+/**
+ * Make every object of the VM read-only, for other VMs to share (see `freezeVM()`). Their GCs never mark a shared
+ * object, and nothing the VM running a function writes to it while it runs is left: the inline caches are the VM's own,
+ * at `ObjFunction.sharedCacheBase` in `VM.sharedCaches`, chunks start with `QUICKEN_MAX_DEOPTS` deoptimizations and
+ * functions as hot as the baseline JIT counts. The tracing JIT leaves their loops alone (see `HOT_LOOP()` in `vm.c`).
+ */
+void freezeObjects()
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        stopMarkThread(); // it would go on writing mark bits
+    }
+#endif
+
+    Obj *lists[] = {vm->objects, vm->youngObjects};
+    for (int i = 0; i < 2; i++)
+    {
+        for (Obj *object = lists[i]; object != NULL; object = object->next)
+        {
+            object->generation = GEN_SHARED;
+            if (object->type != OBJ_FUNCTION)
+            {
+                continue;
+            }
+
+            ObjFunction *function = (ObjFunction *)object;
+            function->sharedCacheBase = vm->sharedCacheCount;
+            vm->sharedCacheCount += function->chunk.cacheCount;
+            function->chunk.deoptCount = QUICKEN_MAX_DEOPTS;
+#ifdef BASELINE_JIT
+            function->hotness = JIT_THRESHOLD;
+#endif
+        }
+    }
+}
+
+void freeObjects()
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        stopMarkThread();
+    }
+    free(vm->deferredFrees);
+    pthread_mutex_destroy(&vm->heapLock);
+#endif
+    if (vm->markPool != NULL)
+    {
+        stopMarkPool(vm->markPool);
+    }
+
+    freeList(vm->objects);
+    freeList(vm->youngObjects);
 
-    free(vm.grayStack);
+    free(vm->grayStack);
+    free(vm->rememberedSet);
 }
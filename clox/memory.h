@@ -3,6 +3,31 @@
 
 #include "common.h"
 #include "object.h"
+#include "vm.h"
+
+/**
+ * Bytes allocated after a collection that trigger the next minor collection, can be set at build time, e.g.
+ * `-DGC_NURSERY_SIZE=65536`
+ */
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (256 * 1024)
+#endif
+
+/**
+ * Objects a slice of incremental marking traces, the bound of the pause it adds to an allocation. Can be set at build
+ * time, e.g. `-DGC_MARK_SLICE=1000`.
+ */
+#ifndef GC_MARK_SLICE
+#define GC_MARK_SLICE 100
+#endif
+
+/**
+ * Old objects each allocation sweeps after a major collection, until the whole old generation is swept. Can be set at
+ * build time, e.g. `-DGC_SWEEP_SLICE=1000`.
+ */
+#ifndef GC_SWEEP_SLICE
+#define GC_SWEEP_SLICE 100
+#endif
 
 /** Minimum threshold of array capacity*/
 #define ARRAY_COUNT_MINIMUM_THRESHOLD 8
@@ -69,5 +94,95 @@ void markObject(Obj *object);
 void markValue(Value value);
 void collectGarbage();
 void freeObjects();
+void rememberOldObject(Obj *object);
+void shadeObject(Obj *object);
+void freezeObjects();
+
+static inline bool isMarked(Obj *object)
+{
+    return atomic_load_explicit(&object->markBit, memory_order_relaxed) == vm->markBit;
+}
+
+/**
+ * Keep the marking thread out of the heap while the program reshapes an object the thread may be tracing: it replaces
+ * the array of a table, a value array or a chunk, or changes the shape and the fields of an instance together. Nothing
+ * may allocate or run a write barrier before `unlockHeap()`.
+ */
+static inline void lockHeap()
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        pthread_mutex_lock(&vm->heapLock);
+    }
+#endif
+}
+
+static inline void unlockHeap()
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        pthread_mutex_unlock(&vm->heapLock);
+    }
+#endif
+}
+
+/**
+ * Write barrier for a store into `object` that may add references to young or unmarked objects, e.g. a table of the
+ * object growing or taking new keys. It must run after the store and before the next allocation.
+ *
+ * @details Old objects go to the remembered set. While marking, an object already marked is traced again.
+ */
+static inline void rememberObject(Obj *object)
+{
+    if (object->generation == GEN_OLD)
+    {
+        rememberOldObject(object);
+    }
+    if (vm->marking && isMarked(object))
+    {
+        shadeObject(object);
+    }
+}
+
+/**
+ * Write barrier for storing `value` in a field of `owner`, it must run after the store and before the next allocation
+ *
+ * @details An old owner of a young value goes to the remembered set. While marking, the value is marked (Dijkstra).
+ */
+static inline void writeBarrier(Obj *owner, Value value)
+{
+    if (!IS_OBJ(value))
+    {
+        return;
+    }
+    if (owner->generation == GEN_OLD && AS_OBJ(value)->generation == GEN_YOUNG)
+    {
+        rememberOldObject(owner);
+    }
+    if (vm->marking && !isMarked(AS_OBJ(value)))
+    {
+        shadeObject(AS_OBJ(value));
+    }
+}
+
+/**
+ * Write barrier for overwriting `old` in a field of an object, it must run before the store
+ *
+ * @details While the marking thread runs, the overwritten value is marked (snapshot at the beginning): every object
+ * reachable when marking started is marked, even if the program moves it behind an object already traced.
+ */
+static inline void overwriteBarrier(Value old)
+{
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently && IS_OBJ(old) && !isMarked(AS_OBJ(old)))
+    {
+        shadeObject(AS_OBJ(old));
+    }
+#else
+    (void)old;
+#endif
+}
 
 #endif
\ No newline at end of file
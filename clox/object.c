@@ -14,11 +14,18 @@ static Obj *allocateObject(size_t size, ObjType type)
 {
     Obj *object = (Obj *)reallocate(NULL, 0, size);
     object->type = type;
-    object->isMarked = false;
+    atomic_store_explicit(&object->markBit, !vm->markBit, memory_order_relaxed);
+#ifdef CONCURRENT_GC
+    if (vm->markingConcurrently)
+    {
+        atomic_store_explicit(&object->markBit, vm->markBit, memory_order_relaxed); // allocated black, the snapshot the marking thread traces doesn't have it
+    }
+#endif
+    object->generation = GEN_YOUNG;
 
     // Save heap-allocated objects to list for later used in garbage collector
-    object->next = vm.objects;
-    vm.objects = object;
+    object->next = vm->youngObjects;
+    vm->youngObjects = object;
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void *)object, size, type);
@@ -27,6 +34,17 @@ static Obj *allocateObject(size_t size, ObjType type)
     return object;
 }
 
+/**
+ * Set up an object that lives in a frame cell instead of the heap, it stays out of `vm->objects` so it is never freed
+ */
+static void initFrameObject(Obj *object, ObjType type)
+{
+    object->type = type;
+    atomic_store_explicit(&object->markBit, !vm->markBit, memory_order_relaxed);
+    object->generation = GEN_FRAME; // unmarked before every collection, so it is traced whenever it is reachable
+    object->next = NULL;
+}
+
 static ObjString *allocateString(char *chars, int length, uint32_t hash)
 {
     ObjString *string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
@@ -34,8 +52,8 @@ static ObjString *allocateString(char *chars, int length, uint32_t hash)
     string->chars = chars;
     string->hash = hash;
 
-    push(OBJ_VAL(string));                    // push value to stack to prevent it from being garbage collected when vm.strings is being resized (re-allocated).
-    tableSet(&(vm.strings), string, NIL_VAL); // save string to global string pool
+    push(OBJ_VAL(string));                    // push value to stack to prevent it from being garbage collected when vm->strings is being resized (re-allocated).
+    tableSet(&(vm->strings), string, NIL_VAL); // save string to global string pool
     pop();
     return string;
 }
@@ -62,11 +80,20 @@ ObjBoundMethod *newBoundMethod(Value receiver, ObjClosure *method)
     return bound;
 }
 
+void initFrameBoundMethod(ObjBoundMethod *bound, Value receiver, ObjClosure *method)
+{
+    initFrameObject((Obj *)bound, OBJ_BOUND_METHOD);
+    bound->receiver = receiver;
+    bound->method = method;
+}
+
 ObjClass *newClass(ObjString *name)
 {
     ObjClass *klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
     klass->name = name;
     initTable(&(klass->methods));
+    klass->rootShape = NULL;
+    klass->fieldCountHint = 0;
     return klass;
 }
 
@@ -75,19 +102,206 @@ ObjFunction *newFunction()
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->maxStack = 1;
+    function->sharedCacheBase = 0;
     function->name = NULL;
+    function->lazySource = NULL;
+    function->lazyStart = 0;
+    function->lazyLine = 0;
+    function->lazyType = 0;
+    function->lazyClass = -1;
+    initValueArray(&function->upvalueNames);
+#ifdef BASELINE_JIT
+    function->hotness = 0;
+    function->jit = NULL;
+#endif
+#ifdef TRACING_JIT
+    function->hotLoops = NULL;
+#endif
+#ifdef AOT_RUNTIME
+    function->aot = NULL;
+#endif
     initChunk(&function->chunk);
     return function;
 }
 
+static ObjShape *newShape()
+{
+    ObjShape *shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    initTable(&(shape->slots));
+    shape->slotCount = 0;
+    initTable(&(shape->transitions));
+    return shape;
+}
+
+/**
+ * @note `klass` must be reachable, the root shape of the class is created here with its first instance.
+ */
 ObjInstance *newInstance(ObjClass *klass)
 {
-    ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+    if (klass->rootShape == NULL)
+    {
+        klass->rootShape = newShape();
+        writeBarrier((Obj *)klass, OBJ_VAL(klass->rootShape));
+    }
+
+    int inlineCapacity = klass->fieldCountHint;
+    ObjInstance *instance = (ObjInstance *)allocateObject(sizeof(ObjInstance) + sizeof(Value) * inlineCapacity,
+                                                          OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&(instance->fields));
+    instance->shape = klass->rootShape;
+    instance->fields = instance->inlineFields;
+    instance->fieldCapacity = inlineCapacity;
+    instance->inlineCapacity = inlineCapacity;
+    instance->dictionary = NULL;
     return instance;
 }
 
+/**
+ * @return slot of the field `name` in instances of `shape`, -1 if they have no such field
+ */
+int shapeSlot(ObjShape *shape, ObjString *name)
+{
+    Value slot;
+    return tableGet(&(shape->slots), name, &slot) ? (int)AS_NUMBER(slot) : -1;
+}
+
+/**
+ * @return the shape reached from `shape` by adding the field `name`, NULL if that takes one transition too many
+ */
+static ObjShape *transitionShape(ObjShape *shape, ObjString *name)
+{
+    Value next;
+    if (tableGet(&(shape->transitions), name, &next))
+    {
+        return (ObjShape *)AS_OBJ(next);
+    }
+
+    if (shape->slotCount == SHAPE_MAX_SLOTS || shape->transitions.count == SHAPE_MAX_TRANSITIONS)
+    {
+        return NULL;
+    }
+
+    ObjShape *child = newShape();
+    push(OBJ_VAL(child)); // keep the shape reachable until it is a transition of its parent
+    tableAddAll(&(shape->slots), &(child->slots));
+    tableSet(&(child->slots), name, NUMBER_VAL(shape->slotCount));
+    rememberObject((Obj *)child); // a collection while its table grew may have promoted it
+    child->slotCount = shape->slotCount + 1;
+    tableSet(&(shape->transitions), name, OBJ_VAL(child));
+    rememberObject((Obj *)shape);
+    pop();
+    return child;
+}
+
+/**
+ * Move the fields of `instance` to a hash table, it has no shape afterwards
+ */
+static void toDictionaryMode(ObjInstance *instance)
+{
+    Table *dictionary = ALLOCATE(Table, 1);
+    initTable(dictionary);
+    lockHeap();
+    instance->dictionary = dictionary; // the GC marks both the table and the slots while the fields move
+    unlockHeap();
+
+    Table *slots = &(instance->shape->slots);
+    for (int i = 0; i < slots->capacity; i++)
+    {
+        Entry *entry = &(slots->entries[i]);
+        if (entry->key != NULL)
+        {
+            tableSet(instance->dictionary, entry->key, instance->fields[(int)AS_NUMBER(entry->value)]);
+            rememberObject((Obj *)instance);
+        }
+    }
+
+    lockHeap();
+    if (instance->fields != instance->inlineFields)
+    {
+        FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+    }
+    instance->shape = NULL;
+    instance->fields = NULL;
+    instance->fieldCapacity = 0;
+    unlockHeap();
+}
+
+/**
+ * If the instance has the field `name`, it returns true and writes its value to `value`, otherwise it returns false.
+ */
+bool getField(ObjInstance *instance, ObjString *name, Value *value)
+{
+    if (instance->shape == NULL)
+    {
+        return tableGet(instance->dictionary, name, value);
+    }
+
+    int slot = shapeSlot(instance->shape, name);
+    if (slot == -1)
+    {
+        return false;
+    }
+
+    *value = instance->fields[slot];
+    return true;
+}
+
+/**
+ * Set the field `name` of `instance`, adding it if it is new.
+ *
+ * @return whether the field is new
+ * @note Adding a field allocates, so `instance` and `value` must be reachable.
+ */
+bool setField(ObjInstance *instance, ObjString *name, Value value)
+{
+    if (instance->shape != NULL)
+    {
+        int slot = shapeSlot(instance->shape, name);
+        if (slot != -1)
+        {
+            overwriteBarrier(instance->fields[slot]);
+            instance->fields[slot] = value;
+            writeBarrier((Obj *)instance, value);
+            return false;
+        }
+
+        ObjShape *next = transitionShape(instance->shape, name);
+        if (next != NULL)
+        {
+            if (next->slotCount > instance->fieldCapacity)
+            {
+                int capacity = GROW_CAPACITY(instance->fieldCapacity);
+                Value *fields = ALLOCATE(Value, capacity);
+                memcpy(fields, instance->fields, sizeof(Value) * instance->shape->slotCount);
+                if (instance->fields != instance->inlineFields)
+                {
+                    FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+                }
+                instance->fields = fields;
+                instance->fieldCapacity = capacity;
+            }
+
+            lockHeap(); // the marking thread reads the shape and the fields together
+            instance->fields[next->slotCount - 1] = value;
+            instance->shape = next;
+            unlockHeap();
+            rememberObject((Obj *)instance);
+            if (next->slotCount > instance->klass->fieldCountHint)
+            {
+                instance->klass->fieldCountHint = next->slotCount;
+            }
+            return true;
+        }
+
+        toDictionaryMode(instance);
+    }
+
+    bool isNewKey = tableSet(instance->dictionary, name, value);
+    rememberObject((Obj *)instance);
+    return isNewKey;
+}
+
 ObjClosure *newClosure(ObjFunction *function)
 {
     ObjUpvalue **upvalues = ALLOCATE(ObjUpvalue *, function->upvalueCount);
@@ -110,12 +324,39 @@ ObjNative *newNative(NativeFn function)
     return native;
 }
 
+/**
+ * @return the interned string of `chars`, a shared one first (see `VM.sharedStrings`), NULL if there is none
+ *
+ * @note The program may get back a string nothing references anymore, which the marking thread left unmarked, so it is
+ * shaded.
+ */
+static ObjString *findInterned(const char *chars, int length, uint32_t hash)
+{
+    if (vm->sharedStrings != NULL)
+    {
+        ObjString *shared = tableFindString(vm->sharedStrings, chars, length, hash);
+        if (shared != NULL)
+        {
+            return shared;
+        }
+    }
+
+    ObjString *interned = tableFindString(&(vm->strings), chars, length, hash);
+#ifdef CONCURRENT_GC
+    if (interned != NULL && vm->markingConcurrently && !isMarked(&interned->obj))
+    {
+        shadeObject(&interned->obj);
+    }
+#endif
+    return interned;
+}
+
 ObjString *takeString(char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
 
     // Re-use string in global string pool if possible
-    ObjString *interned = tableFindString(&(vm.strings), chars, length, hash);
+    ObjString *interned = findInterned(chars, length, hash);
     if (interned != NULL)
     {
         FREE_ARRAY(char, chars, length + 1);
@@ -125,12 +366,27 @@ ObjString *takeString(char *chars, int length)
     return allocateString(chars, length, hash);
 }
 
+/**
+ * Intern a string whose NUL-terminated bytes live in a mapped bytecode file, they are used in place
+ */
+ObjString *mapString(const char *chars, int length)
+{
+    uint32_t hash = hashString(chars, length);
+    ObjString *interned = findInterned(chars, length, hash);
+    if (interned != NULL)
+    {
+        return interned;
+    }
+
+    return allocateString((char *)chars, length, hash);
+}
+
 ObjString *copyString(const char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
 
     // Re-use string in global string pool if possible
-    ObjString *interned = tableFindString(&(vm.strings), chars, length, hash);
+    ObjString *interned = findInterned(chars, length, hash);
     if (interned != NULL)
     {
         return interned;
@@ -151,6 +407,14 @@ ObjUpvalue *newUpvalue(Value *slot)
     return upvalue;
 }
 
+void initFrameUpvalue(ObjUpvalue *upvalue, Value *slot)
+{
+    initFrameObject((Obj *)upvalue, OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->next = NULL;
+    upvalue->closed = NIL_VAL;
+}
+
 static void printFunction(ObjFunction *function)
 {
     if (function->name == NULL)
@@ -197,6 +461,11 @@ void printObj(Value value)
         printf("<native fn>");
         break;
     }
+    case OBJ_SHAPE:
+    {
+        printf("shape");
+        break;
+    }
     case OBJ_STRING:
     {
         printf("%s", AS_CSTRING(value));
@@ -1,6 +1,8 @@
 #ifndef clox_object_h
 #define clox_object_h
 
+#include <stdatomic.h>
+
 #include "common.h"
 #include "chunk.h"
 #include "table.h"
@@ -33,17 +35,31 @@ typedef enum
     OBJ_FUNCTION,
     OBJ_INSTANCE,
     OBJ_NATIVE, // native function
+    OBJ_SHAPE,  // hidden class of instances
     OBJ_STRING,
     OBJ_UPVALUE
 } ObjType;
 
+/**
+ * Generation of an object, see `memory.c`
+ */
+typedef enum
+{
+    GEN_YOUNG,      // allocated since the last collection, in `vm->youngObjects`
+    GEN_OLD,        // survived a collection, in `vm->objects`
+    GEN_REMEMBERED, // old, and in `vm->rememberedSet` since it may reference young objects
+    GEN_FRAME,      // lives in a frame cell, in no list
+    GEN_SHARED,     // belongs to a frozen VM whose code this VM runs, read-only and never marked, see `freezeObjects()`
+} Generation;
+
 /**
  * Lox value whose state lives on the heap is an Obj.
  */
 struct Obj
 {
     ObjType type;
-    bool isMarked;
+    atomic_bool markBit; // marked when it equals `vm->markBit`, see `isMarked()`, parallel GC threads claim it
+    uint8_t generation; // Generation
     struct Obj *next;
 };
 
@@ -75,14 +91,60 @@ typedef struct
      * Number of upvalue of this function
      */
     int upvalueCount;
+    /**
+     * Most stack slots a frame of the function uses, from its slot 0 up, checked once by `call()`
+     */
+    int maxStack;
     /**
      * Point to the first bytecode of the function
      */
     Chunk chunk;
+    /**
+     * Once the function is frozen, index of its first inline cache in `VM.sharedCaches` of the VMs running it
+     */
+    int sharedCacheBase;
     /**
      * Function name
      */
     ObjString *name;
+    /**
+     * Source of the script while the body isn't compiled, NULL once it is. `compileLazily()` compiles it on the first
+     * call from the parameter list at `lazyStart`.
+     */
+    ObjString *lazySource;
+    int lazyStart;
+    int lazyLine;
+    /**
+     * `FunctionType` of the function, and -1 outside of classes, else whether the innermost class has a superclass
+     */
+    uint8_t lazyType;
+    int8_t lazyClass;
+    /**
+     * Names of the variables the function captures by upvalue index, resolved again when the body compiles
+     */
+    ValueArray upvalueNames;
+#ifdef BASELINE_JIT
+    /**
+     * Calls and loop iterations counted up to `JIT_THRESHOLD`, when the function gets compiled
+     */
+    int hotness;
+    /**
+     * Native code of the function, NULL until it gets hot
+     */
+    struct JitCode *jit;
+#endif
+#ifdef TRACING_JIT
+    /**
+     * Loops of the function that took a back-edge, with their traces
+     */
+    struct HotLoop *hotLoops;
+#endif
+#ifdef AOT_RUNTIME
+    /**
+     * C code the function was translated to by `clox --emit-c`, NULL when the script didn't match it
+     */
+    const struct AotFunction *aot;
+#endif
 } ObjFunction;
 
 typedef struct
@@ -93,19 +155,75 @@ typedef struct
     int upvalueCount;
 } ObjClosure;
 
+/**
+ * Most fields of an instance with a shape, adding one more switches it to dictionary mode
+ */
+#define SHAPE_MAX_SLOTS 64
+/**
+ * Most transitions out of a shape, an instance adding a field that needs one more switches to dictionary mode
+ */
+#define SHAPE_MAX_TRANSITIONS 16
+
+/**
+ * Hidden class, the layout of the fields of instances.
+ *
+ * @details Instances of a class start with the root shape of the class and move to a child shape with every field
+ * they add, so instances that add the same fields in the same order share a shape and keep a field at the same slot.
+ */
+struct ObjShape
+{
+    Obj obj;
+    /**
+     * Field names to their slot, as number values
+     */
+    Table slots;
+    /**
+     * Number of fields of instances with this shape
+     */
+    int slotCount;
+    /**
+     * Child shapes keyed by the name of the field an instance adds to reach them
+     */
+    Table transitions;
+};
+
 typedef struct
 {
     Obj obj;
     ObjString *name;
     Table methods;
+    /**
+     * Shape of the instances without fields, created with the first instance
+     */
+    ObjShape *rootShape;
+    /**
+     * Most fields an instance of the class got so far, new instances reserve that many slots inline
+     */
+    int fieldCountHint;
 } ObjClass;
 
 typedef struct
 {
     Obj obj;
     ObjClass *klass;
-    /** @brief Store fields */
-    Table fields;
+    /**
+     * Layout of `fields`, NULL once the instance is in dictionary mode
+     */
+    ObjShape *shape;
+    /**
+     * Field values at the slots of `shape`, points to `inlineFields` until they are full
+     */
+    Value *fields;
+    int fieldCapacity;
+    /**
+     * Number of slots allocated along with the instance
+     */
+    int inlineCapacity;
+    /**
+     * Fields of an instance in dictionary mode, for unusual field patterns. NULL before.
+     */
+    Table *dictionary;
+    Value inlineFields[];
 } ObjInstance;
 
 typedef struct
@@ -145,10 +263,19 @@ ObjClass *newClass(ObjString *name);
 ObjClosure *newClosure(ObjFunction *function);
 ObjFunction *newFunction();
 ObjInstance *newInstance(ObjClass *klass);
+int shapeSlot(ObjShape *shape, ObjString *name);
+bool getField(ObjInstance *instance, ObjString *name, Value *value);
+bool setField(ObjInstance *instance, ObjString *name, Value value);
 ObjNative *newNative(NativeFn function);
 ObjString *takeString(char *chars, int length);
 ObjString *copyString(const char *chars, int length);
+ObjString *mapString(const char *chars, int length);
 ObjUpvalue *newUpvalue(Value *slot);
+/**
+ * Set up an object in a frame cell (see `FrameCell`), in place of `newBoundMethod()` and `newUpvalue()`
+ */
+void initFrameBoundMethod(ObjBoundMethod *bound, Value receiver, ObjClosure *method);
+void initFrameUpvalue(ObjUpvalue *upvalue, Value *slot);
 void printObj(Value value);
 
 static inline bool isObjType(Value value, ObjType type)
@@ -0,0 +1,652 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+#include "peephole.h"
+
+/**
+ * Jump emitted into the optimized code, patched once every instruction has its new offset.
+ */
+typedef struct
+{
+    /**
+     * Offset of the jump instruction in the optimized code
+     */
+    int offset;
+    /**
+     * Offset of the jump target in the original code
+     */
+    int target;
+} PendingJump;
+
+/**
+ * State of one run of the pass over a chunk
+ */
+typedef struct
+{
+    Chunk *chunk;
+    /**
+     * Offset of every instruction of the original code, in order
+     */
+    int *starts;
+    int instructionCount;
+    /**
+     * Index in `starts` of every offset that starts an instruction
+     */
+    int *indexes;
+    /**
+     * Number of jumps landing on every offset of the original code
+     */
+    int *jumpsTo;
+    /**
+     * Instructions of the original code that become dead once their only jump is redirected
+     */
+    bool *dead;
+
+    //> Optimized code
+    uint8_t *code;
+    int *lines;
+    int count;
+    /**
+     * Offset in the optimized code of every offset of the original code
+     */
+    int *newOffsets;
+    PendingJump *jumps;
+    int jumpCount;
+    //<
+} Peephole;
+
+int readLong(uint8_t *operand)
+{
+    return (operand[0] << 16) | (operand[1] << 8) | operand[2];
+}
+
+/**
+ * @return length of the instruction after the `OP_WIDE` at `offset`, the prefix included
+ */
+static int wideInstructionLength(Chunk *chunk, int offset)
+{
+    switch (chunk->code[offset + 1])
+    {
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+        return 7;
+    case OP_INVOKE:
+        return 8;
+    case OP_SUPER_INVOKE:
+        return 6;
+    case OP_CLOSURE:
+    {
+        ObjFunction *function = AS_FUNCTION(chunk->constants.values[readLong(&chunk->code[offset + 2])]);
+        return 5 + 4 * function->upvalueCount; // an `isLocal` byte and a 3-byte `index` per upvalue
+    }
+    default: // a local, an upvalue or a name
+        return 5;
+    }
+}
+
+int instructionLength(Chunk *chunk, int offset)
+{
+    switch (chunk->code[offset])
+    {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_GET_SUPER:
+    case OP_CALL:
+    case OP_CLASS:
+    case OP_METHOD:
+        return 2;
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_SUPER_INVOKE:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_EQUAL_NUMBER:
+    case OP_JUMP_IF_NOT_EQUAL_NUMBER:
+    case OP_ADD_CONSTANT_TO_LOCAL:
+        return 3;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+    case OP_GET_PROPERTY_FRAME:
+    case OP_CONSTANT_LONG:
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_LOOP_LONG:
+        return 4;
+    case OP_INVOKE:
+        return 5;
+    case OP_WIDE:
+        return wideInstructionLength(chunk, offset);
+    case OP_CLOSURE:
+    {
+        ObjFunction *function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+        return 2 + 2 * function->upvalueCount; // an `isLocal` and an `index` byte per upvalue
+    }
+    default:
+        return 1;
+    }
+}
+
+int jumpTarget(Chunk *chunk, int offset)
+{
+    uint8_t *ip = &chunk->code[offset];
+    switch (ip[0])
+    {
+    case OP_LOOP:
+        return offset + 3 - ((ip[1] << 8) | ip[2]);
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+        return offset + 4 + readLong(&ip[1]);
+    case OP_LOOP_LONG:
+        return offset + 4 - readLong(&ip[1]);
+    default:
+        return offset + 3 + ((ip[1] << 8) | ip[2]);
+    }
+}
+
+/**
+ * @return the 2-byte form of a jump, any other instruction unchanged
+ */
+static uint8_t shortJump(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_JUMP_LONG:
+        return OP_JUMP;
+    case OP_JUMP_IF_FALSE_LONG:
+        return OP_JUMP_IF_FALSE;
+    case OP_LOOP_LONG:
+        return OP_LOOP;
+    default:
+        return instruction;
+    }
+}
+
+static bool isJump(uint8_t instruction)
+{
+    instruction = shortJump(instruction);
+    return instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE || instruction == OP_LOOP;
+}
+
+int stackEffect(Chunk *chunk, int offset)
+{
+    uint8_t *ip = &chunk->code[offset];
+    switch (ip[0])
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_GET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_CLASS:
+    case OP_CONSTANT_LONG:
+        return 1;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_PROPERTY:
+    case OP_GET_SUPER:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_PRINT:
+    case OP_CLOSE_UPVALUE:
+    case OP_INHERIT:
+    case OP_METHOD:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+    case OP_ADD_NUMBER:
+    case OP_ADD_STRING:
+    case OP_EQUAL_NUMBER:
+    case OP_NOT_EQUAL_NUMBER:
+        return -1;
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_JUMP_IF_EQUAL_NUMBER:
+    case OP_JUMP_IF_NOT_EQUAL_NUMBER:
+        return -2; // both operands, on both paths
+    case OP_CALL:
+        return -ip[1]; // the arguments, the callee slot gets the result
+    case OP_INVOKE:
+        return -ip[2];
+    case OP_SUPER_INVOKE:
+        return -ip[2] - 1; // the superclass too
+    case OP_WIDE:
+        switch (ip[1])
+        {
+        case OP_GET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+            return 1;
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_METHOD:
+            return -1;
+        case OP_INVOKE:
+            return -ip[5];
+        case OP_SUPER_INVOKE:
+            return -ip[5] - 1;
+        default:
+            return 0;
+        }
+    default:
+        return 0;
+    }
+}
+
+bool isBranch(uint8_t instruction)
+{
+    return isJump(instruction) || (instruction >= OP_JUMP_IF_EQUAL && instruction <= OP_JUMP_IF_NOT_GREATER) ||
+           instruction == OP_JUMP_IF_EQUAL_NUMBER || instruction == OP_JUMP_IF_NOT_EQUAL_NUMBER;
+}
+
+/**
+ * @details Walks every path of the chunk from its first instruction, every instruction has one stack height as the
+ * compiler only jumps between points of equal height. Code no path reaches is left out.
+ */
+int stackDepth(Chunk *chunk, int base)
+{
+    int *heights = malloc(sizeof(int) * chunk->count);
+    int *pending = malloc(sizeof(int) * chunk->count);
+    for (int i = 0; i < chunk->count; i++)
+    {
+        heights[i] = -1;
+    }
+
+    int pendingCount = 0;
+    int depth = base;
+    heights[0] = base;
+    pending[pendingCount++] = 0;
+    while (pendingCount > 0)
+    {
+        int offset = pending[--pendingCount];
+        for (;;)
+        {
+            uint8_t instruction = chunk->code[offset];
+            int height = heights[offset] + stackEffect(chunk, offset);
+            depth = height > depth ? height : depth;
+            if (instruction == OP_RETURN)
+            {
+                break;
+            }
+
+            if (isBranch(instruction))
+            {
+                int target = jumpTarget(chunk, offset);
+                if (target < chunk->count && heights[target] < height)
+                {
+                    heights[target] = height;
+                    pending[pendingCount++] = target;
+                }
+                if (instruction == OP_JUMP || instruction == OP_JUMP_LONG || instruction == OP_LOOP ||
+                    instruction == OP_LOOP_LONG)
+                {
+                    break;
+                }
+            }
+
+            offset += instructionLength(chunk, offset);
+            if (offset >= chunk->count || heights[offset] >= height)
+            {
+                break;
+            }
+            heights[offset] = height;
+        }
+    }
+
+    free(heights);
+    free(pending);
+    return depth;
+}
+
+/**
+ * @return whether a jump at `offset` of the original code reaches `target` with a 2-byte offset. The optimized code
+ * only shrinks, so the distance in the original code is an upper bound of the final one.
+ */
+static bool fitsShortJump(uint8_t instruction, int offset, int target)
+{
+    int jump = instruction == OP_LOOP ? offset + 3 - target : target - (offset + 3);
+    return jump <= UINT16_MAX;
+}
+
+/**
+ * @return the instruction at `index`, jumps in their 2-byte form
+ */
+static uint8_t opAt(Peephole *p, int index)
+{
+    return index < p->instructionCount ? shortJump(p->chunk->code[p->starts[index]]) : OP_RETURN;
+}
+
+/**
+ * Whether `length` instructions starting at `index` can be fused, i.e. they exist and no jump lands in the middle
+ */
+static bool isStraightLine(Peephole *p, int index, int length)
+{
+    if (index + length > p->instructionCount)
+    {
+        return false;
+    }
+
+    for (int i = index + 1; i < index + length; i++)
+    {
+        if (p->jumpsTo[p->starts[i]] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void emit(Peephole *p, uint8_t byte, int line)
+{
+    p->code[p->count] = byte;
+    p->lines[p->count] = line;
+    p->count++;
+}
+
+/**
+ * Emit a jump whose offset is patched at the end of the pass, in its long form when the target may be too far for a
+ * 2-byte offset
+ *
+ * @param instruction the jump in its 2-byte form
+ * @param offset offset of the jump in the original code
+ */
+static void emitJump(Peephole *p, uint8_t instruction, int offset, int target, int line)
+{
+    p->jumps[p->jumpCount].offset = p->count;
+    p->jumps[p->jumpCount].target = target;
+    p->jumpCount++;
+
+    if (fitsShortJump(instruction, offset, target))
+    {
+        emit(p, instruction, line);
+        emit(p, 0xff, line);
+        emit(p, 0xff, line);
+        return;
+    }
+
+    switch (instruction)
+    {
+    case OP_JUMP:
+        emit(p, OP_JUMP_LONG, line);
+        break;
+    case OP_JUMP_IF_FALSE:
+        emit(p, OP_JUMP_IF_FALSE_LONG, line);
+        break;
+    default:
+        emit(p, OP_LOOP_LONG, line);
+        break;
+    }
+    emit(p, 0xff, line);
+    emit(p, 0xff, line);
+    emit(p, 0xff, line);
+}
+
+/**
+ * `OP_EQUAL`, `OP_LESS` and `OP_GREATER`, optionally followed by `OP_NOT`, fused into one comparison.
+ *
+ * @return the fused comparison, or `OP_RETURN` if the instructions at `index` are not a comparison.
+ * @param length number of instructions of the comparison
+ */
+static uint8_t matchComparison(Peephole *p, int index, int *length)
+{
+    uint8_t instruction = opAt(p, index);
+    if (instruction != OP_EQUAL && instruction != OP_LESS && instruction != OP_GREATER)
+    {
+        return OP_RETURN;
+    }
+
+    *length = 1;
+    if (opAt(p, index + 1) != OP_NOT || !isStraightLine(p, index, 2))
+    {
+        return instruction;
+    }
+
+    *length = 2;
+    switch (instruction)
+    {
+    case OP_EQUAL:
+        return OP_NOT_EQUAL;
+    case OP_LESS:
+        return OP_GREATER_EQUAL; // `!(a < b)`, so NaN still compares like `OP_LESS`, `OP_NOT`
+    default:
+        return OP_LESS_EQUAL;
+    }
+}
+
+/**
+ * Fuse a comparison, the `OP_JUMP_IF_FALSE` that tests it and the `OP_POP` of the fall-through path into one
+ * compare-and-branch instruction. The jump then lands after the `OP_POP` that the unfused jump landed on,
+ * as no condition is left on the stack to pop.
+ *
+ * @return number of fused instructions, 0 if the pattern does not match
+ */
+static int fuseCompareAndBranch(Peephole *p, int index)
+{
+    int length;
+    uint8_t comparison = matchComparison(p, index, &length);
+    if (comparison == OP_RETURN ||
+        opAt(p, index + length) != OP_JUMP_IF_FALSE ||
+        opAt(p, index + length + 1) != OP_POP ||
+        !isStraightLine(p, index, length + 2))
+    {
+        return 0;
+    }
+
+    Chunk *chunk = p->chunk;
+    int jump = p->starts[index + length];
+    int target = jumpTarget(chunk, jump);
+    if (target >= chunk->count || chunk->code[target] != OP_POP ||
+        !fitsShortJump(OP_JUMP_IF_FALSE, p->starts[index], target + 1)) // fused jumps have no long form
+    {
+        return 0;
+    }
+
+    uint8_t instruction;
+    switch (comparison)
+    {
+    case OP_EQUAL:
+        instruction = OP_JUMP_IF_NOT_EQUAL;
+        break;
+    case OP_NOT_EQUAL:
+        instruction = OP_JUMP_IF_EQUAL;
+        break;
+    case OP_LESS:
+        instruction = OP_JUMP_IF_NOT_LESS;
+        break;
+    case OP_GREATER_EQUAL:
+        instruction = OP_JUMP_IF_LESS;
+        break;
+    case OP_GREATER:
+        instruction = OP_JUMP_IF_NOT_GREATER;
+        break;
+    default:
+        instruction = OP_JUMP_IF_GREATER;
+        break;
+    }
+
+    //> Redirect the jump past the `OP_POP`, which is dead if nothing else reaches it
+    p->jumpsTo[target]--;
+    p->jumpsTo[target + 1]++;
+
+    uint8_t previous = opAt(p, p->indexes[target] - 1);
+    if (p->jumpsTo[target] == 0 && (previous == OP_JUMP || previous == OP_LOOP || previous == OP_RETURN))
+    {
+        p->dead[target] = true;
+    }
+    //<
+
+    emitJump(p, instruction, p->starts[index], target + 1, chunk->lines[p->starts[index]]);
+    return length + 2;
+}
+
+/**
+ * Fuse `local = local + constant;` into one instruction, for number constants only so it never concatenates.
+ *
+ * @return number of fused instructions, 0 if the pattern does not match
+ */
+static int fuseAddConstantToLocal(Peephole *p, int index)
+{
+    if (opAt(p, index) != OP_GET_LOCAL ||
+        opAt(p, index + 1) != OP_CONSTANT ||
+        opAt(p, index + 2) != OP_ADD ||
+        opAt(p, index + 3) != OP_SET_LOCAL ||
+        opAt(p, index + 4) != OP_POP ||
+        !isStraightLine(p, index, 5))
+    {
+        return 0;
+    }
+
+    Chunk *chunk = p->chunk;
+    uint8_t slot = chunk->code[p->starts[index] + 1];
+    uint8_t constant = chunk->code[p->starts[index + 1] + 1];
+    if (chunk->code[p->starts[index + 3] + 1] != slot || !IS_NUMBER(chunk->constants.values[constant]))
+    {
+        return 0;
+    }
+
+    int line = chunk->lines[p->starts[index + 2]]; // where `OP_ADD` reports its errors
+    emit(p, OP_ADD_CONSTANT_TO_LOCAL, line);
+    emit(p, slot, line);
+    emit(p, constant, line);
+    return 5;
+}
+
+/**
+ * Peephole pass, rewrite common instruction sequences of a finished chunk into superinstructions.
+ *
+ * @details The chunk is decoded into instructions, every instruction that is not a jump target in the middle of a
+ * pattern can be fused with the ones after it. The optimized code is written to a new buffer while recording the new
+ * offset of every old one, then every jump is re-encoded against the new offsets. `break` and `continue` are plain
+ * `OP_JUMP` and `OP_LOOP` once their loop has been compiled, so they are patched like any other jump.
+ *
+ * The compiler emits every jump in its long form, the pass picks the width: a jump gets its 2-byte form when its
+ * distance in the original code fits. The code only shrinks, so that distance bounds the re-encoded one.
+ *
+ * @note Runs at `endCompiler()` on a chunk without errors, all of its jumps are patched by then.
+ */
+void optimizeChunk(Chunk *chunk)
+{
+    Peephole p;
+    p.chunk = chunk;
+    p.starts = malloc(sizeof(int) * chunk->count);
+    p.instructionCount = 0;
+    p.indexes = malloc(sizeof(int) * chunk->count);
+    p.jumpsTo = calloc(chunk->count + 1, sizeof(int));
+    p.dead = calloc(chunk->count + 1, sizeof(bool));
+    p.code = malloc(chunk->count);
+    p.lines = malloc(sizeof(int) * chunk->count);
+    p.count = 0;
+    p.newOffsets = malloc(sizeof(int) * (chunk->count + 1));
+    p.jumps = malloc(sizeof(PendingJump) * chunk->count);
+    p.jumpCount = 0;
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        p.indexes[offset] = p.instructionCount;
+        p.starts[p.instructionCount++] = offset;
+        if (isJump(chunk->code[offset]))
+        {
+            p.jumpsTo[jumpTarget(chunk, offset)]++;
+        }
+    }
+
+    for (int index = 0; index < p.instructionCount;)
+    {
+        int offset = p.starts[index];
+        p.newOffsets[offset] = p.count;
+
+        int fused = fuseCompareAndBranch(&p, index);
+        if (fused == 0)
+        {
+            fused = fuseAddConstantToLocal(&p, index);
+        }
+
+        if (fused == 0)
+        {
+            fused = 1;
+            int length;
+            uint8_t comparison = matchComparison(&p, index, &length);
+            if (comparison != OP_RETURN && length == 2)
+            {
+                emit(&p, comparison, chunk->lines[offset]);
+                fused = 2;
+            }
+            else if (isJump(chunk->code[offset]))
+            {
+                emitJump(&p, shortJump(chunk->code[offset]), offset, jumpTarget(chunk, offset), chunk->lines[offset]);
+            }
+            else if (!p.dead[offset])
+            {
+                for (int i = 0; i < instructionLength(chunk, offset); i++)
+                {
+                    emit(&p, chunk->code[offset + i], chunk->lines[offset + i]);
+                }
+            }
+        }
+
+        for (int i = 1; i < fused; i++)
+        {
+            p.newOffsets[p.starts[index + i]] = p.count; // nothing jumps into a fused instruction
+        }
+        index += fused;
+    }
+    p.newOffsets[chunk->count] = p.count;
+
+    for (int i = 0; i < p.jumpCount; i++)
+    {
+        PendingJump *jump = &p.jumps[i];
+        uint8_t *code = &p.code[jump->offset];
+        int target = p.newOffsets[jump->target];
+        int length = code[0] == shortJump(code[0]) ? 3 : 4;
+        int offset = shortJump(code[0]) == OP_LOOP ? jump->offset + length - target : target - (jump->offset + length);
+        if (length == 4)
+        {
+            code[1] = (offset >> 16) & 0xff;
+            code[2] = (offset >> 8) & 0xff;
+            code[3] = offset & 0xff;
+        }
+        else
+        {
+            code[1] = (offset >> 8) & 0xff;
+            code[2] = offset & 0xff;
+        }
+    }
+
+    memcpy(chunk->code, p.code, p.count);
+    memcpy(chunk->lines, p.lines, sizeof(int) * p.count);
+    chunk->count = p.count;
+
+    free(p.starts);
+    free(p.indexes);
+    free(p.jumpsTo);
+    free(p.dead);
+    free(p.code);
+    free(p.lines);
+    free(p.newOffsets);
+    free(p.jumps);
+}
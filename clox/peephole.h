@@ -0,0 +1,35 @@
+#ifndef clox_peephole_h
+#define clox_peephole_h
+
+#include "chunk.h"
+
+void optimizeChunk(Chunk *chunk);
+/**
+ * @return length in bytes of the instruction at `offset`, opcode and operands
+ */
+int instructionLength(Chunk *chunk, int offset);
+/**
+ * @return offset of the instruction the jump at `offset` lands on, any jump, fused or long
+ */
+int jumpTarget(Chunk *chunk, int offset);
+/**
+ * @return whether `instruction` is a jump of any kind, fused compare-and-branch instructions and their quickened forms
+ * included
+ */
+bool isBranch(uint8_t instruction);
+/**
+ * @return how many slots the instruction at `offset` pushes, negative when it pops more than it pushes
+ */
+int stackEffect(Chunk *chunk, int offset);
+/**
+ * @return the 3-byte operand at `operand`, most significant byte first
+ */
+int readLong(uint8_t *operand);
+/**
+ * @return the most stack slots a frame running `chunk` uses, counted from its slot 0
+ *
+ * @param base slots in use on entry: the callee and its arguments
+ */
+int stackDepth(Chunk *chunk, int base);
+
+#endif
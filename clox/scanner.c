@@ -27,13 +27,16 @@ static Token string();
 static Token number();
 static Token identifier();
 
-Scanner scanner;
+_Thread_local Scanner scanner;
 
-void initScanner(const char *source)
+/**
+ * @param line line number of the start of `source`
+ */
+void initScanner(const char *source, int line)
 {
     scanner.start = source;
     scanner.current = source;
-    scanner.line = 1;
+    scanner.line = line;
 }
 
 Token scanToken()
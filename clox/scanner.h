@@ -62,7 +62,7 @@ typedef struct
     int line;
 } Token;
 
-void initScanner(const char *source);
+void initScanner(const char *source, int line);
 Token scanToken();
 
 #endif
\ No newline at end of file
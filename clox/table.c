@@ -68,9 +68,11 @@ static void adjustCapacity(Table *table, int capacity)
         table->count++;
     }
 
+    lockHeap();
     FREE_ARRAY(Entry, table->entries, table->capacity);
     table->entries = entries;
     table->capacity = capacity;
+    unlockHeap();
 }
 
 void initTable(Table *table)
@@ -120,6 +122,10 @@ bool tableSet(Table *table, ObjString *key, Value value)
     {
         table->count++;
     }
+    else if (!isNewKey)
+    {
+        overwriteBarrier(entry->value);
+    }
 
     entry->key = key;
     entry->value = value;
@@ -200,7 +206,7 @@ void tableRemoveWhite(Table *table)
     for (int i = 0; i < table->capacity; i++)
     {
         Entry *entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked)
+        if (entry->key != NULL && !isMarked(&entry->key->obj))
         {
             tableDelete(table, entry->key);
         }
@@ -0,0 +1,1988 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "memory.h"
+#include "peephole.h"
+#include "trace.h"
+#include "x64.h"
+
+#ifdef TRACING_JIT
+
+/**
+ * Tracing JIT: a loop whose back-edge is taken `TRACE_THRESHOLD` times has its next iteration recorded, from its header
+ * back to it, by running it one instruction at a time with `stepInstruction()`. Each recorded instruction keeps
+ * what was observed while it ran: whether its operands were numbers, whether its branch was taken and the shape of the
+ * receiver of a property access.
+ *
+ * The recording is compiled to straight x86-64 code that loops on itself:
+ *
+ * - the observations become guards, a guard that fails is a side exit that spills the state of the trace back to the
+ *   stack and the frame and leaves to the interpreter at the instruction it stands for.
+ * - numbers stay unboxed in `xmm` registers: the values above the header of the first `SLOT_REGISTERS` stack slots, and
+ *   the locals below the header that only ever hold numbers in the loop (promoted locals, loaded once on entry).
+ * - property accesses of fields compare the shape of the instance with the recorded one and read the slot directly.
+ * - a call to a function that returns without calls, loops or closures is inlined, guarded on the callee or on the
+ *   shape of the receiver: its instructions work on the stack slots from the callee up, and a side exit among them
+ *   pushes its frame before leaving. Other calls run to completion through `callInstruction()`, any other instruction
+ *   without a template runs with `stepInstruction()`. Both are C calls: the stack is written back before them and
+ *   read again after.
+ *
+ * A side exit taken `TRACE_THRESHOLD` times gets its own recording, from the exit back to the header, compiled to a side
+ * trace the exit jumps to instead of leaving, which is how a loop body with branches ends up compiled on both paths.
+ * Recording gives up when the iteration returns, leaves the loop or runs an inner loop: inner loops get their own
+ * traces and the outer loop stays interpreted.
+ *
+ * Registers of the trace, `rbx` to `r14` are saved on entry and restored when it leaves:
+ *
+ * - `rbx`: the stack slot of the header, the height of the stack when the loop starts an iteration
+ * - `r12`: first stack slot of the frame
+ * - `r13`: the frame
+ * - `r14`: `QNAN`, tested against values by the number guards
+ * - `xmm0` to `xmm5`: numbers of the stack slots above the header, `xmm6` and `xmm7`: scratch
+ * - `xmm8` to `xmm15`: promoted locals
+ */
+
+/**
+ * Most instructions in a trace, its loop body has to fit
+ */
+#define TRACE_MAX_STEPS 512
+/**
+ * Most stack slots above the header a trace uses
+ */
+#define TRACE_MAX_HEIGHT 64
+#define PROMOTED_MAX 8
+/**
+ * Most nested `run()`s of calls out of traces under which traces still run
+ */
+#define TRACE_NESTING_MAX 256
+/**
+ * Most back-edges of a loop, a `for` loop with an increment has two
+ */
+#define EDGES_MAX 4
+#define SLOT_REGISTERS 6
+#define SCRATCH_A 6
+#define SCRATCH_B 7
+#define PROMOTED_XMM 8
+
+/**
+ * A way out of a trace
+ */
+typedef struct TraceExit
+{
+    /**
+     * Native code run once the stack is written back: the code that leaves to the interpreter, or a side trace
+     */
+    uint8_t *target;
+    /**
+     * Offset of the bytecode the interpreter resumes at
+     */
+    int offset;
+    /**
+     * Height of the stack above the header
+     */
+    int height;
+    /**
+     * Times taken, counted up to `TRACE_THRESHOLD` when a side trace gets recorded
+     */
+    int hits;
+} TraceExit;
+
+/**
+ * The code of a trace or of one of its side traces, in its own executable mapping
+ */
+typedef struct TraceFragment
+{
+    uint8_t *code;
+    size_t size;
+    TraceExit *exits;
+    int exitCount;
+    struct TraceFragment *next;
+} TraceFragment;
+
+/**
+ * The bytecode of a loop, from the back-edges that jump into it
+ *
+ * @details A `for` loop with an increment is compiled with two back-edges, from the body to the increment and from the
+ * increment to the condition, which get hot together. The loop of a header is the span of a back-edge that jumps to
+ * it, joined with the spans of the back-edges it partly overlaps. A back-edge whose span lies inside is an inner loop.
+ */
+typedef struct
+{
+    int start;
+    int end;
+    int edges[EDGES_MAX];
+    int edgeCount;
+} LoopExtent;
+
+typedef struct Trace
+{
+    int (*entry)(CallFrame *frame);
+    /**
+     * Native address of the start of the loop body, side traces jump back there
+     */
+    uint8_t *loop;
+    int header;
+    LoopExtent extent;
+    /**
+     * Height of the stack at the header, counted from the first slot of the frame
+     */
+    int height;
+    /**
+     * Functions are inlined, the trace needs room for one more frame to leave from one
+     */
+    bool inlines;
+    /**
+     * Local slots kept in `xmm8` and up while the trace runs
+     */
+    uint8_t promoted[PROMOTED_MAX];
+    int promotedCount;
+    /**
+     * Exit the trace took last, NULL when it left at its entry guards or on an error
+     */
+    TraceExit *lastExit;
+    TraceFragment *fragments;
+    /**
+     * Shapes and inlined functions the guards compare with, kept alive with the function
+     */
+    Obj **objects;
+    int objectCount;
+    int objectCapacity;
+} Trace;
+
+/**
+ * An instruction run while recording, with what it saw
+ */
+typedef struct
+{
+    int offset;
+    uint8_t op;
+    /**
+     * Height of the stack above the header, before and after the instruction
+     */
+    int height;
+    int heightAfter;
+    /**
+     * The branch jumped
+     */
+    bool taken;
+    /**
+     * The top two values of the stack were numbers, before the instruction
+     */
+    bool topNumber;
+    bool belowNumber;
+    /**
+     * The value on top of the stack, or the local that `OP_ADD_CONSTANT_TO_LOCAL` set, was a number after it
+     */
+    bool resultNumber;
+    /**
+     * Shape of the instance of `OP_GET_PROPERTY` and `OP_SET_PROPERTY` and the slot of its field, NULL when the name was
+     * not one of its fields. Shape of the receiver of `OP_INVOKE` when the name was one of its methods.
+     */
+    ObjShape *shape;
+    int field;
+    /**
+     * Function a call runs inlined, NULL when it is a C call
+     */
+    ObjClosure *callee;
+    /**
+     * Inlined function the instruction belongs to, NULL for the traced function
+     */
+    ObjClosure *closure;
+} TraceStep;
+
+typedef struct Recording
+{
+    TraceStep steps[TRACE_MAX_STEPS];
+    int count;
+    bool aborted;
+    /**
+     * An `OP_CLOSURE` ran: locals may be captured, so they are always written back to the stack
+     */
+    bool capturing;
+    struct Recording *enclosing;
+} Recording;
+
+/**
+ * Recordings in progress, a call made while recording can record a loop of its own
+ */
+static _Thread_local Recording *recordings = NULL;
+
+typedef enum
+{
+    /**
+     * Boxed in its stack slot
+     */
+    SLOT_MEMORY,
+    /**
+     * Unboxed number in the `xmm` register of the same index, its stack slot is stale
+     */
+    SLOT_XMM,
+    /**
+     * Known value, its stack slot is stale
+     */
+    SLOT_CONSTANT,
+} SlotKind;
+
+/**
+ * A stack slot above the header, as the compiled code keeps it
+ */
+typedef struct
+{
+    SlotKind kind;
+    /**
+     * Known to hold a number
+     */
+    bool number;
+    Value constant;
+} TraceSlot;
+
+/**
+ * A guard waiting for its side exit, which is emitted after the body with a copy of the stack at the guard
+ */
+typedef struct
+{
+    int jump;
+    int offset;
+    int height;
+    TraceSlot *stack;
+    /**
+     * Inlined function the exit leaves from, its frame is pushed on the way out
+     */
+    ObjClosure *closure;
+    int frameBase;
+    int returnOffset;
+} PendingExit;
+
+typedef struct
+{
+    Assembler as;
+    Trace *trace;
+    Chunk *chunk;
+    TraceSlot stack[TRACE_MAX_HEIGHT];
+    int height;
+    PendingExit *exits;
+    int exitCount;
+    int exitCapacity;
+    /**
+     * Native offset of the code that restores the registers and returns `eax`
+     */
+    int epilogue;
+    /**
+     * Native offset of the loop body of a trace, -1 for a side trace which jumps back to `trace->loop`
+     */
+    int loopStart;
+    bool capturing;
+    bool failed;
+    /**
+     * The back-edge to the header that closes the recording
+     */
+    TraceStep *last;
+    Chunk *traceChunk;
+    /**
+     * Inlined function running the instructions being compiled, NULL for the traced function
+     */
+    ObjClosure *closure;
+    /**
+     * Stack slot above the header of the first slot of the inlined function
+     */
+    int frameBase;
+    /**
+     * Offset of the instruction after the inlined call, where its frame returns
+     */
+    int returnOffset;
+} TraceCompiler;
+
+HotLoop *findHotLoop(ObjFunction *function, int header)
+{
+    for (HotLoop *loop = function->hotLoops; loop != NULL; loop = loop->next)
+    {
+        if (loop->header == header)
+        {
+            return loop;
+        }
+    }
+
+    HotLoop *loop = malloc(sizeof(HotLoop));
+    if (loop == NULL)
+    {
+        exit(1);
+    }
+    loop->header = header;
+    loop->hotness = 0;
+    loop->trace = NULL;
+    loop->next = function->hotLoops;
+    lockHeap(); // the marking thread walks the loops of the function
+    function->hotLoops = loop;
+    unlockHeap();
+    return loop;
+}
+
+static void addObject(Trace *trace, Obj *object)
+{
+    for (int i = 0; i < trace->objectCount; i++)
+    {
+        if (trace->objects[i] == object)
+        {
+            return;
+        }
+    }
+
+    lockHeap(); // the marking thread reads the objects of the trace of a side exit
+    if (trace->objectCount == trace->objectCapacity)
+    {
+        trace->objectCapacity = trace->objectCapacity < 8 ? 8 : trace->objectCapacity * 2;
+        trace->objects = realloc(trace->objects, sizeof(Obj *) * trace->objectCapacity);
+        if (trace->objects == NULL)
+        {
+            exit(1);
+        }
+    }
+    trace->objects[trace->objectCount++] = object;
+    unlockHeap();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Recording
+
+static int loopTarget(Chunk *chunk, int offset)
+{
+    return offset + 3 - readShort(&chunk->code[offset]);
+}
+
+static bool isLoopEdge(LoopExtent *extent, int offset)
+{
+    for (int i = 0; i < extent->edgeCount; i++)
+    {
+        if (extent->edges[i] == offset)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @return the loop of `header` was found, false when no back-edge jumps to it or it has too many
+ */
+static bool findLoopExtent(Chunk *chunk, int header, LoopExtent *extent)
+{
+    extent->edgeCount = 0;
+    for (int offset = header; offset < chunk->count; offset += instructionLength(chunk, offset))
+    {
+        if (chunk->code[offset] == OP_LOOP && loopTarget(chunk, offset) == header)
+        {
+            extent->start = header;
+            extent->end = offset;
+            extent->edges[extent->edgeCount++] = offset;
+            break;
+        }
+    }
+    if (extent->edgeCount == 0)
+    {
+        return false;
+    }
+
+    bool grown = true;
+    while (grown)
+    {
+        grown = false;
+        for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset))
+        {
+            if (chunk->code[offset] != OP_LOOP || isLoopEdge(extent, offset))
+            {
+                continue;
+            }
+
+            int target = loopTarget(chunk, offset);
+            bool entersFromBefore = target < extent->start && offset >= extent->start && offset <= extent->end;
+            bool leavesPastEnd = target >= extent->start && target <= extent->end && offset > extent->end;
+            if (entersFromBefore || leavesPastEnd)
+            {
+                if (extent->edgeCount == EDGES_MAX)
+                {
+                    return false;
+                }
+                extent->edges[extent->edgeCount++] = offset;
+                extent->start = target < extent->start ? target : extent->start;
+                extent->end = offset > extent->end ? offset : extent->end;
+                grown = true;
+            }
+        }
+    }
+    return true;
+}
+
+static Recording *beginRecording()
+{
+    Recording *recording = malloc(sizeof(Recording));
+    if (recording == NULL)
+    {
+        exit(1);
+    }
+    recording->count = 0;
+    recording->aborted = false;
+    recording->capturing = false;
+    recording->enclosing = recordings;
+    recordings = recording;
+    return recording;
+}
+
+static void endRecording(Recording *recording)
+{
+    recordings = recording->enclosing;
+    free(recording);
+}
+
+/**
+ * Keep the shape of `receiver` and the slot of the field `name` when it has one
+ */
+static void observeProperty(TraceStep *step, Value receiver, ObjString *name)
+{
+    if (!IS_INSTANCE(receiver) || AS_INSTANCE(receiver)->shape == NULL)
+    {
+        return;
+    }
+
+    ObjShape *shape = AS_INSTANCE(receiver)->shape;
+    int slot = shapeSlot(shape, name);
+    if (slot >= 0)
+    {
+        step->shape = shape;
+        step->field = slot;
+    }
+}
+
+/**
+ * Append the instruction at `frame->ip` to the recording, with what can be seen before it runs
+ *
+ * @param height height of the stack above the header
+ */
+static TraceStep *beginStep(Recording *recording, CallFrame *frame, int height)
+{
+    Chunk *chunk = &frame->closure->function->chunk;
+    int offset = (int)(frame->ip - chunk->code);
+    uint8_t op = genericOpcode(chunk->code[offset]);
+
+    TraceStep *step = &recording->steps[recording->count++];
+    step->offset = offset;
+    step->op = op;
+    step->height = height;
+    step->topNumber = IS_NUMBER(vm->stackTop[-1]);
+    step->belowNumber = vm->stackTop - 2 >= vm->stack && IS_NUMBER(vm->stackTop[-2]);
+    step->shape = NULL;
+    step->field = -1;
+    step->callee = NULL;
+    step->closure = NULL;
+    if (op == OP_GET_PROPERTY || op == OP_SET_PROPERTY)
+    {
+        ObjString *name = AS_STRING(chunk->constants.values[chunk->code[offset + 1]]);
+        observeProperty(step, vm->stackTop[op == OP_GET_PROPERTY ? -1 : -2], name);
+    }
+    else if (op == OP_INVOKE)
+    {
+        ObjString *name = AS_STRING(chunk->constants.values[chunk->code[offset + 1]]);
+        Value receiver = vm->stackTop[-1 - chunk->code[offset + 2]];
+        if (IS_INSTANCE(receiver) && AS_INSTANCE(receiver)->shape != NULL &&
+            shapeSlot(AS_INSTANCE(receiver)->shape, name) < 0)
+        {
+            step->shape = AS_INSTANCE(receiver)->shape; // the shape of the receiver picks the method
+        }
+    }
+    return step;
+}
+
+/**
+ * Keep what the instruction of `step` left, once it ran in `frame`
+ */
+static void endStep(TraceStep *step, CallFrame *frame, int height)
+{
+    Chunk *chunk = &frame->closure->function->chunk;
+    step->taken = frame->ip != &chunk->code[step->offset + instructionLength(chunk, step->offset)];
+    step->heightAfter = height;
+    step->resultNumber = step->op == OP_ADD_CONSTANT_TO_LOCAL ? IS_NUMBER(frame->slots[chunk->code[step->offset + 1]])
+                                                              : IS_NUMBER(vm->stackTop[-1]);
+}
+
+/**
+ * @return the instruction of `step` can run in the code of its caller: it has a template that needs no C call and
+ * no frame of its own
+ */
+static bool isInlinable(TraceStep *step)
+{
+    switch (step->op)
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_POP:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_GREATER_EQUAL:
+    case OP_LESS_EQUAL:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_ADD_CONSTANT_TO_LOCAL:
+    case OP_RETURN:
+        return true;
+    case OP_ADD:
+        return step->topNumber && step->belowNumber;
+    case OP_GET_PROPERTY:
+    case OP_SET_PROPERTY:
+        return step->shape != NULL;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Record the function the call of `call` just pushed, to inline it into the trace: a function that returns without
+ * calls, loops, closures or instructions that need the interpreter. Any other function runs to completion in the
+ * interpreter and the call stays a C call.
+ *
+ * @param frameCount frame count before the call
+ */
+static int recordCallee(Recording *recording, TraceStep *call, CallFrame *frame, int base, int frameCount)
+{
+    CallFrame *callee = &vm->frames[frameCount];
+    int first = recording->count;
+    bool inlinable = vm->frameCount == frameCount + 1;
+    while (inlinable)
+    {
+        int height = (int)(vm->stackTop - frame->slots) - base;
+        if (recording->count == TRACE_MAX_STEPS || height >= TRACE_MAX_HEIGHT - 1)
+        {
+            inlinable = false;
+            break;
+        }
+
+        TraceStep *step = beginStep(recording, callee, height);
+        step->closure = callee->closure;
+        if (!isInlinable(step))
+        {
+            recording->count--;
+            inlinable = false;
+            break;
+        }
+
+        int result = stepInstruction();
+        if (result != JIT_CONTINUE)
+        {
+            return result;
+        }
+        if (step->op == OP_RETURN)
+        {
+            call->callee = step->closure;
+            return JIT_CONTINUE;
+        }
+        endStep(step, callee, (int)(vm->stackTop - frame->slots) - base);
+    }
+
+    recording->count = first;
+    return finishCall(frameCount);
+}
+
+/**
+ * Run the running frame with the interpreter back to the header of the loop, recording every instruction. The
+ * recording is complete when a back-edge lands on the header, and aborted when the iteration goes anywhere a trace
+ * can't follow: out of the loop, around an inner loop or out of the frame.
+ *
+ * @param base height of the stack at the header
+ * @return `JIT_CONTINUE`, or the `InterpretResult` of an instruction that ended the program
+ */
+static int record(Recording *recording, CallFrame *frame, int header, LoopExtent *extent, int base)
+{
+    Chunk *chunk = &frame->closure->function->chunk;
+    for (;;)
+    {
+        int offset = (int)(frame->ip - chunk->code);
+        if (offset == header && recording->count > 0 && recording->steps[recording->count - 1].op == OP_LOOP)
+        {
+            return JIT_CONTINUE;
+        }
+
+        uint8_t op = genericOpcode(chunk->code[offset]);
+        int height = (int)(vm->stackTop - frame->slots) - base;
+        if (offset < extent->start || offset > extent->end || recording->count == TRACE_MAX_STEPS ||
+            height >= TRACE_MAX_HEIGHT - 1 || op == OP_RETURN || (op == OP_LOOP && !isLoopEdge(extent, offset)) ||
+            op == OP_JUMP_LONG || op == OP_JUMP_IF_FALSE_LONG || op == OP_LOOP_LONG) // over 64 KiB of loop body
+        {
+            recording->aborted = true;
+            return JIT_CONTINUE;
+        }
+
+        TraceStep *step = beginStep(recording, frame, height);
+        if (op == OP_CLOSURE)
+        {
+            recording->capturing = true;
+        }
+
+        int frameCount = vm->frameCount;
+        bool inlinable = (op == OP_CALL && IS_CLOSURE(vm->stackTop[-1 - chunk->code[offset + 1]])) ||
+                         (op == OP_INVOKE && step->shape != NULL);
+        int result;
+        if (inlinable)
+        {
+            result = stepInstruction();
+            if (result == JIT_CONTINUE && vm->frameCount != frameCount)
+            {
+                frame = &vm->frames[frameCount - 1]; // `call()` can move the frames
+                result = recordCallee(recording, step, frame, base, frameCount);
+            }
+        }
+        else
+        {
+            result = op == OP_CALL || op == OP_INVOKE || op == OP_SUPER_INVOKE ? callInstruction() : stepInstruction();
+        }
+        if (result != JIT_CONTINUE)
+        {
+            return result;
+        }
+        if (vm->frameCount != frameCount)
+        {
+            recording->aborted = true;
+            return JIT_CONTINUE;
+        }
+
+        frame = &vm->frames[frameCount - 1];
+        endStep(step, frame, (int)(vm->stackTop - frame->slots) - base);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Compiling
+
+static void initTraceCompiler(TraceCompiler *tc, Trace *trace, ObjFunction *function, Recording *recording, int height)
+{
+    initAssembler(&tc->as);
+    tc->trace = trace;
+    tc->chunk = &function->chunk;
+    tc->traceChunk = &function->chunk;
+    tc->closure = NULL;
+    tc->frameBase = 0;
+    tc->returnOffset = 0;
+    tc->height = height;
+    for (int i = 0; i < height; i++)
+    {
+        tc->stack[i].kind = SLOT_MEMORY;
+        tc->stack[i].number = false;
+    }
+    tc->exits = NULL;
+    tc->exitCount = 0;
+    tc->exitCapacity = 0;
+    tc->epilogue = 0;
+    tc->loopStart = -1;
+    tc->capturing = recording->capturing;
+    tc->failed = false;
+}
+
+static int32_t slotOffset(int index)
+{
+    return index * (int)sizeof(Value);
+}
+
+/**
+ * Leave the trace through a side exit when the jump at `jump` is taken, the interpreter resumes at `offset` with the
+ * stack as it is now
+ */
+static void exitOn(TraceCompiler *tc, int jump, int offset)
+{
+    if (tc->exitCount == tc->exitCapacity)
+    {
+        tc->exitCapacity = tc->exitCapacity < 16 ? 16 : tc->exitCapacity * 2;
+        tc->exits = realloc(tc->exits, sizeof(PendingExit) * tc->exitCapacity);
+        if (tc->exits == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    PendingExit *pending = &tc->exits[tc->exitCount++];
+    pending->jump = jump;
+    pending->offset = offset;
+    pending->height = tc->height;
+    pending->stack = malloc(sizeof(TraceSlot) * (tc->height > 0 ? tc->height : 1));
+    memcpy(pending->stack, tc->stack, sizeof(TraceSlot) * tc->height);
+    pending->closure = tc->closure;
+    pending->frameBase = tc->frameBase;
+    pending->returnOffset = tc->returnOffset;
+}
+
+/**
+ * Load the boxed value of the stack slot `index` into `dst`
+ */
+static void boxSlot(Assembler *as, TraceSlot *slot, int index, Register dst)
+{
+    switch (slot->kind)
+    {
+    case SLOT_MEMORY:
+        load(as, dst, RBX, slotOffset(index));
+        break;
+    case SLOT_XMM:
+        movFromXmm(as, dst, index);
+        break;
+    case SLOT_CONSTANT:
+        movImmediate(as, dst, slot->constant);
+        break;
+    }
+}
+
+static void boxValue(TraceCompiler *tc, int index, Register dst)
+{
+    boxSlot(&tc->as, &tc->stack[index], index, dst);
+}
+
+static void storeSlot(TraceCompiler *tc, int index, Register src, bool number)
+{
+    store(&tc->as, RBX, slotOffset(index), src);
+    tc->stack[index].kind = SLOT_MEMORY;
+    tc->stack[index].number = number;
+}
+
+static void materialize(TraceCompiler *tc, int index)
+{
+    if (tc->stack[index].kind != SLOT_MEMORY)
+    {
+        boxValue(tc, index, RAX);
+        storeSlot(tc, index, RAX, tc->stack[index].number);
+    }
+}
+
+static void pushConstant(TraceCompiler *tc, Value value)
+{
+    TraceSlot *slot = &tc->stack[tc->height++];
+    slot->kind = SLOT_CONSTANT;
+    slot->number = IS_NUMBER(value);
+    slot->constant = value;
+}
+
+static void setXmm(TraceCompiler *tc, int index)
+{
+    tc->stack[index].kind = SLOT_XMM;
+    tc->stack[index].number = true;
+}
+
+/**
+ * Unbox the number in the stack slot `index` into an `xmm` register, leaving through a side exit to `offset` when it
+ * is not a number
+ *
+ * @param scratch register used when the slot has none of its own
+ * @return the register
+ */
+static int numberOperand(TraceCompiler *tc, int index, int scratch, int offset)
+{
+    Assembler *as = &tc->as;
+    TraceSlot *slot = &tc->stack[index];
+    if (slot->kind == SLOT_XMM)
+    {
+        return index;
+    }
+
+    int xmm = index < SLOT_REGISTERS ? index : scratch;
+    if (slot->kind == SLOT_CONSTANT)
+    {
+        if (!IS_NUMBER(slot->constant))
+        {
+            exitOn(tc, emitJump(as, -1), offset); // the interpreter reports the error
+        }
+        movImmediate(as, RAX, slot->constant);
+    }
+    else
+    {
+        load(as, RAX, RBX, slotOffset(index));
+        if (!slot->number)
+        {
+            exitOn(tc, jumpIfNotNumber(as, RAX), offset);
+        }
+    }
+    movToXmm(as, xmm, RAX);
+    return xmm;
+}
+
+/**
+ * Leave the number in `xmm` as the stack slot `index`
+ */
+static void setNumber(TraceCompiler *tc, int index, int xmm)
+{
+    if (xmm == index)
+    {
+        setXmm(tc, index);
+    }
+    else
+    {
+        movFromXmm(&tc->as, RAX, xmm);
+        storeSlot(tc, index, RAX, true);
+    }
+}
+
+static int promotedIndex(TraceCompiler *tc, int slot)
+{
+    if (tc->closure != NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < tc->trace->promotedCount; i++)
+    {
+        if (tc->trace->promoted[i] == slot)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void spillPromoted(TraceCompiler *tc)
+{
+    for (int i = 0; i < tc->trace->promotedCount; i++)
+    {
+        movFromXmm(&tc->as, RAX, PROMOTED_XMM + i);
+        store(&tc->as, R12, slotOffset(tc->trace->promoted[i]), RAX);
+    }
+}
+
+static void reloadPromoted(TraceCompiler *tc)
+{
+    for (int i = 0; i < tc->trace->promotedCount; i++)
+    {
+        load(&tc->as, RAX, R12, slotOffset(tc->trace->promoted[i]));
+        movToXmm(&tc->as, PROMOTED_XMM + i, RAX);
+    }
+}
+
+/**
+ * `frame->ip` and `vm->stackTop` of the instruction at `offset`, for a stack `height` slots above the header
+ *
+ * @param frame displacement of the frame from `r13`
+ */
+static void spillState(Assembler *as, int32_t frame, Chunk *chunk, int offset, int height)
+{
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&chunk->code[offset]);
+    store(as, R13, frame + (int32_t)offsetof(CallFrame, ip), RAX);
+    emitMemory(as, true, 0x8d, RCX, RBX, slotOffset(height)); // lea rcx, [rbx + height]
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->stackTop);
+    store(as, RAX, 0, RCX);
+}
+
+/**
+ * Push the frame of the inlined function `pending` leaves from, as `call()` would have, and spill its state
+ */
+static void pushInlinedFrame(TraceCompiler *tc, PendingExit *pending)
+{
+    Assembler *as = &tc->as;
+    int32_t callee = (int32_t)sizeof(CallFrame);
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&tc->traceChunk->code[pending->returnOffset]);
+    store(as, R13, offsetof(CallFrame, ip), RAX);
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)pending->closure);
+    store(as, R13, callee + (int32_t)offsetof(CallFrame, closure), RAX);
+    emitMemory(as, true, 0x8d, RCX, RBX, slotOffset(pending->frameBase)); // lea rcx, [rbx + frameBase]
+    store(as, R13, callee + (int32_t)offsetof(CallFrame, slots), RCX);
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->frameCount);
+    emitMemory(as, false, 0xff, 0, RAX, 0); // inc dword [rax]
+    spillState(as, callee, &pending->closure->function->chunk, pending->offset, pending->height);
+}
+
+/**
+ * Load the registers of the frame again after a call, which can have moved the frames and the stack
+ */
+static void reloadFrame(TraceCompiler *tc)
+{
+    Assembler *as = &tc->as;
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)&vm->frameCount);
+    emitMemory(as, true, 0x63, RAX, RAX, 0); // movsxd rax, [rax]
+    emitBytes(as, "\x48\x6b\xc0", 3);      // imul rax, rax, sizeof(CallFrame)
+    emitByte(as, sizeof(CallFrame));
+    movImmediate(as, R13, (uint64_t)(uintptr_t)&vm->frames);
+    load(as, R13, R13, 0);
+    aluRegisters(as, ALU_ADD, R13, RAX);
+    emitMemory(as, true, 0x8d, R13, R13, -(int)sizeof(CallFrame)); // lea r13, [r13 - sizeof(CallFrame)]
+    load(as, R12, R13, offsetof(CallFrame, slots));
+    emitMemory(as, true, 0x8d, RBX, R12, slotOffset(tc->trace->height)); // lea rbx, [r12 + header]
+}
+
+/**
+ * Run the instruction of `step` in the VM with `function`, `stepInstruction()` or `callInstruction()`
+ */
+static void callVm(TraceCompiler *tc, TraceStep *step, int (*function)())
+{
+    Assembler *as = &tc->as;
+    if (tc->closure != NULL)
+    {
+        tc->failed = true; // an inlined function has no frame for the VM to run
+        return;
+    }
+    for (int i = 0; i < tc->height; i++)
+    {
+        materialize(tc, i);
+    }
+    spillPromoted(tc);
+    spillState(as, 0, tc->chunk, step->offset, tc->height);
+    callAddress(as, function);
+    compareContinue(as);
+    patchJump(as, emitJump(as, CC_NE), tc->epilogue);
+    if (function == callInstruction)
+    {
+        reloadFrame(tc);
+    }
+    reloadPromoted(tc);
+
+    tc->height = step->heightAfter;
+    for (int i = 0; i < tc->height; i++)
+    {
+        tc->stack[i].kind = SLOT_MEMORY;
+        tc->stack[i].number = false; // a call can change what a captured slot holds
+    }
+}
+
+/**
+ * Guard the direction of a branch, `condition` holds when it jumps to `target`
+ */
+static void guardBranch(TraceCompiler *tc, TraceStep *step, Condition condition, int target)
+{
+    if (step->taken)
+    {
+        exitOn(tc, emitJump(&tc->as, condition ^ 1), step->offset + 3);
+    }
+    else
+    {
+        exitOn(tc, emitJump(&tc->as, condition), target);
+    }
+}
+
+/**
+ * Guard a branch known at compile time
+ */
+static void guardKnownBranch(TraceCompiler *tc, TraceStep *step, bool jumps, int target)
+{
+    if (jumps != step->taken)
+    {
+        exitOn(tc, emitJump(&tc->as, -1), jumps ? target : step->offset + 3);
+    }
+}
+
+/**
+ * `al = valuesEqual(a, b)` of the top two stack slots, numbers are unboxed when the recording saw two of them
+ */
+static void compareEquality(TraceCompiler *tc, TraceStep *step)
+{
+    Assembler *as = &tc->as;
+    int a = tc->height - 2;
+    int b = tc->height - 1;
+    if (step->topNumber && step->belowNumber)
+    {
+        int xmmA = numberOperand(tc, a, SCRATCH_A, step->offset);
+        int xmmB = numberOperand(tc, b, SCRATCH_B, step->offset);
+        compareXmm(as, xmmA, xmmB);
+        setCondition(as, CC_E, RAX);
+        setCondition(as, CC_NP, RCX);
+        aluRegisters(as, ALU_AND, RAX, RCX);
+        return;
+    }
+
+    int bits[2];
+    boxValue(tc, a, RAX);
+    boxValue(tc, b, RDX);
+    bits[0] = jumpIfNotNumber(as, RAX);
+    bits[1] = jumpIfNotNumber(as, RDX);
+    movToXmm(as, SCRATCH_A, RAX);
+    movToXmm(as, SCRATCH_B, RDX);
+    compareXmm(as, SCRATCH_A, SCRATCH_B);
+    setCondition(as, CC_E, RAX);
+    setCondition(as, CC_NP, RCX);
+    aluRegisters(as, ALU_AND, RAX, RCX);
+    int done = emitJump(as, -1);
+
+    patchJumpHere(as, bits[0]);
+    patchJumpHere(as, bits[1]);
+    aluRegisters(as, ALU_CMP, RAX, RDX);
+    setCondition(as, CC_E, RAX);
+    patchJumpHere(as, done);
+}
+
+/**
+ * Compare the top two stack slots as numbers, the flags are those of `ucomisd a, b`, or of `ucomisd b, a` with `swap`
+ */
+static void compareNumbers(TraceCompiler *tc, TraceStep *step, bool swap)
+{
+    int xmmA = numberOperand(tc, tc->height - 2, SCRATCH_A, step->offset);
+    int xmmB = numberOperand(tc, tc->height - 1, SCRATCH_B, step->offset);
+    compareXmm(&tc->as, swap ? xmmB : xmmA, swap ? xmmA : xmmB);
+}
+
+/**
+ * `OP_GREATER` and friends, see `comparison()` in `jit.c` for the conditions
+ */
+static void comparison(TraceCompiler *tc, TraceStep *step, bool swap, Condition condition)
+{
+    compareNumbers(tc, step, swap);
+    setCondition(&tc->as, condition, RAX);
+    boxBool(&tc->as);
+    tc->height--;
+    storeSlot(tc, tc->height - 1, RAX, false);
+}
+
+static void compareAndJump(TraceCompiler *tc, TraceStep *step, bool swap, Condition condition)
+{
+    compareNumbers(tc, step, swap);
+    tc->height -= 2;
+    guardBranch(tc, step, condition, jumpTarget(tc->chunk, step->offset));
+}
+
+static void arithmetic(TraceCompiler *tc, TraceStep *step, SseOp op)
+{
+    int a = tc->height - 2;
+    int xmmA = numberOperand(tc, a, SCRATCH_A, step->offset);
+    int xmmB = numberOperand(tc, a + 1, SCRATCH_B, step->offset);
+    sseRegisters(&tc->as, op, xmmA, xmmB);
+    tc->height--;
+    setNumber(tc, a, xmmA);
+}
+
+/**
+ * Set `rax` to the falsiness of the top stack slot: the flags are below for `nil` and `false` (`CC_B`)
+ */
+static void testFalsey(TraceCompiler *tc)
+{
+    Assembler *as = &tc->as;
+    boxValue(tc, tc->height - 1, RAX);
+    movImmediate(as, RCX, NIL_VAL);
+    aluRegisters(as, ALU_SUB, RAX, RCX);
+    emitBytes(as, "\x48\x83\xf8\x02", 4); // cmp rax, 2: FALSE_VAL is NIL_VAL + 1
+}
+
+/**
+ * @return the stack slot is `nil` or `false` for sure, or -1 when it is only known at run time
+ */
+static int knownFalsey(TraceSlot *slot)
+{
+    if (slot->kind == SLOT_CONSTANT)
+    {
+        return IS_NIL(slot->constant) || (IS_BOOL(slot->constant) && !AS_BOOL(slot->constant));
+    }
+    return slot->number ? 0 : -1;
+}
+
+/**
+ * @return stack slot above the header of the local at `local` of the running function, negative for the locals of the
+ * traced function below the header
+ */
+static int stackIndex(TraceCompiler *tc, int local)
+{
+    return tc->closure != NULL ? tc->frameBase + local : local - tc->trace->height;
+}
+
+static void getLocal(TraceCompiler *tc, int local)
+{
+    Assembler *as = &tc->as;
+    int top = tc->height++;
+    int index = stackIndex(tc, local);
+    if (index >= 0)
+    {
+        TraceSlot *source = &tc->stack[index];
+        if (source->kind == SLOT_XMM && top < SLOT_REGISTERS)
+        {
+            sseRegisters(as, SSE_MOV, top, index);
+            setXmm(tc, top);
+        }
+        else if (source->kind == SLOT_CONSTANT)
+        {
+            tc->stack[top] = *source;
+        }
+        else
+        {
+            boxValue(tc, index, RAX);
+            storeSlot(tc, top, RAX, source->number);
+        }
+        return;
+    }
+
+    int promoted = promotedIndex(tc, local);
+    if (promoted >= 0)
+    {
+        if (top < SLOT_REGISTERS)
+        {
+            sseRegisters(as, SSE_MOV, top, PROMOTED_XMM + promoted);
+            setXmm(tc, top);
+        }
+        else
+        {
+            movFromXmm(as, RAX, PROMOTED_XMM + promoted);
+            storeSlot(tc, top, RAX, true);
+        }
+        return;
+    }
+
+    load(as, RAX, R12, slotOffset(local));
+    storeSlot(tc, top, RAX, false);
+}
+
+static void setLocal(TraceCompiler *tc, TraceStep *step, int local)
+{
+    Assembler *as = &tc->as;
+    int top = tc->height - 1;
+    int index = stackIndex(tc, local);
+    TraceSlot *value = &tc->stack[top];
+    if (index >= 0)
+    {
+        if (index == top)
+        {
+            return;
+        }
+        if (tc->capturing || value->kind == SLOT_MEMORY || (value->kind == SLOT_XMM && index >= SLOT_REGISTERS))
+        {
+            boxValue(tc, top, RAX);
+            storeSlot(tc, index, RAX, value->number);
+        }
+        else if (value->kind == SLOT_XMM)
+        {
+            sseRegisters(as, SSE_MOV, index, top);
+            setXmm(tc, index);
+        }
+        else
+        {
+            tc->stack[index] = *value;
+        }
+        return;
+    }
+
+    int promoted = promotedIndex(tc, local);
+    if (promoted >= 0)
+    {
+        int xmm = numberOperand(tc, top, SCRATCH_A, step->offset);
+        sseRegisters(as, SSE_MOV, PROMOTED_XMM + promoted, xmm);
+        return;
+    }
+
+    boxValue(tc, top, RAX);
+    store(as, R12, slotOffset(local), RAX);
+}
+
+static void addConstantToLocal(TraceCompiler *tc, TraceStep *step, int local, Value constant)
+{
+    Assembler *as = &tc->as;
+    int index = stackIndex(tc, local);
+    int promoted = promotedIndex(tc, local);
+    if (promoted >= 0)
+    {
+        movImmediate(as, RAX, constant);
+        movToXmm(as, SCRATCH_B, RAX);
+        sseRegisters(as, SSE_ADD, PROMOTED_XMM + promoted, SCRATCH_B);
+    }
+    else if (index >= 0 && !tc->capturing)
+    {
+        int xmm = numberOperand(tc, index, SCRATCH_A, step->offset);
+        movImmediate(as, RAX, constant);
+        movToXmm(as, SCRATCH_B, RAX);
+        sseRegisters(as, SSE_ADD, xmm, SCRATCH_B);
+        setNumber(tc, index, xmm);
+    }
+    else
+    {
+        Register frameBase = index >= 0 ? RBX : R12;
+        int32_t offset = slotOffset(index >= 0 ? index : local);
+        load(as, RAX, frameBase, offset);
+        exitOn(tc, jumpIfNotNumber(as, RAX), step->offset);
+        movToXmm(as, SCRATCH_A, RAX);
+        movImmediate(as, RAX, constant);
+        movToXmm(as, SCRATCH_B, RAX);
+        sseRegisters(as, SSE_ADD, SCRATCH_A, SCRATCH_B);
+        movFromXmm(as, RAX, SCRATCH_A);
+        store(as, frameBase, offset, RAX);
+        if (index >= 0)
+        {
+            tc->stack[index].number = true;
+        }
+    }
+}
+
+/**
+ * Unbox the instance in the stack slot `index` into `rax` and guard its shape
+ */
+static void guardShape(TraceCompiler *tc, TraceStep *step, int index)
+{
+    Assembler *as = &tc->as;
+    int slow[2];
+    boxValue(tc, index, RAX);
+    loadObject(as, OBJ_INSTANCE, slow);
+    exitOn(tc, slow[0], step->offset);
+    exitOn(tc, slow[1], step->offset);
+    load(as, RDX, RAX, offsetof(ObjInstance, shape));
+    movImmediate(as, RCX, (uint64_t)(uintptr_t)step->shape);
+    aluRegisters(as, ALU_CMP, RDX, RCX);
+    exitOn(tc, emitJump(as, CC_NE), step->offset);
+    addObject(tc->trace, (Obj *)step->shape);
+}
+
+/**
+ * Guard the shape of the instance in the stack slot `index`, then load its fields into `rax`
+ */
+static void loadShapedFields(TraceCompiler *tc, TraceStep *step, int index)
+{
+    guardShape(tc, step, index);
+    load(&tc->as, RAX, RAX, offsetof(ObjInstance, fields));
+}
+
+/**
+ * Guard that the call of `step` runs `step->callee` and go on with the instructions of the callee, which work on the
+ * stack slots from the callee or the receiver up
+ *
+ * @details A receiver with the recorded shape has the recorded class, and the methods of a class never change.
+ */
+static void inlineCall(TraceCompiler *tc, TraceStep *step, int argCount)
+{
+    Assembler *as = &tc->as;
+    int callee = tc->height - argCount - 1;
+    if (step->op == OP_INVOKE)
+    {
+        guardShape(tc, step, callee);
+    }
+    else
+    {
+        boxValue(tc, callee, RAX);
+        movImmediate(as, RCX, OBJ_VAL(step->callee));
+        aluRegisters(as, ALU_CMP, RAX, RCX);
+        exitOn(tc, emitJump(as, CC_NE), step->offset);
+    }
+    addObject(tc->trace, (Obj *)step->callee);
+
+    tc->trace->inlines = true;
+    tc->closure = step->callee;
+    tc->frameBase = callee;
+    tc->returnOffset = step->offset + instructionLength(tc->chunk, step->offset);
+    tc->chunk = &step->callee->function->chunk;
+}
+
+/**
+ * `OP_RETURN` of an inlined function: its result replaces the callee or the receiver
+ */
+static void returnFromInline(TraceCompiler *tc)
+{
+    Assembler *as = &tc->as;
+    int top = tc->height - 1;
+    int result = tc->frameBase;
+    TraceSlot *value = &tc->stack[top];
+    if (value->kind == SLOT_XMM && result < SLOT_REGISTERS)
+    {
+        sseRegisters(as, SSE_MOV, result, top);
+        setXmm(tc, result);
+    }
+    else if (value->kind == SLOT_CONSTANT)
+    {
+        tc->stack[result] = *value;
+    }
+    else
+    {
+        boxValue(tc, top, RAX);
+        storeSlot(tc, result, RAX, value->number);
+    }
+
+    tc->height = result + 1;
+    tc->closure = NULL;
+    tc->chunk = tc->traceChunk;
+}
+
+static void compileStep(TraceCompiler *tc, TraceStep *step)
+{
+    Assembler *as = &tc->as;
+    uint8_t *ip = &tc->chunk->code[step->offset];
+    Value *constants = tc->chunk->constants.values;
+    int top = tc->height - 1;
+
+    switch (step->op)
+    {
+    case OP_CONSTANT:
+        pushConstant(tc, constants[ip[1]]);
+        break;
+    case OP_NIL:
+        pushConstant(tc, NIL_VAL);
+        break;
+    case OP_TRUE:
+        pushConstant(tc, TRUE_VAL);
+        break;
+    case OP_FALSE:
+        pushConstant(tc, FALSE_VAL);
+        break;
+    case OP_POP:
+        tc->height--;
+        break;
+    case OP_GET_LOCAL:
+        getLocal(tc, ip[1]);
+        break;
+    case OP_SET_LOCAL:
+        setLocal(tc, step, ip[1]);
+        break;
+    case OP_GET_GLOBAL:
+        exitOn(tc, loadGlobal(as, readShort(ip)), step->offset);
+        storeSlot(tc, tc->height++, RAX, false);
+        break;
+    case OP_DEFINE_GLOBAL:
+        movImmediate(as, RDX, (uint64_t)(uintptr_t)&vm->globalValues.values);
+        load(as, RDX, RDX, 0);
+        boxValue(tc, top, RAX);
+        store(as, RDX, readShort(ip) * (int)sizeof(Value), RAX);
+        tc->height--;
+        break;
+    case OP_SET_GLOBAL:
+        exitOn(tc, loadGlobal(as, readShort(ip)), step->offset);
+        boxValue(tc, top, RAX);
+        store(as, RDX, readShort(ip) * (int)sizeof(Value), RAX);
+        break;
+    case OP_GET_UPVALUE:
+        loadUpvalueLocation(as, ip[1]);
+        load(as, RAX, RAX, 0);
+        storeSlot(tc, tc->height++, RAX, false);
+        break;
+    case OP_SET_UPVALUE:
+    {
+        int barrier[2];
+        loadUpvalue(as, ip[1]);
+        boxValue(tc, top, RDX);
+        if (!tc->stack[top].number)
+        {
+            guardWriteBarrier(as, RAX, RDX, barrier);
+            exitOn(tc, barrier[0], step->offset); // the interpreter runs the barrier
+            exitOn(tc, barrier[1], step->offset);
+        }
+        load(as, RAX, RAX, offsetof(ObjUpvalue, location));
+        store(as, RAX, 0, RDX);
+        break;
+    }
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+        compareEquality(tc, step);
+        if (step->op == OP_NOT_EQUAL)
+        {
+            emitBytes(as, "\x34\x01", 2); // xor al, 1
+        }
+        boxBool(as);
+        tc->height--;
+        storeSlot(tc, tc->height - 1, RAX, false);
+        break;
+    case OP_GREATER:
+        comparison(tc, step, false, CC_A);
+        break;
+    case OP_LESS:
+        comparison(tc, step, true, CC_A);
+        break;
+    case OP_GREATER_EQUAL:
+        comparison(tc, step, true, CC_BE);
+        break;
+    case OP_LESS_EQUAL:
+        comparison(tc, step, false, CC_BE);
+        break;
+    case OP_ADD:
+        if (step->topNumber && step->belowNumber)
+        {
+            arithmetic(tc, step, SSE_ADD);
+        }
+        else
+        {
+            callVm(tc, step, stepInstruction);
+        }
+        break;
+    case OP_SUBTRACT:
+        arithmetic(tc, step, SSE_SUB);
+        break;
+    case OP_MULTIPLY:
+        arithmetic(tc, step, SSE_MUL);
+        break;
+    case OP_DIVIDE:
+        arithmetic(tc, step, SSE_DIV);
+        break;
+    case OP_NOT:
+    {
+        int falsey = knownFalsey(&tc->stack[top]);
+        if (falsey >= 0)
+        {
+            tc->height--;
+            pushConstant(tc, BOOL_VAL(falsey));
+        }
+        else
+        {
+            testFalsey(tc);
+            setCondition(as, CC_B, RAX);
+            boxBool(as);
+            storeSlot(tc, top, RAX, false);
+        }
+        break;
+    }
+    case OP_NEGATE:
+    {
+        int xmm = numberOperand(tc, top, SCRATCH_A, step->offset);
+        movFromXmm(as, RAX, xmm);
+        emitBytes(as, "\x48\x0f\xba\xf8\x3f", 5); // btc rax, 63
+        if (top < SLOT_REGISTERS)
+        {
+            movToXmm(as, top, RAX);
+            setXmm(tc, top);
+        }
+        else
+        {
+            storeSlot(tc, top, RAX, true);
+        }
+        break;
+    }
+    case OP_JUMP:
+        break;
+    case OP_JUMP_IF_FALSE:
+    {
+        int target = jumpTarget(tc->chunk, step->offset);
+        int falsey = knownFalsey(&tc->stack[top]);
+        if (falsey >= 0)
+        {
+            guardKnownBranch(tc, step, falsey, target);
+        }
+        else
+        {
+            testFalsey(tc);
+            guardBranch(tc, step, CC_B, target);
+        }
+        break;
+    }
+    case OP_LOOP:
+        if (step != tc->last)
+        {
+            break; // a back-edge within the loop, like a jump
+        }
+        if (tc->height != 0)
+        {
+            tc->failed = true;
+        }
+        else if (tc->loopStart >= 0)
+        {
+            patchJump(as, emitJump(as, -1), tc->loopStart);
+        }
+        else
+        {
+            movImmediate(as, RAX, (uint64_t)(uintptr_t)tc->trace->loop);
+            emitBytes(as, "\xff\xe0", 2); // jmp rax
+        }
+        break;
+    case OP_JUMP_IF_EQUAL:
+    case OP_JUMP_IF_NOT_EQUAL:
+        compareEquality(tc, step);
+        tc->height -= 2;
+        emitBytes(as, "\x84\xc0", 2); // test al, al
+        guardBranch(tc, step, step->op == OP_JUMP_IF_EQUAL ? CC_NE : CC_E, jumpTarget(tc->chunk, step->offset));
+        break;
+    case OP_JUMP_IF_LESS:
+        compareAndJump(tc, step, true, CC_A);
+        break;
+    case OP_JUMP_IF_NOT_LESS:
+        compareAndJump(tc, step, true, CC_BE);
+        break;
+    case OP_JUMP_IF_GREATER:
+        compareAndJump(tc, step, false, CC_A);
+        break;
+    case OP_JUMP_IF_NOT_GREATER:
+        compareAndJump(tc, step, false, CC_BE);
+        break;
+    case OP_ADD_CONSTANT_TO_LOCAL:
+        addConstantToLocal(tc, step, ip[1], constants[ip[2]]);
+        break;
+    case OP_GET_PROPERTY:
+        if (step->shape == NULL)
+        {
+            callVm(tc, step, stepInstruction);
+            break;
+        }
+        loadShapedFields(tc, step, top);
+        load(as, RAX, RAX, slotOffset(step->field));
+        storeSlot(tc, top, RAX, false);
+        break;
+    case OP_SET_PROPERTY:
+    {
+        if (step->shape == NULL)
+        {
+            callVm(tc, step, stepInstruction);
+            break;
+        }
+        int barrier[2];
+        guardShape(tc, step, top - 1);
+        boxValue(tc, top, RDX);
+        if (!tc->stack[top].number)
+        {
+            guardWriteBarrier(as, RAX, RDX, barrier);
+            exitOn(tc, barrier[0], step->offset); // the interpreter runs the barrier
+            exitOn(tc, barrier[1], step->offset);
+        }
+        load(as, RAX, RAX, offsetof(ObjInstance, fields));
+        store(as, RAX, slotOffset(step->field), RDX);
+        tc->height--;
+        storeSlot(tc, top - 1, RDX, tc->stack[top].number);
+        break;
+    }
+    case OP_CALL:
+        if (step->callee != NULL)
+        {
+            inlineCall(tc, step, ip[1]);
+            break;
+        }
+        callVm(tc, step, callInstruction);
+        break;
+    case OP_INVOKE:
+        if (step->callee != NULL)
+        {
+            inlineCall(tc, step, ip[2]);
+            break;
+        }
+        callVm(tc, step, callInstruction);
+        break;
+    case OP_SUPER_INVOKE:
+        callVm(tc, step, callInstruction);
+        break;
+    case OP_RETURN:
+        returnFromInline(tc); // the traced function never returns within a trace
+        break;
+    default:
+        callVm(tc, step, stepInstruction);
+        break;
+    }
+}
+
+/**
+ * `pop r14, r13, r12, rbx, rbp` and `ret`, the epilogue of every fragment of a trace
+ */
+static void emitEpilogue(TraceCompiler *tc)
+{
+    tc->epilogue = tc->as.count;
+    emitBytes(&tc->as, "\x41\x5e\x41\x5d\x41\x5c\x5b\x5d\xc3", 9);
+}
+
+/**
+ * Patch the 64-bit immediate of the `mov` at `offset`
+ */
+static void patchImmediate(Assembler *as, int offset, void *value)
+{
+    uint64_t address = (uint64_t)(uintptr_t)value;
+    memcpy(&as->code[offset], &address, sizeof(address));
+}
+
+/**
+ * Emit the side exits after the body and map the code
+ *
+ * @details A side exit writes the stack back, then jumps through `exit->target`: to the code that follows, which writes
+ * the promoted locals, `frame->ip` and `vm->stackTop` back and leaves, or to a side trace compiled later.
+ * @return the fragment, linked into its trace, or NULL when the code can't be mapped
+ */
+static TraceFragment *finishFragment(TraceCompiler *tc)
+{
+    Assembler *as = &tc->as;
+    int *targets = malloc(sizeof(int) * (tc->exitCount > 0 ? tc->exitCount : 1) * 3);
+    for (int i = 0; i < tc->exitCount; i++)
+    {
+        PendingExit *pending = &tc->exits[i];
+        patchJumpHere(as, pending->jump);
+        for (int j = 0; j < pending->height; j++)
+        {
+            if (pending->stack[j].kind != SLOT_MEMORY)
+            {
+                boxSlot(as, &pending->stack[j], j, RAX);
+                store(as, RBX, slotOffset(j), RAX);
+            }
+        }
+        movImmediate(as, RAX, 0);
+        targets[i * 3] = as->count - 8;
+        emitBytes(as, "\xff\x20", 2); // jmp [rax]
+
+        targets[i * 3 + 1] = as->count;
+        spillPromoted(tc);
+        if (pending->closure == NULL)
+        {
+            spillState(as, 0, tc->traceChunk, pending->offset, pending->height);
+        }
+        else
+        {
+            pushInlinedFrame(tc, pending);
+        }
+        movImmediate(as, RAX, (uint64_t)(uintptr_t)&tc->trace->lastExit);
+        movImmediate(as, RCX, 0);
+        targets[i * 3 + 2] = as->count - 8;
+        store(as, RAX, 0, RCX);
+        emitByte(as, 0xb8); // mov eax, JIT_CONTINUE
+        emit32(as, (uint32_t)JIT_CONTINUE);
+        patchJump(as, emitJump(as, -1), tc->epilogue);
+    }
+
+    TraceExit *exits = malloc(sizeof(TraceExit) * (tc->exitCount > 0 ? tc->exitCount : 1));
+    for (int i = 0; i < tc->exitCount; i++)
+    {
+        patchImmediate(as, targets[i * 3], &exits[i].target);
+        patchImmediate(as, targets[i * 3 + 2], &exits[i]);
+    }
+
+    uint8_t *code = tc->failed ? NULL : mapCode(as);
+    TraceFragment *fragment = NULL;
+    if (code == NULL)
+    {
+        free(exits);
+    }
+    else
+    {
+        for (int i = 0; i < tc->exitCount; i++)
+        {
+            exits[i].target = code + targets[i * 3 + 1];
+            exits[i].offset = tc->exits[i].offset;
+            exits[i].height = tc->exits[i].height;
+            exits[i].hits = tc->exits[i].closure == NULL ? 0 : TRACE_THRESHOLD; // side traces start in the traced frame
+        }
+
+        fragment = malloc(sizeof(TraceFragment));
+        fragment->code = code;
+        fragment->size = as->count;
+        fragment->exits = exits;
+        fragment->exitCount = tc->exitCount;
+        fragment->next = tc->trace->fragments;
+        tc->trace->fragments = fragment;
+    }
+
+    for (int i = 0; i < tc->exitCount; i++)
+    {
+        free(tc->exits[i].stack);
+    }
+    free(tc->exits);
+    free(targets);
+    freeAssembler(as);
+    return fragment;
+}
+
+static void compileSteps(TraceCompiler *tc, Recording *recording)
+{
+    tc->last = &recording->steps[recording->count - 1];
+    for (int i = 0; i < recording->count; i++)
+    {
+        compileStep(tc, &recording->steps[i]);
+    }
+}
+
+/**
+ * Promote the locals below the header that the loop reads or writes and that were numbers every time
+ */
+static void choosePromoted(Trace *trace, Chunk *chunk, Recording *recording)
+{
+    trace->promotedCount = 0;
+    if (recording->capturing)
+    {
+        return;
+    }
+
+    bool used[UINT8_COUNT] = {false};
+    bool rejected[UINT8_COUNT] = {false};
+    rejected[0] = true; // the closure or the receiver
+    for (int i = 0; i < recording->count; i++)
+    {
+        TraceStep *step = &recording->steps[i];
+        if (step->closure != NULL)
+        {
+            continue;
+        }
+
+        int local = chunk->code[step->offset + 1];
+        bool number;
+        switch (step->op)
+        {
+        case OP_GET_LOCAL:
+        case OP_ADD_CONSTANT_TO_LOCAL:
+            number = step->resultNumber;
+            break;
+        case OP_SET_LOCAL:
+            number = step->topNumber;
+            break;
+        default:
+            continue;
+        }
+
+        if (local < trace->height)
+        {
+            used[local] = true;
+            rejected[local] |= !number;
+        }
+    }
+
+    for (int local = 0; local < trace->height && local < UINT8_COUNT; local++)
+    {
+        if (used[local] && !rejected[local] && trace->promotedCount < PROMOTED_MAX)
+        {
+            trace->promoted[trace->promotedCount++] = (uint8_t)local;
+        }
+    }
+}
+
+static void freeTrace(Trace *trace)
+{
+    TraceFragment *fragment = trace->fragments;
+    while (fragment != NULL)
+    {
+        TraceFragment *next = fragment->next;
+        unmapCode(fragment->code, fragment->size);
+        free(fragment->exits);
+        free(fragment);
+        fragment = next;
+    }
+    free(trace->objects);
+    free(trace);
+}
+
+/**
+ * @details The entry loads the promoted locals, leaving right away when one of them is not a number, then falls into the
+ * loop body.
+ */
+static Trace *compileTrace(ObjFunction *function, Recording *recording, int header, LoopExtent *extent, int height)
+{
+    Trace *trace = malloc(sizeof(Trace));
+    trace->header = header;
+    trace->extent = *extent;
+    trace->height = height;
+    trace->lastExit = NULL;
+    trace->inlines = false;
+    trace->fragments = NULL;
+    trace->objects = NULL;
+    trace->objectCount = 0;
+    trace->objectCapacity = 0;
+    choosePromoted(trace, &function->chunk, recording);
+
+    TraceCompiler tc;
+    initTraceCompiler(&tc, trace, function, recording, 0);
+    Assembler *as = &tc.as;
+    emitBytes(as, "\x55\x53\x41\x54\x41\x55\x41\x56", 8); // push rbp, rbx, r12, r13, r14, the stack stays aligned
+    movRegister(as, R13, RDI);
+    load(as, R12, R13, offsetof(CallFrame, slots));
+    emitMemory(as, true, 0x8d, RBX, R12, slotOffset(height)); // lea rbx, [r12 + height]
+    movImmediate(as, R14, QNAN);
+
+    int notNumbers[PROMOTED_MAX];
+    for (int i = 0; i < trace->promotedCount; i++)
+    {
+        load(as, RAX, R12, slotOffset(trace->promoted[i]));
+        notNumbers[i] = jumpIfNotNumber(as, RAX);
+        movToXmm(as, PROMOTED_XMM + i, RAX);
+    }
+    int body = emitJump(as, -1);
+    for (int i = 0; i < trace->promotedCount; i++)
+    {
+        patchJumpHere(as, notNumbers[i]);
+    }
+    emitByte(as, 0xb8); // mov eax, JIT_CONTINUE
+    emit32(as, (uint32_t)JIT_CONTINUE);
+    emitEpilogue(&tc);
+
+    patchJumpHere(as, body);
+    tc.loopStart = as->count;
+    compileSteps(&tc, recording);
+    int loopStart = tc.loopStart;
+    TraceFragment *fragment = finishFragment(&tc);
+    if (fragment == NULL)
+    {
+        freeTrace(trace);
+        return NULL;
+    }
+
+    trace->entry = (int (*)(CallFrame *))(void *)fragment->code;
+    trace->loop = fragment->code + loopStart;
+    return trace;
+}
+
+/**
+ * Compile the recording made from `exit` back to the header and make the exit jump to it
+ */
+static void compileSideTrace(ObjFunction *function, Trace *trace, Recording *recording, TraceExit *exit)
+{
+    TraceCompiler tc;
+    initTraceCompiler(&tc, trace, function, recording, exit->height);
+    if (tc.capturing && trace->promotedCount > 0)
+    {
+        freeAssembler(&tc.as);
+        return; // a closure of the side path could capture a promoted local
+    }
+
+    Assembler *as = &tc.as;
+    int body = emitJump(as, -1);
+    emitEpilogue(&tc);
+    patchJumpHere(as, body);
+    compileSteps(&tc, recording);
+    TraceFragment *fragment = finishFragment(&tc);
+    if (fragment != NULL)
+    {
+        exit->target = fragment->code;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Running
+
+/**
+ * @return a closure captured one of the promoted locals of the frame, the trace would not see its writes
+ */
+static bool capturesPromoted(Trace *trace, CallFrame *frame)
+{
+    for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL && upvalue->location >= frame->slots;
+         upvalue = upvalue->next)
+    {
+        for (int i = 0; i < trace->promotedCount; i++)
+        {
+            if (upvalue->location == &frame->slots[trace->promoted[i]])
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Record from the side exit the trace just took, at `frame->ip`, back to the header and compile it
+ *
+ * @param completed set when the recording reached the header
+ */
+static int recordSideTrace(ObjFunction *function, Trace *trace, TraceExit *exit, CallFrame *frame, bool *completed)
+{
+    Recording *recording = beginRecording();
+    int result = record(recording, frame, trace->header, &trace->extent, trace->height);
+    *completed = result == JIT_CONTINUE && !recording->aborted;
+    if (*completed)
+    {
+        compileSideTrace(function, trace, recording, exit);
+        rememberObject((Obj *)function);
+    }
+    endRecording(recording);
+    return result;
+}
+
+/**
+ * @details The calls a trace runs can move the frames and the stack, the running frame is read again after each run.
+ * A trace is entered with room for `TRACE_MAX_HEIGHT` more slots and, for an inlined call, one more frame.
+ */
+static int enterTrace(ObjFunction *function, Trace *trace)
+{
+    for (;;)
+    {
+        CallFrame *frame = &vm->frames[vm->frameCount - 1];
+        if (vm->stackTop - frame->slots != trace->height || capturesPromoted(trace, frame))
+        {
+            return JIT_CONTINUE;
+        }
+        if (vm->frameCount == vm->frameCapacity || vm->stackTop + TRACE_MAX_HEIGHT > vm->stackEnd)
+        {
+            if (!growStack((int)(vm->stackTop - vm->stack) + TRACE_MAX_HEIGHT))
+            {
+                return JIT_CONTINUE;
+            }
+            frame = &vm->frames[vm->frameCount - 1];
+        }
+
+        trace->lastExit = NULL;
+        int result = trace->entry(frame);
+        TraceExit *exit = trace->lastExit;
+        if (result != JIT_CONTINUE || exit == NULL || exit->hits >= TRACE_THRESHOLD ||
+            ++exit->hits < TRACE_THRESHOLD)
+        {
+            return result;
+        }
+
+        bool completed;
+        result = recordSideTrace(function, trace, exit, &vm->frames[vm->frameCount - 1], &completed);
+        if (result != JIT_CONTINUE || !completed)
+        {
+            return result;
+        }
+    }
+}
+
+int runTrace(HotLoop *loop)
+{
+    if (vm->traceNesting == TRACE_NESTING_MAX)
+    {
+        return JIT_CONTINUE;
+    }
+
+    CallFrame *frame = &vm->frames[vm->frameCount - 1];
+    ObjFunction *function = frame->closure->function;
+    if (loop->trace == NULL)
+    {
+        LoopExtent extent;
+        if (!findLoopExtent(&function->chunk, loop->header, &extent))
+        {
+            return JIT_CONTINUE;
+        }
+
+        int height = (int)(vm->stackTop - frame->slots);
+        Recording *recording = beginRecording();
+        int result = record(recording, frame, loop->header, &extent, height);
+        if (result == JIT_CONTINUE && !recording->aborted)
+        {
+            Trace *trace = compileTrace(function, recording, loop->header, &extent, height);
+            lockHeap();
+            loop->trace = trace;
+            unlockHeap();
+            rememberObject((Obj *)function); // the trace keeps objects of the recording alive, they may be young
+        }
+        endRecording(recording);
+        if (result != JIT_CONTINUE || loop->trace == NULL)
+        {
+            return result;
+        }
+    }
+
+    return enterTrace(function, loop->trace);
+}
+
+void markTraces(ObjFunction *function)
+{
+    for (HotLoop *loop = function->hotLoops; loop != NULL; loop = loop->next)
+    {
+        if (loop->trace != NULL)
+        {
+            for (int i = 0; i < loop->trace->objectCount; i++)
+            {
+                markObject(loop->trace->objects[i]);
+            }
+        }
+    }
+}
+
+void markTraceRoots()
+{
+    for (Recording *recording = recordings; recording != NULL; recording = recording->enclosing)
+    {
+        for (int i = 0; i < recording->count; i++)
+        {
+            markObject((Obj *)recording->steps[i].shape);
+            markObject((Obj *)recording->steps[i].callee);
+        }
+    }
+}
+
+void freeTraces(ObjFunction *function)
+{
+    HotLoop *loop = function->hotLoops;
+    while (loop != NULL)
+    {
+        HotLoop *next = loop->next;
+        if (loop->trace != NULL)
+        {
+            freeTrace(loop->trace);
+        }
+        free(loop);
+        loop = next;
+    }
+    function->hotLoops = NULL;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef clox_trace_h
+#define clox_trace_h
+
+#include "common.h"
+#include "object.h"
+
+#ifdef TRACING_JIT
+
+/**
+ * A loop of a function, found by the offset of its header: the target of the `OP_LOOP` that closes it
+ */
+typedef struct HotLoop
+{
+    int header;
+    /**
+     * Back-edges taken, counted up to `TRACE_THRESHOLD` when the next iteration gets recorded
+     */
+    int hotness;
+    /**
+     * NULL until the loop is recorded, and for good when its recording fails
+     */
+    struct Trace *trace;
+    struct HotLoop *next;
+} HotLoop;
+
+/**
+ * @return the counter of the loop of `function` starting at `header`, created on its first back-edge
+ */
+HotLoop *findHotLoop(ObjFunction *function, int header);
+/**
+ * Run the hot loop of the running frame, stopped at its header, with its trace: recorded and compiled first when it
+ * has none. The state of the frame must be spilled, the interpreter goes on at `frame->ip`.
+ *
+ * @return `JIT_CONTINUE`, or the `InterpretResult` that ends `run()`
+ */
+int runTrace(HotLoop *loop);
+/**
+ * Mark the shapes and the functions the traces of `function` guard on
+ */
+void markTraces(ObjFunction *function);
+/**
+ * Mark the shapes and the functions observed by the recordings in progress
+ */
+void markTraceRoots();
+void freeTraces(ObjFunction *function);
+
+#endif
+
+#endif
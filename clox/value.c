@@ -20,14 +20,18 @@ void writeValueArray(ValueArray *array, Value value)
         array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
     }
 
+    lockHeap(); // the marking thread reads the values up to the count
     array->values[array->count] = value;
     array->count++;
+    unlockHeap();
 }
 
 void freeValueArray(ValueArray *array)
 {
     FREE_ARRAY(Value, array->values, array->capacity);
+    lockHeap();
     initValueArray(array);
+    unlockHeap();
 }
 
 void printValue(Value value)
@@ -72,6 +76,8 @@ void printValue(Value value)
         return printObj(value);
         break;
     }
+    case VAL_UNDEFINED:
+        break;
     }
 #endif
 }
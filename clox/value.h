@@ -7,6 +7,7 @@
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct ObjShape ObjShape;
 
 #ifdef NAN_BOXING
 
@@ -17,6 +18,7 @@ typedef struct ObjString ObjString;
 #define TAG_NIL 1   // 01
 #define TAG_FALSE 2 // 10
 #define TAG_TRUE 3  // 11
+#define TAG_UNDEFINED 4 // 100, marks global slots that are not defined yet, never a Lox value
 
 typedef uint64_t Value;
 
@@ -40,6 +42,8 @@ typedef uint64_t Value;
 #define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
 #define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
 #define NUMBER_VAL(num) numToValue(num)
 #define OBJ_VAL(obj) \
     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
@@ -65,6 +69,7 @@ typedef enum
     VAL_NIL,
     VAL_NUMBER,
     VAL_OBJ,
+    VAL_UNDEFINED, // marks global slots that are not defined yet, never a Lox value
 } ValueType;
 
 /**
@@ -96,6 +101,8 @@ typedef struct
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(value) ((Value){VAL_OBJ, {.obj = (Obj *)value}})
+#define UNDEFINED_VAL ((Value){VAL_UNDEFINED, {.number = 0}})
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #endif
 
@@ -1,57 +1,190 @@
+#define _DEFAULT_SOURCE // flockfile() is not in strict C17 mode
+
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "aot.h"
+#include "cache.h"
 #include "common.h"
 #include "compiler.h"
 // #include "chunk.h"
 // #include "value.h"
 #include "debug.h"
+#include "jit.h"
 #include "object.h"
 #include "memory.h"
+#include "trace.h"
 #include "vm.h"
 
-VM vm;
+_Thread_local VM *vm = NULL;
 
 static InterpretResult run();
 static void resetStack();
 static void runtimeError(const char *format, ...);
 static void defineNative(const char *name, NativeFn function);
 static Value peek(int distance);
-static ObjUpvalue *captureUpvalue(Value *local);
+static ObjUpvalue *captureUpvalue(Value *local, bool inFrame);
 static void closeUpvalues(Value *last);
 static bool isFalsey(Value value);
 static void concatenate();
 static bool call(ObjClosure *closure, int argCount);
+static bool callValue(Value callee, int argCount);
 static Value clockNative(int argCount, Value *args);
+#ifdef BASELINE_JIT
+static int runJit();
+#endif
+#ifdef AOT_RUNTIME
+static int runAot();
+#endif
 
-void initVM()
+/**
+ * @param frozen VM whose code and strings this one shares, or NULL
+ */
+static void initVM(VM *frozen)
 {
+    vm->frames = malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm->frameCapacity = FRAMES_INITIAL;
+    vm->stack = malloc(sizeof(Value) * STACK_INITIAL);
+    vm->stackEnd = vm->stack + STACK_INITIAL;
+    if (vm->frames == NULL || vm->stack == NULL)
+    {
+        exit(1);
+    }
     resetStack();
-    vm.objects = NULL;
-    vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1204;
+    vm->frameCells = NULL;
+    vm->frameCellBlocks = 0;
+#ifdef TRACING_JIT
+    vm->traceNesting = 0;
+#endif
+    vm->objects = NULL;
+    vm->youngObjects = NULL;
+    vm->rememberedSet = NULL;
+    vm->rememberedCount = 0;
+    vm->rememberedCapacity = 0;
+    vm->markBit = true;
+    vm->marking = false;
+    vm->sweepCursor = NULL;
+    vm->gcThreads = 1;
+    vm->markPool = NULL;
+#ifdef CONCURRENT_GC
+    vm->markingConcurrently = false;
+    atomic_init(&vm->markThreadDone, false);
+    pthread_mutex_init(&vm->heapLock, NULL);
+    vm->shadeCount = 0;
+    vm->deferredFrees = NULL;
+    vm->deferredCount = 0;
+    vm->deferredCapacity = 0;
+#endif
+    vm->bytesAllocated = 0;
+    vm->nextGC = 1024 * 1204;
+    vm->youngLimit = GC_NURSERY_SIZE;
+
+    vm->grayCount = 0;
+    vm->grayCapacity = 0;
+    vm->grayStack = NULL;
 
-    vm.grayCount = 0;
-    vm.grayCapacity = 0;
-    vm.grayStack = NULL;
+    initTable(&(vm->globalSlots));
+    initValueArray(&(vm->globalNames));
+    initValueArray(&(vm->globalValues));
+    initTable(&(vm->strings));
+    vm->sharedStrings = frozen != NULL ? &frozen->strings : NULL;
+    vm->sharedCacheCount = frozen != NULL ? frozen->sharedCacheCount : 0;
+    vm->sharedCaches = NULL;
+    if (vm->sharedCacheCount > 0)
+    {
+        vm->sharedCaches = calloc(vm->sharedCacheCount, sizeof(InlineCache)); // all empty
+        if (vm->sharedCaches == NULL)
+        {
+            exit(1);
+        }
+    }
+    vm->mappedFiles = NULL;
+    vm->lazyCompile = false;
 
-    initTable(&(vm.globals));
-    initTable(&(vm.strings));
+    vm->initString = NULL;
+    vm->initString = copyString("init", 4);
 
-    vm.initString = NULL;
-    vm.initString = copyString("init", 4);
+#ifdef DEBUG_COUNT_DISPATCH
+    vm->dispatchCount = 0;
+#endif
 
     defineNative("clock", clockNative);
+    if (frozen != NULL)
+    {
+        // the code indexes globals by the slots of `frozen`, the natives above took the same ones
+        for (int i = 0; i < frozen->globalNames.count; i++)
+        {
+            globalSlot(AS_STRING(frozen->globalNames.values[i]));
+        }
+    }
+}
+
+static VM *createVM(VM *frozen)
+{
+    VM *instance = malloc(sizeof(VM));
+    if (instance == NULL)
+    {
+        exit(1);
+    }
+
+    VM *previous = vm;
+    vm = instance;
+    initVM(frozen);
+    vm = previous;
+    return instance;
+}
+
+VM *newVM()
+{
+    return createVM(NULL);
+}
+
+VM *newSharingVM(VM *frozen)
+{
+    return createVM(frozen);
+}
+
+void freezeVM(VM *instance)
+{
+    VM *previous = vm;
+    vm = instance;
+    freezeObjects();
+    vm = previous;
 }
 
-void freeVM()
+static void releaseVM()
 {
-    freeTable(&(vm.globals));
-    freeTable(&(vm.strings));
-    vm.initString = NULL;
+#ifdef DEBUG_COUNT_DISPATCH
+    fprintf(stderr, "dispatches: %llu\n", (unsigned long long)vm->dispatchCount);
+#endif
+
+    freeTable(&(vm->globalSlots));
+    freeValueArray(&(vm->globalNames));
+    freeValueArray(&(vm->globalValues));
+    freeTable(&(vm->strings));
+    free(vm->sharedCaches);
+    vm->initString = NULL;
     freeObjects();
+    unmapBytecode();
+    free(vm->frames);
+    free(vm->stack);
+    for (int i = 0; i < vm->frameCellBlocks; i++)
+    {
+        free(vm->frameCells[i]);
+    }
+    free(vm->frameCells);
+}
+
+void freeVM(VM *instance)
+{
+    VM *previous = vm;
+    vm = instance;
+    releaseVM();
+    vm = previous == instance ? NULL : previous;
+    free(instance);
 }
 
 static Value clockNative(int argCount, Value *args)
@@ -60,40 +193,302 @@ static Value clockNative(int argCount, Value *args)
 }
 
 /**
- * Execute the given chunk of instructions
+ * Run the frame `call()` just pushed on an empty call stack to its return, which leaves its result on the stack
  */
-InterpretResult interpret(const char *source)
+static InterpretResult execute()
 {
-    ObjFunction *function = compile(source);
-    if (function == NULL)
+#ifdef BASELINE_JIT
+    int result = runJit();
+    if (result != JIT_CONTINUE)
     {
-        return INTERPRET_COMPILE_ERROR;
+        return (InterpretResult)result;
+    }
+#elif defined(AOT_RUNTIME)
+    int result = runAot();
+    if (result != JIT_CONTINUE)
+    {
+        return (InterpretResult)result;
     }
+#endif
+    return run();
+}
 
+/**
+ * Execute the given chunk of instructions
+ */
+static InterpretResult runFunction(ObjFunction *function)
+{
     push(OBJ_VAL(function));
     ObjClosure *closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
     call(closure, 0);
 
-    return run();
+#ifdef AOT_RUNTIME
+    if (!attachAot(function))
+    {
+        fprintf(stderr, "Translated functions don't match the script, running it interpreted.\n");
+    }
+#endif
+    InterpretResult result = execute();
+    if (result == INTERPRET_OK)
+    {
+        pop(); // the `nil` the script returns
+    }
+    return result;
+}
+
+static InterpretResult runScript(const char *source)
+{
+    ObjFunction *function = compile(source);
+    if (function == NULL)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    return runFunction(function);
+}
+
+InterpretResult interpret(VM *instance, const char *source)
+{
+    VM *previous = vm;
+    vm = instance;
+    InterpretResult result = runScript(source);
+    vm = previous;
+    return result;
+}
+
+ObjFunction *compileSource(VM *instance, const char *source)
+{
+    VM *previous = vm;
+    vm = instance;
+    ObjFunction *script = compile(source);
+    vm = previous;
+    return script;
+}
+
+ObjFunction *loadScript(VM *instance, const char *path, const char *source)
+{
+    VM *previous = vm;
+    vm = instance;
+    ObjFunction *script = source == NULL ? loadBytecode(path, NULL) : compileCached(path, source);
+    vm = previous;
+    return script;
+}
+
+bool saveScript(VM *instance, const char *path, const char *source, ObjFunction *script)
+{
+    VM *previous = vm;
+    vm = instance;
+    bool saved = saveBytecode(path, source, script);
+    vm = previous;
+    return saved;
+}
+
+InterpretResult interpretFunction(VM *instance, ObjFunction *script)
+{
+    VM *previous = vm;
+    vm = instance;
+    InterpretResult result = runFunction(script);
+    vm = previous;
+    return result;
+}
+
+/**
+ * @details Runs to completion in the VM like a script does, so it can't be called while `instance` runs (from a native
+ * function).
+ */
+InterpretResult callGlobal(VM *instance, const char *name, int argCount, const Value *args, Value *result)
+{
+    VM *previous = vm;
+    vm = instance;
+    InterpretResult status = INTERPRET_RUNTIME_ERROR;
+    Value callee;
+    if (vm->frameCount != 0)
+    {
+        fprintf(stderr, "Can't call '%s' while the VM runs.\n", name);
+    }
+    else if (argCount < 0 || argCount > UINT8_MAX)
+    {
+        fprintf(stderr, "Can't have more than 255 arguments.\n");
+    }
+    else if (!getGlobal(instance, name, &callee))
+    {
+        fprintf(stderr, "Undefined variable '%s'.\n", name);
+    }
+    else
+    {
+        push(callee);
+        for (int i = 0; i < argCount; i++)
+        {
+            push(args[i]);
+        }
+
+        if (callValue(callee, argCount)) // a runtime error empties the stack
+        {
+            status = vm->frameCount == 0 ? INTERPRET_OK : execute(); // a native or a class without `init` returned
+            if (status == INTERPRET_OK)
+            {
+                *result = pop();
+            }
+        }
+    }
+    vm = previous;
+    return status;
+}
+
+bool getGlobal(VM *instance, const char *name, Value *value)
+{
+    VM *previous = vm;
+    vm = instance;
+    ObjString *string = copyString(name, (int)strlen(name));
+    Value slot;
+    bool found = tableGet(&(vm->globalSlots), string, &slot);
+    if (found)
+    {
+        *value = vm->globalValues.values[(int)AS_NUMBER(slot)];
+        found = !IS_UNDEFINED(*value);
+    }
+    vm = previous;
+    return found;
 }
 
 void push(Value value)
 {
-    *(vm.stackTop) = value;
-    vm.stackTop++;
+    *(vm->stackTop) = value;
+    vm->stackTop++;
 }
 
 Value pop()
 {
-    vm.stackTop--;
-    return *(vm.stackTop);
+    vm->stackTop--;
+    return *(vm->stackTop);
 }
 
 static Value peek(int distance)
 {
-    return vm.stackTop[-1 - distance];
+    return vm->stackTop[-1 - distance];
+}
+
+#ifdef BASELINE_JIT
+/**
+ * Count a call or a loop iteration of `function`, compile it once it gets hot
+ */
+static inline void countHotness(ObjFunction *function)
+{
+    if (function->hotness < JIT_THRESHOLD && ++function->hotness == JIT_THRESHOLD)
+    {
+        jitCompile(function);
+    }
+}
+
+/**
+ * Run the native code of the running frame, then of every frame it switches to that has some
+ *
+ * @return `JIT_CONTINUE` when the interpreter has to go on with the running frame, which has no native code
+ */
+static int runJit()
+{
+    for (;;)
+    {
+        CallFrame *frame = &vm->frames[vm->frameCount - 1];
+        JitCode *jit = frame->closure->function->jit;
+        if (jit == NULL)
+        {
+            return JIT_CONTINUE;
+        }
+
+        int result = jit->entry(frame);
+        if (result != JIT_CONTINUE)
+        {
+            return result;
+        }
+    }
+}
+#endif
+
+#ifdef AOT_RUNTIME
+/**
+ * Run the C code of the running frame, then of every frame it switches to that has some
+ *
+ * @return `JIT_CONTINUE` when the interpreter has to go on with the running frame, which has no C code or was entered
+ * where its C code can't resume
+ */
+static int runAot()
+{
+    for (;;)
+    {
+        CallFrame *frame = &vm->frames[vm->frameCount - 1];
+        const AotFunction *aot = frame->closure->function->aot;
+        if (aot == NULL)
+        {
+            return JIT_CONTINUE;
+        }
+
+        int result = aot->entry(frame);
+        if (result == AOT_INTERPRET)
+        {
+            return JIT_CONTINUE;
+        }
+        if (result != JIT_CONTINUE)
+        {
+            return result;
+        }
+    }
+}
+#endif
+
+/**
+ * Grow the frames to hold one more frame and the stack to hold `slotCount` slots, doubling each that is too small.
+ * Frames and open upvalues point into the stack, they are rebased when it moves.
+ *
+ * @return false past `FRAMES_MAX` frames or `STACK_MAX` slots, nothing is grown then
+ */
+bool growStack(int slotCount)
+{
+    if (vm->frameCount == FRAMES_MAX || slotCount > STACK_MAX)
+    {
+        return false;
+    }
+
+    if (vm->frameCount == vm->frameCapacity)
+    {
+        int capacity = vm->frameCapacity * 2 < FRAMES_MAX ? vm->frameCapacity * 2 : FRAMES_MAX;
+        CallFrame *frames = realloc(vm->frames, sizeof(CallFrame) * capacity);
+        if (frames == NULL)
+        {
+            exit(1);
+        }
+        vm->frames = frames;
+        vm->frameCapacity = capacity;
+    }
+
+    int capacity = (int)(vm->stackEnd - vm->stack);
+    if (slotCount > capacity)
+    {
+        while (capacity < slotCount)
+        {
+            capacity = capacity * 2 < STACK_MAX ? capacity * 2 : STACK_MAX;
+        }
+
+        Value *stack = realloc(vm->stack, sizeof(Value) * capacity);
+        if (stack == NULL)
+        {
+            exit(1);
+        }
+        for (int i = 0; i < vm->frameCount; i++)
+        {
+            vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+        }
+        for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL; upvalue = upvalue->next)
+        {
+            upvalue->location = stack + (upvalue->location - vm->stack);
+        }
+        vm->stackTop = stack + (vm->stackTop - vm->stack);
+        vm->stack = stack;
+        vm->stackEnd = stack + capacity;
+    }
+    return true;
 }
 
 /**
@@ -107,16 +502,30 @@ static bool call(ObjClosure *closure, int argCount)
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX)
+    if (closure->function->lazySource != NULL && !compileLazily(closure->function))
     {
-        runtimeError("Stack overflow.");
+        runtimeError("Can't compile '%s'.", closure->function->name->chars);
         return false;
     }
 
-    CallFrame *frame = &vm.frames[vm.frameCount++]; // Get stack frame for function being called
+    Value *slots = vm->stackTop - argCount - 1;
+    if (vm->frameCount == vm->frameCapacity || slots + closure->function->maxStack > vm->stackEnd)
+    {
+        if (!growStack((int)(slots - vm->stack) + closure->function->maxStack))
+        {
+            runtimeError("Stack overflow.");
+            return false;
+        }
+    }
+
+#ifdef BASELINE_JIT
+    countHotness(closure->function);
+#endif
+
+    CallFrame *frame = &vm->frames[vm->frameCount++]; // Get stack frame for function being called
     frame->closure = closure;
     frame->ip = closure->function->chunk.code; // Set instruction pointer to the first bytecode of function being called
-    frame->slots = vm.stackTop - argCount - 1; // Set local stack pointer of current function
+    frame->slots = vm->stackTop - argCount - 1; // Set local stack pointer of current function, the stack may have moved
     return true;
 }
 
@@ -129,15 +538,15 @@ static bool callValue(Value callee, int argCount)
         case OBJ_BOUND_METHOD:
         {
             ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
-            vm.stackTop[-argCount - 1] = bound->receiver; // Use slot 0 of method's stack for saving `this` pointer.
+            vm->stackTop[-argCount - 1] = bound->receiver; // Use slot 0 of method's stack for saving `this` pointer.
             return call(bound->method, argCount);
         }
         case OBJ_CLASS: // Invoke constructor of a class
         {
             ObjClass *klass = AS_CLASS(callee);
-            vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(klass));
+            vm->stackTop[-argCount - 1] = OBJ_VAL(newInstance(klass));
             Value initializer;
-            if (tableGet(&(klass->methods), vm.initString, &initializer))
+            if (tableGet(&(klass->methods), vm->initString, &initializer))
             {
                 return call(AS_CLOSURE(initializer), argCount);
             }
@@ -159,8 +568,8 @@ static bool callValue(Value callee, int argCount)
              */
 
             NativeFn native = AS_NATIVE(callee);
-            Value result = native(argCount, vm.stackTop - argCount);
-            vm.stackTop -= argCount + 1;
+            Value result = native(argCount, vm->stackTop - argCount);
+            vm->stackTop -= argCount + 1;
             push(result);
             return true;
         }
@@ -186,107 +595,347 @@ static bool invokeFromClass(ObjClass *klass, ObjString *name, int argCount)
     return call(AS_CLOSURE(method), argCount);
 }
 
-static bool invoke(ObjString *name, int argCount)
+/**
+ * @return the inline caches of `function`, the ones of the VM when it is frozen code
+ */
+static inline InlineCache *functionCaches(ObjFunction *function)
 {
-    Value receiver = peek(argCount);
-
-    if (!IS_INSTANCE(receiver))
+    if (function->obj.generation == GEN_SHARED)
     {
-        runtimeError("Only instances have methods.");
-        return false;
+        return vm->sharedCaches + function->sharedCacheBase;
     }
+    return function->chunk.caches;
+}
 
-    ObjInstance *instance = AS_INSTANCE(receiver);
-
-    Value value;
-    if (tableGet(&instance->fields, name, &value))
+/**
+ * @return the entry of `cache` for receivers of `shape`, or NULL on a miss
+ */
+static inline InlineCacheEntry *probeCache(InlineCache *cache, ObjShape *shape)
+{
+    for (int i = 0; i < cache->count; i++)
     {
-        vm.stackTop[-argCount - 1] = value;
-        return callValue(value, argCount);
+        if (cache->entries[i].shape == shape)
+        {
+            return &cache->entries[i];
+        }
     }
 
-    return invokeFromClass(instance->klass, name, argCount);
+    return NULL;
 }
 
-static bool bindMethod(ObjClass *klass, ObjString *name)
+/**
+ * @return whether `entry` caches a field of its shape
+ */
+static inline bool isCachedField(InlineCacheEntry *entry)
 {
-    Value method;
-    if (!tableGet(&(klass->methods), name, &method))
-    {
-        runtimeError("Undefined property '%s'.", name->chars);
-        return false;
-    }
+    return entry != NULL && entry->field >= 0 && entry->transition == NULL;
+}
 
-    ObjBoundMethod *bound = newBoundMethod(peek(0) /** Peek the instance */,
-                                           AS_CLOSURE(method));
-    pop();                // Pop the instance
-    push(OBJ_VAL(bound)); // Push the bounded method to stack before invoking it
-    return true;
+/**
+ * @return whether `entry` caches a method, its shape guarantees that no field shadows it
+ */
+static inline bool isCachedMethod(InlineCacheEntry *entry)
+{
+    return entry != NULL && entry->field < 0;
 }
 
 /**
- * Capture upvalue and save it into a linked list
+ * @return whether `entry` caches the shape `instance` moves to by adding a field, in a slot it already has room for
  */
-static ObjUpvalue *captureUpvalue(Value *local)
+static inline bool isCachedTransition(InlineCacheEntry *entry, ObjInstance *instance)
 {
-    ObjUpvalue *preUpvalue = NULL;
-    ObjUpvalue *upvalue = vm.openUpvalues;
-    while (upvalue != NULL && upvalue->location > local)
-    {
-        preUpvalue = upvalue;
-        upvalue = upvalue->next;
-    }
-    if (upvalue != NULL && upvalue->location == local)
+    return entry != NULL && entry->transition != NULL && entry->field < instance->fieldCapacity;
+}
+
+/**
+ * Remember what a property access resolved to for receivers of `shape`, instances in dictionary mode are not cached
+ *
+ * @param field slot of the field in the receiver, -1 for `method`
+ * @param transition shape of the receiver after adding the field, or NULL
+ */
+static void updateCache(InlineCache *cache, ObjShape *shape, int field, Value method, ObjShape *transition)
+{
+    if (cache->megamorphic || shape == NULL)
     {
-        return upvalue;
+        return;
     }
 
-    ObjUpvalue *createdUpvalue = newUpvalue(local);
-    createdUpvalue->next = upvalue;
-
-    if (preUpvalue == NULL)
+    InlineCacheEntry *entry = probeCache(cache, shape);
+    if (entry == NULL && cache->count == INLINE_CACHE_SIZE)
     {
-        vm.openUpvalues = createdUpvalue;
+        cache->megamorphic = true;
+        cache->count = 0;
+        return;
     }
-    else
+
+    lockHeap(); // the marking thread reads the entries up to the count
+    if (entry == NULL)
     {
-        preUpvalue->next = createdUpvalue;
+        entry = &cache->entries[cache->count++];
+        entry->shape = shape;
     }
-
-    return createdUpvalue;
+    entry->field = field;
+    entry->method = method;
+    entry->transition = transition;
+    unlockHeap();
+    rememberObject((Obj *)vm->frames[vm->frameCount - 1].closure->function); // the function owns its caches, or the VM
 }
 
 /**
- * @brief Allocate all upvalues into heap after out of scope
+ * Remember the slot of the field `name` that `instance` just resolved
  */
-static void closeUpvalues(Value *last)
+static void cacheField(InlineCache *cache, ObjInstance *instance, ObjString *name)
 {
-    while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last)
+    if (instance->shape != NULL)
     {
-        ObjUpvalue *upvalue = vm.openUpvalues;
-        upvalue->closed = *upvalue->location;
-        upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+        updateCache(cache, instance->shape, shapeSlot(instance->shape, name), NIL_VAL, NULL);
     }
 }
 
-static void defineMethod(ObjString *name)
+static bool findMethod(ObjClass *klass, ObjString *name, Value *method)
 {
-    Value method = peek(0);
-    ObjClass *kclass = AS_CLASS(peek(1));
-    tableSet(&(kclass->methods), name, method);
-    pop(); // pop the method out of stack after binding
-}
+    if (!tableGet(&(klass->methods), name, method))
+    {
+        runtimeError("Undefined property '%s'.", name->chars);
+        return false;
+    }
 
-static bool isFalsey(Value value)
-{
-    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+    return true;
 }
 
-static void concatenate()
+static bool invoke(ObjString *name, int argCount, InlineCache *cache)
 {
-    ObjString *b = AS_STRING(peek(0)); // keep this value in stack to preventing it from being garbage collected before completing the string concatenation.
-    ObjString *a = AS_STRING(peek(1)); // like above
+    Value receiver = peek(argCount);
+
+    if (!IS_INSTANCE(receiver))
+    {
+        runtimeError("Only instances have methods.");
+        return false;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(receiver);
+    InlineCacheEntry *entry = probeCache(cache, instance->shape);
+    if (isCachedMethod(entry))
+    {
+        return call(AS_CLOSURE(entry->method), argCount);
+    }
+
+    Value value;
+    if (isCachedField(entry))
+    {
+        value = instance->fields[entry->field];
+    }
+    else if (getField(instance, name, &value))
+    {
+        cacheField(cache, instance, name);
+    }
+    else
+    {
+        Value method;
+        if (!findMethod(instance->klass, name, &method))
+        {
+            return false;
+        }
+
+        updateCache(cache, instance->shape, -1, method, NULL);
+        return call(AS_CLOSURE(method), argCount);
+    }
+
+    vm->stackTop[-argCount - 1] = value;
+    return callValue(value, argCount);
+}
+
+/**
+ * @return the frame cell of the stack slot `slot`, its block is allocated on first use
+ */
+static FrameCell *frameCell(Value *slot)
+{
+    int index = (int)(slot - vm->stack);
+    int block = index / FRAME_CELL_BLOCK;
+    if (block >= vm->frameCellBlocks)
+    {
+        FrameCell **blocks = realloc(vm->frameCells, sizeof(FrameCell *) * (block + 1));
+        if (blocks == NULL)
+        {
+            exit(1);
+        }
+        for (int i = vm->frameCellBlocks; i <= block; i++)
+        {
+            blocks[i] = NULL;
+        }
+        vm->frameCells = blocks;
+        vm->frameCellBlocks = block + 1;
+    }
+
+    if (vm->frameCells[block] == NULL)
+    {
+        vm->frameCells[block] = malloc(sizeof(FrameCell) * FRAME_CELL_BLOCK);
+        if (vm->frameCells[block] == NULL)
+        {
+            exit(1);
+        }
+    }
+    return &vm->frameCells[block][index % FRAME_CELL_BLOCK];
+}
+
+/**
+ * Replace the instance on top of the stack with `method` bound to it
+ *
+ * @param inFrame bind into the frame cell of the slot of the instance instead of the heap, see `OP_GET_PROPERTY_FRAME`
+ */
+static void bindToInstance(Value method, bool inFrame)
+{
+    ObjBoundMethod *bound;
+    if (inFrame)
+    {
+        bound = &frameCell(vm->stackTop - 1)->boundMethod;
+        initFrameBoundMethod(bound, peek(0), AS_CLOSURE(method));
+    }
+    else
+    {
+        bound = newBoundMethod(peek(0) /** Peek the instance */, AS_CLOSURE(method));
+    }
+    pop();                // Pop the instance
+    push(OBJ_VAL(bound)); // Push the bounded method to stack before invoking it
+}
+
+static bool bindMethod(ObjClass *klass, ObjString *name)
+{
+    Value method;
+    if (!findMethod(klass, name, &method))
+    {
+        return false;
+    }
+
+    bindToInstance(method, false);
+    return true;
+}
+
+/**
+ * Slow path of `OP_GET_PROPERTY` on the instance on top of the stack, when its inline cache holds no field of it
+ *
+ * @param inFrame a method is bound into a frame cell, for `OP_GET_PROPERTY_FRAME`
+ */
+static bool getProperty(ObjString *name, InlineCache *cache, bool inFrame)
+{
+    ObjInstance *instance = AS_INSTANCE(peek(0));
+    InlineCacheEntry *entry = probeCache(cache, instance->shape);
+    if (isCachedMethod(entry))
+    {
+        bindToInstance(entry->method, inFrame);
+        return true;
+    }
+
+    if (getField(instance, name, &vm->stackTop[-1]))
+    {
+        cacheField(cache, instance, name);
+        return true;
+    }
+
+    Value method;
+    if (!findMethod(instance->klass, name, &method))
+    {
+        return false;
+    }
+
+    updateCache(cache, instance->shape, -1, method, NULL);
+    bindToInstance(method, inFrame);
+    return true;
+}
+
+/**
+ * Slow path of `OP_SET_PROPERTY`, when its inline cache holds neither the field nor the transition to add it
+ *
+ * @note `instance` and `value` must be on the stack, adding a field allocates.
+ */
+static void setProperty(ObjInstance *instance, ObjString *name, Value value, InlineCache *cache)
+{
+    ObjShape *shape = instance->shape;
+    if (setField(instance, name, value) && shape != NULL && instance->shape != NULL)
+    {
+        updateCache(cache, shape, instance->shape->slotCount - 1, NIL_VAL, instance->shape);
+        return;
+    }
+
+    cacheField(cache, instance, name);
+}
+
+/**
+ * Capture upvalue and save it into a linked list
+ *
+ * @param inFrame a new upvalue goes in the frame cell of `local` instead of the heap, for `CAPTURE_FRAME_LOCAL`
+ */
+static ObjUpvalue *captureUpvalue(Value *local, bool inFrame)
+{
+    ObjUpvalue *preUpvalue = NULL;
+    ObjUpvalue *upvalue = vm->openUpvalues;
+    while (upvalue != NULL && upvalue->location > local)
+    {
+        preUpvalue = upvalue;
+        upvalue = upvalue->next;
+    }
+    if (upvalue != NULL && upvalue->location == local)
+    {
+        return upvalue;
+    }
+
+    ObjUpvalue *createdUpvalue;
+    if (inFrame)
+    {
+        createdUpvalue = &frameCell(local)->upvalue;
+        initFrameUpvalue(createdUpvalue, local);
+    }
+    else
+    {
+        createdUpvalue = newUpvalue(local);
+    }
+    createdUpvalue->next = upvalue;
+
+    if (preUpvalue == NULL)
+    {
+        vm->openUpvalues = createdUpvalue;
+    }
+    else
+    {
+        preUpvalue->next = createdUpvalue;
+    }
+
+    return createdUpvalue;
+}
+
+/**
+ * @brief Allocate all upvalues into heap after out of scope
+ */
+static void closeUpvalues(Value *last)
+{
+    while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last)
+    {
+        ObjUpvalue *upvalue = vm->openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        writeBarrier((Obj *)upvalue, upvalue->closed);
+        vm->openUpvalues = upvalue->next;
+    }
+}
+
+static void defineMethod(ObjString *name)
+{
+    Value method = peek(0);
+    ObjClass *kclass = AS_CLASS(peek(1));
+    tableSet(&(kclass->methods), name, method);
+    rememberObject((Obj *)kclass);
+    pop(); // pop the method out of stack after binding
+}
+
+static bool isFalsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static void concatenate()
+{
+    ObjString *b = AS_STRING(peek(0)); // keep this value in stack to preventing it from being garbage collected before completing the string concatenation.
+    ObjString *a = AS_STRING(peek(1)); // like above
 
     int length = a->length + b->length;
     char *chars = ALLOCATE(char, length + 1);
@@ -301,439 +950,630 @@ static void concatenate()
 }
 
 /**
- * Execute instructions stored in VM
+ * @brief Interpreter state of `run()`
+ *
+ * @details The hot state of the interpreter lives in locals of `run()` (or in the arguments of the handlers of the
+ * tail-call engine) so the C compiler can keep it in registers:
+ *
+ * - `frame`: the stack frame of current invoked function
+ * - `ip`: instruction pointer of `frame`
+ * - `slots`: first stack slot of `frame`
+ * - `constants`: constant pool of the function of `frame`
+ * - `sp`: stack pointer
+ *
+ * `frame->ip` and `vm->stackTop` are stale while a handler runs. They are written back only at spill points,
+ * with `STORE_FRAME()`, before any code that reads the VM from outside `run()`:
+ *
+ * - calls into `callValue()`, `invoke()`, `invokeFromClass()` and returns, which push or pop a `CallFrame`.
+ * - `runtimeError()`, which prints the stack trace from `frame->ip` of every frame and resets the stack.
+ * - any allocation, which can reach `collectGarbage()` and `markRoots()` reading `vm->stack` up to `vm->stackTop`.
+ *   So every value that must survive the allocation has to be pushed before `STORE_FRAME()`.
+ *
+ * After a spill point that may change the stack or the frames, `LOAD_FRAME()` reloads every local from `vm`.
  */
-static InterpretResult run()
-{
-    /**
-     * Stack frame of current invoked function
-     */
-    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+#define STORE_FRAME()      \
+    do                     \
+    {                      \
+        frame->ip = ip;    \
+        vm->stackTop = sp; \
+    } while (false)
+
+#define LOAD_FRAME()                                                  \
+    do                                                                \
+    {                                                                 \
+        frame = &vm->frames[vm->frameCount - 1];                      \
+        ip = frame->ip;                                               \
+        slots = frame->slots;                                         \
+        constants = frame->closure->function->chunk.constants.values; \
+        sp = vm->stackTop;                                            \
+    } while (false)
+
+/**
+ * Spill the state, report a runtime error and leave the interpreter loop
+ */
+#define RUNTIME_ERROR(...)              \
+    do                                  \
+    {                                   \
+        STORE_FRAME();                  \
+        runtimeError(__VA_ARGS__);      \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define DROP() (sp--)
+#define PEEK(distance) (sp[-1 - (distance)])
 
 /**
  * Return current instruction and advance instruction pointer
  */
-#define READ_BYTE() (*frame->ip++)
+#define READ_BYTE() (*ip++)
 /**
  * Read the next byte from the bytecode, treat the resulting number as an index,
  * and look up the corresponding Value in the chunk’s constant table.
  */
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT() (constants[READ_BYTE()])
 /**
  * Read next 2 bytecode to construct uint16_t value
  */
-#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+/**
+ * Read next 3 bytecode to construct a 3-byte operand, the index or offset of a long or wide instruction
+ */
+#define READ_LONG() (ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+#define READ_LONG_CONSTANT() (constants[READ_LONG()])
 /**
  * Read string from constants
  */
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_LONG_STRING() AS_STRING(READ_LONG_CONSTANT())
+/**
+ * Read the 2-byte index of the inline cache of a property access
+ */
+#define READ_INLINE_CACHE() (&functionCaches(frame->closure->function)[READ_SHORT()])
 /**
  * Handle binary operators
  */
 #define BINARY_OP(valueType, op)                        \
     do                                                  \
     {                                                   \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
+        {                                               \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        }                                               \
+        double b = AS_NUMBER(POP());                    \
+        double a = AS_NUMBER(POP());                    \
+        PUSH(valueType(a op b));                        \
+    } while (false)
+
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+/**
+ * Runtime quickening: a generic instruction that sees operands of one type rewrites itself in place to its typed
+ * form, which has a single guard on the operand types. A typed form whose guard fails rewrites itself back with
+ * `DEOPT()`, rewinds to it and ends with `DISPATCH()` so the generic form runs the instruction. A chunk that
+ * deoptimized `QUICKEN_MAX_DEOPTS` times stops quickening, so a site that keeps changing types settles on the generic
+ * form.
+ *
+ * @note Both rewrite `ip[-1]`, they must run before the instruction reads its operands.
+ */
+#define QUICKEN(op)                                                          \
+    do                                                                       \
+    {                                                                        \
+        if (frame->closure->function->chunk.deoptCount < QUICKEN_MAX_DEOPTS) \
+        {                                                                    \
+            ip[-1] = (op);                                                   \
+        }                                                                    \
+    } while (false)
+
+#define DEOPT(op)                                     \
+    do                                                \
+    {                                                 \
+        ip[-1] = (op);                                \
+        frame->closure->function->chunk.deoptCount++; \
+        ip--;                                         \
+    } while (false)
+
+/**
+ * Handle compare-and-branch superinstructions, the jump is taken when `a op b` is `jumpIf`
+ */
+#define COMPARE_JUMP(op, jumpIf)                        \
+    do                                                  \
+    {                                                   \
+        uint16_t offset = READ_SHORT();                 \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) \
         {                                               \
-            runtimeError("Operands must be numbers.");  \
-            return INTERPRET_RUNTIME_ERROR;             \
+            RUNTIME_ERROR("Operands must be numbers."); \
         }                                               \
-        double b = AS_NUMBER(pop());                    \
-        double a = AS_NUMBER(pop());                    \
-        push(valueType(a op b));                        \
+        double b = AS_NUMBER(POP());                    \
+        double a = AS_NUMBER(POP());                    \
+        if ((a op b) == jumpIf)                         \
+        {                                               \
+            ip += offset;                               \
+        }                                               \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void traceExecution(CallFrame *frame)
+{
+    printf("            ");
+    for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
+    {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+
+    disassembleInstruction(&frame->closure->function->chunk,
+                           (int)(frame->ip - frame->closure->function->chunk.code));
+}
+#define TRACE_EXECUTION()      \
+    do                         \
+    {                          \
+        STORE_FRAME();         \
+        traceExecution(frame); \
+    } while (false)
+#else
+#define TRACE_EXECUTION() ((void)0)
+#endif
+
+#ifdef DEBUG_COUNT_DISPATCH
+#define COUNT_DISPATCH() (vm->dispatchCount++)
+#else
+#define COUNT_DISPATCH() ((void)0)
+#endif
+
+#ifdef BASELINE_JIT
+/**
+ * Hand the running frame to its native code if it has some, after a call or a return switched frames. The interpreter
+ * goes on with the frame the native code leaves running.
+ */
+#define JIT_ENTRY()                                \
+    do                                             \
+    {                                              \
+        if (frame->closure->function->jit != NULL) \
+        {                                          \
+            STORE_FRAME();                         \
+            int jitResult = runJit();              \
+            if (jitResult != JIT_CONTINUE)         \
+            {                                      \
+                return (InterpretResult)jitResult; \
+            }                                      \
+            LOAD_FRAME();                          \
+        }                                          \
+    } while (false)
+
+/**
+ * Count a loop iteration at the start of the loop, a loop that makes its function hot continues in native code
+ */
+#define HOT_LOOP()                              \
+    do                                          \
+    {                                           \
+        countHotness(frame->closure->function); \
+        JIT_ENTRY();                            \
+    } while (false)
+#elif defined(AOT_RUNTIME)
+/**
+ * Hand the running frame to the C code of its function, after a call or a return switched frames
+ */
+#define JIT_ENTRY()                                \
+    do                                             \
+    {                                              \
+        if (frame->closure->function->aot != NULL) \
+        {                                          \
+            STORE_FRAME();                         \
+            int aotResult = runAot();              \
+            if (aotResult != JIT_CONTINUE)         \
+            {                                      \
+                return (InterpretResult)aotResult; \
+            }                                      \
+            LOAD_FRAME();                          \
+        }                                          \
+    } while (false)
+#define HOT_LOOP() ((void)0)
+#elif defined(TRACING_JIT)
+#define JIT_ENTRY() ((void)0)
+
+/**
+ * Count a back-edge of the loop, the interpreter stopped at its header: a loop with a trace runs it, a loop that just
+ * got hot is recorded first. The interpreter goes on where the trace left. Loops of frozen code are never counted.
+ */
+#define HOT_LOOP()                                                                       \
+    do                                                                                   \
+    {                                                                                    \
+        ObjFunction *function = frame->closure->function;                                \
+        HotLoop *loop = function->obj.generation == GEN_SHARED                           \
+                            ? NULL                                                       \
+                            : findHotLoop(function, (int)(ip - function->chunk.code));   \
+        if (loop != NULL &&                                                              \
+            (loop->trace != NULL ||                                                      \
+             (loop->hotness < TRACE_THRESHOLD && ++loop->hotness == TRACE_THRESHOLD)))   \
+        {                                                                                \
+            STORE_FRAME();                                                               \
+            int traceResult = runTrace(loop);                                            \
+            if (traceResult != JIT_CONTINUE)                                             \
+            {                                                                            \
+                return (InterpretResult)traceResult;                                     \
+            }                                                                            \
+            LOAD_FRAME();                                                                \
+        }                                                                                \
+    } while (false)
+#else
+#define JIT_ENTRY() ((void)0)
+#define HOT_LOOP() ((void)0)
+#endif
+
+#ifdef TRACING_JIT
+/**
+ * Leave a nested `run()` of `callInstruction()` once the call it runs has returned
+ */
+#define RETURN_TO_TRACE()                          \
+    do                                             \
+    {                                              \
+        if (vm->frameCount == vm->traceFrameCount) \
+        {                                          \
+            return INTERPRET_OK;                   \
+        }                                          \
     } while (false)
+#else
+#define RETURN_TO_TRACE() ((void)0)
+#endif
+
+/**
+ * Designated initializer of the dispatch table used by the computed-goto and tail-call engines,
+ * `HANDLER(op)` is defined by each engine. A new opcode must be added here and in `vm_handlers.h`.
+ */
+#define DISPATCH_TABLE             \
+    {                              \
+        HANDLER(OP_CONSTANT),      \
+        HANDLER(OP_NIL),           \
+        HANDLER(OP_TRUE),          \
+        HANDLER(OP_FALSE),         \
+        HANDLER(OP_POP),           \
+        HANDLER(OP_GET_LOCAL),     \
+        HANDLER(OP_SET_LOCAL),     \
+        HANDLER(OP_GET_GLOBAL),    \
+        HANDLER(OP_DEFINE_GLOBAL), \
+        HANDLER(OP_SET_GLOBAL),    \
+        HANDLER(OP_GET_UPVALUE),   \
+        HANDLER(OP_SET_UPVALUE),   \
+        HANDLER(OP_GET_PROPERTY),  \
+        HANDLER(OP_SET_PROPERTY),  \
+        HANDLER(OP_GET_SUPER),     \
+        HANDLER(OP_EQUAL),         \
+        HANDLER(OP_GREATER),       \
+        HANDLER(OP_LESS),          \
+        HANDLER(OP_ADD),           \
+        HANDLER(OP_SUBTRACT),      \
+        HANDLER(OP_MULTIPLY),      \
+        HANDLER(OP_DIVIDE),        \
+        HANDLER(OP_NOT),           \
+        HANDLER(OP_NEGATE),        \
+        HANDLER(OP_PRINT),         \
+        HANDLER(OP_JUMP),          \
+        HANDLER(OP_JUMP_IF_FALSE), \
+        HANDLER(OP_LOOP),          \
+        HANDLER(OP_CALL),          \
+        HANDLER(OP_INVOKE),        \
+        HANDLER(OP_SUPER_INVOKE),  \
+        HANDLER(OP_CLOSURE),       \
+        HANDLER(OP_CLOSE_UPVALUE), \
+        HANDLER(OP_RETURN),        \
+        HANDLER(OP_CLASS),         \
+        HANDLER(OP_INHERIT),       \
+        HANDLER(OP_METHOD),        \
+        HANDLER(OP_NOT_EQUAL),             \
+        HANDLER(OP_GREATER_EQUAL),         \
+        HANDLER(OP_LESS_EQUAL),            \
+        HANDLER(OP_JUMP_IF_EQUAL),         \
+        HANDLER(OP_JUMP_IF_NOT_EQUAL),     \
+        HANDLER(OP_JUMP_IF_LESS),          \
+        HANDLER(OP_JUMP_IF_NOT_LESS),      \
+        HANDLER(OP_JUMP_IF_GREATER),       \
+        HANDLER(OP_JUMP_IF_NOT_GREATER),   \
+        HANDLER(OP_ADD_CONSTANT_TO_LOCAL), \
+        HANDLER(OP_ADD_NUMBER),               \
+        HANDLER(OP_ADD_STRING),               \
+        HANDLER(OP_EQUAL_NUMBER),             \
+        HANDLER(OP_NOT_EQUAL_NUMBER),         \
+        HANDLER(OP_JUMP_IF_EQUAL_NUMBER),     \
+        HANDLER(OP_JUMP_IF_NOT_EQUAL_NUMBER), \
+        HANDLER(OP_GET_PROPERTY_FRAME),       \
+        HANDLER(OP_CONSTANT_LONG),            \
+        HANDLER(OP_JUMP_LONG),                \
+        HANDLER(OP_JUMP_IF_FALSE_LONG),       \
+        HANDLER(OP_LOOP_LONG),                \
+        HANDLER(OP_WIDE),                     \
+    }
+
+#if DISPATCH_ENGINE == DISPATCH_SWITCH
+
+/**
+ * Execute instructions stored in VM
+ *
+ * @details Switch dispatch: every instruction goes back to the top of the loop and through the single indirect
+ * branch the compiler generates for the `switch`.
+ */
+static InterpretResult run()
+{
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *slots;
+    Value *constants;
+    Value *sp;
+    LOAD_FRAME();
+
+#define OPCODE(op) case op:
+#define DISPATCH() continue
 
     for (;;)
     {
-        /**
-         * Other technique to implement bytecode dispatching:
-         * - Direct threaded code
-         * - Jump table
-         * - Computed goto
-         */
+        TRACE_EXECUTION();
+        COUNT_DISPATCH();
 
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("            ");
-        for (Value *slot = vm.stack; slot < vm.stackTop; slot++)
+        switch (READ_BYTE())
         {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
+#include "vm_handlers.h"
         }
-        printf("\n");
+    }
+
+#undef OPCODE
+#undef DISPATCH
+}
 
-        disassembleInstruction(&frame->closure->function->chunk,
-                               (int)(frame->ip - frame->closure->function->chunk.code));
+#elif DISPATCH_ENGINE == DISPATCH_COMPUTED_GOTO
+
+#ifndef __GNUC__
+#error "DISPATCH_COMPUTED_GOTO requires the labels-as-values extension of GCC or Clang."
 #endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE())
-        {
-        case OP_CONSTANT:
-        {
-            Value constant = READ_CONSTANT();
-            push(constant);
-            break;
-        }
-        case OP_NIL:
-        {
-            push(NIL_VAL);
-            break;
-        }
-        case OP_TRUE:
-        {
-            push(BOOL_VAL(true));
-            break;
-        }
-        case OP_FALSE:
-        {
-            push(BOOL_VAL(false));
-            break;
-        }
-        case OP_POP:
-        {
-            pop();
-            break;
-        }
-        case OP_SET_LOCAL:
-        {
-            uint8_t slot = READ_BYTE();
-            frame->slots[slot] = peek(0);
-            break;
-        }
-        case OP_GET_LOCAL:
-        {
-            uint8_t slot = READ_BYTE();
-            push(frame->slots[slot]);
-            break;
-        }
-        case OP_GET_GLOBAL:
-        {
-            ObjString *name = READ_STRING();
-            Value value;
-            if (!tableGet(&vm.globals, name, &value))
-            {
-                runtimeError("Undefined variable '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(value);
-            break;
-        }
-        case OP_DEFINE_GLOBAL:
-        {
-            ObjString *name = READ_STRING();
-            tableSet(&vm.globals, name, peek(0));
-            pop();
-            break;
-        }
-        case OP_SET_GLOBAL:
-        {
-            ObjString *name = READ_STRING();
-            if (tableSet(&(vm.globals), name, peek(0)))
-            {
-                tableDelete(&(vm.globals), name);
-                runtimeError("Undefined variable '%s'.", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            break;
-        }
-        case OP_GET_UPVALUE:
-        {
-            uint8_t slot = READ_BYTE();
-            push(*frame->closure->upvalues[slot]->location);
-            break;
-        }
-        case OP_SET_UPVALUE:
-        {
-            uint8_t slot = READ_BYTE();
-            *frame->closure->upvalues[slot]->location = peek(0);
-            break;
-        }
-        case OP_SET_PROPERTY:
-        {
-            if (!IS_INSTANCE(peek(1)))
-            {
-                runtimeError("Only instances have fields.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
+/**
+ * Execute instructions stored in VM
+ *
+ * @details Computed goto: the tail of every handler jumps through the label table on its own, so the branch
+ * predictor learns opcode pairs instead of sharing one indirect branch for all instructions.
+ */
+static InterpretResult run()
+{
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *slots;
+    Value *constants;
+    Value *sp;
+    LOAD_FRAME();
 
-            ObjInstance *instance = AS_INSTANCE(peek(1));
-            tableSet(&(instance->fields), READ_STRING(), peek(0));
-            Value value = pop();
-            pop();
-            push(value);
-            break;
-        }
-        case OP_GET_PROPERTY:
-        {
-            if (!IS_INSTANCE(peek(0)))
-            {
-                runtimeError("Only instances have properties.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
+#define HANDLER(op) [op] = &&label_##op
+    static void *dispatchTable[UINT8_COUNT] = DISPATCH_TABLE;
+#undef HANDLER
 
-            ObjInstance *instance = AS_INSTANCE(peek(0));
-            ObjString *name = READ_STRING();
+#define OPCODE(op) label_##op:
+#define DISPATCH()                        \
+    do                                    \
+    {                                     \
+        TRACE_EXECUTION();                \
+        COUNT_DISPATCH();                 \
+        goto *dispatchTable[READ_BYTE()]; \
+    } while (false)
 
-            Value value;
-            if (tableGet(&(instance->fields), name, &value)) // Lookup field
-            {
-                pop(); // pop the instance out of stack.
-                push(value);
-                break;
-            }
+    DISPATCH();
 
-            if (!bindMethod(instance->klass, name)) // Lookup method
-            {
-                return INTERPRET_RUNTIME_ERROR;
-            }
+#include "vm_handlers.h"
 
-            break;
-        }
-        case OP_GET_SUPER:
-        {
-            ObjString *name = READ_STRING();
-            ObjClass *superclass = AS_CLASS(pop());
+#undef OPCODE
+#undef DISPATCH
+}
 
-            if (!bindMethod(superclass, name))
-            {
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            break;
-        }
-        case OP_EQUAL:
-        {
-            Value b = pop();
-            Value a = pop();
-            push(BOOL_VAL(valuesEqual(a, b)));
-            break;
-        }
-        case OP_GREATER:
-        {
-            BINARY_OP(BOOL_VAL, >);
-            break;
-        }
-        case OP_LESS:
-        {
-            BINARY_OP(BOOL_VAL, <);
-            break;
-        }
-        case OP_ADD:
-        {
-            if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
-            {
-                concatenate();
-            }
-            else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
-            {
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a + b));
-            }
-            else
-            {
-                runtimeError("Operands must be two numbers or two strings.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
+#elif DISPATCH_ENGINE == DISPATCH_TAIL_CALL
 
-            break;
-        }
-        case OP_SUBTRACT:
-        {
-            BINARY_OP(NUMBER_VAL, -);
-            break;
-        }
-        case OP_MULTIPLY:
-        {
-            BINARY_OP(NUMBER_VAL, *);
-            break;
-        }
-        case OP_DIVIDE:
-        {
-            BINARY_OP(NUMBER_VAL, /);
-            break;
-        }
-        case OP_NOT:
-        {
-            push(BOOL_VAL(isFalsey(pop())));
-            break;
-        }
-        case OP_NEGATE:
-        {
-            if (!IS_NUMBER(peek(0)))
-            {
-                runtimeError("Operand must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(NUMBER_VAL(-(AS_NUMBER(pop()))));
-            break;
-        }
-        case OP_PRINT:
-        {
-            printValue(pop());
-            printf("\n");
-            break;
-        }
-        case OP_JUMP:
-        {
-            uint16_t offset = READ_SHORT();
-            frame->ip += offset;
-            break;
-        }
-        case OP_JUMP_IF_FALSE:
-        {
-            uint16_t offset = READ_SHORT(); // read jump offset
-            if (isFalsey(peek(0)))
-            {
-                frame->ip += offset;
-            }
-            break;
-        }
-        case OP_LOOP:
-        {
-            uint16_t offset = READ_SHORT();
-            frame->ip -= offset; // jump to start of loop
-            break;
-        }
-        case OP_CALL:
-        {
-            int argCount = READ_BYTE();
-            if (!callValue(peek(argCount), argCount))
-            {
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            frame = &vm.frames[vm.frameCount - 1]; // Assign the stack frame of current invoked function to `frame`.
-            break;
-        }
-        case OP_INVOKE:
-        {
-            ObjString *method = READ_STRING();
-            int argCount = READ_BYTE();
-            if (!invoke(method, argCount))
-            {
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            frame = &vm.frames[vm.frameCount - 1];
-            break;
-        }
-        case OP_SUPER_INVOKE:
-        {
-            ObjString *method = READ_STRING();
-            int argCount = READ_BYTE();
-            ObjClass *superclass = AS_CLASS(pop());
-            if (!invokeFromClass(superclass, method, argCount))
-            {
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            frame = &vm.frames[vm.frameCount - 1];
-            break;
-        }
-        case OP_CLOSURE:
-        {
-            ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
-            ObjClosure *closure = newClosure(function);
-            push(OBJ_VAL(closure));
-            for (int i = 0; i < closure->upvalueCount; i++)
-            {
-                uint8_t isLocal = READ_BYTE();
-                uint8_t index = READ_BYTE();
-                if (isLocal)
-                {
-                    closure->upvalues[i] = captureUpvalue(frame->slots + index);
-                }
-                else
-                {
-                    closure->upvalues[i] = frame->closure->upvalues[index];
-                }
-            }
-            break;
-        }
-        case OP_CLOSE_UPVALUE:
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef MUSTTAIL
+/**
+ * Without `musttail` the engine relies on sibling call optimization (`-O2`), an unoptimized build grows the C stack
+ * with every executed instruction.
+ */
+#define MUSTTAIL
+#endif
+
+/**
+ * The interpreter state is passed from handler to handler in argument registers.
+ */
+typedef InterpretResult (*OpHandler)(CallFrame *frame, uint8_t *ip, Value *slots, Value *constants, Value *sp);
+
+static const OpHandler dispatchTable[UINT8_COUNT];
+
+#define OPCODE(op) static InterpretResult handler_##op(CallFrame *frame, uint8_t *ip, Value *slots, Value *constants, Value *sp)
+#define DISPATCH()                                                                   \
+    do                                                                               \
+    {                                                                                \
+        TRACE_EXECUTION();                                                           \
+        COUNT_DISPATCH();                                                            \
+        uint8_t instruction = READ_BYTE();                                           \
+        MUSTTAIL return dispatchTable[instruction](frame, ip, slots, constants, sp); \
+    } while (false)
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter" // not every handler touches every part of the state
+#include "vm_handlers.h"
+#pragma GCC diagnostic pop
+
+#define HANDLER(op) [op] = handler_##op
+static const OpHandler dispatchTable[UINT8_COUNT] = DISPATCH_TABLE;
+#undef HANDLER
+
+/**
+ * Execute instructions stored in VM
+ *
+ * @details Tail-call dispatch: each handler is a separate function ending with a guaranteed tail call to the next
+ * handler, so no handler returns until the interpreter leaves the loop.
+ */
+static InterpretResult run()
+{
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *slots;
+    Value *constants;
+    Value *sp;
+    LOAD_FRAME();
+
+    DISPATCH();
+}
+
+#undef OPCODE
+#undef DISPATCH
+
+#else
+#error "Unknown DISPATCH_ENGINE."
+#endif
+
+#if defined(BASELINE_JIT) || defined(TRACING_JIT) || defined(AOT_RUNTIME)
+
+#undef JIT_ENTRY
+#undef HOT_LOOP
+#undef RETURN_TO_TRACE
+#define JIT_ENTRY() ((void)0)
+#define HOT_LOOP() ((void)0)
+#define RETURN_TO_TRACE() ((void)0)
+
+/**
+ * @details One more instance of the handlers, in a `switch` left as soon as the ip moves or the running frame changes.
+ * A typed instruction that deoptimizes rewinds to itself, so the loop runs its generic form before leaving.
+ */
+int stepInstruction()
+{
+    CallFrame *frame;
+    uint8_t *ip;
+    Value *slots;
+    Value *constants;
+    Value *sp;
+    LOAD_FRAME();
+
+    CallFrame *startFrame = frame;
+    uint8_t *startIp = ip;
+
+#define OPCODE(op) case op:
+#define DISPATCH() continue
+
+    for (;;)
+    {
+        if (frame != startFrame || ip != startIp)
         {
-            closeUpvalues(vm.stackTop - 1);
-            pop();
-            break;
+            STORE_FRAME();
+            return JIT_CONTINUE;
         }
-        case OP_RETURN:
-        {
-            Value result = pop();
-            closeUpvalues(frame->slots);
-            vm.frameCount--;
-            if (vm.frameCount == 0)
-            {
-                pop();
-                return INTERPRET_OK;
-            }
 
-            vm.stackTop = frame->slots;
-            push(result);
-            frame = &vm.frames[vm.frameCount - 1]; // Assign the stack frame of the caller after executing `return` statement.
-            break;
-        }
-        case OP_CLASS:
+        switch (READ_BYTE())
         {
-            push(OBJ_VAL(newClass(READ_STRING())));
-            break;
+#include "vm_handlers.h"
         }
-        case OP_INHERIT:
-        {
-            Value superclass = peek(1);
-            if (!IS_CLASS(superclass))
-            {
-                runtimeError("Superclass must be a class.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
+    }
+
+#undef OPCODE
+#undef DISPATCH
+}
 
-            ObjClass *subclass = AS_CLASS(peek(0));
+#endif
 
-            /// @brief `copy-down inheritance`
-            ///
-            /// @note When the subclass is declared, we copy all of the inherited class’s methods down into the subclass’s own method table.
-            /// It’s simple and fast, but, like most optimizations, you get to use it only under certain constraints.
-            /// It works in Lox because Lox classes are closed. Once a class declaration is finished executing,
-            /// the set of methods for that class can never change.
-            tableAddAll(&(AS_CLASS(superclass)->methods), &(subclass->methods));
+#ifdef TRACING_JIT
 
-            pop(); // subclass
-            break;
-        }
-        case OP_METHOD:
-        {
-            defineMethod(READ_STRING());
-            break;
-        }
-        }
+/**
+ * @details A native function or a class without an initializer pushes no frame.
+ */
+int callInstruction()
+{
+    int frameCount = vm->frameCount;
+    int result = stepInstruction();
+    if (result != JIT_CONTINUE || vm->frameCount == frameCount)
+    {
+        return result;
     }
+    return finishCall(frameCount);
+}
+
+/**
+ * @details The frames run in a nested `run()`, which returns when `OP_RETURN` pops back to the frame count saved in
+ * `vm->traceFrameCount`.
+ */
+int finishCall(int frameCount)
+{
+    int traceFrameCount = vm->traceFrameCount;
+    vm->traceFrameCount = frameCount;
+    vm->traceNesting++;
+    int result = run();
+    vm->traceNesting--;
+    vm->traceFrameCount = traceFrameCount;
+    return result == INTERPRET_OK && vm->frameCount != 0 ? JIT_CONTINUE : result;
+}
 
+#endif
+
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef PUSH
+#undef POP
+#undef DROP
+#undef PEEK
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
+#undef READ_LONG
+#undef READ_LONG_CONSTANT
 #undef READ_STRING
+#undef READ_LONG_STRING
+#undef READ_INLINE_CACHE
 #undef BINARY_OP
-}
+#undef NOT_BOOL_VAL
+#undef COMPARE_JUMP
+#undef QUICKEN
+#undef DEOPT
+#undef TRACE_EXECUTION
+#undef COUNT_DISPATCH
+#undef JIT_ENTRY
+#undef HOT_LOOP
+#undef RETURN_TO_TRACE
+#undef DISPATCH_TABLE
 
 static void resetStack()
 {
-    vm.stackTop = vm.stack;
-    vm.frameCount = 0;
-    vm.openUpvalues = NULL;
+    vm->stackTop = vm->stack;
+    vm->frameCount = 0;
+#ifdef TRACING_JIT
+    vm->traceFrameCount = 0;
+#endif
+    vm->openUpvalues = NULL;
 }
 
+/**
+ * Frames printed at each end of the stack trace of a runtime error
+ */
+#define TRACE_FRAMES_SHOWN 16
+
 /**
  * @details a variadic function
  */
 static void runtimeError(const char *format, ...)
 {
+    flockfile(stderr); // keep the report of the error in one piece when VMs run on several threads
     va_list args;
     va_start(args, format);
     vfprintf(stderr, format, args);
     va_end(args);
     fputs("\n", stderr);
 
-    //< print stack trace
-    for (int i = vm.frameCount - 1; i >= 0; i--)
+    //< print stack trace, the innermost and outermost frames of a deep one
+    for (int i = vm->frameCount - 1; i >= 0; i--)
     {
-        CallFrame *frame = &vm.frames[i];
+        if (i == vm->frameCount - 1 - TRACE_FRAMES_SHOWN && i >= TRACE_FRAMES_SHOWN)
+        {
+            fprintf(stderr, "... %d more frames\n", i + 1 - TRACE_FRAMES_SHOWN);
+            i = TRACE_FRAMES_SHOWN - 1;
+        }
+        CallFrame *frame = &vm->frames[i];
         ObjFunction *function = frame->closure->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
         fprintf(stderr, "[line %d] in ",
@@ -748,6 +1588,7 @@ static void runtimeError(const char *format, ...)
         }
     }
     //>
+    funlockfile(stderr);
 
     resetStack();
 }
@@ -759,7 +1600,31 @@ static void defineNative(const char *name, NativeFn function)
 {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = globalSlot(AS_STRING(vm->stack[0])); // can grow `vm->globalValues`
+    vm->globalValues.values[slot] = vm->stack[1];
+    pop();
     pop();
+}
+
+/**
+ * Resolve a global variable name to its slot, a new name gets a new undefined slot
+ *
+ * @note Called by the compiler, which also runs inside `run()`: `compileLazily()` compiles a body on its first call and
+ * may add slots then, reallocating `vm->globalValues`. A slot number stays valid, but `vm->globalValues.values` must be
+ * read again after any call instead of kept across it, as the handlers and the code of the JITs do.
+ */
+int globalSlot(ObjString *name)
+{
+    Value slot;
+    if (tableGet(&(vm->globalSlots), name, &slot))
+    {
+        return (int)AS_NUMBER(slot);
+    }
+
+    push(OBJ_VAL(name)); // keep the name reachable while the arrays grow
+    writeValueArray(&(vm->globalNames), OBJ_VAL(name));
+    writeValueArray(&(vm->globalValues), UNDEFINED_VAL);
+    tableSet(&(vm->globalSlots), name, NUMBER_VAL(vm->globalValues.count - 1));
     pop();
+    return vm->globalValues.count - 1;
 }
\ No newline at end of file
@@ -5,9 +5,50 @@
 #include "table.h"
 #include "value.h"
 #include "chunk.h"
+#ifdef CONCURRENT_GC
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+/**
+ * Sizes of the call stack (frames) and of the value stack (slots). Both start at their initial size and double when a
+ * call needs more, a call past the largest size is a stack overflow. Each can be set at build time, e.g.
+ * `-DFRAMES_MAX=100000`.
+ */
+#ifndef FRAMES_INITIAL
+#define FRAMES_INITIAL 64
+#endif
+#ifndef FRAMES_MAX
+#define FRAMES_MAX (1 << 18)
+#endif
+#ifndef STACK_INITIAL
+#define STACK_INITIAL (FRAMES_INITIAL * UINT8_COUNT)
+#endif
+#ifndef STACK_MAX
+#define STACK_MAX (1 << 22)
+#endif
+
+/**
+ * Stack slots per block of frame cells, see `VM.frameCells`
+ */
+#define FRAME_CELL_BLOCK 1024
+
+#ifdef CONCURRENT_GC
+/**
+ * Objects the write barriers shade before the program hands them to the marking thread, see `VM.shadeBuffer`
+ */
+#define SHADE_BUFFER_SIZE 256
+#endif
+
+/**
+ * Object kept for a stack slot instead of on the heap, when the escape analysis proved it never outlives the frame
+ * (see `escape.c`): the upvalue of a local captured at that slot, or a method bound to the instance at that slot.
+ */
+typedef union
+{
+    ObjUpvalue upvalue;
+    ObjBoundMethod boundMethod;
+} FrameCell;
 
 /**
  * A stack frame
@@ -20,6 +61,8 @@ typedef struct
     ObjClosure *closure;
     /**
      * Caller's current instruction pointer. When we return from a function, the VM will jump to the ip of the caller’s CallFrame and resume from there.
+     *
+     * @note For the running frame, `run()` keeps the ip in a local and writes it back only at spill points.
      */
     uint8_t *ip;
     /**
@@ -31,31 +74,88 @@ typedef struct
 typedef struct
 {
     /**
-     * Call stack
+     * Call stack, `frameCapacity` frames on the heap
      */
-    CallFrame frames[FRAMES_MAX];
+    CallFrame *frames;
     /**
      * Stack frame count
      */
     int frameCount;
-    Value stack[STACK_MAX];
+    int frameCapacity;
+#ifdef TRACING_JIT
+    /**
+     * Frame count `run()` returns at, to the call of a trace in `callInstruction()`, 0 when no call runs under a trace
+     */
+    int traceFrameCount;
+    /**
+     * Nested `run()`s of `finishCall()`, traces aren't entered past `TRACE_NESTING_MAX` of them: a recursion through
+     * traced loops would nest them as deep as it goes, on the C stack
+     */
+    int traceNesting;
+#endif
+    /**
+     * Value stack on the heap, `stackEnd` is one past its last slot
+     *
+     * @note Growing it moves every slot: `call()` rebases `CallFrame.slots`, open upvalues and `stackTop`, and any other
+     * pointer into the stack has to be read again after a call.
+     */
+    Value *stack;
+    Value *stackEnd;
     /**
      * Stack pointer
+     *
+     * @note `run()` keeps the stack pointer in a local and writes it back only at spill points (calls, returns,
+     * runtime errors and allocations), which is when the GC and the stack trace read it.
      */
     Value *stackTop;
     /**
-     * Global variables
+     * Global variable names to their slot, shared by every `compile()` so the REPL keeps its globals
+     */
+    Table globalSlots;
+    /**
+     * Name of the global variable of every slot
      */
-    Table globals;
+    ValueArray globalNames;
+    /**
+     * Global variables by slot, `UNDEFINED_VAL` until defined
+     */
+    ValueArray globalValues;
     /**
      * Global string pool for `string interning`
      *
      * @see https://craftinginterpreters.com/hash-tables.html#string-interning
      */
     Table strings;
+    /**
+     * Strings of the frozen VM whose code this VM runs, looked up before `strings` so both intern a string once. NULL
+     * unless the VM was created by `newSharingVM()`.
+     */
+    Table *sharedStrings;
+    /**
+     * Inline caches of the frozen code this VM runs, which it can't write to (see `ObjFunction.sharedCacheBase`). A
+     * frozen VM only counts the caches of its functions, each VM running them gets that many.
+     */
+    InlineCache *sharedCaches;
+    int sharedCacheCount;
+    /**
+     * Bytecode cache files the code and strings of loaded functions live in, see `cache.c`
+     */
+    struct MappedFile *mappedFiles;
+    /**
+     * Compile function bodies on their first call instead of with the script (`clox --lazy`), see `compileLazily()`
+     */
+    bool lazyCompile;
     /** Constant for `init` */
     ObjString* initString;
     ObjUpvalue *openUpvalues;
+    /**
+     * Frame cells by stack slot, in blocks of `FRAME_CELL_BLOCK` allocated when first used
+     *
+     * @note Unlike the stack they never move, values point to them. They are not in `objects`: the GC marks them
+     * through their references and never frees them, and unmarks the ones of live slots before every collection.
+     */
+    FrameCell **frameCells;
+    int frameCellBlocks;
     /**
      * Bytes allocated in heap
      */
@@ -65,14 +165,83 @@ typedef struct
      */
     size_t nextGC;
     /**
-     * List of all objects stored in heap
+     * The threshold of bytes allocated that triggers the next minor collection, which only frees young objects
+     */
+    size_t youngLimit;
+    /**
+     * List of old objects, the ones that survived a collection. They stay marked between major collections.
      */
     Obj *objects;
+    /**
+     * List of young objects, the ones allocated since the last collection
+     */
+    Obj *youngObjects;
+    /**
+     * Old objects that may reference young objects since the last collection, minor collections trace them as roots
+     */
+    Obj **rememberedSet;
+    int rememberedCount;
+    int rememberedCapacity;
+    /**
+     * Value of `Obj.markBit` of marked objects, a major collection flips it to unmark every object at once
+     */
+    bool markBit;
+    /**
+     * A major collection is marking, a slice of it runs on each allocation until the gray stack is empty (or the marking
+     * thread traces it, see `CONCURRENT_GC`)
+     */
+    bool marking;
+    /**
+     * Link to the next old object to sweep after a major collection, NULL once they are all swept, see `sweepOld()`
+     */
+    Obj **sweepCursor;
+    /**
+     * GC threads (`clox --gc-threads N`), above 1 they mark a major collection in one parallel pause, see
+     * `traceInParallel()`
+     */
+    int gcThreads;
+    /**
+     * Helper threads and gray deques of the parallel marking, started by its first trace
+     */
+    struct MarkPool *markPool;
+#ifdef CONCURRENT_GC
+    /**
+     * The background thread that marks a major collection, it runs while `markingConcurrently` is set
+     */
+    pthread_t markThread;
+    bool markingConcurrently;
+    /**
+     * Set by the marking thread once it found the gray stack empty, the next allocation finishes the collection
+     */
+    atomic_bool markThreadDone;
+    /**
+     * Held by the marking thread while it traces a slice, and by the program while it reshapes an object the thread may
+     * be tracing (see `lockHeap()`)
+     */
+    pthread_mutex_t heapLock;
+    /**
+     * Objects shaded by the write barriers of the program since the last hand-off to the gray stack
+     */
+    Obj *shadeBuffer[SHADE_BUFFER_SIZE];
+    int shadeCount;
+    /**
+     * Blocks the program freed while the marking thread runs, which may still be reading them
+     */
+    void **deferredFrees;
+    int deferredCount;
+    int deferredCapacity;
+#endif
     //> Gray stack for tracing referenced object
     int grayCount;
     int grayCapacity;
     Obj **grayStack;
     //<
+#ifdef DEBUG_COUNT_DISPATCH
+    /**
+     * Number of dispatched instructions, reported by `freeVM()`
+     */
+    uint64_t dispatchCount;
+#endif
 } VM;
 
 typedef enum
@@ -82,11 +251,75 @@ typedef enum
     INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-extern VM vm;
+/**
+ * VM of the calling thread, the one every function of the interpreter works on. The embedding API below makes its
+ * `instance` the VM of the thread for the duration of the call, so threads can each run their own VMs.
+ */
+extern _Thread_local VM *vm;
+
+//> Embedding API
+/**
+ * A VM shares nothing with other VMs: heap, strings and globals are its own, and objects never pass from one to another
+ * but for the code of a frozen VM. Any number of them can live in a process, each used by one thread at a time.
+ */
+VM *newVM();
+void freeVM(VM *instance);
+/**
+ * Make `instance` read-only once it compiled the code other VMs will run, see `newSharingVM()`. It is never used again
+ * but to be freed, after those VMs.
+ *
+ * @note Frozen code runs without quickening nor JIT compilation, which would write to it. Each VM running it has its own
+ * inline caches for it instead.
+ */
+void freezeVM(VM *instance);
+/**
+ * Create a VM that runs the functions of `frozen` as they are, e.g. a script it compiled given to `interpretFunction()`.
+ * It interns strings as the ones of `frozen`, which it shares, and declares the globals of `frozen` in the same slots.
+ * Any number of threads can each run such a VM at once.
+ */
+VM *newSharingVM(VM *frozen);
+/**
+ * Compile `source` and run it as a script, its functions, classes and variables become globals of `instance`
+ */
+InterpretResult interpret(VM *instance, const char *source);
+/**
+ * Compile `source` into a script function of `instance` without running it
+ *
+ * @return the script, NULL on a compile error. Nothing roots it: hand it to `interpretFunction()` before anything else
+ * allocates in `instance`.
+ */
+ObjFunction *compileSource(VM *instance, const char *source);
+/**
+ * `compileSource()` through the bytecode cache: load the `.loxc` file at `path` when `source` is NULL, else compile the
+ * script at `path` or map its cached bytecode (see `cache.c`)
+ */
+ObjFunction *loadScript(VM *instance, const char *path, const char *source);
+/**
+ * Write `script`, compiled from `source` by `instance`, to the `.loxc` file at `path`
+ */
+bool saveScript(VM *instance, const char *path, const char *source, ObjFunction *script);
+/**
+ * Run `script`, a script function compiled by `compileSource()` or copied into `instance`
+ */
+InterpretResult interpretFunction(VM *instance, ObjFunction *script);
+/**
+ * Call the global function, class or native function `name` with `argCount` arguments, from outside of the VM
+ *
+ * @param result what the call returned when it returns `INTERPRET_OK`. An object belongs to `instance`, it can be
+ * collected by the next call into it.
+ */
+InterpretResult callGlobal(VM *instance, const char *name, int argCount, const Value *args, Value *result);
+/**
+ * @return whether the global variable `name` is defined, its value is copied to `value` then
+ */
+bool getGlobal(VM *instance, const char *name, Value *value);
+//<
 
-void initVM();
-void freeVM();
-InterpretResult interpret(const char *source);
+int globalSlot(ObjString *name);
+/**
+ * Make room for one more frame and for `slotCount` stack slots
+ */
+bool growStack(int slotCount);
 void push(Value value);
 Value pop();
 
@@ -0,0 +1,778 @@
+/**
+ * Opcode handlers of the interpreter loop.
+ *
+ * @details This file has no include guard on purpose, it is included by `vm.c` once for the selected dispatch engine:
+ * inside the `switch` of `run()`, inside `run()` as labels of computed goto, or at file scope where every handler
+ * becomes its own function for the tail-call engine. `stepInstruction()` includes it once more when a JIT is
+ * built in. Handlers are written against these macros only:
+ *
+ * - `OPCODE(op)` opens the handler of `op`.
+ * - `DISPATCH()` ends the handler and transfers control to the next instruction.
+ * - `return INTERPRET_*` or `RUNTIME_ERROR()` leaves the interpreter loop.
+ * - `PUSH()`, `POP()`, `DROP()`, `PEEK()`, `READ_*()` work on the cached interpreter state, `STORE_FRAME()` and
+ *   `LOAD_FRAME()` spill and reload it (see the spill protocol in `vm.c`).
+ * - `QUICKEN()` and `DEOPT()` rewrite the running instruction to its typed or generic form (see `vm.c`).
+ * - `JIT_ENTRY()` and `HOT_LOOP()` hand the running frame to the baseline JIT (see `jit.c`), `HOT_LOOP()` hands the
+ *   loop to the tracing JIT instead (see `trace.c`), they do nothing when neither is built in.
+ * - `RETURN_TO_TRACE()` leaves a nested interpreter loop run by `callInstruction()` when its call returns.
+ *
+ * So a handler must never `break` out of itself, and it must spill before calling anything that allocates, reports an
+ * error or touches the call frames.
+ */
+
+OPCODE(OP_CONSTANT)
+{
+    Value constant = READ_CONSTANT();
+    PUSH(constant);
+    DISPATCH();
+}
+OPCODE(OP_NIL)
+{
+    PUSH(NIL_VAL);
+    DISPATCH();
+}
+OPCODE(OP_TRUE)
+{
+    PUSH(BOOL_VAL(true));
+    DISPATCH();
+}
+OPCODE(OP_FALSE)
+{
+    PUSH(BOOL_VAL(false));
+    DISPATCH();
+}
+OPCODE(OP_POP)
+{
+    DROP();
+    DISPATCH();
+}
+OPCODE(OP_SET_LOCAL)
+{
+    uint8_t slot = READ_BYTE();
+    slots[slot] = PEEK(0);
+    DISPATCH();
+}
+OPCODE(OP_GET_LOCAL)
+{
+    uint8_t slot = READ_BYTE();
+    PUSH(slots[slot]);
+    DISPATCH();
+}
+OPCODE(OP_GET_GLOBAL)
+{
+    uint16_t slot = READ_SHORT();
+    Value value = vm->globalValues.values[slot];
+    if (IS_UNDEFINED(value))
+    {
+        RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm->globalNames.values[slot]));
+    }
+    PUSH(value);
+    DISPATCH();
+}
+OPCODE(OP_DEFINE_GLOBAL)
+{
+    uint16_t slot = READ_SHORT();
+    vm->globalValues.values[slot] = PEEK(0);
+    DROP();
+    DISPATCH();
+}
+OPCODE(OP_SET_GLOBAL)
+{
+    uint16_t slot = READ_SHORT();
+    if (IS_UNDEFINED(vm->globalValues.values[slot]))
+    {
+        RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm->globalNames.values[slot]));
+    }
+    vm->globalValues.values[slot] = PEEK(0);
+    DISPATCH();
+}
+OPCODE(OP_GET_UPVALUE)
+{
+    uint8_t slot = READ_BYTE();
+    PUSH(*frame->closure->upvalues[slot]->location);
+    DISPATCH();
+}
+OPCODE(OP_SET_UPVALUE)
+{
+    ObjUpvalue *upvalue = frame->closure->upvalues[READ_BYTE()];
+    overwriteBarrier(*upvalue->location);
+    *upvalue->location = PEEK(0);
+    writeBarrier((Obj *)upvalue, PEEK(0));
+    DISPATCH();
+}
+OPCODE(OP_SET_PROPERTY)
+{
+    if (!IS_INSTANCE(PEEK(1)))
+    {
+        RUNTIME_ERROR("Only instances have fields.");
+    }
+
+    ObjInstance *instance = AS_INSTANCE(PEEK(1));
+    ObjString *name = READ_STRING();
+    InlineCache *cache = READ_INLINE_CACHE();
+    InlineCacheEntry *entry = probeCache(cache, instance->shape);
+    if (isCachedField(entry))
+    {
+        overwriteBarrier(instance->fields[entry->field]);
+        instance->fields[entry->field] = PEEK(0);
+        writeBarrier((Obj *)instance, PEEK(0));
+    }
+    else if (isCachedTransition(entry, instance))
+    {
+        lockHeap(); // the marking thread reads the shape and the fields together
+        instance->fields[entry->field] = PEEK(0);
+        instance->shape = entry->transition;
+        unlockHeap();
+        rememberObject((Obj *)instance);
+    }
+    else
+    {
+        STORE_FRAME(); // Adding a field can allocate
+        setProperty(instance, name, PEEK(0), cache);
+    }
+
+    Value value = POP();
+    DROP();
+    PUSH(value);
+    DISPATCH();
+}
+OPCODE(OP_GET_PROPERTY)
+{
+    if (!IS_INSTANCE(PEEK(0)))
+    {
+        RUNTIME_ERROR("Only instances have properties.");
+    }
+
+    ObjInstance *instance = AS_INSTANCE(PEEK(0));
+    ObjString *name = READ_STRING();
+    InlineCache *cache = READ_INLINE_CACHE();
+
+    /**
+     * A field held by the inline cache overwrites the instance on top of the stack with the field value.
+     *
+     * @note Handlers avoid taking the address of their own locals, it would stop the compiler from turning
+     * `DISPATCH()` into a tail call in the tail-call engine.
+     */
+    InlineCacheEntry *entry = probeCache(cache, instance->shape);
+    if (isCachedField(entry))
+    {
+        PEEK(0) = instance->fields[entry->field];
+        DISPATCH();
+    }
+
+    STORE_FRAME();
+    if (!getProperty(name, cache, false)) // Lookup field or method, and cache it
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+
+    DISPATCH();
+}
+OPCODE(OP_GET_SUPER)
+{
+    ObjString *name = READ_STRING();
+    ObjClass *superclass = AS_CLASS(POP());
+
+    STORE_FRAME();
+    if (!bindMethod(superclass, name))
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+    DISPATCH();
+}
+OPCODE(OP_EQUAL)
+{
+    if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+    {
+        QUICKEN(OP_EQUAL_NUMBER);
+    }
+
+    Value b = POP();
+    Value a = POP();
+    PUSH(BOOL_VAL(valuesEqual(a, b)));
+    DISPATCH();
+}
+OPCODE(OP_GREATER)
+{
+    BINARY_OP(BOOL_VAL, >);
+    DISPATCH();
+}
+OPCODE(OP_LESS)
+{
+    BINARY_OP(BOOL_VAL, <);
+    DISPATCH();
+}
+OPCODE(OP_ADD)
+{
+    if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1)))
+    {
+        QUICKEN(OP_ADD_STRING);
+        STORE_FRAME();
+        concatenate();
+        sp = vm->stackTop;
+    }
+    else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+    {
+        QUICKEN(OP_ADD_NUMBER);
+        double b = AS_NUMBER(POP());
+        double a = AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a + b));
+    }
+    else
+    {
+        RUNTIME_ERROR("Operands must be two numbers or two strings.");
+    }
+
+    DISPATCH();
+}
+OPCODE(OP_SUBTRACT)
+{
+    BINARY_OP(NUMBER_VAL, -);
+    DISPATCH();
+}
+OPCODE(OP_MULTIPLY)
+{
+    BINARY_OP(NUMBER_VAL, *);
+    DISPATCH();
+}
+OPCODE(OP_DIVIDE)
+{
+    BINARY_OP(NUMBER_VAL, /);
+    DISPATCH();
+}
+OPCODE(OP_NOT)
+{
+    PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+    DISPATCH();
+}
+OPCODE(OP_NEGATE)
+{
+    if (!IS_NUMBER(PEEK(0)))
+    {
+        RUNTIME_ERROR("Operand must be a number.");
+    }
+    PEEK(0) = NUMBER_VAL(-(AS_NUMBER(PEEK(0))));
+    DISPATCH();
+}
+OPCODE(OP_PRINT)
+{
+    flockfile(stdout); // a line is printed whole when VMs run on several threads
+    printValue(POP());
+    printf("\n");
+    funlockfile(stdout);
+    DISPATCH();
+}
+OPCODE(OP_JUMP)
+{
+    uint16_t offset = READ_SHORT();
+    ip += offset;
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_FALSE)
+{
+    uint16_t offset = READ_SHORT(); // read jump offset
+    if (isFalsey(PEEK(0)))
+    {
+        ip += offset;
+    }
+    DISPATCH();
+}
+OPCODE(OP_LOOP)
+{
+    uint16_t offset = READ_SHORT();
+    ip -= offset; // jump to start of loop
+    HOT_LOOP();
+    DISPATCH();
+}
+OPCODE(OP_CALL)
+{
+    int argCount = READ_BYTE();
+    STORE_FRAME();
+    if (!callValue(PEEK(argCount), argCount))
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME(); // Switch to the stack frame of current invoked function.
+    JIT_ENTRY();
+    DISPATCH();
+}
+OPCODE(OP_INVOKE)
+{
+    ObjString *method = READ_STRING();
+    int argCount = READ_BYTE();
+    InlineCache *cache = READ_INLINE_CACHE();
+    STORE_FRAME();
+    if (!invoke(method, argCount, cache))
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+    JIT_ENTRY();
+    DISPATCH();
+}
+OPCODE(OP_SUPER_INVOKE)
+{
+    ObjString *method = READ_STRING();
+    int argCount = READ_BYTE();
+    ObjClass *superclass = AS_CLASS(POP());
+    STORE_FRAME();
+    if (!invokeFromClass(superclass, method, argCount))
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+    JIT_ENTRY();
+    DISPATCH();
+}
+OPCODE(OP_CLOSURE)
+{
+    ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+    STORE_FRAME();
+    ObjClosure *closure = newClosure(function);
+    PUSH(OBJ_VAL(closure));
+    STORE_FRAME(); // Keep the closure reachable while capturing upvalues allocates
+    for (int i = 0; i < closure->upvalueCount; i++)
+    {
+        uint8_t kind = READ_BYTE();
+        uint8_t index = READ_BYTE();
+        if (kind != CAPTURE_UPVALUE)
+        {
+            closure->upvalues[i] = captureUpvalue(slots + index, kind == CAPTURE_FRAME_LOCAL);
+        }
+        else
+        {
+            closure->upvalues[i] = frame->closure->upvalues[index];
+        }
+        writeBarrier((Obj *)closure, OBJ_VAL(closure->upvalues[i])); // capturing may have promoted the closure
+    }
+    DISPATCH();
+}
+OPCODE(OP_CLOSE_UPVALUE)
+{
+    closeUpvalues(sp - 1);
+    DROP();
+    DISPATCH();
+}
+OPCODE(OP_RETURN)
+{
+    Value result = POP();
+    closeUpvalues(slots);
+    vm->frameCount--;
+    vm->stackTop = slots;
+    push(result);
+    if (vm->frameCount == 0)
+    {
+        return INTERPRET_OK; // the result is left on the stack for `interpret()` or `callGlobal()`
+    }
+
+    RETURN_TO_TRACE();
+    LOAD_FRAME(); // Switch to the stack frame of the caller after executing `return` statement.
+    JIT_ENTRY();
+    DISPATCH();
+}
+OPCODE(OP_CLASS)
+{
+    ObjString *name = READ_STRING();
+    STORE_FRAME();
+    PUSH(OBJ_VAL(newClass(name)));
+    DISPATCH();
+}
+OPCODE(OP_INHERIT)
+{
+    Value superclass = PEEK(1);
+    if (!IS_CLASS(superclass))
+    {
+        RUNTIME_ERROR("Superclass must be a class.");
+    }
+
+    ObjClass *subclass = AS_CLASS(PEEK(0));
+
+    /// @brief `copy-down inheritance`
+    ///
+    /// @note When the subclass is declared, we copy all of the inherited class’s methods down into the subclass’s own method table.
+    /// It’s simple and fast, but, like most optimizations, you get to use it only under certain constraints.
+    /// It works in Lox because Lox classes are closed. Once a class declaration is finished executing,
+    /// the set of methods for that class can never change.
+    STORE_FRAME(); // The method table can grow
+    tableAddAll(&(AS_CLASS(superclass)->methods), &(subclass->methods));
+    rememberObject((Obj *)subclass);
+
+    DROP(); // subclass
+    DISPATCH();
+}
+OPCODE(OP_METHOD)
+{
+    ObjString *name = READ_STRING();
+    STORE_FRAME();
+    defineMethod(name);
+    sp = vm->stackTop;
+    DISPATCH();
+}
+OPCODE(OP_NOT_EQUAL)
+{
+    if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+    {
+        QUICKEN(OP_NOT_EQUAL_NUMBER);
+    }
+
+    Value b = POP();
+    Value a = POP();
+    PUSH(BOOL_VAL(!valuesEqual(a, b)));
+    DISPATCH();
+}
+OPCODE(OP_GREATER_EQUAL)
+{
+    BINARY_OP(NOT_BOOL_VAL, <);
+    DISPATCH();
+}
+OPCODE(OP_LESS_EQUAL)
+{
+    BINARY_OP(NOT_BOOL_VAL, >);
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_EQUAL)
+{
+    if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+    {
+        QUICKEN(OP_JUMP_IF_EQUAL_NUMBER);
+    }
+
+    uint16_t offset = READ_SHORT();
+    Value b = POP();
+    Value a = POP();
+    if (valuesEqual(a, b))
+    {
+        ip += offset;
+    }
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_NOT_EQUAL)
+{
+    if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+    {
+        QUICKEN(OP_JUMP_IF_NOT_EQUAL_NUMBER);
+    }
+
+    uint16_t offset = READ_SHORT();
+    Value b = POP();
+    Value a = POP();
+    if (!valuesEqual(a, b))
+    {
+        ip += offset;
+    }
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_LESS)
+{
+    COMPARE_JUMP(<, true);
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_NOT_LESS)
+{
+    COMPARE_JUMP(<, false);
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_GREATER)
+{
+    COMPARE_JUMP(>, true);
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_NOT_GREATER)
+{
+    COMPARE_JUMP(>, false);
+    DISPATCH();
+}
+OPCODE(OP_ADD_CONSTANT_TO_LOCAL)
+{
+    uint8_t slot = READ_BYTE();
+    Value constant = READ_CONSTANT(); // always a number, see `peephole.c`
+    if (!IS_NUMBER(slots[slot]))
+    {
+        RUNTIME_ERROR("Operands must be two numbers or two strings.");
+    }
+    slots[slot] = NUMBER_VAL(AS_NUMBER(slots[slot]) + AS_NUMBER(constant));
+    DISPATCH();
+}
+OPCODE(OP_ADD_NUMBER)
+{
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+    {
+        DEOPT(OP_ADD);
+        DISPATCH();
+    }
+
+    double b = AS_NUMBER(POP());
+    double a = AS_NUMBER(POP());
+    PUSH(NUMBER_VAL(a + b));
+    DISPATCH();
+}
+OPCODE(OP_ADD_STRING)
+{
+    if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1)))
+    {
+        DEOPT(OP_ADD);
+        DISPATCH();
+    }
+
+    STORE_FRAME();
+    concatenate();
+    sp = vm->stackTop;
+    DISPATCH();
+}
+OPCODE(OP_EQUAL_NUMBER)
+{
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+    {
+        DEOPT(OP_EQUAL);
+        DISPATCH();
+    }
+
+    double b = AS_NUMBER(POP());
+    double a = AS_NUMBER(POP());
+    PUSH(BOOL_VAL(a == b));
+    DISPATCH();
+}
+OPCODE(OP_NOT_EQUAL_NUMBER)
+{
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+    {
+        DEOPT(OP_NOT_EQUAL);
+        DISPATCH();
+    }
+
+    double b = AS_NUMBER(POP());
+    double a = AS_NUMBER(POP());
+    PUSH(BOOL_VAL(a != b));
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_EQUAL_NUMBER)
+{
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+    {
+        DEOPT(OP_JUMP_IF_EQUAL);
+        DISPATCH();
+    }
+
+    COMPARE_JUMP(==, true);
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_NOT_EQUAL_NUMBER)
+{
+    if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1)))
+    {
+        DEOPT(OP_JUMP_IF_NOT_EQUAL);
+        DISPATCH();
+    }
+
+    COMPARE_JUMP(==, false);
+    DISPATCH();
+}
+OPCODE(OP_GET_PROPERTY_FRAME)
+{
+    if (!IS_INSTANCE(PEEK(0)))
+    {
+        RUNTIME_ERROR("Only instances have properties.");
+    }
+
+    ObjInstance *instance = AS_INSTANCE(PEEK(0));
+    ObjString *name = READ_STRING();
+    InlineCache *cache = READ_INLINE_CACHE();
+
+    InlineCacheEntry *entry = probeCache(cache, instance->shape); // a field is read like `OP_GET_PROPERTY` does
+    if (isCachedField(entry))
+    {
+        PEEK(0) = instance->fields[entry->field];
+        DISPATCH();
+    }
+
+    STORE_FRAME();
+    if (!getProperty(name, cache, true)) // a method is bound into the frame cell of the slot of the instance
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+
+    DISPATCH();
+}
+OPCODE(OP_CONSTANT_LONG)
+{
+    Value constant = READ_LONG_CONSTANT();
+    PUSH(constant);
+    DISPATCH();
+}
+OPCODE(OP_JUMP_LONG)
+{
+    uint32_t offset = READ_LONG();
+    ip += offset;
+    DISPATCH();
+}
+OPCODE(OP_JUMP_IF_FALSE_LONG)
+{
+    uint32_t offset = READ_LONG();
+    if (isFalsey(PEEK(0)))
+    {
+        ip += offset;
+    }
+    DISPATCH();
+}
+OPCODE(OP_LOOP_LONG)
+{
+    uint32_t offset = READ_LONG();
+    ip -= offset; // a loop body over 64 KiB is never handed to a JIT by `HOT_LOOP()`
+    DISPATCH();
+}
+OPCODE(OP_WIDE)
+{
+    /**
+     * The instruction after the prefix with 3-byte indexes. Property accesses and invocations skip the inline fast
+     * path of their short form and go straight to `getProperty()`, `setProperty()` and `invoke()`, which still probe
+     * and fill the inline cache.
+     */
+    switch (READ_BYTE())
+    {
+    case OP_GET_LOCAL:
+    {
+        uint32_t slot = READ_LONG();
+        PUSH(slots[slot]);
+        DISPATCH();
+    }
+    case OP_SET_LOCAL:
+    {
+        uint32_t slot = READ_LONG();
+        slots[slot] = PEEK(0);
+        DISPATCH();
+    }
+    case OP_GET_UPVALUE:
+    {
+        uint32_t slot = READ_LONG();
+        PUSH(*frame->closure->upvalues[slot]->location);
+        DISPATCH();
+    }
+    case OP_SET_UPVALUE:
+    {
+        ObjUpvalue *upvalue = frame->closure->upvalues[READ_LONG()];
+        overwriteBarrier(*upvalue->location);
+        *upvalue->location = PEEK(0);
+        writeBarrier((Obj *)upvalue, PEEK(0));
+        DISPATCH();
+    }
+    case OP_GET_PROPERTY:
+    {
+        if (!IS_INSTANCE(PEEK(0)))
+        {
+            RUNTIME_ERROR("Only instances have properties.");
+        }
+
+        ObjString *name = READ_LONG_STRING();
+        InlineCache *cache = READ_INLINE_CACHE();
+        STORE_FRAME();
+        if (!getProperty(name, cache, false))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    case OP_SET_PROPERTY:
+    {
+        if (!IS_INSTANCE(PEEK(1)))
+        {
+            RUNTIME_ERROR("Only instances have fields.");
+        }
+
+        ObjInstance *instance = AS_INSTANCE(PEEK(1));
+        ObjString *name = READ_LONG_STRING();
+        InlineCache *cache = READ_INLINE_CACHE();
+        STORE_FRAME(); // Adding a field can allocate
+        setProperty(instance, name, PEEK(0), cache);
+
+        Value value = POP();
+        DROP();
+        PUSH(value);
+        DISPATCH();
+    }
+    case OP_GET_SUPER:
+    {
+        ObjString *name = READ_LONG_STRING();
+        ObjClass *superclass = AS_CLASS(POP());
+
+        STORE_FRAME();
+        if (!bindMethod(superclass, name))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    case OP_INVOKE:
+    {
+        ObjString *method = READ_LONG_STRING();
+        int argCount = READ_BYTE();
+        InlineCache *cache = READ_INLINE_CACHE();
+        STORE_FRAME();
+        if (!invoke(method, argCount, cache))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME();
+        JIT_ENTRY();
+        DISPATCH();
+    }
+    case OP_SUPER_INVOKE:
+    {
+        ObjString *method = READ_LONG_STRING();
+        int argCount = READ_BYTE();
+        ObjClass *superclass = AS_CLASS(POP());
+        STORE_FRAME();
+        if (!invokeFromClass(superclass, method, argCount))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME();
+        JIT_ENTRY();
+        DISPATCH();
+    }
+    case OP_CLOSURE:
+    {
+        ObjFunction *function = AS_FUNCTION(READ_LONG_CONSTANT());
+        STORE_FRAME();
+        ObjClosure *closure = newClosure(function);
+        PUSH(OBJ_VAL(closure));
+        STORE_FRAME(); // Keep the closure reachable while capturing upvalues allocates
+        for (int i = 0; i < closure->upvalueCount; i++)
+        {
+            uint8_t kind = READ_BYTE();
+            uint32_t index = READ_LONG();
+            if (kind != CAPTURE_UPVALUE)
+            {
+                closure->upvalues[i] = captureUpvalue(slots + index, kind == CAPTURE_FRAME_LOCAL);
+            }
+            else
+            {
+                closure->upvalues[i] = frame->closure->upvalues[index];
+            }
+            writeBarrier((Obj *)closure, OBJ_VAL(closure->upvalues[i])); // capturing may have promoted the closure
+        }
+        DISPATCH();
+    }
+    case OP_CLASS:
+    {
+        ObjString *name = READ_LONG_STRING();
+        STORE_FRAME();
+        PUSH(OBJ_VAL(newClass(name)));
+        DISPATCH();
+    }
+    case OP_METHOD:
+    {
+        ObjString *name = READ_LONG_STRING();
+        STORE_FRAME();
+        defineMethod(name);
+        sp = vm->stackTop;
+        DISPATCH();
+    }
+    }
+
+    RUNTIME_ERROR("Unknown wide instruction."); // the compiler never emits one
+}
@@ -0,0 +1,327 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS is not in strict C17 mode
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "x64.h"
+
+#if defined(BASELINE_JIT) || defined(TRACING_JIT)
+
+void initAssembler(Assembler *as)
+{
+    as->code = NULL;
+    as->count = 0;
+    as->capacity = 0;
+}
+
+void freeAssembler(Assembler *as)
+{
+    free(as->code);
+    initAssembler(as);
+}
+
+void emitByte(Assembler *as, uint8_t byte)
+{
+    if (as->count == as->capacity)
+    {
+        as->capacity = as->capacity < 256 ? 256 : as->capacity * 2;
+        as->code = realloc(as->code, as->capacity);
+        if (as->code == NULL)
+        {
+            exit(1);
+        }
+    }
+
+    as->code[as->count++] = byte;
+}
+
+void emitBytes(Assembler *as, const char *bytes, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        emitByte(as, (uint8_t)bytes[i]);
+    }
+}
+
+void emit32(Assembler *as, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        emitByte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+void emit64(Assembler *as, uint64_t value)
+{
+    emit32(as, (uint32_t)value);
+    emit32(as, (uint32_t)(value >> 32));
+}
+
+static void emitRex(Assembler *as, int reg, int rm)
+{
+    emitByte(as, 0x48 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+}
+
+/**
+ * The REX prefix of an instruction without a 64-bit operand, only when one of its registers is past the eighth
+ */
+static void emitOptionalRex(Assembler *as, int reg, int rm)
+{
+    if (reg >= 8 || rm >= 8)
+    {
+        emitByte(as, 0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+    }
+}
+
+void movImmediate(Assembler *as, Register dst, uint64_t value)
+{
+    emitRex(as, 0, dst);
+    emitByte(as, 0xb8 + (dst & 7));
+    emit64(as, value);
+}
+
+void emitMemory(Assembler *as, bool wide, uint8_t opcode, int reg, Register base, int32_t disp)
+{
+    if (wide || reg >= R8 || base >= R8)
+    {
+        emitByte(as, (wide ? 0x48 : 0x40) | ((reg & 8) >> 1) | ((base & 8) >> 3));
+    }
+    emitByte(as, opcode);
+    emitByte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+    {
+        emitByte(as, 0x24); // `rsp` and `r12` as a base need a SIB byte
+    }
+    emit32(as, (uint32_t)disp);
+}
+
+void load(Assembler *as, Register dst, Register base, int32_t disp)
+{
+    emitMemory(as, true, 0x8b, dst, base, disp);
+}
+
+void store(Assembler *as, Register base, int32_t disp, Register src)
+{
+    emitMemory(as, true, 0x89, src, base, disp);
+}
+
+void compareMemory(Assembler *as, bool wide, Register base, int32_t disp, int8_t value)
+{
+    emitMemory(as, wide, 0x83, 7, base, disp);
+    emitByte(as, (uint8_t)value);
+}
+
+void aluRegisters(Assembler *as, AluOp op, Register dst, Register src)
+{
+    emitRex(as, src, dst);
+    emitByte(as, op);
+    emitByte(as, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+void movRegister(Assembler *as, Register dst, Register src)
+{
+    aluRegisters(as, ALU_MOV, dst, src);
+}
+
+void callAddress(Assembler *as, void *address)
+{
+    movImmediate(as, RAX, (uint64_t)(uintptr_t)address);
+    emitBytes(as, "\xff\xd0", 2); // call rax
+}
+
+void compareContinue(Assembler *as)
+{
+    emitBytes(as, "\x83\xf8", 2);
+    emitByte(as, (uint8_t)JIT_CONTINUE);
+}
+
+void movToXmm(Assembler *as, int xmm, Register src)
+{
+    emitByte(as, 0x66);
+    emitRex(as, xmm, src);
+    emitBytes(as, "\x0f\x6e", 2);
+    emitByte(as, 0xc0 | ((xmm & 7) << 3) | (src & 7));
+}
+
+void movFromXmm(Assembler *as, Register dst, int xmm)
+{
+    emitByte(as, 0x66);
+    emitRex(as, xmm, dst);
+    emitBytes(as, "\x0f\x7e", 2);
+    emitByte(as, 0xc0 | ((xmm & 7) << 3) | (dst & 7));
+}
+
+void sseRegisters(Assembler *as, SseOp op, int dst, int src)
+{
+    emitByte(as, 0xf2);
+    emitOptionalRex(as, dst, src);
+    emitByte(as, 0x0f);
+    emitByte(as, op);
+    emitByte(as, 0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+void compareXmm(Assembler *as, int a, int b)
+{
+    emitByte(as, 0x66);
+    emitOptionalRex(as, a, b);
+    emitBytes(as, "\x0f\x2e", 2);
+    emitByte(as, 0xc0 | ((a & 7) << 3) | (b & 7));
+}
+
+void setCondition(Assembler *as, Condition condition, Register dst)
+{
+    emitByte(as, 0x0f);
+    emitByte(as, 0x90 | condition);
+    emitByte(as, 0xc0 | dst);
+}
+
+int emitJump(Assembler *as, int condition)
+{
+    if (condition < 0)
+    {
+        emitByte(as, 0xe9);
+    }
+    else
+    {
+        emitByte(as, 0x0f);
+        emitByte(as, 0x80 | condition);
+    }
+
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+void patchJump(Assembler *as, int jump, int target)
+{
+    int32_t displacement = target - (jump + 4);
+    memcpy(&as->code[jump], &displacement, sizeof(displacement));
+}
+
+void patchJumpHere(Assembler *as, int jump)
+{
+    patchJump(as, jump, as->count);
+}
+
+int jumpIfNotNumber(Assembler *as, Register src)
+{
+    movRegister(as, RCX, src);
+    aluRegisters(as, ALU_AND, RCX, R14);
+    aluRegisters(as, ALU_CMP, RCX, R14);
+    return emitJump(as, CC_E);
+}
+
+void boxBool(Assembler *as)
+{
+    emitBytes(as, "\x0f\xb6\xc0", 3); // movzx eax, al
+    movImmediate(as, RCX, FALSE_VAL);
+    aluRegisters(as, ALU_ADD, RAX, RCX); // TRUE_VAL is FALSE_VAL + 1
+}
+
+int loadGlobal(Assembler *as, int slot)
+{
+    movImmediate(as, RDX, (uint64_t)(uintptr_t)&vm->globalValues.values);
+    load(as, RDX, RDX, 0);
+    load(as, RAX, RDX, slot * (int)sizeof(Value));
+    movImmediate(as, RCX, UNDEFINED_VAL);
+    aluRegisters(as, ALU_CMP, RAX, RCX);
+    return emitJump(as, CC_E);
+}
+
+void loadUpvalue(Assembler *as, int slot)
+{
+    load(as, RAX, R13, offsetof(CallFrame, closure));
+    load(as, RAX, RAX, offsetof(ObjClosure, upvalues));
+    load(as, RAX, RAX, slot * (int)sizeof(ObjUpvalue *));
+}
+
+void loadUpvalueLocation(Assembler *as, int slot)
+{
+    loadUpvalue(as, slot);
+    load(as, RAX, RAX, offsetof(ObjUpvalue, location));
+}
+
+void guardWriteBarrier(Assembler *as, Register owner, Register value, int slow[2])
+{
+    movImmediate(as, RSI, (uint64_t)(uintptr_t)&vm->marking);
+    emitMemory(as, false, 0x80, 7, RSI, 0); // cmp byte [rsi], 0
+    emitByte(as, 0);
+    slow[0] = emitJump(as, CC_NE);
+    emitMemory(as, false, 0x80, 7, owner, offsetof(Obj, generation)); // cmp byte [owner + generation], GEN_OLD
+    emitByte(as, GEN_OLD);
+    int young = emitJump(as, CC_NE);
+    movImmediate(as, RCX, SIGN_BIT | QNAN);
+    movRegister(as, RSI, value);
+    aluRegisters(as, ALU_AND, RSI, RCX);
+    aluRegisters(as, ALU_CMP, RSI, RCX);
+    int notObject = emitJump(as, CC_NE);
+    movImmediate(as, RCX, ~(SIGN_BIT | QNAN));
+    movRegister(as, RSI, value);
+    aluRegisters(as, ALU_AND, RSI, RCX);
+    emitMemory(as, false, 0x80, 7, RSI, offsetof(Obj, generation)); // cmp byte [rsi + generation], GEN_YOUNG
+    emitByte(as, GEN_YOUNG);
+    slow[1] = emitJump(as, CC_E);
+    patchJumpHere(as, young);
+    patchJumpHere(as, notObject);
+}
+
+void loadObject(Assembler *as, ObjType type, int slow[2])
+{
+    movImmediate(as, RCX, SIGN_BIT | QNAN);
+    movRegister(as, RDX, RAX);
+    aluRegisters(as, ALU_AND, RDX, RCX);
+    aluRegisters(as, ALU_CMP, RDX, RCX);
+    slow[0] = emitJump(as, CC_NE);
+    movImmediate(as, RCX, ~(SIGN_BIT | QNAN));
+    aluRegisters(as, ALU_AND, RAX, RCX);
+    compareMemory(as, false, RAX, offsetof(Obj, type), type);
+    slow[1] = emitJump(as, CC_NE);
+}
+
+int readShort(uint8_t *ip)
+{
+    return (ip[1] << 8) | ip[2];
+}
+
+uint8_t genericOpcode(uint8_t instruction)
+{
+    switch (instruction)
+    {
+    case OP_ADD_NUMBER:
+    case OP_ADD_STRING:
+        return OP_ADD;
+    case OP_EQUAL_NUMBER:
+        return OP_EQUAL;
+    case OP_NOT_EQUAL_NUMBER:
+        return OP_NOT_EQUAL;
+    case OP_JUMP_IF_EQUAL_NUMBER:
+        return OP_JUMP_IF_EQUAL;
+    case OP_JUMP_IF_NOT_EQUAL_NUMBER:
+        return OP_JUMP_IF_NOT_EQUAL;
+    case OP_GET_PROPERTY_FRAME:
+        return OP_GET_PROPERTY;
+    default:
+        return instruction;
+    }
+}
+
+uint8_t *mapCode(Assembler *as)
+{
+    uint8_t *code = mmap(NULL, as->count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    memcpy(code, as->code, as->count);
+    mprotect(code, as->count, PROT_READ | PROT_EXEC);
+    return code;
+}
+
+void unmapCode(uint8_t *code, size_t size)
+{
+    munmap(code, size);
+}
+
+#endif
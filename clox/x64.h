@@ -0,0 +1,214 @@
+#ifndef clox_x64_h
+#define clox_x64_h
+
+#include "common.h"
+#include "chunk.h"
+#include "object.h"
+
+#if defined(BASELINE_JIT) || defined(TRACING_JIT)
+
+/**
+ * x86-64 code emission shared by the baseline JIT (`jit.c`) and the tracing JIT (`trace.c`): an encoder of the few
+ * instructions they need, a handful of templates that work on NaN-boxed values, and the mapping of finished code.
+ *
+ * The templates assume the register convention of both JITs: `r13` holds the running frame and `r14` holds `QNAN`.
+ */
+
+typedef enum
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+} Register;
+
+/**
+ * Condition codes, the low nibble of `jcc` and `setcc`
+ */
+typedef enum
+{
+    CC_B = 0x2,  // below, or unordered after `ucomisd`
+    CC_AE = 0x3, // above or equal
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6, // below or equal, or unordered
+    CC_A = 0x7,  // above, never unordered
+    CC_S = 0x8,  // negative
+    CC_NS = 0x9,
+    CC_P = 0xa,  // unordered
+    CC_NP = 0xb,
+    CC_GE = 0xd, // signed greater or equal
+} Condition;
+
+/**
+ * Opcodes of the instructions taking two 64-bit registers
+ */
+typedef enum
+{
+    ALU_ADD = 0x01,
+    ALU_OR = 0x09,
+    ALU_AND = 0x21,
+    ALU_SUB = 0x29,
+    ALU_CMP = 0x39,
+    ALU_MOV = 0x89,
+} AluOp;
+
+/**
+ * Opcodes of the scalar double instructions taking two `xmm` registers
+ */
+typedef enum
+{
+    SSE_MOV = 0x10,
+    SSE_ADD = 0x58,
+    SSE_MUL = 0x59,
+    SSE_SUB = 0x5c,
+    SSE_DIV = 0x5e,
+} SseOp;
+
+/**
+ * Growable buffer of machine code
+ */
+typedef struct
+{
+    uint8_t *code;
+    int count;
+    int capacity;
+} Assembler;
+
+void initAssembler(Assembler *as);
+void freeAssembler(Assembler *as);
+
+void emitByte(Assembler *as, uint8_t byte);
+void emitBytes(Assembler *as, const char *bytes, int count);
+void emit32(Assembler *as, uint32_t value);
+void emit64(Assembler *as, uint64_t value);
+/**
+ * `mov dst, imm64`
+ */
+void movImmediate(Assembler *as, Register dst, uint64_t value);
+/**
+ * Emit `opcode` with a memory operand `[base + disp]`, `reg` is the register operand or the opcode extension
+ *
+ * @param wide 64-bit operand size
+ */
+void emitMemory(Assembler *as, bool wide, uint8_t opcode, int reg, Register base, int32_t disp);
+void load(Assembler *as, Register dst, Register base, int32_t disp);
+void store(Assembler *as, Register base, int32_t disp, Register src);
+/**
+ * `cmp [base + disp], imm8` on a 64-bit or a 32-bit value
+ */
+void compareMemory(Assembler *as, bool wide, Register base, int32_t disp, int8_t value);
+/**
+ * `op dst, src`
+ */
+void aluRegisters(Assembler *as, AluOp op, Register dst, Register src);
+void movRegister(Assembler *as, Register dst, Register src);
+/**
+ * `call` the C function at `address`, `rax` is clobbered
+ */
+void callAddress(Assembler *as, void *address);
+/**
+ * `cmp eax, JIT_CONTINUE`
+ */
+void compareContinue(Assembler *as);
+/**
+ * `movq xmm, reg`
+ */
+void movToXmm(Assembler *as, int xmm, Register src);
+/**
+ * `movq reg, xmm`
+ */
+void movFromXmm(Assembler *as, Register dst, int xmm);
+/**
+ * `op xmm(dst), xmm(src)` on the low doubles
+ */
+void sseRegisters(Assembler *as, SseOp op, int dst, int src);
+/**
+ * `ucomisd xmm(a), xmm(b)`, sets the flags of an unsigned compare of `a` with `b`, or all of them when unordered
+ */
+void compareXmm(Assembler *as, int a, int b);
+/**
+ * `setcc` of the low byte of `dst`, `al` or `cl`
+ */
+void setCondition(Assembler *as, Condition condition, Register dst);
+/**
+ * Emit a `jcc rel32`, or a `jmp rel32` when `condition` is negative
+ *
+ * @return offset of the displacement, for `patchJump()`
+ */
+int emitJump(Assembler *as, int condition);
+/**
+ * Point the jump emitted at `jump` to the native offset `target`
+ */
+void patchJump(Assembler *as, int jump, int target);
+void patchJumpHere(Assembler *as, int jump);
+
+/**
+ * Jump away when the value in `src` is not a number, `rcx` is clobbered
+ *
+ * @return the jump, for `patchJump()`
+ */
+int jumpIfNotNumber(Assembler *as, Register src);
+/**
+ * `rax = BOOL_VAL(al)`
+ */
+void boxBool(Assembler *as);
+/**
+ * Load `vm->globalValues.values` into `rdx` and the global at `slot` into `rax`, jump away when it is not defined
+ */
+int loadGlobal(Assembler *as, int slot);
+/**
+ * Load the upvalue at `slot` of the closure of the frame into `rax`
+ */
+void loadUpvalue(Assembler *as, int slot);
+/**
+ * Load the address of the value of the upvalue at `slot` of the closure of the frame into `rax`
+ */
+void loadUpvalueLocation(Assembler *as, int slot);
+/**
+ * Jump away when storing the value in `value` into the object `owner` needs the write barrier of `memory.h`: when a
+ * major collection is marking, or the owner is old and the value a young object. `rcx` and `rsi` are clobbered.
+ *
+ * @param slow the two jumps taken then
+ */
+void guardWriteBarrier(Assembler *as, Register owner, Register value, int slow[2]);
+/**
+ * Unbox the object in the value in `rax` into `rax`, jump away unless it is an object of `type`
+ *
+ * @param slow the two jumps taken when it is not
+ */
+void loadObject(Assembler *as, ObjType type, int slow[2]);
+
+/**
+ * @return the 2-byte operand of the instruction at `ip`
+ */
+int readShort(uint8_t *ip);
+/**
+ * Typed forms of quickened instructions are compiled like their generic form, their guards are the same. So are
+ * frame-bound forms, whose slow path is the interpreter.
+ */
+uint8_t genericOpcode(uint8_t instruction);
+
+/**
+ * Copy the code of `as` to a new executable mapping
+ *
+ * @return the mapping, NULL when it fails
+ */
+uint8_t *mapCode(Assembler *as);
+void unmapCode(uint8_t *code, size_t size);
+
+#endif
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+
+#include "ast.h"
+
+/**
+ * Size of an arena block, bigger requests get a block of their own
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void initArena(Arena *arena)
+{
+    arena->blocks = NULL;
+}
+
+/**
+ * @return memory that lives until `freeArena()`, not zeroed
+ */
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->used + size > block->size)
+    {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL)
+        {
+            exit(1);
+        }
+
+        block->used = 0;
+        block->size = blockSize;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *pointer = block->data + block->used;
+    block->used += size;
+    return pointer;
+}
+
+void freeArena(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->blocks = NULL;
+}
+
+Node *newNode(Arena *arena, NodeType type, int line)
+{
+    Node *node = arenaAlloc(arena, sizeof(Node));
+    node->type = type;
+    node->line = line;
+    node->next = NULL;
+    return node;
+}
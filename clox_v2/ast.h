@@ -0,0 +1,255 @@
+#ifndef clox_ast_h
+#define clox_ast_h
+
+#include "common.h"
+#include "scanner.h"
+
+/**
+ * Abstract syntax tree built by the parser, annotated by the resolver and consumed by the code generator.
+ *
+ * @details Nodes live in an `Arena` for the time of one `compile()` and are freed all at once. They hold no heap
+ * objects: names and strings are tokens pointing into the source, so the garbage collector never sees the tree.
+ */
+typedef enum
+{
+    // Expressions
+    NODE_NIL,
+    NODE_TRUE,
+    NODE_FALSE,
+    NODE_NUMBER,
+    NODE_STRING,
+    NODE_VARIABLE,
+    NODE_ASSIGN,
+    NODE_THIS,
+    NODE_SUPER,
+    NODE_UNARY,
+    NODE_BINARY,
+    NODE_AND,
+    NODE_OR,
+    NODE_CONDITIONAL,
+    NODE_CALL,
+    NODE_GET,
+    NODE_SET,
+    NODE_INVOKE,
+    NODE_FUNCTION,
+    // Statements
+    NODE_PRINT,
+    NODE_EXPRESSION,
+    NODE_VAR,
+    NODE_FUN,
+    NODE_CLASS,
+    NODE_BLOCK,
+    NODE_IF,
+    NODE_WHILE,
+    NODE_FOR,
+    NODE_BREAK,
+    NODE_CONTINUE,
+    NODE_RETURN,
+} NodeType;
+
+typedef enum
+{
+    TYPE_FUNCTION,
+    TYPE_INITIALIZER, // class constructor
+    TYPE_METHOD,
+    TYPE_SCRIPT // Top-level function that wraps all bytecode
+} FunctionType;
+
+typedef enum
+{
+    VAR_LOCAL,   // index = register of the local
+    VAR_UPVALUE, // index = upvalue index
+    VAR_GLOBAL,  // the name is the operand
+} VariableKind;
+
+/**
+ * A use of a variable, `kind` and `index` are set by the resolver.
+ */
+typedef struct
+{
+    Token name;
+    VariableKind kind;
+    int index;
+} Variable;
+
+/**
+ * A variable being declared, `slot` and `isCaptured` are set by the resolver.
+ */
+typedef struct
+{
+    Token name;
+    /**
+     * Register of a local variable, `-1` for a global
+     */
+    int slot;
+    /**
+     * The local is captured by a nested function, its upvalue is closed when its scope ends
+     */
+    bool isCaptured;
+} Declaration;
+
+/**
+ * Compile-time presentation of a variable that a closure function inherited from its enclosing function.
+ */
+typedef struct
+{
+    uint8_t index;
+    bool isLocal;
+} Upvalue;
+
+typedef struct Node Node;
+
+typedef struct
+{
+    FunctionType type;
+    Token name;
+    Declaration *params;
+    int arity;
+    /**
+     * Statements of the body, linked by `Node.next`
+     */
+    Node *body;
+    /**
+     * Variables of enclosing functions the closure captures, set by the resolver
+     */
+    Upvalue *upvalues;
+    int upvalueCount;
+} FunctionNode;
+
+typedef struct
+{
+    Declaration name;
+    Node *superclass; // `NODE_VARIABLE`, NULL without superclass
+    /**
+     * Hidden local holding the superclass, captured by the methods that use `super`
+     */
+    Declaration super;
+    Node *methods; // `NODE_FUNCTION`s linked by `Node.next`
+} ClassNode;
+
+typedef struct
+{
+    Token method;
+    Variable receiver; // `this`
+    Variable superclass;
+    bool isInvoke;
+    Node *arguments;
+} SuperNode;
+
+struct Node
+{
+    NodeType type;
+    /**
+     * Line of the last token of the node, the line of the instructions emitted once the node is complete
+     */
+    int line;
+    /**
+     * Next statement of a block, argument of a call or method of a class
+     */
+    Node *next;
+    union
+    {
+        double number;
+        Token string; // with the quotes
+        Variable variable;
+        struct
+        {
+            Variable variable;
+            Node *value;
+        } assign;
+        SuperNode *super;
+        struct
+        {
+            TokenType op;
+            Node *operand;
+        } unary;
+        /**
+         * `NODE_BINARY`, `NODE_AND` and `NODE_OR`, the left operand is consumed on the line of the operator
+         */
+        struct
+        {
+            TokenType op;
+            int opLine;
+            Node *left;
+            Node *right;
+        } binary;
+        struct
+        {
+            Node *condition;
+            Node *thenBranch;
+            Node *elseBranch;
+            int questionLine;
+            int thenLine;
+        } conditional;
+        struct
+        {
+            Node *callee;
+            Node *arguments; // linked by `Node.next`
+            int parenLine;
+        } call;
+        /**
+         * `NODE_GET`, `NODE_SET` and `NODE_INVOKE`
+         */
+        struct
+        {
+            Node *object;
+            Token name;
+            Node *value;
+            Node *arguments;
+            int opLine; // line of the `=` or `(` after the name, where the object is put in a register
+        } property;
+        FunctionNode *function;
+        Node *expression; // `NODE_PRINT` and `NODE_EXPRESSION`
+        struct
+        {
+            Declaration name;
+            Node *initializer; // `NODE_VAR`: NULL is `nil`, `NODE_FUN`: the `NODE_FUNCTION`
+        } var;
+        ClassNode *klass;
+        Node *statements; // `NODE_BLOCK`
+        /**
+         * `NODE_IF`, `NODE_WHILE` and `NODE_FOR`, any part but the body of a `for` may be NULL
+         */
+        struct
+        {
+            Node *initializer;
+            Node *condition;
+            Node *increment;
+            Node *body;
+            Node *elseBranch;
+            int conditionLine; // line of the token ending the condition, where it is turned into a jump
+            int incrementLine;
+            int bodyLine; // line of the token before the body
+            int elseLine;
+        } branch;
+        Token keyword; // `NODE_BREAK`, `NODE_CONTINUE`
+        struct
+        {
+            Token keyword;
+            Node *value; // NULL for `return;`
+        } ret;
+    } as;
+};
+
+/**
+ * A block of the arena, the allocations of a `compile()` are bumped in the newest one
+ */
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *blocks;
+} Arena;
+
+void initArena(Arena *arena);
+void *arenaAlloc(Arena *arena, size_t size);
+void freeArena(Arena *arena);
+Node *newNode(Arena *arena, NodeType type, int line);
+
+#endif
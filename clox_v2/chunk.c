@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "chunk.h"
+#include "memory.h"
+#include "vm.h"
+
+void initChunk(Chunk *chunk)
+{
+    INIT_DYNAMIC_ARRAY_STRUCT_COMMON_FIELD(chunk)
+    chunk->code = NULL;
+    chunk->lines = NULL;
+    initValueArray(&(chunk->constants));
+}
+
+void freeChunk(Chunk *chunk)
+{
+    FREE_ARRAY(Instruction, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    freeValueArray(&(chunk->constants));
+    initChunk(chunk);
+}
+
+void writeChunk(Chunk *chunk, Instruction instruction, int line)
+{
+    if (chunk->capacity < chunk->count + 1)
+    {
+        int oldCapacity = chunk->capacity;
+        chunk->capacity = GROW_CAPACITY(oldCapacity);
+        chunk->code = GROW_ARRAY(Instruction, chunk->code, oldCapacity, chunk->capacity);
+        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    }
+
+    chunk->code[chunk->count] = instruction;
+    chunk->lines[chunk->count] = line;
+    chunk->count++;
+}
+
+/**
+ * Insert an instruction before `offset`, shifting the rest of the chunk down by one.
+ *
+ * @note Jumps are relative, so only jumps that cross `offset` are affected; the caller must make sure there are none.
+ */
+void insertChunk(Chunk *chunk, int offset, Instruction instruction, int line)
+{
+    writeChunk(chunk, instruction, line); // grow by one
+    memmove(chunk->code + offset + 1, chunk->code + offset, sizeof(Instruction) * (chunk->count - 1 - offset));
+    memmove(chunk->lines + offset + 1, chunk->lines + offset, sizeof(int) * (chunk->count - 1 - offset));
+    chunk->code[offset] = instruction;
+    chunk->lines[offset] = line;
+}
+
+/**
+ * Unlike `valuesEqual()`, `0` and `-0` are different constants.
+ */
+static bool sameConstant(Value a, Value b)
+{
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    return !IS_NUMBER(a) && !IS_NUMBER(b) && !IS_OBJ(a) == !IS_OBJ(b) && valuesEqual(a, b);
+}
+
+/**
+ * @details Literals and names are interned, so that the first `MAX_INDEX_RK` distinct constants of a function can be
+ * `RK` operands.
+ *
+ * @return index of `value` in the constant pool, added if it is not there yet
+ */
+int internConstant(Chunk *chunk, Value value)
+{
+    ValueArray *constants = &chunk->constants;
+    if (!IS_OBJ(value) || IS_STRING(value))
+    {
+        for (int i = 0; i < constants->count; i++)
+        {
+            if (sameConstant(constants->values[i], value))
+            {
+                return i;
+            }
+        }
+    }
+
+    return addConstant(chunk, value);
+}
+
+int addConstant(Chunk *chunk, Value value)
+{
+    push(value); // push value to stack to prevent it from being garbage collected when chunk->constants is being resized (re-allocated).
+    writeValueArray(&(chunk->constants), value);
+    pop();
+    return chunk->constants.count - 1;
+}
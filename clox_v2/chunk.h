@@ -0,0 +1,152 @@
+#ifndef clox_chunk_h
+#define clox_chunk_h
+
+#include "common.h"
+#include "value.h"
+
+/**
+ * Register-based bytecode, in the style of Lua 5.
+ *
+ * @details Every instruction is one 32-bit word. The low 6 bits are the opcode, the rest are operands in one of
+ * these layouts:
+ *
+ * ```
+ *  31        23        14        6       0
+ *  |  B (9)  |  C (9)  |  A (8)  | op (6) |   iABC
+ *  |      Bx (18)      |  A (8)  | op (6) |   iABx
+ *  |     sBx (18)      |  A (8)  | op (6) |   iAsBx
+ * ```
+ *
+ * `R(x)` is register `x` of the running frame: register 0 holds the callee (or `this`), parameters and locals follow
+ * in declaration order, and temporaries are allocated above the locals. `K(x)` is constant `x` of the chunk.
+ * `RK(x)` operands name a register or, when `x` has `BIT_RK` set, a constant, so arithmetic and comparisons read
+ * their operands in place instead of pushing them first.
+ */
+typedef uint32_t Instruction;
+
+#define SIZE_OP 6
+#define SIZE_A 8
+#define SIZE_B 9
+#define SIZE_C 9
+#define SIZE_BX (SIZE_B + SIZE_C)
+
+#define POS_OP 0
+#define POS_A (POS_OP + SIZE_OP)
+#define POS_C (POS_A + SIZE_A)
+#define POS_B (POS_C + SIZE_C)
+#define POS_BX POS_C
+
+#define MAXARG_A ((1 << SIZE_A) - 1)
+#define MAXARG_B ((1 << SIZE_B) - 1)
+#define MAXARG_C ((1 << SIZE_C) - 1)
+#define MAXARG_BX ((1 << SIZE_BX) - 1)
+#define MAXARG_SBX (MAXARG_BX >> 1) // `sBx` is stored with an excess of `MAXARG_SBX`
+
+#define MASK(size) ((1u << (size)) - 1)
+
+#define GET_OP(i) ((OpCode)(((i) >> POS_OP) & MASK(SIZE_OP)))
+#define GET_A(i) ((int)(((i) >> POS_A) & MASK(SIZE_A)))
+#define GET_B(i) ((int)(((i) >> POS_B) & MASK(SIZE_B)))
+#define GET_C(i) ((int)(((i) >> POS_C) & MASK(SIZE_C)))
+#define GET_BX(i) ((int)(((i) >> POS_BX) & MASK(SIZE_BX)))
+#define GET_SBX(i) (GET_BX(i) - MAXARG_SBX)
+
+#define SET_A(i, a) ((i) = ((i) & ~(MASK(SIZE_A) << POS_A)) | ((Instruction)(a) << POS_A))
+#define SET_SBX(i, sbx) \
+    ((i) = ((i) & ~(MASK(SIZE_BX) << POS_BX)) | ((Instruction)((sbx) + MAXARG_SBX) << POS_BX))
+
+#define CREATE_ABC(op, a, b, c) \
+    (((Instruction)(op) << POS_OP) | ((Instruction)(a) << POS_A) | ((Instruction)(b) << POS_B) | ((Instruction)(c) << POS_C))
+#define CREATE_ABX(op, a, bx) \
+    (((Instruction)(op) << POS_OP) | ((Instruction)(a) << POS_A) | ((Instruction)(bx) << POS_BX))
+#define CREATE_ASBX(op, a, sbx) CREATE_ABX(op, a, (sbx) + MAXARG_SBX)
+
+/**
+ * `RK` operand encoding: the high bit of `B` or `C` selects the constant pool.
+ */
+#define BIT_RK (1 << (SIZE_B - 1))
+#define IS_K(x) ((x) & BIT_RK)
+#define INDEX_K(x) ((x) & ~BIT_RK)
+#define MAX_INDEX_RK (BIT_RK - 1)
+#define RK_K(x) ((x) | BIT_RK)
+
+/**
+ * Registers of a frame, a few values of `MAXARG_A` are left as headroom.
+ */
+#define MAX_REGISTERS 250
+
+typedef enum
+{
+    OP_MOVE,          // A B      R(A) = R(B)
+    OP_LOADK,         // A Bx     R(A) = K(Bx)
+    OP_LOADNIL,       // A        R(A) = nil
+    OP_LOADBOOL,      // A B      R(A) = (bool)B
+    OP_GET_GLOBAL,    // A Bx     R(A) = globals[K(Bx)]
+    OP_DEFINE_GLOBAL, // A Bx     define globals[K(Bx)] = R(A)
+    OP_SET_GLOBAL,    // A Bx     globals[K(Bx)] = R(A)
+    OP_GET_UPVALUE,   // A B      R(A) = upvalues[B]
+    OP_SET_UPVALUE,   // A B      upvalues[B] = R(A)
+    OP_GET_PROPERTY,  // A B C    R(A) = R(B).K(C)
+    OP_SET_PROPERTY,  // A B C    R(A).K(B) = RK(C)
+    OP_GET_SUPER,     // A B C    R(A) = method K(C) of superclass R(B) bound to R(A)
+    OP_EQUAL,         // A B C    R(A) = RK(B) == RK(C)
+    OP_NOT_EQUAL,     // A B C    R(A) = !(RK(B) == RK(C))
+    OP_GREATER,       // A B C    R(A) = RK(B) > RK(C)
+    OP_GREATER_EQUAL, // A B C    R(A) = !(RK(B) < RK(C))
+    OP_LESS,          // A B C    R(A) = RK(B) < RK(C)
+    OP_LESS_EQUAL,    // A B C    R(A) = !(RK(B) > RK(C))
+    OP_ADD,           // A B C    R(A) = RK(B) + RK(C)
+    OP_SUBTRACT,      // A B C    R(A) = RK(B) - RK(C)
+    OP_MULTIPLY,      // A B C    R(A) = RK(B) * RK(C)
+    OP_DIVIDE,        // A B C    R(A) = RK(B) / RK(C)
+    OP_NOT,           // A B      R(A) = !R(B)
+    OP_NEGATE,        // A B      R(A) = -R(B)
+    OP_PRINT,         // A        print R(A)
+    OP_JUMP,          // sBx      ip += sBx
+    OP_JUMP_IF_FALSE, // A sBx    if R(A) is falsey then ip += sBx
+    OP_JUMP_IF_TRUE,  // A sBx    if R(A) is truthy then ip += sBx
+    OP_TEST_EQUAL,    // A B C    if (RK(B) == RK(C)) == A then take the OP_JUMP that follows, else skip it
+    OP_TEST_LESS,     // A B C    if (RK(B) < RK(C)) == A then take the OP_JUMP that follows, else skip it
+    OP_TEST_GREATER,  // A B C    if (RK(B) > RK(C)) == A then take the OP_JUMP that follows, else skip it
+    OP_CALL,          // A B      R(A) = R(A)(R(A+1), ..., R(A+B))
+    OP_INVOKE,        // A B C    R(A) = R(A).K(B)(R(A+1), ..., R(A+C))
+    OP_SUPER_INVOKE,  // A B C    R(A) = method K(B) of superclass R(A+C+1) called on R(A) with R(A+1), ..., R(A+C)
+    OP_CLOSURE,       // A Bx     R(A) = closure(K(Bx)), followed by one upvalue descriptor word per upvalue
+    OP_CLOSE_UPVALUE, // A        close all upvalues >= R(A)
+    OP_RETURN,        // A B      return R(A), or nil when B is 1
+    OP_CLASS,         // A Bx     R(A) = class named K(Bx)
+    OP_INHERIT,       // A B      copy the methods of superclass R(B) down into class R(A)
+    OP_METHOD,        // A B      define closure R(B) as a method of class R(A), named after its function
+} OpCode;
+
+/**
+ * Upvalue descriptor word that follows `OP_CLOSURE`.
+ */
+#define UPVALUE_DESC(isLocal, index) ((Instruction)(isLocal) | ((Instruction)(index) << 8))
+#define UPVALUE_IS_LOCAL(i) ((i) & 0xff)
+#define UPVALUE_INDEX(i) (((i) >> 8) & 0xff)
+
+/**
+ * Sequences of instructions
+ */
+typedef struct
+{
+    DYNAMIC_ARRAY_STRUCT_COMMON_FIELD
+
+    Instruction *code;
+    int *lines;
+    /**
+     * Constant pool
+     */
+    ValueArray constants;
+
+} Chunk;
+
+void initChunk(Chunk *chunk);
+void freeChunk(Chunk *chunk);
+void writeChunk(Chunk *chunk, Instruction instruction, int line);
+void insertChunk(Chunk *chunk, int offset, Instruction instruction, int line);
+int internConstant(Chunk *chunk, Value value);
+int addConstant(Chunk *chunk, Value value);
+
+#endif
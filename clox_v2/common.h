@@ -0,0 +1,57 @@
+#ifndef clox_common_h
+#define clox_common_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Enable nan boxing
+#define NAN_BOXING
+/**
+ * Debug flags are on by default, building with `-DNDEBUG` turns them off (used by `make bench`).
+ *
+ * Define `DEBUG_PRINT_IR` to print the optimized SSA IR of the functions compiled through `ir.h`.
+ */
+#ifndef NDEBUG
+/**
+ * `Stress test” mode for the garbage collector. When this flag is defined, the GC runs as often as it possibly can.
+ */
+#define DEBUG_STRESS_GC
+#define DEBUG_LOG_GC
+#define DEBUG_PRINT_CODE
+#define DEBUG_TRACE_EXECUTION
+#endif
+
+/**
+ * Bytecode dispatch engines of `run()`, selected at build time with `-DDISPATCH_ENGINE=...`.
+ *
+ * - `DISPATCH_SWITCH`: one `switch` on the opcode at the top of the interpreter loop.
+ * - `DISPATCH_COMPUTED_GOTO`: every handler jumps straight to the next one through a table of label
+ *   addresses (`&&label`, a GCC/Clang extension), so each handler gets its own indirect branch.
+ *
+ * Define `DEBUG_COUNT_DISPATCH` to count dispatched instructions, the count is printed to stderr by `freeVM()`.
+ */
+#define DISPATCH_SWITCH 0
+#define DISPATCH_COMPUTED_GOTO 1
+
+#ifndef DISPATCH_ENGINE
+#define DISPATCH_ENGINE DISPATCH_SWITCH
+#endif
+
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+/**
+ * Common field for dynamic array struct
+ *
+ * @var count
+ * @var capacity
+ */
+#define DYNAMIC_ARRAY_STRUCT_COMMON_FIELD \
+    int count;                            \
+    int capacity;
+
+#define INIT_DYNAMIC_ARRAY_STRUCT_COMMON_FIELD(pointer) \
+    pointer->count = 0;                                 \
+    pointer->capacity = 0;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,1911 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "compiler.h"
+#include "ir.h"
+#include "memory.h"
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
+#include "parser.h"
+#include "resolver.h"
+
+/**
+ * Jump offset of a jump that is never emitted, e.g. the exit jump of `while (true)`.
+ */
+#define NO_JUMP (-1)
+
+/**
+ * Where the value of an expression is, while the compiler has not decided yet which register it goes to.
+ *
+ * @details Expressions are compiled lazily, in the way of Lua: a variable or a constant emits no code until its
+ * consumer asks for it, so `a + 1` reads local `a` and constant `1` in place and `x = a + 1` writes the sum straight
+ * into the register of `x`.
+ */
+typedef enum
+{
+    EXP_NIL,
+    EXP_TRUE,
+    EXP_FALSE,
+    EXP_CONSTANT,    // info = constant index
+    EXP_LOCAL,       // info = register of a local variable
+    EXP_UPVALUE,     // info = upvalue index
+    EXP_GLOBAL,      // info = constant index of the name
+    EXP_PROPERTY,    // info = register of the object, aux = constant index of the name
+    EXP_COMPARE,     // info = RK of the left operand, aux = RK of the right operand, see `ExpDesc.test`
+    EXP_RELOCATABLE, // info = offset of an emitted instruction whose target register `A` is not set yet
+    EXP_TEMP,        // info = register holding the value
+    EXP_DETACHED,    // info = register holding the value, above `freeReg` so it must be consumed right away
+} ExpKind;
+
+typedef struct
+{
+    ExpKind kind;
+    int info;
+    int aux;
+    /**
+     * `EXP_COMPARE` only: `OP_TEST_*` opcode of the comparison, whether its result is negated
+     * and the first temporary register held by its operands.
+     */
+    OpCode test;
+    bool negated;
+    int base;
+} ExpDesc;
+
+typedef struct
+{
+    /**
+     * The scope depth of the block where the local variable was declared.
+     * `-1` is uninitialized variable
+     */
+    int depth;
+    /**
+     * The local is captured by any later nested function, as found by the resolver
+     */
+    bool isCaptured;
+} Local;
+
+typedef enum
+{
+    SCOPE_GLOBAL, // global scope
+    SCOPE_CLASS,
+    SCOPE_FUNCTION, // function scope
+    SCOPE_LOOP,     // inside for-loop or while-loop
+    SCOPE_BLOCK,    // scope opened by block statement
+} ScopeType;
+
+typedef enum
+{
+    FCS_BREAK,
+    FCS_CONTINUE,
+    FCS_THROW,
+} FlowControlStatement;
+
+typedef struct ScopeJumpInstruction
+{
+    struct ScopeJumpInstruction *next;
+    int jumpOffset;
+    FlowControlStatement type;
+} ScopeJumpInstruction;
+
+typedef struct ScopeCompiler
+{
+    struct ScopeCompiler *enclosing;
+    ScopeType type;
+    int depth;
+    /// @brief List of instruction that can jump out of current scope, used to patch pump
+    /// at the end of scope
+    ScopeJumpInstruction *jumpInstructions;
+} ScopeCompiler;
+
+/**
+ *  @details Creating a separate **Compiler** for each function being compiled to handle compiling multiple functions nested within each other.
+ */
+typedef struct Compiler
+{
+
+    struct Compiler *enclosing;
+
+    ObjFunction *function; // Top-level function that wraps all bytecode
+    FunctionType type;
+    /**
+     * Locals in scope, local `i` lives in register `i` of the frame.
+     */
+    Local locals[UINT8_COUNT];
+    /**
+     * Tracking how many locals are in scope—how many of those array slots are in use.
+     */
+    int localCount;
+    /**
+     * First free register, temporaries are allocated as a stack above the locals.
+     */
+    int freeReg;
+    /**
+     * Bumped by every emitted instruction that can write a local behind the back of an expression being compiled
+     * (calls and assignments to locals), see `pinLocal()`.
+     */
+    int sideEffects;
+    /**
+     * This is the number of blocks surrounding the current bit of code we’re compiling.
+     * Zero is the global scope, one is the first top-level block, two is inside that.
+     */
+    int scopeDepth;
+    ScopeCompiler *currentScope;
+} Compiler;
+
+/**
+ * A local used as the left operand of an operator while the right operand is compiled.
+ */
+typedef struct
+{
+    int offset;      // where the copy of the local goes if it is needed
+    int reg;         // register reserved for the copy
+    int sideEffects; // `Compiler.sideEffects` before the right operand
+} PinnedLocal;
+
+/**
+ * Instructions cut out of the chunk to be emitted again later, used to move loop conditions below loop bodies.
+ */
+typedef struct
+{
+    int count;
+    Instruction *code;
+    int *lines;
+} CodeBlock;
+
+Compiler *current = NULL;
+/**
+ * Source line of the instructions being emitted, set from the nodes as they are generated
+ */
+static int currentLine;
+static bool hadError;
+
+static ObjFunction *generate(Node *script);
+static int emitInstruction(Instruction instruction);
+static int emitABC(OpCode op, int a, int b, int c);
+static int emitABx(OpCode op, int a, int bx);
+static int emitJump(OpCode op, int a);
+static int emitBreak();
+static int emitContinue();
+static void emitLoop(int loopStart);
+static void patchJump(int offset);
+static void patchJumpTo(int offset, int target);
+static CodeBlock cutCode(int start);
+static int pasteCode(CodeBlock *block);
+static ObjFunction *endCompiler();
+static void beginScope(ScopeType scopeType);
+static void endScope();
+static void clearScopeCompiler();
+static void emitOutScope(int scopeDepth);
+static ScopeCompiler *latestLoopScope();
+static void patchLoopJumps(int continueTarget);
+static void reserveRegisters(int count);
+static void freeRegister(int reg);
+static void freeExpression(ExpDesc *e);
+static void initExpression(ExpDesc *e, ExpKind kind, int info);
+static void dischargeVariable(ExpDesc *e);
+static void dischargeToRegister(ExpDesc *e, int reg);
+static void toRegister(ExpDesc *e, int reg);
+static void toNextRegister(ExpDesc *e);
+static int toAnyRegister(ExpDesc *e);
+static int toRK(ExpDesc *e);
+static void discardExpression(ExpDesc *e);
+static int conditionJump(ExpDesc *e, bool jumpIfTrue);
+static void pinLocal(PinnedLocal *pin);
+static void unpinLocal(ExpDesc *e, PinnedLocal *pin, ExpDesc *right);
+static void declaration(Node *node);
+static void classDeclaration(Node *node);
+static void method(Node *node, int classReg);
+static void funcDeclaration(Node *node);
+static void varDeclaration(Node *node);
+static void statement(Node *node);
+static void printStatement(Node *node);
+static void expressionStatement(Node *node);
+static void ifStatement(Node *node);
+static void whileStatement(Node *node);
+static void forStatement(Node *node);
+static void returnStatement(Node *node);
+static void block(Node *node);
+static void expression(Node *node, ExpDesc *e);
+static void conditional_(Node *node, ExpDesc *e);
+static void binary(Node *node, ExpDesc *e);
+static void logical(Node *node, ExpDesc *e);
+static void call(Node *node, ExpDesc *e);
+static void getProperty(Node *node, ExpDesc *e);
+static void setProperty(Node *node, ExpDesc *e);
+static void invoke(Node *node, ExpDesc *e);
+static int argumentList(Node *arguments);
+static void unary(Node *node, ExpDesc *e);
+static void variable(Variable *variable, ExpDesc *e);
+static void assignment(Node *node, ExpDesc *e);
+static void super_(Node *node, ExpDesc *e);
+static void function(Node *node, ExpDesc *e);
+static bool generateOptimized(Node *node);
+static int declareVariable(Declaration *declaration);
+static void defineVariable(int global, ExpDesc *value);
+static void addLocal(bool isCaptured);
+static void markInitialized();
+static int identifierConstant(Token *name);
+static int propertyConstant(Token *name);
+static void emitReturn();
+static int makeConstant(Value value);
+static void initCompiler(Compiler *compiler, FunctionType type, Token *name);
+static Chunk *currentChunk();
+static void error(const char *message);
+
+/**
+ * Compile source to register-based bytecode in three stages:
+ *
+ * 1. `parse()` builds the syntax tree with the **Pratt parsing algorithm**.
+ * 2. `resolve()` binds every variable to a register, an upvalue or a global and marks the captured locals.
+ * 3. The code generator walks the annotated tree, registers are allocated as a stack while it goes.
+ *
+ * Each stage runs only if the one before it found no error.
+ */
+ObjFunction *compile(const char *source)
+{
+    Arena arena;
+    initArena(&arena);
+
+    ObjFunction *function = NULL;
+    Node *script = parse(&arena, source);
+    if (script != NULL && resolve(&arena, script))
+    {
+        function = generate(script);
+    }
+
+    freeArena(&arena);
+    return function;
+}
+
+void markCompilerRoots()
+{
+    Compiler *compiler = current;
+    while (compiler != NULL)
+    {
+        markObject((Obj *)compiler->function);
+        compiler = compiler->enclosing;
+    }
+}
+
+static ObjFunction *generate(Node *script)
+{
+    hadError = false;
+    Compiler compiler;
+    initCompiler(&compiler, TYPE_SCRIPT, NULL);
+
+    for (Node *node = script->as.function->body; node != NULL; node = node->next)
+    {
+        declaration(node);
+    }
+
+    currentLine = script->line;
+    emitReturn();
+    ObjFunction *function = endCompiler();
+    return hadError ? NULL : function;
+}
+
+/**
+ * @return offset of the emitted instruction
+ */
+static int emitInstruction(Instruction instruction)
+{
+    writeChunk(currentChunk(), instruction, currentLine);
+    return currentChunk()->count - 1;
+}
+
+static int emitABC(OpCode op, int a, int b, int c)
+{
+    return emitInstruction(CREATE_ABC(op, a, b, c));
+}
+
+static int emitABx(OpCode op, int a, int bx)
+{
+    return emitInstruction(CREATE_ABX(op, a, bx));
+}
+
+/**
+ * Emit a jump whose offset is patched later.
+ */
+static int emitJump(OpCode op, int a)
+{
+    return emitInstruction(CREATE_ASBX(op, a, 0));
+}
+
+static void emitLoop(int loopStart)
+{
+    int offset = emitJump(OP_JUMP, 0);
+    patchJumpTo(offset, loopStart);
+}
+
+static int emitBreak()
+{
+    ScopeCompiler *cur = latestLoopScope();
+    if (cur == NULL)
+        return -1;
+
+    emitOutScope(cur->depth);
+
+    ScopeJumpInstruction *inst = malloc(sizeof(ScopeJumpInstruction));
+    inst->type = FCS_BREAK;
+    inst->jumpOffset = emitJump(OP_JUMP, 0);
+    inst->next = cur->jumpInstructions;
+    cur->jumpInstructions = inst;
+
+    return inst->jumpOffset;
+}
+
+static int emitContinue()
+{
+    ScopeCompiler *cur = latestLoopScope();
+    if (cur == NULL)
+        return -1;
+
+    emitOutScope(cur->depth);
+
+    ScopeJumpInstruction *inst = malloc(sizeof(ScopeJumpInstruction));
+    inst->type = FCS_CONTINUE;
+    inst->jumpOffset = emitJump(OP_JUMP, 0); // Jumps are relative both ways, patched once the target is known.
+    inst->next = cur->jumpInstructions;
+    cur->jumpInstructions = inst;
+
+    return inst->jumpOffset;
+}
+
+/**
+ * Patching jump offset to placeholder for jump instruction, the jump lands on the next emitted instruction.
+ */
+static void patchJump(int offset)
+{
+    patchJumpTo(offset, currentChunk()->count);
+}
+
+static void patchJumpTo(int offset, int target)
+{
+    if (offset == NO_JUMP)
+    {
+        return;
+    }
+
+    int jump = target - (offset + 1); // jumps are relative to the next instruction
+    if (jump > MAXARG_SBX || jump < -MAXARG_SBX)
+    {
+        error(jump > 0 ? "Too much code to jump over." : "Loop body too large.");
+    }
+
+    SET_SBX(currentChunk()->code[offset], jump);
+}
+
+/**
+ * Move the instructions from `start` to the end of the chunk out of it.
+ *
+ * @note Only self-contained code can be moved, i.e. code whose jumps all land inside of it.
+ */
+static CodeBlock cutCode(int start)
+{
+    Chunk *chunk = currentChunk();
+    CodeBlock block;
+    block.count = chunk->count - start;
+    block.code = malloc(sizeof(Instruction) * block.count);
+    block.lines = malloc(sizeof(int) * block.count);
+    memcpy(block.code, chunk->code + start, sizeof(Instruction) * block.count);
+    memcpy(block.lines, chunk->lines + start, sizeof(int) * block.count);
+    chunk->count = start;
+    return block;
+}
+
+/**
+ * Emit instructions cut by `cutCode()` again.
+ *
+ * @return offset of the first pasted instruction
+ */
+static int pasteCode(CodeBlock *block)
+{
+    int start = currentChunk()->count;
+    for (int i = 0; i < block->count; i++)
+    {
+        writeChunk(currentChunk(), block->code[i], block->lines[i]);
+    }
+
+    free(block->code);
+    free(block->lines);
+    block->count = 0;
+    block->code = NULL;
+    block->lines = NULL;
+    return start;
+}
+
+static ObjFunction *endCompiler()
+{
+    ObjFunction *function = current->function;
+
+#ifdef DEBUG_PRINT_CODE
+    if (!hadError)
+    {
+        disassembleChunk(currentChunk(), function->name != NULL
+                                             ? function->name->chars
+                                             : "<script>");
+    }
+#endif
+
+    current = current->enclosing;
+    return function;
+}
+
+static void beginScope(ScopeType scopeType)
+{
+    current->scopeDepth++;
+
+    //> Create new scope
+    ScopeCompiler *newScope = malloc(sizeof(ScopeCompiler));
+    newScope->enclosing = current->currentScope;
+    newScope->type = scopeType;
+    newScope->jumpInstructions = NULL;
+    newScope->depth = current->scopeDepth;
+    current->currentScope = newScope;
+    //<
+}
+
+static void endScope()
+{
+    clearScopeCompiler();
+
+    current->scopeDepth--;
+
+    // Drop all local variable of closed scope, their registers are reused by whatever comes next
+    int closeFrom = -1;
+    while (
+        current->localCount > 0 &&
+        current->locals[current->localCount - 1].depth > current->scopeDepth)
+    {
+        if (current->locals[current->localCount - 1].isCaptured)
+        {
+            closeFrom = current->localCount - 1;
+        }
+        current->localCount--;
+    }
+
+    if (closeFrom != -1)
+    {
+        emitABC(OP_CLOSE_UPVALUE, closeFrom, 0, 0);
+    }
+    current->freeReg = current->localCount;
+}
+
+static void clearScopeCompiler()
+{
+    ScopeCompiler *latestScope = current->currentScope;
+    current->currentScope = latestScope->enclosing;
+
+    ScopeJumpInstruction *jumpInst = latestScope->jumpInstructions;
+    while (jumpInst != NULL)
+    {
+        ScopeJumpInstruction *temp = jumpInst;
+        jumpInst = jumpInst->next;
+        free(temp);
+    }
+
+    free(latestScope);
+}
+
+/// @brief Emit out scope instruction, closing the captured locals of the scopes being left
+static void emitOutScope(int scopeDepth)
+{
+    int closeFrom = -1;
+    for (int i = current->localCount - 1; i >= 0 && current->locals[i].depth > scopeDepth; i--)
+    {
+        if (current->locals[i].isCaptured)
+            closeFrom = i;
+    }
+
+    if (closeFrom != -1)
+        emitABC(OP_CLOSE_UPVALUE, closeFrom, 0, 0);
+}
+
+static ScopeCompiler *latestLoopScope()
+{
+    ScopeCompiler *cur = current->currentScope;
+    while (cur != NULL && cur->type == SCOPE_BLOCK)
+        cur = cur->enclosing;
+
+    if (cur != NULL && cur->type == SCOPE_LOOP)
+        return cur;
+
+    return NULL;
+}
+
+/**
+ * Patch `continue` jumps of the current loop to `continueTarget` and `break` jumps to the next emitted instruction.
+ */
+static void patchLoopJumps(int continueTarget)
+{
+    ScopeJumpInstruction *jumpInst = current->currentScope->jumpInstructions;
+    while (jumpInst != NULL)
+    {
+        if (jumpInst->type == FCS_CONTINUE)
+            patchJumpTo(jumpInst->jumpOffset, continueTarget);
+        else if (jumpInst->type == FCS_BREAK)
+            patchJump(jumpInst->jumpOffset);
+        jumpInst = jumpInst->next;
+    }
+}
+
+static void reserveRegisters(int count)
+{
+    current->freeReg += count;
+    if (current->freeReg > MAX_REGISTERS)
+    {
+        error("Function needs too many registers.");
+        current->freeReg = MAX_REGISTERS;
+    }
+
+    if (current->freeReg > current->function->maxSlots)
+    {
+        current->function->maxSlots = current->freeReg;
+    }
+}
+
+/**
+ * Release a temporary register, registers of locals stay reserved until their scope ends.
+ */
+static void freeRegister(int reg)
+{
+    if (reg >= current->localCount && reg == current->freeReg - 1)
+    {
+        current->freeReg--;
+    }
+}
+
+static void freeExpression(ExpDesc *e)
+{
+    if (e->kind == EXP_TEMP)
+    {
+        freeRegister(e->info);
+    }
+    else if (e->kind == EXP_COMPARE && e->base < current->freeReg)
+    {
+        current->freeReg = e->base;
+    }
+}
+
+static void initExpression(ExpDesc *e, ExpKind kind, int info)
+{
+    e->kind = kind;
+    e->info = info;
+    e->aux = 0;
+    e->test = OP_TEST_EQUAL;
+    e->negated = false;
+    e->base = 0;
+}
+
+/**
+ * Emit the read of a variable, leaving the target register to the consumer.
+ */
+static void dischargeVariable(ExpDesc *e)
+{
+    switch (e->kind)
+    {
+    case EXP_UPVALUE:
+    {
+        e->info = emitABC(OP_GET_UPVALUE, 0, e->info, 0);
+        e->kind = EXP_RELOCATABLE;
+        break;
+    }
+    case EXP_GLOBAL:
+    {
+        e->info = emitABx(OP_GET_GLOBAL, 0, e->info);
+        e->kind = EXP_RELOCATABLE;
+        break;
+    }
+    case EXP_PROPERTY:
+    {
+        freeRegister(e->info);
+        e->info = emitABC(OP_GET_PROPERTY, 0, e->info, e->aux);
+        e->kind = EXP_RELOCATABLE;
+        break;
+    }
+    case EXP_DETACHED:
+    {
+        e->info = emitABC(OP_MOVE, 0, e->info, 0);
+        e->kind = EXP_RELOCATABLE;
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+}
+
+static void dischargeToRegister(ExpDesc *e, int reg)
+{
+    dischargeVariable(e);
+    switch (e->kind)
+    {
+    case EXP_NIL:
+    {
+        emitABC(OP_LOADNIL, reg, 0, 0);
+        break;
+    }
+    case EXP_TRUE:
+    case EXP_FALSE:
+    {
+        emitABC(OP_LOADBOOL, reg, e->kind == EXP_TRUE, 0);
+        break;
+    }
+    case EXP_CONSTANT:
+    {
+        emitABx(OP_LOADK, reg, e->info);
+        break;
+    }
+    case EXP_RELOCATABLE:
+    {
+        SET_A(currentChunk()->code[e->info], reg);
+        break;
+    }
+    case EXP_LOCAL:
+    case EXP_TEMP:
+    {
+        if (e->info != reg)
+        {
+            emitABC(OP_MOVE, reg, e->info, 0);
+        }
+        break;
+    }
+    case EXP_COMPARE:
+    {
+        OpCode op;
+        switch (e->test)
+        {
+        case OP_TEST_LESS:
+            op = e->negated ? OP_GREATER_EQUAL : OP_LESS;
+            break;
+        case OP_TEST_GREATER:
+            op = e->negated ? OP_LESS_EQUAL : OP_GREATER;
+            break;
+        default:
+            op = e->negated ? OP_NOT_EQUAL : OP_EQUAL;
+            break;
+        }
+        emitABC(op, reg, e->info, e->aux);
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    e->kind = EXP_TEMP;
+    e->info = reg;
+}
+
+/**
+ * Put the value of the expression into the given register.
+ */
+static void toRegister(ExpDesc *e, int reg)
+{
+    dischargeVariable(e);
+    freeExpression(e);
+    dischargeToRegister(e, reg);
+}
+
+/**
+ * Put the value of the expression into a newly reserved register on top of the temporaries.
+ */
+static void toNextRegister(ExpDesc *e)
+{
+    dischargeVariable(e);
+    freeExpression(e);
+    reserveRegisters(1);
+    dischargeToRegister(e, current->freeReg - 1);
+}
+
+/**
+ * Put the value of the expression into any register, locals are used in place.
+ */
+static int toAnyRegister(ExpDesc *e)
+{
+    dischargeVariable(e);
+    if (e->kind == EXP_TEMP || e->kind == EXP_LOCAL)
+    {
+        return e->info;
+    }
+
+    toNextRegister(e);
+    return e->info;
+}
+
+/**
+ * @return `RK` operand of the expression, literals are read from the constant pool without a load.
+ */
+static int toRK(ExpDesc *e)
+{
+    switch (e->kind)
+    {
+    case EXP_NIL:
+    case EXP_TRUE:
+    case EXP_FALSE:
+    {
+        Value value = e->kind == EXP_NIL ? NIL_VAL : BOOL_VAL(e->kind == EXP_TRUE);
+        int constant = makeConstant(value);
+        if (constant <= MAX_INDEX_RK)
+        {
+            return RK_K(constant);
+        }
+        break;
+    }
+    case EXP_CONSTANT:
+    {
+        if (e->info <= MAX_INDEX_RK)
+        {
+            return RK_K(e->info);
+        }
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    return toAnyRegister(e);
+}
+
+/**
+ * Emit what an expression statement needs from its expression: reads that can fail at runtime and the target
+ * register of instructions that have none yet.
+ */
+static void discardExpression(ExpDesc *e)
+{
+    switch (e->kind)
+    {
+    case EXP_NIL:
+    case EXP_TRUE:
+    case EXP_FALSE:
+    case EXP_CONSTANT:
+    case EXP_LOCAL:
+    case EXP_TEMP:
+    case EXP_DETACHED:
+    {
+        break;
+    }
+    default:
+    {
+        toNextRegister(e);
+        break;
+    }
+    }
+
+    current->freeReg = current->localCount;
+}
+
+/**
+ * Emit a jump taken when the truthiness of the expression is `jumpIfTrue`.
+ *
+ * @details A comparison becomes a single `OP_TEST_*` instruction that takes the `OP_JUMP` following it,
+ * so `if (a < b)` costs one dispatch instead of a compare, a jump and a pop.
+ *
+ * @return offset of the jump to patch, or `NO_JUMP` when the jump can never be taken.
+ */
+static int conditionJump(ExpDesc *e, bool jumpIfTrue)
+{
+    dischargeVariable(e);
+    switch (e->kind)
+    {
+    case EXP_COMPARE:
+    {
+        freeExpression(e);
+        emitABC(e->test, jumpIfTrue != e->negated, e->info, e->aux);
+        return emitJump(OP_JUMP, 0);
+    }
+    case EXP_NIL:
+    case EXP_FALSE:
+    {
+        return jumpIfTrue ? NO_JUMP : emitJump(OP_JUMP, 0);
+    }
+    case EXP_TRUE:
+    case EXP_CONSTANT: // numbers and strings are truthy
+    {
+        return jumpIfTrue ? emitJump(OP_JUMP, 0) : NO_JUMP;
+    }
+    default:
+    {
+        int reg = toAnyRegister(e);
+        freeExpression(e);
+        return emitJump(jumpIfTrue ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, reg);
+    }
+    }
+}
+
+/**
+ * Keep a local that is the left operand of an operator from being read after its right operand changed it.
+ *
+ * @details Operators read a local in place, which is after their right operand ran, while Lox evaluates left to
+ * right: in `a + f()` or `a + (a = 1)` the left operand is the value of `a` before the call or the assignment.
+ * A register is reserved for a copy of the local, and the copy is inserted in front of the right operand only if
+ * the right operand turns out to call or assign anything.
+ */
+static void pinLocal(PinnedLocal *pin)
+{
+    pin->offset = currentChunk()->count;
+    pin->reg = current->freeReg;
+    pin->sideEffects = current->sideEffects;
+    reserveRegisters(1);
+}
+
+static void unpinLocal(ExpDesc *e, PinnedLocal *pin, ExpDesc *right)
+{
+    if (e->kind != EXP_LOCAL || current->sideEffects == pin->sideEffects)
+    {
+        return;
+    }
+
+    Chunk *chunk = currentChunk();
+    int line = pin->offset < chunk->count ? chunk->lines[pin->offset] : currentLine;
+    insertChunk(chunk, pin->offset, CREATE_ABC(OP_MOVE, pin->reg, e->info, 0), line);
+    if (right->kind == EXP_RELOCATABLE && right->info >= pin->offset)
+    {
+        right->info++;
+    }
+
+    e->kind = EXP_TEMP;
+    e->info = pin->reg;
+}
+
+static void declaration(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_CLASS:
+    {
+        classDeclaration(node);
+        break;
+    }
+    case NODE_FUN:
+    {
+        funcDeclaration(node);
+        break;
+    }
+    case NODE_VAR:
+    {
+        varDeclaration(node);
+        break;
+    }
+    default:
+    {
+        statement(node);
+        break;
+    }
+    }
+}
+
+static void classDeclaration(Node *node)
+{
+    ClassNode *klass = node->as.klass;
+    currentLine = klass->name.name.line;
+    int nameConstant = identifierConstant(&klass->name.name);
+
+    bool isLocal = current->scopeDepth > 0;
+    if (isLocal)
+    {
+        addLocal(klass->name.isCaptured);
+        markInitialized();
+        reserveRegisters(1);
+    }
+
+    beginScope(SCOPE_CLASS);
+    if (!isLocal)
+    {
+        addLocal(false); // hidden local that holds a global class while its methods are bound
+        markInitialized();
+        reserveRegisters(1);
+    }
+    int classReg = current->localCount - 1;
+
+    emitABx(OP_CLASS, classReg, nameConstant);
+    if (!isLocal)
+    {
+        emitABx(OP_DEFINE_GLOBAL, classReg, nameConstant);
+    }
+
+    //> Class inheritance
+    if (klass->superclass != NULL)
+    {
+        currentLine = klass->superclass->line;
+        ExpDesc superclass;
+        expression(klass->superclass, &superclass);
+
+        addLocal(klass->super.isCaptured); // define `super` as an upvalue for all methods
+        markInitialized();
+        int superReg = current->localCount - 1;
+        toRegister(&superclass, superReg);
+        current->freeReg = superReg;
+        reserveRegisters(1);
+
+        emitABC(OP_INHERIT, classReg, superReg, 0);
+    }
+    //<
+
+    for (Node *member = klass->methods; member != NULL; member = member->next)
+    {
+        method(member, classReg);
+    }
+
+    currentLine = node->line;
+    endScope();
+}
+
+static void method(Node *node, int classReg)
+{
+    ExpDesc closure;
+    function(node, &closure); // the method is named after its function
+    int reg = toAnyRegister(&closure);
+    emitABC(OP_METHOD, classReg, reg, 0);
+    freeExpression(&closure);
+}
+
+static void funcDeclaration(Node *node)
+{
+    int global = declareVariable(&node->as.var.name);
+    markInitialized();
+    ExpDesc closure;
+    function(node->as.var.initializer, &closure);
+    defineVariable(global, &closure);
+}
+
+static void varDeclaration(Node *node)
+{
+    int global = declareVariable(&node->as.var.name);
+
+    ExpDesc value;
+    if (node->as.var.initializer != NULL)
+    {
+        expression(node->as.var.initializer, &value);
+    }
+    else
+    {
+        initExpression(&value, EXP_NIL, 0);
+    }
+
+    currentLine = node->line;
+    defineVariable(global, &value);
+}
+
+static void statement(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_PRINT:
+    {
+        printStatement(node);
+        break;
+    }
+    case NODE_IF:
+    {
+        ifStatement(node);
+        break;
+    }
+    case NODE_RETURN:
+    {
+        returnStatement(node);
+        break;
+    }
+    case NODE_WHILE:
+    {
+        whileStatement(node);
+        break;
+    }
+    case NODE_FOR:
+    {
+        forStatement(node);
+        break;
+    }
+    case NODE_BREAK:
+    {
+        currentLine = node->line;
+        emitBreak();
+        break;
+    }
+    case NODE_CONTINUE:
+    {
+        currentLine = node->line;
+        emitContinue();
+        break;
+    }
+    case NODE_BLOCK:
+    {
+        beginScope(SCOPE_BLOCK);
+        block(node->as.statements);
+        currentLine = node->line;
+        endScope();
+        break;
+    }
+    default:
+    {
+        expressionStatement(node);
+        break;
+    }
+    }
+
+    current->freeReg = current->localCount; // temporaries never outlive a statement
+}
+
+static void printStatement(Node *node)
+{
+    ExpDesc value;
+    expression(node->as.expression, &value);
+    currentLine = node->line;
+    emitABC(OP_PRINT, toAnyRegister(&value), 0, 0);
+}
+
+static void expressionStatement(Node *node)
+{
+    ExpDesc e;
+    expression(node->as.expression, &e);
+    currentLine = node->line;
+    discardExpression(&e);
+}
+
+static void ifStatement(Node *node)
+{
+    ExpDesc condition;
+    expression(node->as.branch.condition, &condition);
+
+    currentLine = node->as.branch.conditionLine;
+    int thenJump = conditionJump(&condition, false);
+    current->freeReg = current->localCount;
+    statement(node->as.branch.body);
+
+    if (node->as.branch.elseBranch != NULL)
+    {
+        currentLine = node->as.branch.elseLine;
+        int elseJump = emitJump(OP_JUMP, 0);
+        patchJump(thenJump);
+        statement(node->as.branch.elseBranch);
+        patchJump(elseJump);
+    }
+    else
+    {
+        patchJump(thenJump);
+    }
+}
+
+/**
+ * @details Loops are rotated: the condition is cut out of the chunk after it is generated and emitted again below the
+ * body, where it jumps back to the body while it holds. An iteration runs the body and one conditional jump, the
+ * entry jump to the condition runs once. Generating the condition first keeps the low constant indices, that fit in
+ * RK operands, for the loop header.
+ */
+static void whileStatement(Node *node)
+{
+    beginScope(SCOPE_LOOP);
+    int conditionStart = currentChunk()->count;
+    ExpDesc condition;
+    expression(node->as.branch.condition, &condition); // The condition
+
+    currentLine = node->as.branch.conditionLine;
+    int loopJump = conditionJump(&condition, true);
+    current->freeReg = current->localCount;
+    loopJump = loopJump == NO_JUMP ? NO_JUMP : loopJump - conditionStart;
+    CodeBlock conditionCode = cutCode(conditionStart);
+
+    int entryJump = emitJump(OP_JUMP, 0); // jump to the condition
+    int bodyStart = currentChunk()->count;
+    statement(node->as.branch.body);
+
+    int conditionOffset = currentChunk()->count;
+    patchJump(entryJump);
+    pasteCode(&conditionCode);
+    if (loopJump != NO_JUMP)
+    {
+        patchJumpTo(conditionOffset + loopJump, bodyStart);
+    }
+
+    patchLoopJumps(conditionOffset);
+    currentLine = node->line;
+    endScope();
+}
+
+static void forStatement(Node *node)
+{
+    beginScope(SCOPE_LOOP);
+
+    Node *initializer = node->as.branch.initializer;
+    if (initializer == NULL)
+    {
+        // No initializer.
+    }
+    else if (initializer->type == NODE_VAR)
+    {
+        varDeclaration(initializer);
+    }
+    else
+    {
+        expressionStatement(initializer);
+    }
+
+    // condition part, moved below the body
+    bool hasCondition = false;
+    int loopJump = NO_JUMP;
+    CodeBlock conditionCode = {0, NULL, NULL};
+    if (node->as.branch.condition != NULL)
+    {
+        int conditionStart = currentChunk()->count;
+        ExpDesc condition;
+        expression(node->as.branch.condition, &condition);
+
+        currentLine = node->as.branch.conditionLine;
+        loopJump = conditionJump(&condition, true);
+        current->freeReg = current->localCount;
+        loopJump = loopJump == NO_JUMP ? NO_JUMP : loopJump - conditionStart;
+        conditionCode = cutCode(conditionStart);
+        hasCondition = true;
+    }
+
+    // increment part, moved below the body
+    CodeBlock incrementCode = {0, NULL, NULL};
+    if (node->as.branch.increment != NULL)
+    {
+        int incrementStart = currentChunk()->count;
+        ExpDesc increment;
+        expression(node->as.branch.increment, &increment);
+        currentLine = node->as.branch.incrementLine;
+        discardExpression(&increment);
+        incrementCode = cutCode(incrementStart);
+    }
+
+    currentLine = node->as.branch.bodyLine;
+    int entryJump = hasCondition ? emitJump(OP_JUMP, 0) : NO_JUMP; // jump to the condition
+    int bodyStart = currentChunk()->count;
+    statement(node->as.branch.body);
+
+    currentLine = node->line;
+    int incrementOffset = pasteCode(&incrementCode);
+    if (hasCondition)
+    {
+        patchJump(entryJump);
+        int conditionOffset = pasteCode(&conditionCode);
+        if (loopJump != NO_JUMP)
+        {
+            patchJumpTo(conditionOffset + loopJump, bodyStart);
+        }
+    }
+    else
+    {
+        emitLoop(bodyStart);
+    }
+
+    patchLoopJumps(incrementOffset);
+    endScope();
+}
+
+static void returnStatement(Node *node)
+{
+    if (node->as.ret.value == NULL)
+    {
+        currentLine = node->line;
+        emitReturn();
+    }
+    else
+    {
+        ExpDesc value;
+        expression(node->as.ret.value, &value);
+        currentLine = node->line;
+        emitABC(OP_RETURN, toAnyRegister(&value), 0, 0);
+    }
+}
+
+static void block(Node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        declaration(node);
+    }
+}
+
+static void expression(Node *node, ExpDesc *e)
+{
+    switch (node->type)
+    {
+    case NODE_NIL:
+    {
+        initExpression(e, EXP_NIL, 0);
+        break;
+    }
+    case NODE_TRUE:
+    {
+        initExpression(e, EXP_TRUE, 0);
+        break;
+    }
+    case NODE_FALSE:
+    {
+        initExpression(e, EXP_FALSE, 0);
+        break;
+    }
+    case NODE_NUMBER:
+    {
+        initExpression(e, EXP_CONSTANT, makeConstant(NUMBER_VAL(node->as.number)));
+        break;
+    }
+    case NODE_STRING:
+    {
+        Token *string = &node->as.string;
+        initExpression(e, EXP_CONSTANT, makeConstant(OBJ_VAL(copyString(string->start + 1, string->length - 2))));
+        break;
+    }
+    case NODE_VARIABLE:
+    case NODE_THIS:
+    {
+        variable(&node->as.variable, e);
+        break;
+    }
+    case NODE_ASSIGN:
+    {
+        assignment(node, e);
+        break;
+    }
+    case NODE_SUPER:
+    {
+        super_(node, e);
+        break;
+    }
+    case NODE_UNARY:
+    {
+        unary(node, e);
+        break;
+    }
+    case NODE_BINARY:
+    {
+        binary(node, e);
+        break;
+    }
+    case NODE_AND:
+    case NODE_OR:
+    {
+        logical(node, e);
+        break;
+    }
+    case NODE_CONDITIONAL:
+    {
+        conditional_(node, e);
+        break;
+    }
+    case NODE_CALL:
+    {
+        call(node, e);
+        break;
+    }
+    case NODE_GET:
+    {
+        getProperty(node, e);
+        break;
+    }
+    case NODE_SET:
+    {
+        setProperty(node, e);
+        break;
+    }
+    case NODE_INVOKE:
+    {
+        invoke(node, e);
+        break;
+    }
+    case NODE_FUNCTION:
+    {
+        function(node, e);
+        break;
+    }
+    default:
+    {
+        initExpression(e, EXP_NIL, 0);
+        break;
+    }
+    }
+}
+
+static void function(Node *node, ExpDesc *e)
+{
+    FunctionNode *function = node->as.function;
+    Compiler compiler;
+    initCompiler(&compiler, function->type, &function->name);
+    beginScope(SCOPE_FUNCTION); // [no-end-scope]
+
+    //< Parameters, the arguments are already in the registers of the parameters
+    for (int i = 0; i < function->arity; i++)
+    {
+        current->function->arity++;
+        addLocal(function->params[i].isCaptured);
+        markInitialized();
+        reserveRegisters(1);
+    }
+    //<
+    if (!generateOptimized(node))
+    {
+        block(function->body);
+        currentLine = node->line;
+        emitReturn();
+    }
+
+    clearScopeCompiler();
+
+    ObjFunction *closure = endCompiler();
+    closure->upvalueCount = function->upvalueCount;
+    initExpression(e, EXP_RELOCATABLE, emitABx(OP_CLOSURE, 0, makeConstant(OBJ_VAL(closure))));
+
+    for (int i = 0; i < function->upvalueCount; i++)
+    {
+        emitInstruction(UPVALUE_DESC(function->upvalues[i].isLocal ? 1 : 0, function->upvalues[i].index));
+    }
+}
+
+/**
+ * Compile the body of the function through the SSA IR of `ir.h`, which the functions without nested functions or
+ * classes go through.
+ *
+ * @return false if the body is left to the code generator, the chunk is empty again then
+ */
+static bool generateOptimized(Node *node)
+{
+    ObjFunction *function = current->function;
+    int maxSlots = function->maxSlots;
+    Arena arena;
+    initArena(&arena);
+
+    bool lowered = false;
+    IrFunction *ir = buildIr(&arena, node, function);
+    if (ir != NULL)
+    {
+        optimizeIr(ir);
+#ifdef DEBUG_PRINT_IR
+        printIr(ir, function->name->chars);
+#endif
+        lowered = lowerIr(ir);
+    }
+
+    if (!lowered)
+    {
+        freeChunk(&function->chunk);
+        function->maxSlots = maxSlots;
+    }
+    freeArena(&arena);
+    return lowered;
+}
+
+static void conditional_(Node *node, ExpDesc *e)
+{
+    expression(node->as.conditional.condition, e);
+    currentLine = node->as.conditional.questionLine;
+    int elseJump = conditionJump(e, false);
+    int reg = current->freeReg; // both branches leave their value here
+
+    //> Then
+    ExpDesc branch;
+    expression(node->as.conditional.thenBranch, &branch);
+    currentLine = node->as.conditional.thenLine;
+    toRegister(&branch, reg);
+    current->freeReg = reg;
+    reserveRegisters(1);
+
+    int endJump = emitJump(OP_JUMP, 0);
+    //<
+
+    //> Else
+    patchJump(elseJump);
+    current->freeReg = reg;
+    expression(node->as.conditional.elseBranch, &branch);
+    currentLine = node->line;
+    toRegister(&branch, reg);
+    current->freeReg = reg;
+    reserveRegisters(1);
+    //<
+
+    patchJump(endJump);
+    initExpression(e, EXP_TEMP, reg);
+}
+
+static void binary(Node *node, ExpDesc *e)
+{
+    TokenType operatorType = node->as.binary.op;
+    expression(node->as.binary.left, e);
+    currentLine = node->as.binary.opLine;
+
+    // Operands are released together once the operator has read them
+    int base = current->freeReg;
+    int left = 0;
+    PinnedLocal pin;
+    if (e->kind == EXP_LOCAL)
+    {
+        pinLocal(&pin);
+    }
+    else
+    {
+        left = toRK(e);
+        if (e->kind == EXP_TEMP && e->info >= current->localCount)
+        {
+            base = e->info;
+        }
+    }
+
+    ExpDesc right;
+    expression(node->as.binary.right, &right);
+    currentLine = node->line;
+    if (e->kind == EXP_LOCAL)
+    {
+        unpinLocal(e, &pin, &right);
+        left = e->info;
+    }
+    int rightRK = toRK(&right);
+
+    OpCode test;
+    bool negated = false;
+    switch (operatorType)
+    {
+    case TOKEN_BANG_EQUAL:
+    {
+        test = OP_TEST_EQUAL;
+        negated = true;
+        break;
+    }
+    case TOKEN_EQUAL_EQUAL:
+    {
+        test = OP_TEST_EQUAL;
+        break;
+    }
+    case TOKEN_GREATER:
+    {
+        test = OP_TEST_GREATER;
+        break;
+    }
+    case TOKEN_GREATER_EQUAL:
+    {
+        test = OP_TEST_LESS; // !(a < b)
+        negated = true;
+        break;
+    }
+    case TOKEN_LESS:
+    {
+        test = OP_TEST_LESS;
+        break;
+    }
+    case TOKEN_LESS_EQUAL:
+    {
+        test = OP_TEST_GREATER; // !(a > b)
+        negated = true;
+        break;
+    }
+    default:
+    {
+        OpCode op;
+        switch (operatorType)
+        {
+        case TOKEN_PLUS:
+            op = OP_ADD;
+            break;
+        case TOKEN_MINUS:
+            op = OP_SUBTRACT;
+            break;
+        case TOKEN_STAR:
+            op = OP_MULTIPLY;
+            break;
+        default:
+            op = OP_DIVIDE;
+            break;
+        }
+
+        current->freeReg = base;
+        initExpression(e, EXP_RELOCATABLE, emitABC(op, 0, left, rightRK));
+        return;
+    }
+    }
+
+    // Comparisons are emitted by their consumer, either as a value or as a conditional jump
+    initExpression(e, EXP_COMPARE, left);
+    e->aux = rightRK;
+    e->test = test;
+    e->negated = negated;
+    e->base = base;
+}
+
+/**
+ * `and` and `or`: the right operand is skipped when the left one decides the value
+ */
+static void logical(Node *node, ExpDesc *e)
+{
+    expression(node->as.binary.left, e);
+    currentLine = node->as.binary.opLine;
+    toNextRegister(e);
+    int reg = e->info;
+    int endJump = emitJump(node->type == NODE_AND ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE, reg);
+
+    ExpDesc right;
+    expression(node->as.binary.right, &right);
+    currentLine = node->line;
+    toRegister(&right, reg);
+    current->freeReg = reg;
+    reserveRegisters(1);
+
+    patchJump(endJump);
+    initExpression(e, EXP_TEMP, reg);
+}
+
+static void call(Node *node, ExpDesc *e)
+{
+    expression(node->as.call.callee, e);
+    currentLine = node->as.call.parenLine;
+    toNextRegister(e);
+    int base = e->info;
+    int argCount = argumentList(node->as.call.arguments);
+    currentLine = node->line;
+    emitABC(OP_CALL, base, argCount, 0);
+    current->sideEffects++;
+
+    current->freeReg = base;
+    reserveRegisters(1);
+    initExpression(e, EXP_TEMP, base);
+}
+
+static void getProperty(Node *node, ExpDesc *e)
+{
+    expression(node->as.property.object, e);
+    currentLine = node->as.property.name.line;
+    int name = propertyConstant(&node->as.property.name);
+
+    int object = toAnyRegister(e);
+    initExpression(e, EXP_PROPERTY, object);
+    e->aux = name;
+}
+
+static void setProperty(Node *node, ExpDesc *e)
+{
+    expression(node->as.property.object, e);
+    currentLine = node->as.property.name.line;
+    int name = propertyConstant(&node->as.property.name);
+    currentLine = node->as.property.opLine;
+
+    int base = current->freeReg;
+    PinnedLocal pin;
+    if (e->kind == EXP_LOCAL)
+    {
+        pinLocal(&pin);
+    }
+    else
+    {
+        toAnyRegister(e);
+        if (e->kind == EXP_TEMP && e->info >= current->localCount)
+        {
+            base = e->info;
+        }
+    }
+
+    ExpDesc value;
+    expression(node->as.property.value, &value);
+    currentLine = node->line;
+    unpinLocal(e, &pin, &value);
+    int valueRK = toRK(&value);
+    emitABC(OP_SET_PROPERTY, e->info, name, valueRK);
+
+    // The value of the assignment is the value assigned, which may sit above the released object register
+    current->freeReg = base;
+    *e = value;
+    if (e->kind == EXP_TEMP && e->info >= current->localCount)
+    {
+        if (e->info == base)
+        {
+            reserveRegisters(1);
+        }
+        else
+        {
+            e->kind = EXP_DETACHED;
+        }
+    }
+}
+
+/**
+ * @details A `superinstruction` optimization for method invocation
+ *
+ * @see https://craftinginterpreters.com/methods-and-initializers.html#optimized-invocations
+ */
+static void invoke(Node *node, ExpDesc *e)
+{
+    expression(node->as.property.object, e);
+    currentLine = node->as.property.name.line;
+    int name = propertyConstant(&node->as.property.name);
+    currentLine = node->as.property.opLine;
+
+    toNextRegister(e); // the receiver goes to slot 0 of the callee
+    int base = e->info;
+    int argCount = argumentList(node->as.property.arguments);
+    currentLine = node->line;
+    emitABC(OP_INVOKE, base, name, argCount);
+    current->sideEffects++;
+
+    current->freeReg = base;
+    reserveRegisters(1);
+    initExpression(e, EXP_TEMP, base);
+}
+
+/**
+ * Put the arguments into consecutive registers above the callee.
+ */
+static int argumentList(Node *arguments)
+{
+    int argCount = 0;
+    for (Node *argument = arguments; argument != NULL; argument = argument->next)
+    {
+        ExpDesc e;
+        expression(argument, &e);
+        currentLine = argument->line;
+        toNextRegister(&e);
+        argCount++;
+    }
+    return argCount;
+}
+
+static void variable(Variable *variable, ExpDesc *e)
+{
+    switch (variable->kind)
+    {
+    case VAR_LOCAL:
+    {
+        initExpression(e, EXP_LOCAL, variable->index);
+        break;
+    }
+    case VAR_UPVALUE:
+    {
+        initExpression(e, EXP_UPVALUE, variable->index);
+        break;
+    }
+    default:
+    {
+        initExpression(e, EXP_GLOBAL, identifierConstant(&variable->name));
+        break;
+    }
+    }
+}
+
+static void assignment(Node *node, ExpDesc *e)
+{
+    variable(&node->as.assign.variable, e);
+
+    ExpDesc value;
+    expression(node->as.assign.value, &value);
+    currentLine = node->line;
+
+    switch (e->kind)
+    {
+    case EXP_LOCAL:
+    {
+        toRegister(&value, e->info); // e.g. `i = i + 1` is a single `OP_ADD` into the register of `i`
+        current->sideEffects++;
+        break;
+    }
+    case EXP_UPVALUE:
+    {
+        emitABC(OP_SET_UPVALUE, toAnyRegister(&value), e->info, 0);
+        *e = value;
+        break;
+    }
+    default:
+    {
+        emitABx(OP_SET_GLOBAL, toAnyRegister(&value), e->info);
+        *e = value;
+        break;
+    }
+    }
+}
+
+static void super_(Node *node, ExpDesc *e)
+{
+    SuperNode *super = node->as.super;
+    currentLine = super->method.line;
+    int name = propertyConstant(&super->method);
+
+    ExpDesc receiver, superclass;
+    variable(&super->receiver, &receiver); // `this` goes to slot 0 of the callee
+    toNextRegister(&receiver);
+    int base = receiver.info;
+
+    if (super->isInvoke)
+    {
+        int argCount = argumentList(super->arguments);
+        currentLine = node->line;
+        variable(&super->superclass, &superclass); // `super` goes after the arguments
+        toNextRegister(&superclass);
+        emitABC(OP_SUPER_INVOKE, base, name, argCount);
+        current->sideEffects++;
+    }
+    else
+    {
+        variable(&super->superclass, &superclass);
+        emitABC(OP_GET_SUPER, base, toAnyRegister(&superclass), name);
+    }
+
+    current->freeReg = base;
+    reserveRegisters(1);
+    initExpression(e, EXP_TEMP, base);
+}
+
+static void unary(Node *node, ExpDesc *e)
+{
+    TokenType operatorType = node->as.unary.op;
+
+    // Compile the operand
+    expression(node->as.unary.operand, e);
+
+    if (operatorType == TOKEN_BANG && e->kind == EXP_COMPARE)
+    {
+        e->negated = !e->negated;
+        return;
+    }
+
+    // Emit the operator instruction
+    currentLine = node->line;
+    int operand = toAnyRegister(e);
+    freeExpression(e);
+    switch (operatorType)
+    {
+    case TOKEN_BANG:
+    {
+        initExpression(e, EXP_RELOCATABLE, emitABC(OP_NOT, 0, operand, 0));
+        break;
+    }
+    case TOKEN_MINUS:
+    {
+        initExpression(e, EXP_RELOCATABLE, emitABC(OP_NEGATE, 0, operand, 0));
+        break;
+    }
+    default:
+    {
+        return;
+    }
+    }
+}
+
+/**
+ * A local takes the register the resolver gave it, a global is named by a constant.
+ *
+ * @return constant index of the name of a global, 0 for a local
+ */
+static int declareVariable(Declaration *declaration)
+{
+    if (current->scopeDepth > 0)
+    {
+        addLocal(declaration->isCaptured);
+        return 0;
+    }
+
+    return identifierConstant(&declaration->name); // save identifier name in constant table and refer to the name by its index in the table
+}
+
+/**
+ * Locals take the register they were declared at, globals are defined from any register.
+ */
+static void defineVariable(int global, ExpDesc *value)
+{
+    if (current->scopeDepth > 0)
+    {
+        int reg = current->localCount - 1;
+        toRegister(value, reg);
+        current->freeReg = reg;
+        reserveRegisters(1);
+        markInitialized();
+        return;
+    }
+
+    emitABx(OP_DEFINE_GLOBAL, toAnyRegister(value), global);
+    freeExpression(value);
+}
+
+static void addLocal(bool isCaptured)
+{
+    Local *local = &current->locals[current->localCount++];
+    local->depth = -1;
+    local->isCaptured = isCaptured;
+}
+
+/**
+ * Mark latest local variable of current scope as initialized.
+ */
+static void markInitialized()
+{
+    if (current->scopeDepth == 0)
+    {
+        return;
+    }
+
+    current->locals[current->localCount - 1].depth = current->scopeDepth;
+}
+
+static int identifierConstant(Token *name)
+{
+    return makeConstant(OBJ_VAL(copyString(name->start, name->length))); // save identifier name in constant table and refer to the name by its index in the table
+}
+
+/**
+ * Property names are operands of their instructions, unlike other constants they can't be loaded into a register.
+ */
+static int propertyConstant(Token *name)
+{
+    int constant = identifierConstant(name);
+    if (constant > MAXARG_C)
+    {
+        error("Too many constants in one chunk.");
+        return 0;
+    }
+
+    return constant;
+}
+
+static void emitReturn()
+{
+    if (current->type == TYPE_INITIALIZER)
+    {
+        emitABC(OP_RETURN, 0, 0, 0); // Return `this` (register 0 of class constructor).
+    }
+    else
+    {
+        emitABC(OP_RETURN, 0, 1, 0); // Return nil
+    }
+}
+
+static void initCompiler(Compiler *compiler, FunctionType type, Token *name)
+{
+    compiler->enclosing = current;
+    compiler->function = NULL;
+    compiler->type = type;
+    compiler->localCount = 0;
+    compiler->freeReg = 0;
+    compiler->sideEffects = 0;
+    compiler->scopeDepth = 0;
+    compiler->currentScope = NULL;
+    compiler->function = newFunction();
+    current = compiler;
+    if (type != TYPE_SCRIPT)
+    {
+        current->function->name = copyString(name->start, name->length);
+    }
+
+    // Register 0 holds the callee, or `this` in methods
+    Local *local = &current->locals[current->localCount++];
+    local->depth = 0;
+    local->isCaptured = false;
+    reserveRegisters(1);
+}
+
+static int makeConstant(Value value)
+{
+    int constant = internConstant(currentChunk(), value);
+    if (constant > MAXARG_BX) /** OP_LOADK uses `Bx` for the index operand. */
+    {
+        error("Too many constants in one chunk.");
+        return 0;
+    }
+
+    return constant;
+}
+
+static Chunk *currentChunk()
+{
+    return &current->function->chunk;
+}
+
+/**
+ * Errors of the code generator are limits of the bytecode, only the first one is reported.
+ */
+static void error(const char *message)
+{
+    if (!hadError)
+    {
+        Token token;
+        token.type = TOKEN_ERROR;
+        token.start = "";
+        token.length = 0;
+        token.line = currentLine;
+        reportError(&token, message);
+    }
+
+    hadError = true;
+}
@@ -0,0 +1,10 @@
+#ifndef clox_compiler_h
+#define clox_compiler_h
+
+#include "object.h"
+#include "vm.h"
+
+ObjFunction *compile(const char *source);
+void markCompilerRoots();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include <stdio.h>
+
+#include "debug.h"
+#include "object.h"
+#include "value.h"
+
+void disassembleChunk(Chunk *chunk, const char *name)
+{
+    printf("== %s ==\n", name);
+
+    for (int offset = 0; offset < chunk->count;)
+    {
+        offset = disassembleInstruction(chunk, offset);
+    }
+}
+
+/**
+ * Print an operand, `R` for a register, `K` for a constant with its value, `X` for an `RK` operand and `N` for a
+ * plain number
+ */
+static void printOperand(Chunk *chunk, char kind, int operand)
+{
+    if (kind == 'X')
+    {
+        kind = IS_K(operand) ? 'K' : 'R';
+        operand = IS_K(operand) ? INDEX_K(operand) : operand;
+    }
+
+    switch (kind)
+    {
+    case 'R':
+        printf(" r%d", operand);
+        break;
+    case 'K':
+        printf(" k%d'", operand);
+        printValue(chunk->constants.values[operand]);
+        printf("'");
+        break;
+    case 'U':
+        printf(" u%d", operand);
+        break;
+    default:
+        printf(" %d", operand);
+        break;
+    }
+}
+
+/**
+ * @param operands kinds of `A`, `B` and `C` (see `printOperand()`), a space skips the operand
+ */
+static int abcInstruction(const char *name, const char *operands, Chunk *chunk, int offset)
+{
+    Instruction instruction = chunk->code[offset];
+    printf("%-16s", name);
+    int values[] = {GET_A(instruction), GET_B(instruction), GET_C(instruction)};
+    for (int i = 0; i < 3 && operands[i] != '\0'; i++)
+    {
+        if (operands[i] != ' ')
+        {
+            printOperand(chunk, operands[i], values[i]);
+        }
+    }
+    printf("\n");
+    return offset + 1;
+}
+
+static int abxInstruction(const char *name, Chunk *chunk, int offset)
+{
+    Instruction instruction = chunk->code[offset];
+    printf("%-16s", name);
+    printOperand(chunk, 'R', GET_A(instruction));
+    printOperand(chunk, 'K', GET_BX(instruction));
+    printf("\n");
+    return offset + 1;
+}
+
+static int jumpInstruction(const char *name, bool hasRegister, Chunk *chunk, int offset)
+{
+    Instruction instruction = chunk->code[offset];
+    printf("%-16s", name);
+    if (hasRegister)
+    {
+        printOperand(chunk, 'R', GET_A(instruction));
+    }
+    printf(" -> %d\n", offset + 1 + GET_SBX(instruction));
+    return offset + 1;
+}
+
+/**
+ * A compare-and-branch instruction, the jump that follows it is printed with it
+ */
+static int testInstruction(const char *name, Chunk *chunk, int offset)
+{
+    Instruction instruction = chunk->code[offset];
+    printf("%-16s", name);
+    printOperand(chunk, 'X', GET_B(instruction));
+    printOperand(chunk, 'X', GET_C(instruction));
+    printf(" == %s\n", GET_A(instruction) ? "true" : "false");
+    return offset + 1;
+}
+
+static int closureInstruction(Chunk *chunk, int offset)
+{
+    Instruction instruction = chunk->code[offset++];
+    printf("%-16s", "OP_CLOSURE");
+    printOperand(chunk, 'R', GET_A(instruction));
+    printOperand(chunk, 'K', GET_BX(instruction));
+    printf("\n");
+
+    ObjFunction *function = AS_FUNCTION(chunk->constants.values[GET_BX(instruction)]);
+    for (int j = 0; j < function->upvalueCount; j++)
+    {
+        Instruction descriptor = chunk->code[offset];
+        printf("%04d      |                     %s %d\n",
+               offset, UPVALUE_IS_LOCAL(descriptor) ? "local" : "upvalue", UPVALUE_INDEX(descriptor));
+        offset++;
+    }
+
+    return offset;
+}
+
+static int returnInstruction(Chunk *chunk, int offset)
+{
+    Instruction instruction = chunk->code[offset];
+    if (GET_B(instruction))
+    {
+        printf("%-16s nil\n", "OP_RETURN");
+    }
+    else
+    {
+        printf("%-16s r%d\n", "OP_RETURN", GET_A(instruction));
+    }
+    return offset + 1;
+}
+
+int disassembleInstruction(Chunk *chunk, int offset)
+{
+    printf("%04d ", offset);
+    if (offset > 0 &&
+        chunk->lines[offset] == chunk->lines[offset - 1])
+    {
+        printf("   | ");
+    }
+    else
+    {
+        printf("%4d ", chunk->lines[offset]);
+    }
+
+    OpCode instruction = GET_OP(chunk->code[offset]);
+    switch (instruction)
+    {
+    case OP_MOVE:
+        return abcInstruction("OP_MOVE", "RR", chunk, offset);
+    case OP_LOADK:
+        return abxInstruction("OP_LOADK", chunk, offset);
+    case OP_LOADNIL:
+        return abcInstruction("OP_LOADNIL", "R", chunk, offset);
+    case OP_LOADBOOL:
+        return abcInstruction("OP_LOADBOOL", "RN", chunk, offset);
+    case OP_GET_GLOBAL:
+        return abxInstruction("OP_GET_GLOBAL", chunk, offset);
+    case OP_DEFINE_GLOBAL:
+        return abxInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+        return abxInstruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_GET_UPVALUE:
+        return abcInstruction("OP_GET_UPVALUE", "RU", chunk, offset);
+    case OP_SET_UPVALUE:
+        return abcInstruction("OP_SET_UPVALUE", "RU", chunk, offset);
+    case OP_GET_PROPERTY:
+        return abcInstruction("OP_GET_PROPERTY", "RRK", chunk, offset);
+    case OP_SET_PROPERTY:
+        return abcInstruction("OP_SET_PROPERTY", "RKX", chunk, offset);
+    case OP_GET_SUPER:
+        return abcInstruction("OP_GET_SUPER", "RRK", chunk, offset);
+    case OP_EQUAL:
+        return abcInstruction("OP_EQUAL", "RXX", chunk, offset);
+    case OP_NOT_EQUAL:
+        return abcInstruction("OP_NOT_EQUAL", "RXX", chunk, offset);
+    case OP_GREATER:
+        return abcInstruction("OP_GREATER", "RXX", chunk, offset);
+    case OP_GREATER_EQUAL:
+        return abcInstruction("OP_GREATER_EQUAL", "RXX", chunk, offset);
+    case OP_LESS:
+        return abcInstruction("OP_LESS", "RXX", chunk, offset);
+    case OP_LESS_EQUAL:
+        return abcInstruction("OP_LESS_EQUAL", "RXX", chunk, offset);
+    case OP_ADD:
+        return abcInstruction("OP_ADD", "RXX", chunk, offset);
+    case OP_SUBTRACT:
+        return abcInstruction("OP_SUBTRACT", "RXX", chunk, offset);
+    case OP_MULTIPLY:
+        return abcInstruction("OP_MULTIPLY", "RXX", chunk, offset);
+    case OP_DIVIDE:
+        return abcInstruction("OP_DIVIDE", "RXX", chunk, offset);
+    case OP_NOT:
+        return abcInstruction("OP_NOT", "RR", chunk, offset);
+    case OP_NEGATE:
+        return abcInstruction("OP_NEGATE", "RR", chunk, offset);
+    case OP_PRINT:
+        return abcInstruction("OP_PRINT", "R", chunk, offset);
+    case OP_JUMP:
+        return jumpInstruction("OP_JUMP", false, chunk, offset);
+    case OP_JUMP_IF_FALSE:
+        return jumpInstruction("OP_JUMP_IF_FALSE", true, chunk, offset);
+    case OP_JUMP_IF_TRUE:
+        return jumpInstruction("OP_JUMP_IF_TRUE", true, chunk, offset);
+    case OP_TEST_EQUAL:
+        return testInstruction("OP_TEST_EQUAL", chunk, offset);
+    case OP_TEST_LESS:
+        return testInstruction("OP_TEST_LESS", chunk, offset);
+    case OP_TEST_GREATER:
+        return testInstruction("OP_TEST_GREATER", chunk, offset);
+    case OP_CALL:
+        return abcInstruction("OP_CALL", "RN", chunk, offset);
+    case OP_INVOKE:
+        return abcInstruction("OP_INVOKE", "RKN", chunk, offset);
+    case OP_SUPER_INVOKE:
+        return abcInstruction("OP_SUPER_INVOKE", "RKN", chunk, offset);
+    case OP_CLOSURE:
+        return closureInstruction(chunk, offset);
+    case OP_CLOSE_UPVALUE:
+        return abcInstruction("OP_CLOSE_UPVALUE", "R", chunk, offset);
+    case OP_RETURN:
+        return returnInstruction(chunk, offset);
+    case OP_CLASS:
+        return abxInstruction("OP_CLASS", chunk, offset);
+    case OP_INHERIT:
+        return abcInstruction("OP_INHERIT", "RR", chunk, offset);
+    case OP_METHOD:
+        return abcInstruction("OP_METHOD", "RR", chunk, offset);
+    default:
+        printf("Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
+}
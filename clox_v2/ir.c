@@ -0,0 +1,1278 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ir.h"
+
+/**
+ * Where `break` and `continue` of the innermost loop being built jump to
+ */
+typedef struct LoopTarget
+{
+    struct LoopTarget *enclosing;
+    IrBlock *breakTarget;
+    IrBlock *continueTarget;
+} LoopTarget;
+
+static IrFunction *ir;
+static IrBlock *currentBlock;
+static IrLoop *currentLoop;
+static LoopTarget *currentTarget;
+/**
+ * Local slots of the function being built, parameters included
+ */
+static int slotCount;
+static bool failed;
+
+static bool supportedStatements(Node *node);
+static bool supportedStatement(Node *node);
+static bool supportedExpression(Node *node);
+static IrBlock *createBlock();
+static void placeBlock(IrBlock *block);
+static void startBlock(IrBlock *block);
+static void startDeadBlock();
+static void sealBlock(IrBlock *block);
+static IrInstr *emit(IrOp op, int operandCount, int line);
+static void jump(IrBlock *target, int line);
+static void branch(IrInstr *condition, IrBlock *ifTrue, IrBlock *ifFalse, int line);
+static IrInstr *addPhi(IrBlock *block);
+static void addPhiOperands(IrInstr *phi);
+static IrInstr *join(IrBlock *block, IrBlock *left, IrInstr *leftValue, IrInstr *rightValue);
+static void writeVariable(int slot, IrInstr *value, int line);
+static IrInstr *readVariable(int slot, IrBlock *block);
+static IrInstr *constant(Value value, int line);
+static int nameConstant(Token *name, int limit);
+static void statements(Node *node);
+static void statement(Node *node);
+static void varDeclaration(Node *node);
+static void ifStatement(Node *node);
+static void loopStatement(Node *node);
+static void returnStatement(Node *node);
+static IrInstr *expression(Node *node);
+static IrInstr *variable(Variable *variable);
+static IrInstr *assignment(Node *node);
+static IrInstr *unary(Node *node);
+static IrInstr *binary(Node *node);
+static IrInstr *logical(Node *node);
+static IrInstr *conditional_(Node *node);
+static IrInstr *call(Node *node, IrOp op, IrInstr *callee, Node *arguments, int name);
+
+/**
+ * Build the IR of a function, or return NULL if the function is out of reach of the IR: it declares functions or
+ * classes (so its locals may be captured), uses `super`, or is bigger than `IR_MAX_VALUES`.
+ */
+IrFunction *buildIr(Arena *arena, Node *node, ObjFunction *target)
+{
+    FunctionNode *function = node->as.function;
+    slotCount = function->arity + 1;
+    if (function->type == TYPE_SCRIPT || !supportedStatements(function->body))
+    {
+        return NULL;
+    }
+
+    ir = arenaAlloc(arena, sizeof(IrFunction));
+    ir->arena = arena;
+    ir->target = target;
+    ir->type = function->type;
+    ir->arity = function->arity;
+    ir->line = node->line;
+    ir->blocks = NULL;
+    ir->blockCount = 0;
+    ir->blockCapacity = 0;
+    ir->loops = NULL;
+    ir->loopCount = 0;
+    ir->loopCapacity = 0;
+    ir->valueCount = 0;
+    ir->nextBlockId = 0;
+    currentLoop = NULL;
+    currentTarget = NULL;
+    failed = false;
+
+    ir->entry = createBlock();
+    startBlock(ir->entry);
+    ir->undefined = constant(NIL_VAL, node->line);
+    for (int i = 0; i <= function->arity; i++)
+    {
+        IrInstr *parameter = emit(IR_PARAMETER, 0, node->line);
+        parameter->index = i;
+        currentBlock->defs[i] = parameter;
+    }
+
+    statements(function->body);
+
+    IrInstr *result = emit(IR_RETURN, 1, node->line);
+    result->operands[0] = function->type == TYPE_INITIALIZER ? readVariable(0, currentBlock)
+                                                             : constant(NIL_VAL, node->line);
+
+    return failed || ir->valueCount > IR_MAX_VALUES ? NULL : ir;
+}
+
+static bool supportedStatements(Node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        if (!supportedStatement(node))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool supportedStatement(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_PRINT:
+    case NODE_EXPRESSION:
+    {
+        return supportedExpression(node->as.expression);
+    }
+    case NODE_VAR:
+    {
+        if (node->as.var.name.slot >= slotCount)
+        {
+            slotCount = node->as.var.name.slot + 1;
+        }
+        return node->as.var.initializer == NULL || supportedExpression(node->as.var.initializer);
+    }
+    case NODE_BLOCK:
+    {
+        return supportedStatements(node->as.statements);
+    }
+    case NODE_IF:
+    {
+        return supportedExpression(node->as.branch.condition) && supportedStatement(node->as.branch.body) &&
+               (node->as.branch.elseBranch == NULL || supportedStatement(node->as.branch.elseBranch));
+    }
+    case NODE_WHILE:
+    case NODE_FOR:
+    {
+        return (node->as.branch.initializer == NULL || supportedStatement(node->as.branch.initializer)) &&
+               (node->as.branch.condition == NULL || supportedExpression(node->as.branch.condition)) &&
+               (node->as.branch.increment == NULL || supportedExpression(node->as.branch.increment)) &&
+               supportedStatement(node->as.branch.body);
+    }
+    case NODE_BREAK:
+    case NODE_CONTINUE:
+    {
+        return true;
+    }
+    case NODE_RETURN:
+    {
+        return node->as.ret.value == NULL || supportedExpression(node->as.ret.value);
+    }
+    default:
+    {
+        return false;
+    }
+    }
+}
+
+static bool supportedExpression(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_NIL:
+    case NODE_TRUE:
+    case NODE_FALSE:
+    case NODE_NUMBER:
+    case NODE_STRING:
+    case NODE_VARIABLE:
+    case NODE_THIS:
+    {
+        return true;
+    }
+    case NODE_ASSIGN:
+    {
+        return supportedExpression(node->as.assign.value);
+    }
+    case NODE_UNARY:
+    {
+        return supportedExpression(node->as.unary.operand);
+    }
+    case NODE_BINARY:
+    case NODE_AND:
+    case NODE_OR:
+    {
+        return supportedExpression(node->as.binary.left) && supportedExpression(node->as.binary.right);
+    }
+    case NODE_CONDITIONAL:
+    {
+        return supportedExpression(node->as.conditional.condition) &&
+               supportedExpression(node->as.conditional.thenBranch) &&
+               supportedExpression(node->as.conditional.elseBranch);
+    }
+    case NODE_CALL:
+    {
+        for (Node *argument = node->as.call.arguments; argument != NULL; argument = argument->next)
+        {
+            if (!supportedExpression(argument))
+            {
+                return false;
+            }
+        }
+        return supportedExpression(node->as.call.callee);
+    }
+    case NODE_GET:
+    case NODE_SET:
+    case NODE_INVOKE:
+    {
+        for (Node *argument = node->as.property.arguments; argument != NULL; argument = argument->next)
+        {
+            if (!supportedExpression(argument))
+            {
+                return false;
+            }
+        }
+        return supportedExpression(node->as.property.object) &&
+               (node->as.property.value == NULL || supportedExpression(node->as.property.value));
+    }
+    default:
+    {
+        return false;
+    }
+    }
+}
+
+/**
+ * @return block that belongs to the loop being built and is not laid out yet
+ */
+static IrBlock *createBlock()
+{
+    IrBlock *block = newBlock(ir);
+    block->loop = currentLoop;
+    block->defs = arenaAlloc(ir->arena, sizeof(IrInstr *) * slotCount);
+    memset(block->defs, 0, sizeof(IrInstr *) * slotCount);
+    return block;
+}
+
+/**
+ * Lay the block out after the ones laid out so far.
+ */
+static void placeBlock(IrBlock *block)
+{
+    if (ir->blockCount == ir->blockCapacity)
+    {
+        int capacity = ir->blockCapacity < 8 ? 8 : ir->blockCapacity * 2;
+        ir->blocks = growArray(ir->arena, ir->blocks, sizeof(IrBlock *), ir->blockCount, capacity);
+        ir->blockCapacity = capacity;
+    }
+    ir->blocks[ir->blockCount++] = block;
+}
+
+/**
+ * Continue building in a block whose predecessors are all known.
+ */
+static void startBlock(IrBlock *block)
+{
+    sealBlock(block);
+    placeBlock(block);
+    currentBlock = block;
+}
+
+/**
+ * Continue after a `break`, `continue` or `return` in a block nothing jumps to, it is removed by the optimizer.
+ */
+static void startDeadBlock()
+{
+    startBlock(createBlock());
+}
+
+/**
+ * All predecessors of the block are known: complete the phis of the locals read before they were.
+ */
+static void sealBlock(IrBlock *block)
+{
+    for (IrInstr *phi = block->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+    {
+        addPhiOperands(phi);
+    }
+    block->sealed = true;
+}
+
+static IrInstr *emit(IrOp op, int operandCount, int line)
+{
+    IrInstr *instr = newInstr(ir, op, operandCount, line);
+    appendInstr(currentBlock, instr);
+    return instr;
+}
+
+static void jump(IrBlock *target, int line)
+{
+    emit(IR_JUMP, 0, line);
+    addEdge(ir, currentBlock, target);
+}
+
+static void branch(IrInstr *condition, IrBlock *ifTrue, IrBlock *ifFalse, int line)
+{
+    IrInstr *instr = emit(IR_BRANCH, 1, line);
+    instr->operands[0] = condition;
+    addEdge(ir, currentBlock, ifTrue);
+    addEdge(ir, currentBlock, ifFalse);
+}
+
+/**
+ * @return phi without operands after the phis of the block
+ */
+static IrInstr *addPhi(IrBlock *block)
+{
+    IrInstr *phi = newInstr(ir, IR_PHI, 0, 0);
+    IrInstr *position = block->first;
+    while (position != NULL && position->op == IR_PHI)
+    {
+        position = position->next;
+    }
+
+    if (position == NULL)
+    {
+        appendInstr(block, phi);
+    }
+    else
+    {
+        insertBefore(position, phi);
+    }
+    return phi;
+}
+
+static void addPhiOperands(IrInstr *phi)
+{
+    IrBlock *block = phi->block;
+    phi->operands = arenaAlloc(ir->arena, sizeof(IrInstr *) * block->predCount);
+    phi->operandCount = block->predCount;
+    for (int i = 0; i < block->predCount; i++)
+    {
+        phi->operands[i] = readVariable(phi->index, block->preds[i]);
+    }
+}
+
+/**
+ * Value of `and`, `or` and `?:` in the block where their two ends meet: `leftValue` comes from the block `left`,
+ * `rightValue` from the other predecessor.
+ */
+static IrInstr *join(IrBlock *block, IrBlock *left, IrInstr *leftValue, IrInstr *rightValue)
+{
+    IrInstr *phi = addPhi(block);
+    phi->operands = arenaAlloc(ir->arena, sizeof(IrInstr *) * block->predCount);
+    phi->operandCount = block->predCount;
+    for (int i = 0; i < block->predCount; i++)
+    {
+        phi->operands[i] = block->preds[i] == left ? leftValue : rightValue;
+    }
+    return phi;
+}
+
+/**
+ * Every write of a local is a copy, so that each definition of a local is a value of its own until copy propagation.
+ */
+static void writeVariable(int slot, IrInstr *value, int line)
+{
+    IrInstr *copy = emit(IR_COPY, 1, line);
+    copy->operands[0] = value;
+    currentBlock->defs[slot] = copy;
+}
+
+static IrInstr *readVariable(int slot, IrBlock *block)
+{
+    if (block->defs[slot] != NULL)
+    {
+        return block->defs[slot];
+    }
+
+    IrInstr *value;
+    if (!block->sealed)
+    {
+        value = addPhi(block); // completed by `sealBlock()`
+        value->index = slot;
+    }
+    else if (block->predCount == 0)
+    {
+        value = ir->undefined;
+    }
+    else if (block->predCount == 1)
+    {
+        value = readVariable(slot, block->preds[0]);
+    }
+    else
+    {
+        value = addPhi(block);
+        value->index = slot;
+        block->defs[slot] = value; // breaks the cycle of loops
+        addPhiOperands(value);
+    }
+
+    block->defs[slot] = value;
+    return value;
+}
+
+/**
+ * Constants are interned in the chunk as they are built, in source order like the code generator does.
+ */
+static IrInstr *constant(Value value, int line)
+{
+    if (internConstant(&ir->target->chunk, value) > MAXARG_BX)
+    {
+        failed = true;
+    }
+
+    IrInstr *instr = emit(IR_CONSTANT, 0, line);
+    instr->value = value;
+    return instr;
+}
+
+static int nameConstant(Token *name, int limit)
+{
+    int index = internConstant(&ir->target->chunk, OBJ_VAL(copyString(name->start, name->length)));
+    if (index > limit)
+    {
+        failed = true;
+    }
+    return index;
+}
+
+static void statements(Node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        statement(node);
+    }
+}
+
+static void statement(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_PRINT:
+    {
+        IrInstr *value = expression(node->as.expression);
+        IrInstr *print = emit(IR_PRINT, 1, node->line);
+        print->operands[0] = value;
+        break;
+    }
+    case NODE_VAR:
+    {
+        varDeclaration(node);
+        break;
+    }
+    case NODE_BLOCK:
+    {
+        statements(node->as.statements);
+        break;
+    }
+    case NODE_IF:
+    {
+        ifStatement(node);
+        break;
+    }
+    case NODE_WHILE:
+    case NODE_FOR:
+    {
+        loopStatement(node);
+        break;
+    }
+    case NODE_BREAK:
+    {
+        jump(currentTarget->breakTarget, node->line);
+        startDeadBlock();
+        break;
+    }
+    case NODE_CONTINUE:
+    {
+        jump(currentTarget->continueTarget, node->line);
+        startDeadBlock();
+        break;
+    }
+    case NODE_RETURN:
+    {
+        returnStatement(node);
+        break;
+    }
+    default:
+    {
+        expression(node->as.expression);
+        break;
+    }
+    }
+}
+
+static void varDeclaration(Node *node)
+{
+    IrInstr *value = node->as.var.initializer != NULL ? expression(node->as.var.initializer)
+                                                      : constant(NIL_VAL, node->line);
+    writeVariable(node->as.var.name.slot, value, node->line);
+}
+
+static void ifStatement(Node *node)
+{
+    IrInstr *condition = expression(node->as.branch.condition);
+    IrBlock *thenBlock = createBlock();
+    IrBlock *end = createBlock();
+    IrBlock *elseBlock = node->as.branch.elseBranch != NULL ? createBlock() : end;
+    branch(condition, thenBlock, elseBlock, node->as.branch.conditionLine);
+
+    startBlock(thenBlock);
+    statement(node->as.branch.body);
+    if (node->as.branch.elseBranch != NULL)
+    {
+        jump(end, node->as.branch.elseLine);
+        startBlock(elseBlock);
+        statement(node->as.branch.elseBranch);
+    }
+
+    jump(end, node->line);
+    startBlock(end);
+}
+
+/**
+ * `while` and `for` loops are inverted: a copy of the condition guards the loop, and the condition at the bottom of
+ * the body jumps back to its top. An iteration runs the body and a single conditional jump like the rotated loops of
+ * the code generator, and the preheader only runs when the body does, so invariants can be hoisted there even if
+ * they may fail.
+ */
+static void loopStatement(Node *node)
+{
+    bool isFor = node->type == NODE_FOR;
+    Node *initializer = node->as.branch.initializer;
+    if (initializer != NULL && initializer->type == NODE_VAR)
+    {
+        varDeclaration(initializer);
+    }
+    else if (initializer != NULL)
+    {
+        expression(initializer->as.expression);
+    }
+
+    IrBlock *exit = createBlock();
+    Node *condition = node->as.branch.condition;
+    if (condition != NULL)
+    {
+        IrBlock *preheader = createBlock();
+        branch(expression(condition), preheader, exit, node->as.branch.conditionLine);
+        startBlock(preheader);
+    }
+
+    IrLoop *loop = arenaAlloc(ir->arena, sizeof(IrLoop));
+    loop->parent = currentLoop;
+    loop->preheader = currentBlock;
+    if (ir->loopCount == ir->loopCapacity)
+    {
+        int capacity = ir->loopCapacity < 4 ? 4 : ir->loopCapacity * 2;
+        ir->loops = growArray(ir->arena, ir->loops, sizeof(IrLoop *), ir->loopCount, capacity);
+        ir->loopCapacity = capacity;
+    }
+    ir->loops[ir->loopCount++] = loop;
+    currentLoop = loop;
+
+    // the header is sealed once the back edge is built, the latch once all the `continue`s are
+    IrBlock *header = createBlock();
+    IrBlock *latch = createBlock();
+    IrBlock *increment = isFor ? createBlock() : latch;
+    loop->header = header;
+    jump(header, isFor ? node->as.branch.bodyLine : node->as.branch.conditionLine);
+    placeBlock(header);
+    currentBlock = header;
+
+    LoopTarget target = {currentTarget, exit, increment};
+    currentTarget = &target;
+    statement(node->as.branch.body);
+    jump(increment, node->line);
+    if (isFor)
+    {
+        startBlock(increment);
+        if (node->as.branch.increment != NULL)
+        {
+            expression(node->as.branch.increment);
+        }
+        jump(latch, node->as.branch.incrementLine);
+    }
+
+    startBlock(latch);
+    IrInstr *loopCondition = condition != NULL ? expression(condition) : constant(TRUE_VAL, node->line);
+    branch(loopCondition, header, exit, node->as.branch.conditionLine);
+    sealBlock(header);
+
+    currentTarget = target.enclosing;
+    currentLoop = loop->parent;
+    startBlock(exit);
+}
+
+static void returnStatement(Node *node)
+{
+    IrInstr *value;
+    if (node->as.ret.value != NULL)
+    {
+        value = expression(node->as.ret.value);
+    }
+    else
+    {
+        value = ir->type == TYPE_INITIALIZER ? readVariable(0, currentBlock) : constant(NIL_VAL, node->line);
+    }
+
+    IrInstr *result = emit(IR_RETURN, 1, node->line);
+    result->operands[0] = value;
+    startDeadBlock();
+}
+
+static IrInstr *expression(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_NIL:
+    {
+        return constant(NIL_VAL, node->line);
+    }
+    case NODE_TRUE:
+    case NODE_FALSE:
+    {
+        return constant(BOOL_VAL(node->type == NODE_TRUE), node->line);
+    }
+    case NODE_NUMBER:
+    {
+        return constant(NUMBER_VAL(node->as.number), node->line);
+    }
+    case NODE_STRING:
+    {
+        Token *string = &node->as.string;
+        return constant(OBJ_VAL(copyString(string->start + 1, string->length - 2)), node->line);
+    }
+    case NODE_VARIABLE:
+    case NODE_THIS:
+    {
+        return variable(&node->as.variable);
+    }
+    case NODE_ASSIGN:
+    {
+        return assignment(node);
+    }
+    case NODE_UNARY:
+    {
+        return unary(node);
+    }
+    case NODE_BINARY:
+    {
+        return binary(node);
+    }
+    case NODE_AND:
+    case NODE_OR:
+    {
+        return logical(node);
+    }
+    case NODE_CONDITIONAL:
+    {
+        return conditional_(node);
+    }
+    case NODE_CALL:
+    {
+        IrInstr *callee = expression(node->as.call.callee);
+        return call(node, IR_CALL, callee, node->as.call.arguments, 0);
+    }
+    case NODE_GET:
+    {
+        IrInstr *object = expression(node->as.property.object);
+        IrInstr *get = emit(IR_GET_PROPERTY, 1, node->as.property.name.line);
+        get->operands[0] = object;
+        get->index = nameConstant(&node->as.property.name, MAXARG_C);
+        return get;
+    }
+    case NODE_SET:
+    {
+        IrInstr *object = expression(node->as.property.object);
+        int name = nameConstant(&node->as.property.name, MAXARG_B);
+        IrInstr *value = expression(node->as.property.value);
+        IrInstr *set = emit(IR_SET_PROPERTY, 2, node->line);
+        set->operands[0] = object;
+        set->operands[1] = value;
+        set->index = name;
+        return value;
+    }
+    case NODE_INVOKE:
+    {
+        IrInstr *receiver = expression(node->as.property.object);
+        int name = nameConstant(&node->as.property.name, MAXARG_B);
+        return call(node, IR_INVOKE, receiver, node->as.property.arguments, name);
+    }
+    default:
+    {
+        failed = true;
+        return ir->undefined;
+    }
+    }
+}
+
+static IrInstr *variable(Variable *variable)
+{
+    switch (variable->kind)
+    {
+    case VAR_LOCAL:
+    {
+        return readVariable(variable->index, currentBlock);
+    }
+    case VAR_UPVALUE:
+    {
+        IrInstr *get = emit(IR_GET_UPVALUE, 0, variable->name.line);
+        get->index = variable->index;
+        return get;
+    }
+    default:
+    {
+        int name = nameConstant(&variable->name, MAXARG_BX);
+        IrInstr *get = emit(IR_GET_GLOBAL, 0, variable->name.line);
+        get->index = name;
+        return get;
+    }
+    }
+}
+
+static IrInstr *assignment(Node *node)
+{
+    Variable *variable = &node->as.assign.variable;
+    int name = variable->kind == VAR_GLOBAL ? nameConstant(&variable->name, MAXARG_BX) : variable->index;
+    IrInstr *value = expression(node->as.assign.value);
+    if (variable->kind == VAR_LOCAL)
+    {
+        writeVariable(variable->index, value, node->line);
+        return value;
+    }
+
+    IrInstr *set = emit(variable->kind == VAR_UPVALUE ? IR_SET_UPVALUE : IR_SET_GLOBAL, 1, node->line);
+    set->operands[0] = value;
+    set->index = name;
+    return value;
+}
+
+static IrInstr *unary(Node *node)
+{
+    IrInstr *operand = expression(node->as.unary.operand);
+    if (node->as.unary.op == TOKEN_BANG && isComparison(operand->op) && operand == currentBlock->last)
+    {
+        // `!(a < b)` is `a >= b`, the comparison was just built so nothing else uses it
+        static const IrOp inverted[] = {
+            [IR_EQUAL] = IR_NOT_EQUAL,
+            [IR_NOT_EQUAL] = IR_EQUAL,
+            [IR_GREATER] = IR_LESS_EQUAL,
+            [IR_GREATER_EQUAL] = IR_LESS,
+            [IR_LESS] = IR_GREATER_EQUAL,
+            [IR_LESS_EQUAL] = IR_GREATER,
+        };
+        operand->op = inverted[operand->op];
+        return operand;
+    }
+
+    IrInstr *instr = emit(node->as.unary.op == TOKEN_BANG ? IR_NOT : IR_NEGATE, 1, node->line);
+    instr->operands[0] = operand;
+    return instr;
+}
+
+static IrInstr *binary(Node *node)
+{
+    IrInstr *left = expression(node->as.binary.left);
+    IrInstr *right = expression(node->as.binary.right);
+
+    IrOp op;
+    switch (node->as.binary.op)
+    {
+    case TOKEN_BANG_EQUAL:
+        op = IR_NOT_EQUAL;
+        break;
+    case TOKEN_EQUAL_EQUAL:
+        op = IR_EQUAL;
+        break;
+    case TOKEN_GREATER:
+        op = IR_GREATER;
+        break;
+    case TOKEN_GREATER_EQUAL:
+        op = IR_GREATER_EQUAL;
+        break;
+    case TOKEN_LESS:
+        op = IR_LESS;
+        break;
+    case TOKEN_LESS_EQUAL:
+        op = IR_LESS_EQUAL;
+        break;
+    case TOKEN_PLUS:
+        op = IR_ADD;
+        break;
+    case TOKEN_MINUS:
+        op = IR_SUBTRACT;
+        break;
+    case TOKEN_STAR:
+        op = IR_MULTIPLY;
+        break;
+    default:
+        op = IR_DIVIDE;
+        break;
+    }
+
+    IrInstr *instr = emit(op, 2, node->line);
+    instr->operands[0] = left;
+    instr->operands[1] = right;
+    return instr;
+}
+
+static IrInstr *logical(Node *node)
+{
+    IrInstr *left = expression(node->as.binary.left);
+    IrBlock *leftBlock = currentBlock;
+    IrBlock *right = createBlock();
+    IrBlock *end = createBlock();
+    if (node->type == NODE_AND)
+    {
+        branch(left, right, end, node->as.binary.opLine);
+    }
+    else
+    {
+        branch(left, end, right, node->as.binary.opLine);
+    }
+
+    startBlock(right);
+    IrInstr *value = expression(node->as.binary.right);
+    jump(end, node->line);
+    startBlock(end);
+    return join(end, leftBlock, left, value);
+}
+
+static IrInstr *conditional_(Node *node)
+{
+    IrInstr *condition = expression(node->as.conditional.condition);
+    IrBlock *thenBlock = createBlock();
+    IrBlock *elseBlock = createBlock();
+    IrBlock *end = createBlock();
+    branch(condition, thenBlock, elseBlock, node->as.conditional.questionLine);
+
+    startBlock(thenBlock);
+    IrInstr *thenValue = expression(node->as.conditional.thenBranch);
+    IrBlock *thenEnd = currentBlock;
+    jump(end, node->as.conditional.thenLine);
+
+    startBlock(elseBlock);
+    IrInstr *elseValue = expression(node->as.conditional.elseBranch);
+    jump(end, node->line);
+    startBlock(end);
+    return join(end, thenEnd, thenValue, elseValue);
+}
+
+/**
+ * `IR_CALL` and `IR_INVOKE`, the arguments are built before the instruction that takes them.
+ */
+static IrInstr *call(Node *node, IrOp op, IrInstr *callee, Node *arguments, int name)
+{
+    int count = 1;
+    for (Node *argument = arguments; argument != NULL; argument = argument->next)
+    {
+        count++;
+    }
+
+    IrInstr **operands = arenaAlloc(ir->arena, sizeof(IrInstr *) * count);
+    operands[0] = callee;
+    count = 1;
+    for (Node *argument = arguments; argument != NULL; argument = argument->next)
+    {
+        operands[count++] = expression(argument);
+    }
+
+    IrInstr *instr = emit(op, 0, node->line);
+    instr->operands = operands;
+    instr->operandCount = count;
+    instr->index = name;
+    return instr;
+}
+
+IrBlock *newBlock(IrFunction *function)
+{
+    IrBlock *block = arenaAlloc(function->arena, sizeof(IrBlock));
+    memset(block, 0, sizeof(IrBlock));
+    block->id = function->nextBlockId++;
+    block->order = -1;
+    return block;
+}
+
+IrInstr *newInstr(IrFunction *function, IrOp op, int operandCount, int line)
+{
+    IrInstr *instr = arenaAlloc(function->arena, sizeof(IrInstr));
+    instr->op = op;
+    instr->id = function->valueCount++;
+    instr->line = line;
+    instr->value = NIL_VAL;
+    instr->index = 0;
+    instr->operands = operandCount > 0 ? arenaAlloc(function->arena, sizeof(IrInstr *) * operandCount) : NULL;
+    instr->operandCount = operandCount;
+    instr->block = NULL;
+    instr->prev = NULL;
+    instr->next = NULL;
+    instr->replacement = NULL;
+    return instr;
+}
+
+void appendInstr(IrBlock *block, IrInstr *instr)
+{
+    instr->block = block;
+    instr->prev = block->last;
+    instr->next = NULL;
+    if (block->last != NULL)
+    {
+        block->last->next = instr;
+    }
+    else
+    {
+        block->first = instr;
+    }
+    block->last = instr;
+}
+
+void insertBefore(IrInstr *position, IrInstr *instr)
+{
+    IrBlock *block = position->block;
+    instr->block = block;
+    instr->next = position;
+    instr->prev = position->prev;
+    if (position->prev != NULL)
+    {
+        position->prev->next = instr;
+    }
+    else
+    {
+        block->first = instr;
+    }
+    position->prev = instr;
+}
+
+/**
+ * Unlink the instruction from its block, `IrInstr.block` is NULL afterwards.
+ */
+void removeInstr(IrInstr *instr)
+{
+    IrBlock *block = instr->block;
+    if (instr->prev != NULL)
+    {
+        instr->prev->next = instr->next;
+    }
+    else
+    {
+        block->first = instr->next;
+    }
+
+    if (instr->next != NULL)
+    {
+        instr->next->prev = instr->prev;
+    }
+    else
+    {
+        block->last = instr->prev;
+    }
+
+    instr->block = NULL;
+    instr->prev = NULL;
+    instr->next = NULL;
+}
+
+void addEdge(IrFunction *function, IrBlock *from, IrBlock *to)
+{
+    from->succs[from->succCount++] = to;
+    if (to->predCount == to->predCapacity)
+    {
+        // blocks are mostly entered from one or two places
+        int capacity = to->predCapacity < 2 ? 2 : to->predCapacity * 2;
+        to->preds = growArray(function->arena, to->preds, sizeof(IrBlock *), to->predCount, capacity);
+        to->predCapacity = capacity;
+    }
+    to->preds[to->predCount++] = from;
+}
+
+/**
+ * Remove the edge from `pred` to `block` from the predecessors of `block` and the operands of its phis.
+ */
+void removePred(IrBlock *block, IrBlock *pred)
+{
+    int index = 0;
+    while (index < block->predCount && block->preds[index] != pred)
+    {
+        index++;
+    }
+    if (index == block->predCount)
+    {
+        return;
+    }
+
+    block->predCount--;
+    memmove(block->preds + index, block->preds + index + 1, sizeof(IrBlock *) * (block->predCount - index));
+    for (IrInstr *phi = block->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+    {
+        if (index < phi->operandCount)
+        {
+            phi->operandCount--;
+            memmove(phi->operands + index, phi->operands + index + 1,
+                    sizeof(IrInstr *) * (phi->operandCount - index));
+        }
+    }
+}
+
+/**
+ * Drop the blocks marked `removed` from the layout, edges to the remaining blocks must be removed before.
+ */
+void removeBlocks(IrFunction *function)
+{
+    int count = 0;
+    for (int i = 0; i < function->blockCount; i++)
+    {
+        if (!function->blocks[i]->removed)
+        {
+            function->blocks[count++] = function->blocks[i];
+        }
+    }
+    function->blockCount = count;
+}
+
+IrInstr *resolveValue(IrInstr *value)
+{
+    while (value->replacement != NULL)
+    {
+        value = value->replacement;
+    }
+    return value;
+}
+
+/**
+ * Point every operand at the value that replaced it.
+ */
+void applyReplacements(IrFunction *function)
+{
+    for (int i = 0; i < function->blockCount; i++)
+    {
+        for (IrInstr *instr = function->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            for (int j = 0; j < instr->operandCount; j++)
+            {
+                instr->operands[j] = resolveValue(instr->operands[j]);
+            }
+        }
+    }
+}
+
+static IrBlock *intersect(IrBlock *a, IrBlock *b)
+{
+    while (a != b)
+    {
+        while (a->order > b->order)
+        {
+            a = a->idom;
+        }
+        while (b->order > a->order)
+        {
+            b = b->idom;
+        }
+    }
+    return a;
+}
+
+/**
+ * Number the reachable blocks in reverse postorder and build their dominator tree, with the algorithm of Cooper,
+ * Harvey and Kennedy, "A Simple, Fast Dominance Algorithm". Unreachable blocks get order `-1`.
+ */
+void computeDominators(IrFunction *function)
+{
+    int count = function->blockCount;
+    IrBlock **postorder = arenaAlloc(function->arena, sizeof(IrBlock *) * count);
+    IrBlock **stack = arenaAlloc(function->arena, sizeof(IrBlock *) * count);
+    int *nextSucc = arenaAlloc(function->arena, sizeof(int) * count);
+    for (int i = 0; i < count; i++)
+    {
+        function->blocks[i]->order = -1;
+        function->blocks[i]->idom = NULL;
+        function->blocks[i]->childCount = 0;
+    }
+
+    int postCount = 0;
+    int depth = 1;
+    stack[0] = function->entry;
+    nextSucc[0] = 0;
+    function->entry->order = -2; // on the stack
+    while (depth > 0)
+    {
+        IrBlock *block = stack[depth - 1];
+        if (nextSucc[depth - 1] < block->succCount)
+        {
+            IrBlock *succ = block->succs[nextSucc[depth - 1]++];
+            if (succ->order == -1)
+            {
+                succ->order = -2;
+                stack[depth] = succ;
+                nextSucc[depth] = 0;
+                depth++;
+            }
+        }
+        else
+        {
+            postorder[postCount++] = block;
+            depth--;
+        }
+    }
+
+    for (int i = 0; i < postCount; i++)
+    {
+        postorder[i]->order = postCount - 1 - i;
+    }
+
+    function->entry->idom = function->entry;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = postCount - 2; i >= 0; i--) // reverse postorder, without the entry
+        {
+            IrBlock *block = postorder[i];
+            IrBlock *idom = NULL;
+            for (int j = 0; j < block->predCount; j++)
+            {
+                IrBlock *pred = block->preds[j];
+                if (pred->order >= 0 && pred->idom != NULL)
+                {
+                    idom = idom == NULL ? pred : intersect(pred, idom);
+                }
+            }
+
+            if (block->idom != idom)
+            {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    function->entry->idom = NULL;
+
+    // children in reverse postorder
+    for (int i = 0; i < postCount - 1; i++)
+    {
+        postorder[i]->idom->childCount++;
+    }
+    for (int i = 0; i < postCount; i++)
+    {
+        postorder[i]->children = arenaAlloc(function->arena, sizeof(IrBlock *) * postorder[i]->childCount);
+        postorder[i]->childCount = 0;
+    }
+    for (int i = postCount - 2; i >= 0; i--)
+    {
+        IrBlock *idom = postorder[i]->idom;
+        idom->children[idom->childCount++] = postorder[i];
+    }
+}
+
+bool isTerminator(IrOp op)
+{
+    return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN;
+}
+
+bool definesValue(IrOp op)
+{
+    switch (op)
+    {
+    case IR_SET_GLOBAL:
+    case IR_SET_UPVALUE:
+    case IR_SET_PROPERTY:
+    case IR_PRINT:
+    case IR_JUMP:
+    case IR_BRANCH:
+    case IR_RETURN:
+        return false;
+    default:
+        return true;
+    }
+}
+
+bool isComparison(IrOp op)
+{
+    return op >= IR_EQUAL && op <= IR_LESS_EQUAL;
+}
+
+/**
+ * @return copy of the first `oldCount` elements of `array` with room for `newCount`, in the arena
+ */
+void *growArray(Arena *arena, void *array, size_t size, int oldCount, int newCount)
+{
+    void *grown = arenaAlloc(arena, size * newCount);
+    if (oldCount > 0)
+    {
+        memcpy(grown, array, size * oldCount);
+    }
+    return grown;
+}
+
+#ifdef DEBUG_PRINT_IR
+static const char *opNames[] = {
+    [IR_CONSTANT] = "const",
+    [IR_PARAMETER] = "param",
+    [IR_PHI] = "phi",
+    [IR_COPY] = "copy",
+    [IR_ADD] = "add",
+    [IR_SUBTRACT] = "sub",
+    [IR_MULTIPLY] = "mul",
+    [IR_DIVIDE] = "div",
+    [IR_EQUAL] = "eq",
+    [IR_NOT_EQUAL] = "ne",
+    [IR_GREATER] = "gt",
+    [IR_GREATER_EQUAL] = "ge",
+    [IR_LESS] = "lt",
+    [IR_LESS_EQUAL] = "le",
+    [IR_NOT] = "not",
+    [IR_NEGATE] = "neg",
+    [IR_GET_GLOBAL] = "getglobal",
+    [IR_SET_GLOBAL] = "setglobal",
+    [IR_GET_UPVALUE] = "getupvalue",
+    [IR_SET_UPVALUE] = "setupvalue",
+    [IR_GET_PROPERTY] = "getprop",
+    [IR_SET_PROPERTY] = "setprop",
+    [IR_CALL] = "call",
+    [IR_INVOKE] = "invoke",
+    [IR_PRINT] = "print",
+    [IR_JUMP] = "jump",
+    [IR_BRANCH] = "branch",
+    [IR_RETURN] = "return",
+};
+
+void printIr(IrFunction *function, const char *name)
+{
+    printf("== %s ir ==\n", name);
+    for (int i = 0; i < function->blockCount; i++)
+    {
+        IrBlock *block = function->blocks[i];
+        printf("b%d", block->id);
+        for (int j = 0; j < block->predCount; j++)
+        {
+            printf("%s b%d", j == 0 ? " <-" : "", block->preds[j]->id);
+        }
+        printf(":\n");
+
+        for (IrInstr *instr = block->first; instr != NULL; instr = instr->next)
+        {
+            printf("%4d ", instr->line);
+            if (definesValue(instr->op))
+            {
+                printf("v%d = ", instr->id);
+            }
+            printf("%s", opNames[instr->op]);
+            if (instr->op == IR_CONSTANT)
+            {
+                printf(" ");
+                printValue(instr->value);
+            }
+            else if (instr->op == IR_PARAMETER || instr->op == IR_GET_UPVALUE || instr->op == IR_SET_UPVALUE)
+            {
+                printf(" %d", instr->index);
+            }
+            else if (instr->op >= IR_GET_GLOBAL && instr->op <= IR_INVOKE && instr->op != IR_CALL)
+            {
+                printf(" ");
+                printValue(function->target->chunk.constants.values[instr->index]);
+            }
+
+            for (int j = 0; j < instr->operandCount; j++)
+            {
+                printf(" v%d", instr->operands[j]->id);
+            }
+            for (int j = 0; j < block->succCount && instr == block->last; j++)
+            {
+                printf(" b%d", block->succs[j]->id);
+            }
+            printf("\n");
+        }
+    }
+}
+#endif
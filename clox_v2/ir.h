@@ -0,0 +1,185 @@
+#ifndef clox_ir_h
+#define clox_ir_h
+
+#include "ast.h"
+#include "object.h"
+
+/**
+ * Mid-level IR in static single assignment form, between the annotated tree and the bytecode.
+ *
+ * @details A function is a control flow graph of basic blocks. Every instruction defines at most one value, which is
+ * the instruction itself, and every value is defined once: locals are not variables any more but the values last
+ * written to them, joined by phis where control flow meets. `buildIr()` builds it straight from the tree in the way of
+ * Braun et al., "Simple and Efficient Construction of Static Single Assignment Form", `optimizeIr()` rewrites it and
+ * `lowerIr()` allocates registers and emits it into the chunk of the function.
+ */
+typedef enum
+{
+    IR_CONSTANT,  // value
+    IR_PARAMETER, // index = register of the parameter, 0 is the callee or `this`
+    IR_PHI,       // one operand per predecessor, in the order of `IrBlock.preds`
+    IR_COPY,      // operand
+    IR_ADD,       // left, right
+    IR_SUBTRACT,
+    IR_MULTIPLY,
+    IR_DIVIDE,
+    IR_EQUAL,
+    IR_NOT_EQUAL,
+    IR_GREATER,
+    IR_GREATER_EQUAL, // `!(a < b)` like `OP_GREATER_EQUAL`
+    IR_LESS,
+    IR_LESS_EQUAL, // `!(a > b)` like `OP_LESS_EQUAL`
+    IR_NOT,        // operand
+    IR_NEGATE,
+    IR_GET_GLOBAL,   // index = constant of the name
+    IR_SET_GLOBAL,   // value, index = constant of the name
+    IR_GET_UPVALUE,  // index = upvalue
+    IR_SET_UPVALUE,  // value, index = upvalue
+    IR_GET_PROPERTY, // object, index = constant of the name
+    IR_SET_PROPERTY, // object, value, index = constant of the name
+    IR_CALL,         // callee, arguments...
+    IR_INVOKE,       // receiver, arguments..., index = constant of the name
+    IR_PRINT,        // value
+    // Terminators, the last instruction of every block
+    IR_JUMP,   // to `succs[0]`
+    IR_BRANCH, // condition, to `succs[0]` when it is truthy, else to `succs[1]`
+    IR_RETURN, // value
+} IrOp;
+
+typedef struct IrBlock IrBlock;
+
+typedef struct IrInstr
+{
+    IrOp op;
+    /**
+     * Dense number of the instruction, for side tables of the passes
+     */
+    int id;
+    int line;
+    /**
+     * `IR_CONSTANT` only, strings are interned in the chunk of the function so the GC keeps them
+     */
+    Value value;
+    int index;
+    struct IrInstr **operands;
+    int operandCount;
+    IrBlock *block;
+    struct IrInstr *prev;
+    struct IrInstr *next;
+    /**
+     * Set when a pass removes the value in favor of another one, see `applyReplacements()`
+     */
+    struct IrInstr *replacement;
+} IrInstr;
+
+/**
+ * A `while` or `for` loop, the blocks it is made of point to it with `IrBlock.loop`.
+ */
+typedef struct IrLoop
+{
+    struct IrLoop *parent;
+    /**
+     * Block that runs once before the first iteration and ends with the jump to the header, where invariants are
+     * hoisted to
+     */
+    IrBlock *preheader;
+    /**
+     * First block of the body, the target of the back edge
+     */
+    IrBlock *header;
+} IrLoop;
+
+struct IrBlock
+{
+    /**
+     * Dense number of the block, for side tables of the passes
+     */
+    int id;
+    /**
+     * Phis first, the terminator last
+     */
+    IrInstr *first;
+    IrInstr *last;
+    IrBlock **preds;
+    int predCount;
+    int predCapacity;
+    IrBlock *succs[2];
+    int succCount;
+    /**
+     * Innermost loop of the block, NULL outside of loops
+     */
+    IrLoop *loop;
+    /**
+     * Immediate dominator, the blocks it immediately dominates and reverse postorder number, set by
+     * `computeDominators()`
+     */
+    IrBlock *idom;
+    IrBlock **children;
+    int childCount;
+    int order;
+    bool removed;
+    /**
+     * While the IR is built: all predecessors are known, and the value of each local slot at the end of the block
+     */
+    bool sealed;
+    IrInstr **defs;
+};
+
+typedef struct
+{
+    Arena *arena;
+    /**
+     * Function that receives the constants and, once lowered, the bytecode
+     */
+    ObjFunction *target;
+    FunctionType type;
+    int arity;
+    int line;
+    IrBlock *entry;
+    /**
+     * Blocks in the order they are laid out in the bytecode
+     */
+    IrBlock **blocks;
+    int blockCount;
+    int blockCapacity;
+    IrLoop **loops;
+    int loopCount;
+    int loopCapacity;
+    int valueCount;
+    int nextBlockId;
+    /**
+     * `nil` standing in for locals read where they were never written, which only happens in unreachable code
+     */
+    IrInstr *undefined;
+} IrFunction;
+
+/**
+ * Functions bigger than this keep the direct code generator, the passes use side tables of values per block.
+ */
+#define IR_MAX_VALUES 8192
+
+IrFunction *buildIr(Arena *arena, Node *function, ObjFunction *target);
+void optimizeIr(IrFunction *function);
+bool lowerIr(IrFunction *function);
+
+IrBlock *newBlock(IrFunction *function);
+IrInstr *newInstr(IrFunction *function, IrOp op, int operandCount, int line);
+void appendInstr(IrBlock *block, IrInstr *instr);
+void insertBefore(IrInstr *position, IrInstr *instr);
+void removeInstr(IrInstr *instr);
+void addEdge(IrFunction *function, IrBlock *from, IrBlock *to);
+void removePred(IrBlock *block, IrBlock *pred);
+void removeBlocks(IrFunction *function);
+IrInstr *resolveValue(IrInstr *value);
+void applyReplacements(IrFunction *function);
+void computeDominators(IrFunction *function);
+bool isTerminator(IrOp op);
+bool definesValue(IrOp op);
+bool isComparison(IrOp op);
+void *growArray(Arena *arena, void *array, size_t size, int oldCount, int newCount);
+
+#ifdef DEBUG_PRINT_IR
+void printIr(IrFunction *function, const char *name);
+#endif
+
+#endif
@@ -0,0 +1,1082 @@
+#include <string.h>
+
+#include "ir.h"
+
+typedef uint64_t Word;
+
+#define WORD_BITS 64
+#define NO_REGISTER -1
+
+/**
+ * One move of a parallel move: a register to register move, or a constant load when `constant` is set
+ */
+typedef struct
+{
+    int dst;
+    int src;
+    IrInstr *constant;
+} Move;
+
+typedef struct
+{
+    Move *moves;
+    int count;
+} MoveList;
+
+/**
+ * Jump to patch once every block is emitted
+ */
+typedef struct
+{
+    int offset;
+    IrBlock *target;
+} PendingJump;
+
+static IrFunction *ir;
+static Chunk *chunk;
+static bool failed;
+
+// Liveness, bitsets of values by block id
+static int words;
+static Word **liveIn;
+static Word **liveOut;
+
+// Register allocation, by value id
+static IrInstr **values;
+static int *useCounts;
+static bool *fused;
+static int *registers;
+static bool **dying;
+static bool *deadAtDef;
+static int *webParent;
+static int *webRegisters;
+static IrInstr **callOf;
+static int *callPositions;
+static int *windows;
+static MoveList *callMoves;
+static IrInstr *regOwner[MAX_REGISTERS];
+static int maxReg;
+
+// Emission, by block id
+static MoveList *phiMoves;
+static IrBlock **forward;
+static int *starts;
+static PendingJump *jumps;
+static int jumpCount;
+
+static void splitCriticalEdges();
+static void insertBlock(IrBlock *block, IrBlock *before);
+static bool rkOperand(IrInstr *instr, int operand);
+static void materializeConstants();
+static void markFusedComparisons();
+static bool needsRegister(IrInstr *value);
+static void computeLiveness();
+static void blockLiveIn(IrBlock *block, Word *live);
+static int findWeb(int id);
+static void scanBlock(IrBlock *block);
+static void allocateBlock(IrBlock *block);
+static void allocateCall(IrInstr *instr);
+static int pickRegister(IrInstr *value);
+static int highestRegister();
+static void assign(IrInstr *value, int reg);
+static void release(IrInstr *value);
+static MoveList sequentialize(Move *moves, int count, int scratch, bool *usedScratch);
+static void resolvePhis();
+static IrBlock *forwardTarget(IrBlock *block);
+static void emitBlocks();
+static void emitInstr(IrInstr *instr, IrBlock *next);
+static void emitMoves(MoveList *list, int line);
+static void emitBranch(IrInstr *instr, IrBlock *next);
+static void emitJumpWhen(IrInstr *condition, bool jumpIfTrue, IrBlock *target, int line);
+static void emitJumpTo(IrBlock *target, int line);
+static int rk(IrInstr *operand);
+static void emit(Instruction instruction, int line);
+
+/**
+ * Allocate registers to the values and emit the bytecode of the function into its chunk.
+ *
+ * @details Registers are allocated on the dominator tree, which is optimal for the live ranges of SSA form: every
+ * value gets a register that is free from its definition to its last use. Arguments of a call are allocated in
+ * place at the top of the registers when their call is the last use; the others, and phis, are moved where they go
+ * right before the call or at the end of the predecessor.
+ *
+ * @return false if the function needs more registers than `MAX_REGISTERS`, or a jump or constant is out of range, the
+ * chunk is left half-written then
+ */
+bool lowerIr(IrFunction *function)
+{
+    ir = function;
+    chunk = &function->target->chunk;
+    failed = false;
+
+    splitCriticalEdges();
+    computeDominators(ir);
+    materializeConstants();
+
+    int count = ir->valueCount;
+    values = arenaAlloc(ir->arena, sizeof(IrInstr *) * count);
+    useCounts = arenaAlloc(ir->arena, sizeof(int) * count);
+    memset(useCounts, 0, sizeof(int) * count);
+    fused = arenaAlloc(ir->arena, sizeof(bool) * count);
+    memset(fused, 0, sizeof(bool) * count);
+    registers = arenaAlloc(ir->arena, sizeof(int) * count);
+    dying = arenaAlloc(ir->arena, sizeof(bool *) * count);
+    deadAtDef = arenaAlloc(ir->arena, sizeof(bool) * count);
+    memset(deadAtDef, 0, sizeof(bool) * count);
+    webParent = arenaAlloc(ir->arena, sizeof(int) * count);
+    webRegisters = arenaAlloc(ir->arena, sizeof(int) * count);
+    callOf = arenaAlloc(ir->arena, sizeof(IrInstr *) * count);
+    callPositions = arenaAlloc(ir->arena, sizeof(int) * count);
+    windows = arenaAlloc(ir->arena, sizeof(int) * count);
+    callMoves = arenaAlloc(ir->arena, sizeof(MoveList) * count);
+    for (int i = 0; i < count; i++)
+    {
+        registers[i] = NO_REGISTER;
+        dying[i] = NULL;
+        webParent[i] = i;
+        webRegisters[i] = NO_REGISTER;
+        callOf[i] = NULL;
+        windows[i] = NO_REGISTER;
+    }
+
+    markFusedComparisons();
+    computeLiveness();
+
+    // phis and their operands form webs that prefer a single register, so the moves between them vanish
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *phi = ir->blocks[i]->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+        {
+            for (int j = 0; j < phi->operandCount; j++)
+            {
+                if (needsRegister(phi->operands[j]))
+                {
+                    webParent[findWeb(phi->operands[j]->id)] = findWeb(phi->id);
+                }
+            }
+        }
+    }
+
+    maxReg = ir->arity;
+    allocateBlock(ir->entry);
+    if (failed)
+    {
+        return false;
+    }
+
+    resolvePhis();
+    emitBlocks();
+    if (maxReg >= MAX_REGISTERS)
+    {
+        return false;
+    }
+
+    ir->target->maxSlots = maxReg + 1;
+    return !failed;
+}
+
+/**
+ * Put a block on every edge from a block with two successors to a block with phis, where the phi moves go.
+ */
+static void splitCriticalEdges()
+{
+    int count = ir->blockCount;
+    IrBlock **blocks = arenaAlloc(ir->arena, sizeof(IrBlock *) * count);
+    memcpy(blocks, ir->blocks, sizeof(IrBlock *) * count);
+    for (int i = 0; i < count; i++)
+    {
+        IrBlock *block = blocks[i];
+        for (int j = 0; j < block->succCount && block->succCount > 1; j++)
+        {
+            IrBlock *target = block->succs[j];
+            if (target->predCount < 2 || target->first == NULL || target->first->op != IR_PHI)
+            {
+                continue;
+            }
+
+            IrBlock *split = newBlock(ir);
+            split->loop = target->loop;
+            appendInstr(split, newInstr(ir, IR_JUMP, 0, block->last->line));
+            split->succs[0] = target;
+            split->succCount = 1;
+            split->preds = arenaAlloc(ir->arena, sizeof(IrBlock *));
+            split->preds[0] = block;
+            split->predCount = 1;
+            split->predCapacity = 1;
+
+            int pred = 0;
+            while (target->preds[pred] != block)
+            {
+                pred++;
+            }
+            target->preds[pred] = split;
+            block->succs[j] = split;
+            insertBlock(split, target);
+        }
+    }
+}
+
+static void insertBlock(IrBlock *block, IrBlock *before)
+{
+    if (ir->blockCount == ir->blockCapacity)
+    {
+        int capacity = ir->blockCapacity * 2;
+        ir->blocks = growArray(ir->arena, ir->blocks, sizeof(IrBlock *), ir->blockCount, capacity);
+        ir->blockCapacity = capacity;
+    }
+
+    int position = 0;
+    while (ir->blocks[position] != before)
+    {
+        position++;
+    }
+    memmove(ir->blocks + position + 1, ir->blocks + position, sizeof(IrBlock *) * (ir->blockCount - position));
+    ir->blocks[position] = block;
+    ir->blockCount++;
+}
+
+/**
+ * @return the operand can be a constant index with `BIT_RK`
+ */
+static bool rkOperand(IrInstr *instr, int operand)
+{
+    return (instr->op >= IR_ADD && instr->op <= IR_LESS_EQUAL) || (instr->op == IR_SET_PROPERTY && operand == 1);
+}
+
+/**
+ * Intern the constants in the chunk and load those that can't be `RK` operands with a copy before their use.
+ */
+static void materializeConstants()
+{
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            for (int j = 0; j < instr->operandCount; j++)
+            {
+                IrInstr *operand = instr->operands[j];
+                if (operand->op != IR_CONSTANT)
+                {
+                    continue;
+                }
+
+                operand->index = internConstant(chunk, operand->value);
+                if (operand->index > MAXARG_BX)
+                {
+                    failed = true;
+                }
+
+                // phi operands are loaded by the phi moves, `return nil` has a form of its own
+                if ((rkOperand(instr, j) && operand->index <= MAX_INDEX_RK) || instr->op == IR_PHI ||
+                    (instr->op == IR_RETURN && IS_NIL(operand->value)))
+                {
+                    continue;
+                }
+
+                IrInstr *copy = newInstr(ir, IR_COPY, 1, instr->line);
+                copy->operands[0] = operand;
+                insertBefore(instr, copy);
+                instr->operands[j] = copy;
+            }
+        }
+    }
+}
+
+/**
+ * A comparison right before the branch that is its only use is emitted as the `OP_TEST_*` of the branch.
+ */
+static void markFusedComparisons()
+{
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            values[instr->id] = instr;
+            for (int j = 0; j < instr->operandCount; j++)
+            {
+                useCounts[instr->operands[j]->id]++;
+            }
+        }
+    }
+
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrInstr *branch = ir->blocks[i]->last;
+        if (branch->op != IR_BRANCH)
+        {
+            continue;
+        }
+
+        IrInstr *condition = branch->operands[0];
+        if (isComparison(condition->op) && condition->next == branch && useCounts[condition->id] == 1)
+        {
+            fused[condition->id] = true;
+        }
+    }
+}
+
+static bool needsRegister(IrInstr *value)
+{
+    return definesValue(value->op) && value->op != IR_CONSTANT && !fused[value->id];
+}
+
+static void computeLiveness()
+{
+    words = (ir->valueCount + WORD_BITS - 1) / WORD_BITS;
+    liveIn = arenaAlloc(ir->arena, sizeof(Word *) * ir->nextBlockId);
+    liveOut = arenaAlloc(ir->arena, sizeof(Word *) * ir->nextBlockId);
+    IrBlock **postorder = arenaAlloc(ir->arena, sizeof(IrBlock *) * ir->blockCount);
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrBlock *block = ir->blocks[i];
+        liveIn[block->id] = arenaAlloc(ir->arena, sizeof(Word) * words);
+        liveOut[block->id] = arenaAlloc(ir->arena, sizeof(Word) * words);
+        memset(liveIn[block->id], 0, sizeof(Word) * words);
+        memset(liveOut[block->id], 0, sizeof(Word) * words);
+        postorder[ir->blockCount - 1 - block->order] = block;
+    }
+
+    Word *live = arenaAlloc(ir->arena, sizeof(Word) * words);
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < ir->blockCount; i++)
+        {
+            IrBlock *block = postorder[i];
+            Word *out = liveOut[block->id];
+            for (int j = 0; j < block->succCount; j++)
+            {
+                IrBlock *succ = block->succs[j];
+                for (int k = 0; k < words; k++)
+                {
+                    out[k] |= liveIn[succ->id][k];
+                }
+
+                int pred = 0;
+                while (succ->preds[pred] != block)
+                {
+                    pred++;
+                }
+                for (IrInstr *phi = succ->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+                {
+                    IrInstr *operand = phi->operands[pred];
+                    if (needsRegister(operand))
+                    {
+                        out[operand->id / WORD_BITS] |= (Word)1 << (operand->id % WORD_BITS);
+                    }
+                }
+            }
+
+            memcpy(live, out, sizeof(Word) * words);
+            blockLiveIn(block, live);
+            if (memcmp(live, liveIn[block->id], sizeof(Word) * words) != 0)
+            {
+                memcpy(liveIn[block->id], live, sizeof(Word) * words);
+                changed = true;
+            }
+        }
+    }
+}
+
+/**
+ * Turn the values live at the end of the block into the ones live at its start, phis excluded.
+ */
+static void blockLiveIn(IrBlock *block, Word *live)
+{
+    for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev)
+    {
+        live[instr->id / WORD_BITS] &= ~((Word)1 << (instr->id % WORD_BITS));
+        if (instr->op == IR_PHI)
+        {
+            continue;
+        }
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            IrInstr *operand = instr->operands[i];
+            if (needsRegister(operand))
+            {
+                live[operand->id / WORD_BITS] |= (Word)1 << (operand->id % WORD_BITS);
+            }
+        }
+    }
+}
+
+static int findWeb(int id)
+{
+    while (webParent[id] != id)
+    {
+        webParent[id] = webParent[webParent[id]];
+        id = webParent[id];
+    }
+    return id;
+}
+
+/**
+ * Walk the block backwards from its live-out values to find the last use of every value, and the arguments that can
+ * be computed right into the registers of their call.
+ */
+static void scanBlock(IrBlock *block)
+{
+    Word *live = arenaAlloc(ir->arena, sizeof(Word) * words);
+    memcpy(live, liveOut[block->id], sizeof(Word) * words);
+    for (IrInstr *instr = block->last; instr != NULL; instr = instr->prev)
+    {
+        int id = instr->id;
+        deadAtDef[id] = needsRegister(instr) && !(live[id / WORD_BITS] & ((Word)1 << (id % WORD_BITS)));
+        live[id / WORD_BITS] &= ~((Word)1 << (id % WORD_BITS));
+        if (instr->op == IR_PHI)
+        {
+            continue;
+        }
+
+        dying[id] = arenaAlloc(ir->arena, sizeof(bool) * (instr->operandCount + 1));
+        for (int i = instr->operandCount - 1; i >= 0; i--)
+        {
+            IrInstr *operand = instr->operands[i];
+            int operandId = operand->id;
+            dying[id][i] = false;
+            if (!needsRegister(operand) || (live[operandId / WORD_BITS] & ((Word)1 << (operandId % WORD_BITS))))
+            {
+                continue;
+            }
+
+            dying[id][i] = true;
+            live[operandId / WORD_BITS] |= (Word)1 << (operandId % WORD_BITS);
+            bool isCall = instr->op == IR_CALL || instr->op == IR_INVOKE;
+            if (isCall && operand->block == block && operand->op != IR_PHI && operand->op != IR_PARAMETER)
+            {
+                callOf[operandId] = instr;
+                callPositions[operandId] = i;
+            }
+        }
+    }
+}
+
+static void allocateBlock(IrBlock *block)
+{
+    memset(regOwner, 0, sizeof(regOwner));
+    Word *in = liveIn[block->id];
+    for (int i = 0; i < words; i++)
+    {
+        for (Word bits = in[i]; bits != 0; bits &= bits - 1)
+        {
+            int id = i * WORD_BITS + __builtin_ctzll(bits);
+            regOwner[registers[id]] = values[id];
+        }
+    }
+
+    scanBlock(block);
+    IrInstr *instr = block->first;
+    for (; instr != NULL && instr->op == IR_PHI; instr = instr->next)
+    {
+        assign(instr, pickRegister(instr));
+    }
+    for (IrInstr *phi = block->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+    {
+        if (deadAtDef[phi->id])
+        {
+            release(phi);
+        }
+    }
+
+    for (; instr != NULL && !failed; instr = instr->next)
+    {
+        if (instr->op == IR_CALL || instr->op == IR_INVOKE)
+        {
+            allocateCall(instr);
+            continue;
+        }
+
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            if (dying[instr->id][i])
+            {
+                release(instr->operands[i]);
+            }
+        }
+        if (needsRegister(instr))
+        {
+            assign(instr, pickRegister(instr));
+            if (deadAtDef[instr->id])
+            {
+                release(instr);
+            }
+        }
+    }
+
+    for (int i = 0; i < block->childCount && !failed; i++)
+    {
+        allocateBlock(block->children[i]);
+    }
+}
+
+/**
+ * Arguments that die at the call were allocated in place, if the registers were free, the others are moved there.
+ */
+static void allocateCall(IrInstr *instr)
+{
+    for (int i = 0; i < instr->operandCount; i++)
+    {
+        if (dying[instr->id][i])
+        {
+            release(instr->operands[i]);
+        }
+    }
+
+    // the callee overwrites every register from the window up, only dead values may be there
+    int window = windows[instr->id] != NO_REGISTER ? windows[instr->id] : 1;
+    int highest = highestRegister();
+    if (highest >= window)
+    {
+        window = highest + 1;
+    }
+    if (window + instr->operandCount > MAX_REGISTERS)
+    {
+        failed = true;
+        return;
+    }
+
+    Move *moves = arenaAlloc(ir->arena, sizeof(Move) * instr->operandCount);
+    int scratch = window + instr->operandCount;
+    for (int i = 0; i < instr->operandCount; i++)
+    {
+        int src = registers[instr->operands[i]->id];
+        moves[i].dst = window + i;
+        moves[i].src = src;
+        moves[i].constant = NULL;
+        scratch = src >= scratch ? src + 1 : scratch;
+    }
+
+    bool usedScratch = false;
+    callMoves[instr->id] = sequentialize(moves, instr->operandCount, scratch, &usedScratch);
+    int top = usedScratch ? scratch : window + instr->operandCount - 1;
+    maxReg = top > maxReg ? top : maxReg;
+    if (maxReg >= MAX_REGISTERS)
+    {
+        failed = true;
+        return;
+    }
+
+    windows[instr->id] = window;
+    assign(instr, window);
+    if (deadAtDef[instr->id])
+    {
+        release(instr);
+    }
+}
+
+/**
+ * Parameters have their own registers. Otherwise the preferred registers are the place of an argument in its call,
+ * then the register of the phi web of the value, then the lowest free one above the callee.
+ */
+static int pickRegister(IrInstr *value)
+{
+    if (value->op == IR_PARAMETER)
+    {
+        return value->index;
+    }
+
+    IrInstr *call = callOf[value->id];
+    if (call != NULL)
+    {
+        if (windows[call->id] == NO_REGISTER)
+        {
+            windows[call->id] = highestRegister() + 1;
+        }
+
+        int reg = windows[call->id] + callPositions[value->id];
+        if (reg < MAX_REGISTERS && regOwner[reg] == NULL)
+        {
+            return reg;
+        }
+    }
+
+    int web = webRegisters[findWeb(value->id)];
+    if (web != NO_REGISTER && regOwner[web] == NULL)
+    {
+        return web;
+    }
+
+    for (int reg = 1; reg < MAX_REGISTERS; reg++)
+    {
+        if (regOwner[reg] == NULL)
+        {
+            return reg;
+        }
+    }
+    return MAX_REGISTERS;
+}
+
+static int highestRegister()
+{
+    for (int reg = MAX_REGISTERS - 1; reg > 0; reg--)
+    {
+        if (regOwner[reg] != NULL)
+        {
+            return reg;
+        }
+    }
+    return 0;
+}
+
+static void assign(IrInstr *value, int reg)
+{
+    if (reg >= MAX_REGISTERS)
+    {
+        failed = true;
+        return;
+    }
+
+    registers[value->id] = reg;
+    regOwner[reg] = value;
+    maxReg = reg > maxReg ? reg : maxReg;
+    int web = findWeb(value->id);
+    if (webRegisters[web] == NO_REGISTER)
+    {
+        webRegisters[web] = reg;
+    }
+}
+
+static void release(IrInstr *value)
+{
+    int reg = registers[value->id];
+    if (reg != NO_REGISTER && regOwner[reg] == value)
+    {
+        regOwner[reg] = NULL;
+    }
+}
+
+/**
+ * Order the moves of a parallel move so that no register is overwritten before it is read, a cycle of moves goes
+ * through the scratch register. Constant loads read no register and come last.
+ */
+static MoveList sequentialize(Move *moves, int count, int scratch, bool *usedScratch)
+{
+    Move *pending = arenaAlloc(ir->arena, sizeof(Move) * (count + 1));
+    Move *sorted = arenaAlloc(ir->arena, sizeof(Move) * (count * 2 + 1));
+    int pendingCount = 0;
+    int sortedCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (moves[i].constant == NULL && moves[i].dst != moves[i].src)
+        {
+            pending[pendingCount++] = moves[i];
+        }
+    }
+
+    while (pendingCount > 0)
+    {
+        int ready = -1;
+        for (int i = 0; i < pendingCount && ready < 0; i++)
+        {
+            ready = i;
+            for (int j = 0; j < pendingCount; j++)
+            {
+                if (j != i && pending[j].src == pending[i].dst)
+                {
+                    ready = -1;
+                    break;
+                }
+            }
+        }
+
+        if (ready >= 0)
+        {
+            sorted[sortedCount++] = pending[ready];
+            pending[ready] = pending[--pendingCount];
+            continue;
+        }
+
+        // every destination is still to be read: save one of them
+        int saved = pending[0].dst;
+        sorted[sortedCount].dst = scratch;
+        sorted[sortedCount].src = saved;
+        sorted[sortedCount].constant = NULL;
+        sortedCount++;
+        *usedScratch = true;
+        for (int i = 0; i < pendingCount; i++)
+        {
+            if (pending[i].src == saved)
+            {
+                pending[i].src = scratch;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (moves[i].constant != NULL)
+        {
+            sorted[sortedCount++] = moves[i];
+        }
+    }
+
+    MoveList list = {sorted, sortedCount};
+    return list;
+}
+
+/**
+ * Compute the moves at the end of each predecessor of a block with phis, there is a single successor after
+ * `splitCriticalEdges()`.
+ */
+static void resolvePhis()
+{
+    phiMoves = arenaAlloc(ir->arena, sizeof(MoveList) * ir->nextBlockId);
+    memset(phiMoves, 0, sizeof(MoveList) * ir->nextBlockId);
+    int scratch = maxReg + 1;
+    bool usedScratch = false;
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrBlock *block = ir->blocks[i];
+        IrBlock *succ = block->succs[0];
+        if (block->succCount != 1 || succ->first == NULL || succ->first->op != IR_PHI)
+        {
+            continue;
+        }
+
+        int pred = 0;
+        while (succ->preds[pred] != block)
+        {
+            pred++;
+        }
+
+        int count = 0;
+        for (IrInstr *phi = succ->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+        {
+            count++;
+        }
+        Move *moves = arenaAlloc(ir->arena, sizeof(Move) * count);
+        count = 0;
+        for (IrInstr *phi = succ->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+        {
+            if (deadAtDef[phi->id])
+            {
+                continue;
+            }
+
+            IrInstr *operand = phi->operands[pred];
+            moves[count].dst = registers[phi->id];
+            moves[count].src = operand->op == IR_CONSTANT ? NO_REGISTER : registers[operand->id];
+            moves[count].constant = operand->op == IR_CONSTANT ? operand : NULL;
+            count++;
+        }
+        phiMoves[block->id] = sequentialize(moves, count, scratch, &usedScratch);
+    }
+
+    if (usedScratch)
+    {
+        maxReg = scratch;
+    }
+}
+
+static IrBlock *forwardTarget(IrBlock *block)
+{
+    while (forward[block->id] != block)
+    {
+        block = forward[block->id];
+    }
+    return block;
+}
+
+/**
+ * Emit the blocks in layout order. A block that only jumps is skipped, jumps to it go where it jumps to, and a jump
+ * to the block right after is left out.
+ */
+static void emitBlocks()
+{
+    forward = arenaAlloc(ir->arena, sizeof(IrBlock *) * ir->nextBlockId);
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrBlock *block = ir->blocks[i];
+        IrInstr *instr = block->first;
+        while (instr->op == IR_PHI)
+        {
+            instr = instr->next;
+        }
+
+        bool empty = instr->op == IR_JUMP && phiMoves[block->id].count == 0 && block != ir->entry;
+        forward[block->id] = empty ? block->succs[0] : block;
+    }
+
+    // a loop of empty blocks is an infinite loop, one of them stays to jump to itself
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrBlock *block = ir->blocks[i];
+        IrBlock *target = block;
+        for (int steps = 0; forward[target->id] != target; steps++)
+        {
+            if (steps > ir->blockCount)
+            {
+                forward[block->id] = block;
+                break;
+            }
+            target = forward[target->id];
+        }
+    }
+
+    IrBlock **emitted = arenaAlloc(ir->arena, sizeof(IrBlock *) * ir->blockCount);
+    int emittedCount = 0;
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        if (forward[ir->blocks[i]->id] == ir->blocks[i])
+        {
+            emitted[emittedCount++] = ir->blocks[i];
+        }
+    }
+
+    starts = arenaAlloc(ir->arena, sizeof(int) * ir->nextBlockId);
+    jumps = arenaAlloc(ir->arena, sizeof(PendingJump) * ir->blockCount * 2);
+    jumpCount = 0;
+    for (int i = 0; i < emittedCount; i++)
+    {
+        IrBlock *next = i + 1 < emittedCount ? emitted[i + 1] : NULL;
+        starts[emitted[i]->id] = chunk->count;
+        for (IrInstr *instr = emitted[i]->first; instr != NULL; instr = instr->next)
+        {
+            emitInstr(instr, next);
+        }
+    }
+
+    for (int i = 0; i < jumpCount; i++)
+    {
+        int offset = starts[forwardTarget(jumps[i].target)->id] - (jumps[i].offset + 1);
+        if (offset > MAXARG_SBX || offset < -MAXARG_SBX)
+        {
+            failed = true;
+            return;
+        }
+        SET_SBX(chunk->code[jumps[i].offset], offset);
+    }
+}
+
+static void emitInstr(IrInstr *instr, IrBlock *next)
+{
+    static const OpCode opCodes[] = {
+        [IR_ADD] = OP_ADD,
+        [IR_SUBTRACT] = OP_SUBTRACT,
+        [IR_MULTIPLY] = OP_MULTIPLY,
+        [IR_DIVIDE] = OP_DIVIDE,
+        [IR_EQUAL] = OP_EQUAL,
+        [IR_NOT_EQUAL] = OP_NOT_EQUAL,
+        [IR_GREATER] = OP_GREATER,
+        [IR_GREATER_EQUAL] = OP_GREATER_EQUAL,
+        [IR_LESS] = OP_LESS,
+        [IR_LESS_EQUAL] = OP_LESS_EQUAL,
+        [IR_NOT] = OP_NOT,
+        [IR_NEGATE] = OP_NEGATE,
+    };
+
+    int line = instr->line;
+    int reg = registers[instr->id];
+    IrInstr **operands = instr->operands;
+    switch (instr->op)
+    {
+    case IR_CONSTANT:
+    case IR_PARAMETER:
+    case IR_PHI:
+    {
+        break;
+    }
+    case IR_COPY:
+    {
+        if (operands[0]->op == IR_CONSTANT)
+        {
+            Move load = {reg, NO_REGISTER, operands[0]};
+            MoveList list = {&load, 1};
+            emitMoves(&list, line);
+        }
+        else if (registers[operands[0]->id] != reg)
+        {
+            emit(CREATE_ABC(OP_MOVE, reg, registers[operands[0]->id], 0), line);
+        }
+        break;
+    }
+    case IR_NOT:
+    case IR_NEGATE:
+    {
+        emit(CREATE_ABC(opCodes[instr->op], reg, registers[operands[0]->id], 0), line);
+        break;
+    }
+    case IR_GET_GLOBAL:
+    {
+        emit(CREATE_ABX(OP_GET_GLOBAL, reg, instr->index), line);
+        break;
+    }
+    case IR_SET_GLOBAL:
+    {
+        emit(CREATE_ABX(OP_SET_GLOBAL, registers[operands[0]->id], instr->index), line);
+        break;
+    }
+    case IR_GET_UPVALUE:
+    {
+        emit(CREATE_ABC(OP_GET_UPVALUE, reg, instr->index, 0), line);
+        break;
+    }
+    case IR_SET_UPVALUE:
+    {
+        emit(CREATE_ABC(OP_SET_UPVALUE, registers[operands[0]->id], instr->index, 0), line);
+        break;
+    }
+    case IR_GET_PROPERTY:
+    {
+        emit(CREATE_ABC(OP_GET_PROPERTY, reg, registers[operands[0]->id], instr->index), line);
+        break;
+    }
+    case IR_SET_PROPERTY:
+    {
+        emit(CREATE_ABC(OP_SET_PROPERTY, registers[operands[0]->id], instr->index, rk(operands[1])), line);
+        break;
+    }
+    case IR_CALL:
+    {
+        emitMoves(&callMoves[instr->id], line);
+        emit(CREATE_ABC(OP_CALL, windows[instr->id], instr->operandCount - 1, 0), line);
+        break;
+    }
+    case IR_INVOKE:
+    {
+        emitMoves(&callMoves[instr->id], line);
+        emit(CREATE_ABC(OP_INVOKE, windows[instr->id], instr->index, instr->operandCount - 1), line);
+        break;
+    }
+    case IR_PRINT:
+    {
+        emit(CREATE_ABC(OP_PRINT, registers[operands[0]->id], 0, 0), line);
+        break;
+    }
+    case IR_JUMP:
+    {
+        emitMoves(&phiMoves[instr->block->id], line);
+        IrBlock *target = forwardTarget(instr->block->succs[0]);
+        if (target != next)
+        {
+            emitJumpTo(target, line);
+        }
+        break;
+    }
+    case IR_BRANCH:
+    {
+        emitBranch(instr, next);
+        break;
+    }
+    case IR_RETURN:
+    {
+        if (operands[0]->op == IR_CONSTANT) // `nil`, other constants are loaded
+        {
+            emit(CREATE_ABC(OP_RETURN, 0, 1, 0), line);
+        }
+        else
+        {
+            emit(CREATE_ABC(OP_RETURN, registers[operands[0]->id], 0, 0), line);
+        }
+        break;
+    }
+    default:
+    {
+        if (!fused[instr->id])
+        {
+            emit(CREATE_ABC(opCodes[instr->op], reg, rk(operands[0]), rk(operands[1])), line);
+        }
+        break;
+    }
+    }
+}
+
+static void emitMoves(MoveList *list, int line)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        Move *move = &list->moves[i];
+        if (move->constant == NULL)
+        {
+            emit(CREATE_ABC(OP_MOVE, move->dst, move->src, 0), line);
+        }
+        else if (IS_NIL(move->constant->value))
+        {
+            emit(CREATE_ABC(OP_LOADNIL, move->dst, 0, 0), line);
+        }
+        else if (IS_BOOL(move->constant->value))
+        {
+            emit(CREATE_ABC(OP_LOADBOOL, move->dst, AS_BOOL(move->constant->value), 0), line);
+        }
+        else
+        {
+            emit(CREATE_ABX(OP_LOADK, move->dst, move->constant->index), line);
+        }
+    }
+}
+
+/**
+ * Jump to the successor that isn't laid out next, or to both.
+ */
+static void emitBranch(IrInstr *instr, IrBlock *next)
+{
+    IrInstr *condition = instr->operands[0];
+    IrBlock *ifTrue = forwardTarget(instr->block->succs[0]);
+    IrBlock *ifFalse = forwardTarget(instr->block->succs[1]);
+    if (ifFalse == next)
+    {
+        emitJumpWhen(condition, true, ifTrue, instr->line);
+    }
+    else if (ifTrue == next)
+    {
+        emitJumpWhen(condition, false, ifFalse, instr->line);
+    }
+    else
+    {
+        emitJumpWhen(condition, true, ifTrue, instr->line);
+        emitJumpTo(ifFalse, instr->line);
+    }
+}
+
+static void emitJumpWhen(IrInstr *condition, bool jumpIfTrue, IrBlock *target, int line)
+{
+    if (!fused[condition->id])
+    {
+        jumps[jumpCount].offset = chunk->count;
+        jumps[jumpCount++].target = target;
+        emit(CREATE_ASBX(jumpIfTrue ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, registers[condition->id], 0), line);
+        return;
+    }
+
+    // `!=`, `>=` and `<=` are the negations of the tests
+    OpCode test;
+    bool negated = condition->op == IR_NOT_EQUAL || condition->op == IR_GREATER_EQUAL ||
+                   condition->op == IR_LESS_EQUAL;
+    switch (condition->op)
+    {
+    case IR_EQUAL:
+    case IR_NOT_EQUAL:
+        test = OP_TEST_EQUAL;
+        break;
+    case IR_LESS:
+    case IR_GREATER_EQUAL:
+        test = OP_TEST_LESS;
+        break;
+    default:
+        test = OP_TEST_GREATER;
+        break;
+    }
+
+    IrInstr **operands = condition->operands;
+    emit(CREATE_ABC(test, jumpIfTrue != negated, rk(operands[0]), rk(operands[1])), line);
+    emitJumpTo(target, line);
+}
+
+static void emitJumpTo(IrBlock *target, int line)
+{
+    jumps[jumpCount].offset = chunk->count;
+    jumps[jumpCount++].target = target;
+    emit(CREATE_ASBX(OP_JUMP, 0, 0), line);
+}
+
+static int rk(IrInstr *operand)
+{
+    return operand->op == IR_CONSTANT ? RK_K(operand->index) : registers[operand->id];
+}
+
+static void emit(Instruction instruction, int line)
+{
+    writeChunk(chunk, instruction, line);
+}
@@ -0,0 +1,73 @@
+#ifndef clox_memory_h
+#define clox_memory_h
+
+#include "common.h"
+#include "object.h"
+
+/** Minimum threshold of array capacity*/
+#define ARRAY_COUNT_MINIMUM_THRESHOLD 8
+/** Scale factor of array capacity */
+#define ARRAY_COUNT_SCALE_FACTOR 2
+
+/**
+ * Allocate on the heap
+ */
+#define ALLOCATE(type, count) \
+    (type *)reallocate(NULL, 0, sizeof(type) * (count))
+
+/**
+ * Calculate new capacity for dynamic arrays based on a given current capacity.
+ */
+#define GROW_CAPACITY(capacity)                 \
+    ((capacity) < ARRAY_COUNT_MINIMUM_THRESHOLD \
+         ? ARRAY_COUNT_MINIMUM_THRESHOLD        \
+         : (capacity) * ARRAY_COUNT_SCALE_FACTOR)
+
+/**
+ * Re-allocate new memory region for dynamic arrays
+ *
+ * @param type type of array's element
+ * @param pointer pointer of array
+ * @param oldCount array's old capacity
+ * @param newCount array's new capacity
+ */
+#define GROW_ARRAY(type, pointer, oldCount, newCount)      \
+    (type *)reallocate(pointer, sizeof(type) * (oldCount), \
+                       sizeof(type) * (newCount))
+/**
+ * Free dynamic arrays
+ *
+ * @param type type of array's element
+ * @param pointer pointer of array
+ * @param oldCount array's current capacity
+ */
+#define FREE_ARRAY(type, pointer, oldCount) \
+    (type *)reallocate(pointer, sizeof(type) * (oldCount), 0)
+
+/**
+ * Free
+ *
+ * @param type type of pointer
+ * @param pointer pointer
+ */
+#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+
+/**
+ * Dynamic memory allocation
+ *
+ * @details The two size arguments control which operation to perform:
+ *
+ * oldSize   | newSize     | Operation
+ * --------- | ----------- | --------------------------------------
+ * 0         | Non-zero    | Allocate new block.
+ * Non-zero  | 0           | Free allocation.
+ * Non-zero  | < oldSize   | Shrink existing allocation.
+ * Non-zero  | > oldSize   | Grow existing allocation.
+ */
+void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+void markObject(Obj *object);
+void markValue(Value value);
+void collectGarbage();
+void freeObjects();
+
+#endif
\ No newline at end of file
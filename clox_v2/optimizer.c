@@ -0,0 +1,936 @@
+#include <string.h>
+
+#include "ir.h"
+
+/**
+ * Lattice of sparse conditional constant propagation: a value is not known to run yet, is the same constant every
+ * time it runs, or varies.
+ */
+typedef enum
+{
+    LATTICE_UNDEFINED,
+    LATTICE_CONSTANT,
+    LATTICE_VARYING,
+} LatticeKind;
+
+typedef struct
+{
+    LatticeKind kind;
+    Value value;
+} Lattice;
+
+/**
+ * Load of a global or upvalue available in the block being scanned by `commonSubexpressions()`
+ */
+typedef struct
+{
+    IrOp op;
+    int index;
+    IrInstr *value;
+} AvailableLoad;
+
+#define MAX_AVAILABLE_LOADS 32
+
+static IrFunction *ir;
+
+// Sparse conditional constant propagation
+static Lattice *lattice;
+static bool *blockExecutable;
+static bool *edgeExecutable; // by `IrBlock.id * 2 + ` successor
+static IrInstr ***uses;
+static int *useCounts;
+static IrBlock **blockWork;
+static int blockWorkCount;
+static IrInstr **valueWork;
+static int valueWorkCount;
+
+// Common subexpressions
+static IrInstr **table;
+static int tableMask;
+static int *tableLog;
+static int tableLogCount;
+
+/**
+ * The value always is a number, once it ran
+ */
+static bool *numeric;
+
+static void propagateConstants();
+static void visit(IrInstr *instr);
+static void markEdge(IrBlock *block, int succ);
+static Lattice evaluate(IrInstr *instr);
+static bool fold(IrOp op, Value *operands, Value *result);
+static bool sameValue(Value a, Value b);
+static bool falsey(Value value);
+static void rewriteConstants();
+static void propagateCopies();
+static void commonSubexpressions();
+static void eliminateInDominated(IrBlock *block);
+static bool sameExpression(IrInstr *a, IrInstr *b);
+static uint32_t hashExpression(IrInstr *instr);
+static bool forwardLoad(IrInstr *instr, AvailableLoad *loads, int *loadCount);
+static void inferNumbers();
+static bool isPure(IrInstr *instr);
+static void hoistInvariants();
+static bool hasEffect(IrInstr *instr);
+static bool inLoop(IrBlock *block, IrLoop *loop);
+static void eliminateDeadCode();
+
+/**
+ * Run the passes, each one leaves the IR in SSA form with its dead blocks removed:
+ *
+ * 1. sparse conditional constant propagation, of Wegman and Zadeck, "Constant Propagation with Conditional
+ *    Branches", folds constant arithmetic and branches and drops the blocks that can't run
+ * 2. copy propagation replaces copies and phis whose operands are all the same value by that value
+ * 3. common subexpression elimination replaces an expression by the same one in a dominating block, and loads of
+ *    globals and upvalues by the previous load or store in the block
+ * 4. loop-invariant code motion moves arithmetic whose operands are defined outside the loop to the preheader of
+ *    the loop
+ * 5. dead code elimination removes the values nothing uses, unless running them may fail
+ */
+void optimizeIr(IrFunction *function)
+{
+    ir = function;
+    propagateConstants();
+    propagateCopies();
+    computeDominators(ir);
+    commonSubexpressions();
+    propagateCopies();
+    inferNumbers();
+    hoistInvariants();
+    eliminateDeadCode();
+}
+
+static void propagateConstants()
+{
+    lattice = arenaAlloc(ir->arena, sizeof(Lattice) * ir->valueCount);
+    for (int i = 0; i < ir->valueCount; i++)
+    {
+        lattice[i].kind = LATTICE_UNDEFINED;
+    }
+    blockExecutable = arenaAlloc(ir->arena, sizeof(bool) * ir->nextBlockId);
+    memset(blockExecutable, 0, sizeof(bool) * ir->nextBlockId);
+    edgeExecutable = arenaAlloc(ir->arena, sizeof(bool) * ir->nextBlockId * 2);
+    memset(edgeExecutable, 0, sizeof(bool) * ir->nextBlockId * 2);
+
+    // def-use chains
+    useCounts = arenaAlloc(ir->arena, sizeof(int) * ir->valueCount);
+    memset(useCounts, 0, sizeof(int) * ir->valueCount);
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            for (int j = 0; j < instr->operandCount; j++)
+            {
+                useCounts[instr->operands[j]->id]++;
+            }
+        }
+    }
+    uses = arenaAlloc(ir->arena, sizeof(IrInstr **) * ir->valueCount);
+    for (int i = 0; i < ir->valueCount; i++)
+    {
+        uses[i] = useCounts[i] > 0 ? arenaAlloc(ir->arena, sizeof(IrInstr *) * useCounts[i]) : NULL;
+        useCounts[i] = 0;
+    }
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            for (int j = 0; j < instr->operandCount; j++)
+            {
+                int id = instr->operands[j]->id;
+                uses[id][useCounts[id]++] = instr;
+            }
+        }
+    }
+
+    // a block is queued once, a value each time it moves up the lattice
+    blockWork = arenaAlloc(ir->arena, sizeof(IrBlock *) * ir->blockCount);
+    valueWork = arenaAlloc(ir->arena, sizeof(IrInstr *) * ir->valueCount * 2);
+    blockWorkCount = 0;
+    valueWorkCount = 0;
+    blockExecutable[ir->entry->id] = true;
+    blockWork[blockWorkCount++] = ir->entry;
+    while (blockWorkCount > 0 || valueWorkCount > 0)
+    {
+        while (blockWorkCount > 0)
+        {
+            IrBlock *block = blockWork[--blockWorkCount];
+            for (IrInstr *instr = block->first; instr != NULL; instr = instr->next)
+            {
+                visit(instr);
+            }
+        }
+
+        while (valueWorkCount > 0)
+        {
+            IrInstr *value = valueWork[--valueWorkCount];
+            for (int i = 0; i < useCounts[value->id]; i++)
+            {
+                IrInstr *use = uses[value->id][i];
+                if (blockExecutable[use->block->id])
+                {
+                    visit(use);
+                }
+            }
+        }
+    }
+
+    rewriteConstants();
+}
+
+static void visit(IrInstr *instr)
+{
+    IrBlock *block = instr->block;
+    switch (instr->op)
+    {
+    case IR_JUMP:
+    {
+        markEdge(block, 0);
+        return;
+    }
+    case IR_BRANCH:
+    {
+        Lattice condition = lattice[instr->operands[0]->id];
+        if (condition.kind == LATTICE_CONSTANT)
+        {
+            markEdge(block, falsey(condition.value) ? 1 : 0);
+        }
+        else if (condition.kind == LATTICE_VARYING)
+        {
+            markEdge(block, 0);
+            markEdge(block, 1);
+        }
+        return;
+    }
+    default:
+    {
+        if (!definesValue(instr->op))
+        {
+            return;
+        }
+        break;
+    }
+    }
+
+    Lattice old = lattice[instr->id];
+    Lattice result = evaluate(instr);
+    if (old.kind == LATTICE_VARYING || result.kind == LATTICE_UNDEFINED)
+    {
+        return;
+    }
+    if (old.kind == LATTICE_CONSTANT)
+    {
+        if (result.kind == LATTICE_CONSTANT && sameValue(old.value, result.value))
+        {
+            return;
+        }
+        result.kind = LATTICE_VARYING;
+    }
+
+    lattice[instr->id] = result;
+    valueWork[valueWorkCount++] = instr;
+}
+
+static void markEdge(IrBlock *block, int succ)
+{
+    if (edgeExecutable[block->id * 2 + succ])
+    {
+        return;
+    }
+    edgeExecutable[block->id * 2 + succ] = true;
+
+    IrBlock *target = block->succs[succ];
+    if (!blockExecutable[target->id])
+    {
+        blockExecutable[target->id] = true;
+        blockWork[blockWorkCount++] = target;
+    }
+    else
+    {
+        // the phis meet one more operand
+        for (IrInstr *phi = target->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+        {
+            visit(phi);
+        }
+    }
+}
+
+static Lattice evaluate(IrInstr *instr)
+{
+    Lattice result = {LATTICE_UNDEFINED, NIL_VAL};
+    switch (instr->op)
+    {
+    case IR_CONSTANT:
+    {
+        result.kind = LATTICE_CONSTANT;
+        result.value = instr->value;
+        return result;
+    }
+    case IR_PHI:
+    {
+        IrBlock *block = instr->block;
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            IrBlock *pred = block->preds[i];
+            bool executable = false;
+            for (int j = 0; j < pred->succCount; j++)
+            {
+                executable = executable || (pred->succs[j] == block && edgeExecutable[pred->id * 2 + j]);
+            }
+
+            Lattice operand = lattice[instr->operands[i]->id];
+            if (!executable || operand.kind == LATTICE_UNDEFINED)
+            {
+                continue;
+            }
+            if (operand.kind == LATTICE_VARYING ||
+                (result.kind == LATTICE_CONSTANT && !sameValue(result.value, operand.value)))
+            {
+                result.kind = LATTICE_VARYING;
+                return result;
+            }
+            result = operand;
+        }
+        return result;
+    }
+    case IR_COPY:
+    {
+        return lattice[instr->operands[0]->id];
+    }
+    case IR_ADD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE:
+    case IR_EQUAL:
+    case IR_NOT_EQUAL:
+    case IR_GREATER:
+    case IR_GREATER_EQUAL:
+    case IR_LESS:
+    case IR_LESS_EQUAL:
+    case IR_NOT:
+    case IR_NEGATE:
+    {
+        Value operands[2];
+        bool undefined = false;
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            Lattice operand = lattice[instr->operands[i]->id];
+            if (operand.kind == LATTICE_VARYING)
+            {
+                result.kind = LATTICE_VARYING;
+                return result;
+            }
+            undefined = undefined || operand.kind == LATTICE_UNDEFINED;
+            operands[i] = operand.value;
+        }
+        if (undefined)
+        {
+            return result;
+        }
+
+        result.kind = fold(instr->op, operands, &result.value) ? LATTICE_CONSTANT : LATTICE_VARYING;
+        return result;
+    }
+    default:
+    {
+        result.kind = LATTICE_VARYING;
+        return result;
+    }
+    }
+}
+
+/**
+ * Compute the operation on constants like the VM does, unless it would fail or allocate.
+ */
+static bool fold(IrOp op, Value *operands, Value *result)
+{
+    Value a = operands[0];
+    Value b = operands[1];
+    switch (op)
+    {
+    case IR_EQUAL:
+    {
+        *result = BOOL_VAL(valuesEqual(a, b));
+        return true;
+    }
+    case IR_NOT_EQUAL:
+    {
+        *result = BOOL_VAL(!valuesEqual(a, b));
+        return true;
+    }
+    case IR_NOT:
+    {
+        *result = BOOL_VAL(falsey(a));
+        return true;
+    }
+    case IR_NEGATE:
+    {
+        if (!IS_NUMBER(a))
+        {
+            return false;
+        }
+        *result = NUMBER_VAL(-AS_NUMBER(a));
+        return true;
+    }
+    default:
+    {
+        break;
+    }
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b))
+    {
+        return false;
+    }
+
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (op)
+    {
+    case IR_ADD:
+        *result = NUMBER_VAL(x + y);
+        break;
+    case IR_SUBTRACT:
+        *result = NUMBER_VAL(x - y);
+        break;
+    case IR_MULTIPLY:
+        *result = NUMBER_VAL(x * y);
+        break;
+    case IR_DIVIDE:
+        *result = NUMBER_VAL(x / y);
+        break;
+    case IR_GREATER:
+        *result = BOOL_VAL(x > y);
+        break;
+    case IR_GREATER_EQUAL:
+        *result = BOOL_VAL(!(x < y));
+        break;
+    case IR_LESS:
+        *result = BOOL_VAL(x < y);
+        break;
+    default:
+        *result = BOOL_VAL(!(x > y));
+        break;
+    }
+    return true;
+}
+
+/**
+ * Unlike `valuesEqual()`, `0` and `-0` are different constants.
+ */
+static bool sameValue(Value a, Value b)
+{
+    if (IS_NUMBER(a) && IS_NUMBER(b))
+    {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    return IS_NUMBER(a) == IS_NUMBER(b) && valuesEqual(a, b);
+}
+
+static bool falsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * Replace the values found constant by constants, constant branches by jumps, and drop the blocks that can't run.
+ */
+static void rewriteConstants()
+{
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrBlock *block = ir->blocks[i];
+        if (!blockExecutable[block->id])
+        {
+            continue;
+        }
+
+        IrInstr *next;
+        for (IrInstr *instr = block->first; instr != NULL; instr = next)
+        {
+            next = instr->next;
+            Lattice value = lattice[instr->id];
+            if (instr->op == IR_BRANCH && lattice[instr->operands[0]->id].kind == LATTICE_CONSTANT)
+            {
+                int taken = falsey(lattice[instr->operands[0]->id].value) ? 1 : 0;
+                removePred(block->succs[1 - taken], block);
+                block->succs[0] = block->succs[taken];
+                block->succCount = 1;
+                instr->op = IR_JUMP;
+                instr->operandCount = 0;
+            }
+            else if (instr->op == IR_PHI && value.kind == LATTICE_CONSTANT)
+            {
+                // phis stay first, the constant goes after them
+                IrInstr *constant = newInstr(ir, IR_CONSTANT, 0, instr->line);
+                constant->value = value.value;
+                IrInstr *position = instr;
+                while (position->op == IR_PHI)
+                {
+                    position = position->next;
+                }
+                insertBefore(position, constant);
+                instr->replacement = constant;
+                removeInstr(instr);
+            }
+            else if (instr->op != IR_CONSTANT && value.kind == LATTICE_CONSTANT)
+            {
+                instr->op = IR_CONSTANT;
+                instr->value = value.value;
+                instr->operandCount = 0;
+            }
+        }
+    }
+
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrBlock *block = ir->blocks[i];
+        if (blockExecutable[block->id])
+        {
+            continue;
+        }
+
+        block->removed = true;
+        for (int j = 0; j < block->succCount; j++)
+        {
+            if (blockExecutable[block->succs[j]->id])
+            {
+                removePred(block->succs[j], block);
+            }
+        }
+    }
+    removeBlocks(ir);
+    applyReplacements(ir);
+}
+
+/**
+ * Replace copies by what they copy, and phis that merge a single value, besides themselves, by that value.
+ */
+static void propagateCopies()
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < ir->blockCount; i++)
+        {
+            IrInstr *next;
+            for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = next)
+            {
+                next = instr->next;
+                if (instr->op == IR_COPY)
+                {
+                    instr->replacement = resolveValue(instr->operands[0]);
+                }
+                else if (instr->op == IR_PHI)
+                {
+                    IrInstr *same = NULL;
+                    bool trivial = true;
+                    for (int j = 0; j < instr->operandCount && trivial; j++)
+                    {
+                        IrInstr *operand = resolveValue(instr->operands[j]);
+                        if (operand != instr && operand != same)
+                        {
+                            trivial = same == NULL;
+                            same = operand;
+                        }
+                    }
+                    if (!trivial)
+                    {
+                        continue;
+                    }
+                    instr->replacement = same != NULL ? same : ir->undefined;
+                }
+                else
+                {
+                    continue;
+                }
+
+                removeInstr(instr);
+                changed = true;
+            }
+        }
+        applyReplacements(ir);
+    }
+}
+
+/**
+ * Walk the dominator tree with a scoped hash table of the expressions computed by the dominators of the block.
+ */
+static void commonSubexpressions()
+{
+    int size = 16;
+    while (size < ir->valueCount * 2)
+    {
+        size *= 2;
+    }
+    table = arenaAlloc(ir->arena, sizeof(IrInstr *) * size);
+    memset(table, 0, sizeof(IrInstr *) * size);
+    tableMask = size - 1;
+    tableLog = arenaAlloc(ir->arena, sizeof(int) * ir->valueCount);
+    tableLogCount = 0;
+
+    eliminateInDominated(ir->entry);
+    applyReplacements(ir);
+}
+
+static void eliminateInDominated(IrBlock *block)
+{
+    int scope = tableLogCount;
+    AvailableLoad loads[MAX_AVAILABLE_LOADS];
+    int loadCount = 0;
+
+    IrInstr *next;
+    for (IrInstr *instr = block->first; instr != NULL; instr = next)
+    {
+        next = instr->next;
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            instr->operands[i] = resolveValue(instr->operands[i]);
+        }
+
+        if (instr->op < IR_ADD || instr->op > IR_NEGATE)
+        {
+            if (forwardLoad(instr, loads, &loadCount))
+            {
+                removeInstr(instr);
+            }
+            continue;
+        }
+
+        // removed slots are the last ones added, so probe sequences never have holes
+        int slot = hashExpression(instr) & tableMask;
+        while (table[slot] != NULL && !sameExpression(table[slot], instr))
+        {
+            slot = (slot + 1) & tableMask;
+        }
+
+        if (table[slot] != NULL)
+        {
+            instr->replacement = table[slot];
+            removeInstr(instr);
+        }
+        else
+        {
+            table[slot] = instr;
+            tableLog[tableLogCount++] = slot;
+        }
+    }
+
+    for (int i = 0; i < block->childCount; i++)
+    {
+        eliminateInDominated(block->children[i]);
+    }
+
+    while (tableLogCount > scope)
+    {
+        table[tableLog[--tableLogCount]] = NULL;
+    }
+}
+
+static bool sameExpression(IrInstr *a, IrInstr *b)
+{
+    if (a->op != b->op)
+    {
+        return false;
+    }
+    if (a->operandCount == 1)
+    {
+        return a->operands[0] == b->operands[0];
+    }
+    if (a->operands[0] == b->operands[0] && a->operands[1] == b->operands[1])
+    {
+        return true;
+    }
+    bool commutative = a->op == IR_EQUAL || a->op == IR_NOT_EQUAL || a->op == IR_MULTIPLY;
+    return commutative && a->operands[0] == b->operands[1] && a->operands[1] == b->operands[0];
+}
+
+static uint32_t hashExpression(IrInstr *instr)
+{
+    uint32_t hash = (uint32_t)instr->op * 2654435761u;
+    for (int i = 0; i < instr->operandCount; i++)
+    {
+        hash += (uint32_t)instr->operands[i]->id * 2246822519u; // sum, so commutative operands hash alike
+    }
+    return hash ^ (hash >> 15);
+}
+
+/**
+ * @return the load can be replaced by the value a previous load or store of the block left in the variable
+ */
+static bool forwardLoad(IrInstr *instr, AvailableLoad *loads, int *loadCount)
+{
+    IrOp load;
+    switch (instr->op)
+    {
+    case IR_GET_GLOBAL:
+    case IR_SET_GLOBAL:
+        load = IR_GET_GLOBAL;
+        break;
+    case IR_GET_UPVALUE:
+    case IR_SET_UPVALUE:
+        load = IR_GET_UPVALUE;
+        break;
+    case IR_CALL:
+    case IR_INVOKE:
+        *loadCount = 0; // the callee may store anything
+        return false;
+    default:
+        return false;
+    }
+
+    int found = 0;
+    while (found < *loadCount && (loads[found].op != load || loads[found].index != instr->index))
+    {
+        found++;
+    }
+
+    if (instr->op == load && found < *loadCount)
+    {
+        instr->replacement = loads[found].value;
+        return true;
+    }
+
+    if (found == *loadCount)
+    {
+        if (*loadCount == MAX_AVAILABLE_LOADS)
+        {
+            return false;
+        }
+        (*loadCount)++;
+    }
+    loads[found].op = load;
+    loads[found].index = instr->index;
+    loads[found].value = instr->op == load ? instr : instr->operands[0];
+    return false;
+}
+
+/**
+ * Find the values that are numbers whenever they exist: the results of arithmetic other than `+`, which fails on
+ * anything else, and `+`s and phis of numbers. Starts from all of them and drops the ones that turn out not to be.
+ */
+static void inferNumbers()
+{
+    numeric = arenaAlloc(ir->arena, sizeof(bool) * ir->valueCount);
+    memset(numeric, 0, sizeof(bool) * ir->valueCount);
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            IrOp op = instr->op;
+            numeric[instr->id] = op == IR_PHI || (op >= IR_ADD && op <= IR_DIVIDE) || op == IR_NEGATE ||
+                                 (op == IR_CONSTANT && IS_NUMBER(instr->value));
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < ir->blockCount; i++)
+        {
+            for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+            {
+                if (!numeric[instr->id] || (instr->op != IR_PHI && instr->op != IR_ADD))
+                {
+                    continue;
+                }
+                for (int j = 0; j < instr->operandCount; j++)
+                {
+                    if (!numeric[instr->operands[j]->id])
+                    {
+                        numeric[instr->id] = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @return the instruction can't fail and doesn't touch anything but its operands
+ */
+static bool isPure(IrInstr *instr)
+{
+    switch (instr->op)
+    {
+    case IR_EQUAL:
+    case IR_NOT_EQUAL:
+    case IR_NOT:
+    {
+        return true;
+    }
+    case IR_ADD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE:
+    case IR_GREATER:
+    case IR_GREATER_EQUAL:
+    case IR_LESS:
+    case IR_LESS_EQUAL:
+    case IR_NEGATE:
+    {
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            if (!numeric[instr->operands[i]->id])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    default:
+    {
+        return false;
+    }
+    }
+}
+
+/**
+ * Move the arithmetic of a loop whose operands are defined outside of it to the preheader, inner loops first so
+ * their invariants can move on out of the enclosing loops.
+ *
+ * @details The preheader only runs if the loop does, so arithmetic that may fail is hoisted too when it runs first
+ * thing in every iteration: in the header, before anything that has an effect or may fail and stays in the loop. It
+ * fails the same way, earlier.
+ */
+static void hoistInvariants()
+{
+    IrBlock **ordered = arenaAlloc(ir->arena, sizeof(IrBlock *) * ir->blockCount);
+    int orderedCount = 0;
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        if (ir->blocks[i]->order >= 0)
+        {
+            ordered[ir->blocks[i]->order] = ir->blocks[i];
+            orderedCount++;
+        }
+    }
+
+    for (int i = ir->loopCount - 1; i >= 0; i--) // loops are numbered outer first
+    {
+        IrLoop *loop = ir->loops[i];
+        if (loop->header->removed || loop->preheader->removed)
+        {
+            continue;
+        }
+
+        // in reverse postorder operands are hoisted before the instructions that use them
+        for (int j = 0; j < orderedCount; j++)
+        {
+            IrBlock *block = ordered[j];
+            if (!inLoop(block, loop))
+            {
+                continue;
+            }
+
+            bool mayFail = block == loop->header;
+            IrInstr *next;
+            for (IrInstr *instr = block->first; instr != NULL; instr = next)
+            {
+                next = instr->next;
+                bool invariant = instr->op >= IR_ADD && instr->op <= IR_NEGATE && (mayFail || isPure(instr));
+                for (int k = 0; k < instr->operandCount && invariant; k++)
+                {
+                    IrInstr *operand = instr->operands[k];
+                    invariant = operand->op == IR_CONSTANT || !inLoop(operand->block, loop); // constants are per use
+                }
+
+                if (invariant)
+                {
+                    removeInstr(instr);
+                    insertBefore(loop->preheader->last, instr);
+                }
+                else if (!isPure(instr) && hasEffect(instr))
+                {
+                    mayFail = false;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @return the instruction has an effect or may fail, pure instructions aside
+ */
+static bool hasEffect(IrInstr *instr)
+{
+    switch (instr->op)
+    {
+    case IR_CONSTANT:
+    case IR_PARAMETER:
+    case IR_PHI:
+    case IR_COPY:
+    case IR_GET_UPVALUE:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static bool inLoop(IrBlock *block, IrLoop *loop)
+{
+    for (IrLoop *enclosing = block->loop; enclosing != NULL; enclosing = enclosing->parent)
+    {
+        if (enclosing == loop)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Mark the values that have effects, may fail, or are used by marked values, and remove the others.
+ */
+static void eliminateDeadCode()
+{
+    bool *live = arenaAlloc(ir->arena, sizeof(bool) * ir->valueCount);
+    memset(live, 0, sizeof(bool) * ir->valueCount);
+    IrInstr **work = arenaAlloc(ir->arena, sizeof(IrInstr *) * ir->valueCount);
+    int workCount = 0;
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = instr->next)
+        {
+            if (hasEffect(instr) && !isPure(instr))
+            {
+                live[instr->id] = true;
+                work[workCount++] = instr;
+            }
+        }
+    }
+
+    while (workCount > 0)
+    {
+        IrInstr *instr = work[--workCount];
+        for (int i = 0; i < instr->operandCount; i++)
+        {
+            IrInstr *operand = instr->operands[i];
+            if (!live[operand->id])
+            {
+                live[operand->id] = true;
+                work[workCount++] = operand;
+            }
+        }
+    }
+
+    for (int i = 0; i < ir->blockCount; i++)
+    {
+        IrInstr *next;
+        for (IrInstr *instr = ir->blocks[i]->first; instr != NULL; instr = next)
+        {
+            next = instr->next;
+            if (!live[instr->id])
+            {
+                removeInstr(instr);
+            }
+        }
+    }
+}
@@ -0,0 +1,890 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "parser.h"
+
+typedef struct
+{
+    Token previous;
+    Token current;
+    bool hadError;
+    bool panicMode;
+} Parser;
+
+typedef Node *(*PrefixFn)(bool canAssign);
+typedef Node *(*InfixFn)(Node *left, bool canAssign);
+
+typedef enum
+{
+    PREC_NONE,
+    PREC_ASSIGNMENT,  // =
+    PREC_CONDITIONAL, // ?:
+    PREC_OR,          // or
+    PREC_AND,         // and
+    PREC_EQUALITY,    // == !=
+    PREC_COMPARISON,  // < > <= >=
+    PREC_TERM,        // + -
+    PREC_FACTOR,      // * /
+    PREC_UNARY,       // ! -
+    PREC_CALL,        // . ()
+    PREC_PRIMARY
+} Precedence;
+
+typedef struct
+{
+    PrefixFn prefix;
+    InfixFn infix;
+    Precedence precedence;
+} ParseRule;
+
+static Parser parser;
+/**
+ * Arena of the tree being built
+ */
+static Arena *nodes;
+
+static void advance();
+static void consume(TokenType type, const char *message);
+static bool match(TokenType type);
+static bool check(TokenType type);
+static Node *declaration();
+static Node *classDeclaration();
+static Node *method();
+static Node *funcDeclaration();
+static Node *varDeclaration();
+static Node *statement();
+static Node *printStatement();
+static Node *expressionStatement();
+static Node *ifStatement();
+static Node *whileStatement();
+static Node *forStatement();
+static Node *returnStatement();
+static Node *jumpStatement(NodeType type, const char *message);
+static Node *conditional_(Node *left, bool canAssign);
+static Node *binary(Node *left, bool canAssign);
+static Node *call(Node *left, bool canAssign);
+static Node *dot(Node *left, bool canAssign);
+static Node *argumentList();
+static Node *literal(bool canAssign);
+static Node *grouping(bool canAssign);
+static Node *unary(bool canAssign);
+static Node *parsePrecedence(Precedence precedence);
+static Node *and_(Node *left, bool canAssign);
+static Node *or_(Node *left, bool canAssign);
+static Declaration newDeclaration(Token name);
+static Variable newVariable(Token name);
+static ParseRule *getRule(TokenType type);
+static Node *number(bool canAssign);
+static Node *string(bool canAssign);
+static Node *variable(bool canAssign);
+static Token syntheticToken(const char *text);
+static Node *super_(bool canAssign);
+static Node *this_(bool canAssign);
+static Node *expression();
+static Node *block();
+static Node *function(FunctionType type);
+static void errorAtCurrent(const char *message);
+static void error(const char *message);
+static void errorAt(Token *token, const char *message);
+static void synchronize();
+
+ParseRule rules[] = {
+    [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
+    [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DOT] = {NULL, dot, PREC_CALL},
+    [TOKEN_MINUS] = {unary, binary, PREC_TERM},
+    [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
+    [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
+    [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
+    [TOKEN_BANG] = {unary, NULL, PREC_NONE},
+    [TOKEN_BANG_EQUAL] = {NULL, binary, PREC_EQUALITY},
+    [TOKEN_EQUAL] = {NULL, NULL, PREC_NONE},
+    [TOKEN_EQUAL_EQUAL] = {NULL, binary, PREC_EQUALITY},
+    [TOKEN_GREATER] = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESS] = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_QUESTION_MARK] = {NULL, conditional_, PREC_CONDITIONAL},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [TOKEN_STRING] = {string, NULL, PREC_NONE},
+    [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
+    [TOKEN_AND] = {NULL, and_, PREC_AND},
+    [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
+    [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IF] = {NULL, NULL, PREC_NONE},
+    [TOKEN_NIL] = {literal, NULL, PREC_NONE},
+    [TOKEN_OR] = {NULL, or_, PREC_OR},
+    [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SUPER] = {super_, NULL, PREC_NONE},
+    [TOKEN_THIS] = {this_, NULL, PREC_NONE},
+    [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
+    [TOKEN_VAR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
+};
+
+/**
+ * Syntax analyzing of the whole source with the **Pratt parsing algorithm**, first stage of `compile()`.
+ *
+ * @return `NODE_FUNCTION` of the script, NULL when the source has syntax errors (they are reported on stderr)
+ */
+Node *parse(Arena *arena, const char *source)
+{
+    nodes = arena;
+    initScanner(source);
+    parser.hadError = false;
+    parser.panicMode = false;
+
+    FunctionNode *script = arenaAlloc(nodes, sizeof(FunctionNode));
+    script->type = TYPE_SCRIPT;
+    script->name = syntheticToken("");
+    script->params = NULL;
+    script->arity = 0;
+    script->body = NULL;
+    script->upvalues = NULL;
+    script->upvalueCount = 0;
+
+    advance();
+
+    Node **tail = &script->body;
+    while (!match(TOKEN_EOF))
+    {
+        *tail = declaration();
+        tail = &(*tail)->next;
+    }
+
+    consume(TOKEN_EOF, "Expect end of expression.");
+    Node *node = newNode(nodes, NODE_FUNCTION, parser.previous.line);
+    node->as.function = script;
+    return parser.hadError ? NULL : node;
+}
+
+/**
+ * Print a compile error, shared by all stages of the compiler.
+ */
+void reportError(Token *token, const char *message)
+{
+    fprintf(stderr, "[line %d] Error", token->line);
+
+    if (token->type == TOKEN_EOF)
+    {
+        fprintf(stderr, " at end");
+    }
+    else if (token->type == TOKEN_ERROR)
+    {
+        // Nothing.
+    }
+    else
+    {
+        fprintf(stderr, " at '%.*s'", token->length, token->start);
+    }
+
+    fprintf(stderr, ": %s\n", message);
+}
+
+static void advance()
+{
+    parser.previous = parser.current;
+
+    for (;;)
+    {
+        parser.current = scanToken();
+        if (parser.current.type != TOKEN_ERROR)
+        {
+            break;
+        }
+
+        errorAtCurrent(parser.current.start);
+    }
+}
+
+static void consume(TokenType type, const char *message)
+{
+    if (parser.current.type == type)
+    {
+        advance();
+        return;
+    }
+
+    errorAtCurrent(message);
+}
+
+/**
+ * Advance if match
+ */
+static bool match(TokenType type)
+{
+    if (!check(type))
+    {
+        return false;
+    }
+
+    advance();
+    return true;
+}
+
+static bool check(TokenType type)
+{
+    return parser.current.type == type;
+}
+
+static Node *declaration()
+{
+    Node *node;
+    if (match(TOKEN_CLASS))
+    {
+        node = classDeclaration();
+    }
+    else if (match(TOKEN_FUN))
+    {
+        node = funcDeclaration();
+    }
+    else if (match(TOKEN_VAR))
+    {
+        node = varDeclaration();
+    }
+    else
+    {
+        node = statement();
+    }
+
+    if (parser.panicMode)
+    {
+        synchronize(); // error recovery for parser
+    }
+
+    return node;
+}
+
+static Node *classDeclaration()
+{
+    consume(TOKEN_IDENTIFIER, "Expect class name.");
+    ClassNode *klass = arenaAlloc(nodes, sizeof(ClassNode));
+    klass->name = newDeclaration(parser.previous);
+    klass->superclass = NULL;
+    klass->super = newDeclaration(syntheticToken("super"));
+    klass->methods = NULL;
+
+    //> Parse class inheritance
+    if (match(TOKEN_LESS))
+    {
+        consume(TOKEN_IDENTIFIER, "Expect superclass name.");
+        klass->superclass = variable(false);
+    }
+    //<
+
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    Node **tail = &klass->methods;
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    {
+        *tail = method();
+        tail = &(*tail)->next;
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+    Node *node = newNode(nodes, NODE_CLASS, parser.previous.line);
+    node->as.klass = klass;
+    return node;
+}
+
+static Node *method()
+{
+    consume(TOKEN_IDENTIFIER, "Expect method name.");
+
+    FunctionType type = TYPE_METHOD;
+    if (parser.previous.length == 4 &&
+        memcmp(parser.previous.start, "init", 4) == 0)
+    {
+        type = TYPE_INITIALIZER;
+    }
+
+    return function(type); // the method is named after its function
+}
+
+static Node *funcDeclaration()
+{
+    consume(TOKEN_IDENTIFIER, "Expect function name");
+    Node *node = newNode(nodes, NODE_FUN, 0);
+    node->as.var.name = newDeclaration(parser.previous);
+    node->as.var.initializer = function(TYPE_FUNCTION);
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *varDeclaration()
+{
+    consume(TOKEN_IDENTIFIER, "Expect variable name");
+    Node *node = newNode(nodes, NODE_VAR, 0);
+    node->as.var.name = newDeclaration(parser.previous);
+    node->as.var.initializer = NULL;
+
+    if (match(TOKEN_EQUAL))
+    {
+        node->as.var.initializer = expression();
+    }
+
+    consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration");
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *statement()
+{
+    if (match(TOKEN_PRINT))
+    {
+        return printStatement();
+    }
+    else if (match(TOKEN_IF))
+    {
+        return ifStatement();
+    }
+    else if (match(TOKEN_RETURN))
+    {
+        return returnStatement();
+    }
+    else if (match(TOKEN_WHILE))
+    {
+        return whileStatement();
+    }
+    else if (match(TOKEN_FOR))
+    {
+        return forStatement();
+    }
+    else if (match(TOKEN_BREAK))
+    {
+        return jumpStatement(NODE_BREAK, "Expect ';' after `break`");
+    }
+    else if (match(TOKEN_CONTINUE))
+    {
+        return jumpStatement(NODE_CONTINUE, "Expect ';' after `continue`");
+    }
+    else if (match(TOKEN_LEFT_BRACE))
+    {
+        Node *node = newNode(nodes, NODE_BLOCK, 0);
+        node->as.statements = block();
+        node->line = parser.previous.line;
+        return node;
+    }
+    else
+    {
+        return expressionStatement();
+    }
+}
+
+static Node *printStatement()
+{
+    Node *node = newNode(nodes, NODE_PRINT, 0);
+    node->as.expression = expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after value");
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *expressionStatement()
+{
+    Node *node = newNode(nodes, NODE_EXPRESSION, 0);
+    node->as.expression = expression();
+    consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *ifStatement()
+{
+    Node *node = newNode(nodes, NODE_IF, 0);
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    node->as.branch.condition = expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    node->as.branch.conditionLine = parser.previous.line;
+    node->as.branch.body = statement();
+
+    node->as.branch.elseBranch = NULL;
+    if (match(TOKEN_ELSE))
+    {
+        node->as.branch.elseLine = parser.previous.line;
+        node->as.branch.elseBranch = statement();
+    }
+
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *whileStatement()
+{
+    Node *node = newNode(nodes, NODE_WHILE, 0);
+    node->as.branch.initializer = NULL;
+    node->as.branch.increment = NULL;
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    node->as.branch.condition = expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    node->as.branch.conditionLine = parser.previous.line;
+    node->as.branch.body = statement();
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *forStatement()
+{
+    Node *node = newNode(nodes, NODE_FOR, 0);
+    node->as.branch.initializer = NULL;
+    node->as.branch.condition = NULL;
+    node->as.branch.increment = NULL;
+
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (match(TOKEN_SEMICOLON))
+    {
+        // No initializer.
+    }
+    else if (match(TOKEN_VAR))
+    {
+        node->as.branch.initializer = varDeclaration();
+    }
+    else
+    {
+        node->as.branch.initializer = expressionStatement();
+    }
+
+    if (!match(TOKEN_SEMICOLON))
+    {
+        node->as.branch.condition = expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+        node->as.branch.conditionLine = parser.previous.line;
+    }
+
+    if (!match(TOKEN_RIGHT_PAREN))
+    {
+        node->as.branch.increment = expression();
+        node->as.branch.incrementLine = parser.previous.line;
+        consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    }
+
+    node->as.branch.bodyLine = parser.previous.line;
+    node->as.branch.body = statement();
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *returnStatement()
+{
+    Node *node = newNode(nodes, NODE_RETURN, 0);
+    node->as.ret.keyword = parser.previous;
+    node->as.ret.value = NULL;
+
+    if (!match(TOKEN_SEMICOLON))
+    {
+        node->as.ret.value = expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+    }
+
+    node->line = parser.previous.line;
+    return node;
+}
+
+/**
+ * `break` and `continue`, whose jump is emitted on the line of the keyword
+ */
+static Node *jumpStatement(NodeType type, const char *message)
+{
+    Node *node = newNode(nodes, type, parser.previous.line);
+    node->as.keyword = parser.previous;
+    consume(TOKEN_SEMICOLON, message);
+    return node;
+}
+
+static Node *expression()
+{
+    return parsePrecedence(PREC_ASSIGNMENT);
+}
+
+/**
+ * @return the declarations of the block, linked by `Node.next`
+ */
+static Node *block()
+{
+    Node *statements = NULL;
+    Node **tail = &statements;
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    {
+        *tail = declaration();
+        tail = &(*tail)->next;
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+    return statements;
+}
+
+static Node *function(FunctionType type)
+{
+    FunctionNode *function = arenaAlloc(nodes, sizeof(FunctionNode));
+    function->type = type;
+    function->name = parser.previous;
+    function->upvalues = NULL;
+    function->upvalueCount = 0;
+
+    Declaration params[UINT8_COUNT];
+    int arity = 0;
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            arity++;
+            if (arity > 255)
+            {
+                errorAtCurrent("Can't have more than 255 parameters.");
+            }
+            consume(TOKEN_IDENTIFIER, "Expect parameter name.");
+            if (arity <= UINT8_COUNT)
+            {
+                params[arity - 1] = newDeclaration(parser.previous);
+            }
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+
+    function->arity = arity > UINT8_COUNT ? UINT8_COUNT : arity;
+    function->params = arenaAlloc(nodes, sizeof(Declaration) * function->arity);
+    memcpy(function->params, params, sizeof(Declaration) * function->arity);
+
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    function->body = block();
+
+    Node *node = newNode(nodes, NODE_FUNCTION, parser.previous.line);
+    node->as.function = function;
+    return node;
+}
+
+static Node *conditional_(Node *left, bool canAssign)
+{
+    ParseRule *rule = getRule(parser.previous.type);
+    Node *node = newNode(nodes, NODE_CONDITIONAL, 0);
+    node->as.conditional.condition = left;
+    node->as.conditional.questionLine = parser.previous.line;
+
+    node->as.conditional.thenBranch = parsePrecedence((Precedence)(rule->precedence)); // Parse then side
+    node->as.conditional.thenLine = parser.previous.line;
+    consume(TOKEN_COLON, "Expect ':' after expression.");
+    node->as.conditional.elseBranch = parsePrecedence((Precedence)(rule->precedence));
+
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *binary(Node *left, bool canAssign)
+{
+    TokenType operatorType = parser.previous.type;
+    ParseRule *rule = getRule(operatorType);
+
+    Node *node = newNode(nodes, NODE_BINARY, 0);
+    node->as.binary.op = operatorType;
+    node->as.binary.opLine = parser.previous.line;
+    node->as.binary.left = left;
+    node->as.binary.right = parsePrecedence((Precedence)(rule->precedence + 1));
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *call(Node *left, bool canAssign)
+{
+    Node *node = newNode(nodes, NODE_CALL, 0);
+    node->as.call.callee = left;
+    node->as.call.parenLine = parser.previous.line;
+    node->as.call.arguments = argumentList();
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *dot(Node *left, bool canAssign)
+{
+    consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    Node *node = newNode(nodes, NODE_GET, 0);
+    node->as.property.object = left;
+    node->as.property.name = parser.previous;
+    node->as.property.value = NULL;
+    node->as.property.arguments = NULL;
+    node->as.property.opLine = parser.previous.line;
+
+    if (canAssign && match(TOKEN_EQUAL))
+    {
+        node->type = NODE_SET;
+        node->as.property.opLine = parser.previous.line;
+        node->as.property.value = expression();
+    }
+    else if (match(TOKEN_LEFT_PAREN))
+    {
+        node->type = NODE_INVOKE;
+        node->as.property.opLine = parser.previous.line;
+        node->as.property.arguments = argumentList();
+    }
+
+    node->line = parser.previous.line;
+    return node;
+}
+
+/**
+ * @return the arguments of a call, linked by `Node.next`
+ */
+static Node *argumentList()
+{
+    Node *arguments = NULL;
+    Node **tail = &arguments;
+    int argCount = 0;
+    if (!check(TOKEN_RIGHT_PAREN))
+    {
+        do
+        {
+            *tail = expression();
+            tail = &(*tail)->next;
+            argCount++;
+            if (argCount == 255)
+            {
+                error("Can't have more than 255 arguments.");
+            }
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return arguments;
+}
+
+static Node *literal(bool canAssign)
+{
+    switch (parser.previous.type)
+    {
+    case TOKEN_FALSE:
+        return newNode(nodes, NODE_FALSE, parser.previous.line);
+    case TOKEN_TRUE:
+        return newNode(nodes, NODE_TRUE, parser.previous.line);
+    default:
+        return newNode(nodes, NODE_NIL, parser.previous.line);
+    }
+}
+
+static Node *grouping(bool canAssign)
+{
+    Node *node = expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    return node;
+}
+
+static Node *number(bool canAssign)
+{
+    Node *node = newNode(nodes, NODE_NUMBER, parser.previous.line);
+    node->as.number = strtod(parser.previous.start, NULL);
+    return node;
+}
+
+static Node *string(bool canAssign)
+{
+    Node *node = newNode(nodes, NODE_STRING, parser.previous.line);
+    node->as.string = parser.previous;
+    return node;
+}
+
+static Node *variable(bool canAssign)
+{
+    Token name = parser.previous;
+    if (canAssign && match(TOKEN_EQUAL))
+    {
+        Node *node = newNode(nodes, NODE_ASSIGN, 0);
+        node->as.assign.variable = newVariable(name);
+        node->as.assign.value = expression();
+        node->line = parser.previous.line;
+        return node;
+    }
+
+    Node *node = newNode(nodes, NODE_VARIABLE, name.line);
+    node->as.variable = newVariable(name);
+    return node;
+}
+
+static Token syntheticToken(const char *text)
+{
+    Token token;
+    token.type = TOKEN_IDENTIFIER;
+    token.start = text;
+    token.length = (int)strlen(text);
+    token.line = 0;
+    return token;
+}
+
+static Node *super_(bool canAssign)
+{
+    SuperNode *super = arenaAlloc(nodes, sizeof(SuperNode));
+    super->superclass = newVariable(parser.previous); // the keyword is the name of the hidden local
+    super->receiver = newVariable(syntheticToken("this"));
+    super->receiver.name.line = parser.previous.line;
+
+    consume(TOKEN_DOT, "Expect '.' after 'super'.");
+    consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
+    super->method = parser.previous;
+
+    super->isInvoke = match(TOKEN_LEFT_PAREN);
+    super->arguments = super->isInvoke ? argumentList() : NULL;
+
+    Node *node = newNode(nodes, NODE_SUPER, parser.previous.line);
+    node->as.super = super;
+    return node;
+}
+
+static Node *this_(bool canAssign)
+{
+    Node *node = newNode(nodes, NODE_THIS, parser.previous.line);
+    node->as.variable = newVariable(parser.previous); // Treat `this` as a lexically scoped local variable.
+    return node;
+}
+
+static Node *unary(bool canAssign)
+{
+    TokenType operatorType = parser.previous.type;
+
+    Node *node = newNode(nodes, NODE_UNARY, 0);
+    node->as.unary.op = operatorType;
+    node->as.unary.operand = parsePrecedence(PREC_UNARY);
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *and_(Node *left, bool canAssign)
+{
+    Node *node = newNode(nodes, NODE_AND, 0);
+    node->as.binary.op = TOKEN_AND;
+    node->as.binary.opLine = parser.previous.line;
+    node->as.binary.left = left;
+    node->as.binary.right = parsePrecedence(PREC_AND);
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Node *or_(Node *left, bool canAssign)
+{
+    Node *node = newNode(nodes, NODE_OR, 0);
+    node->as.binary.op = TOKEN_OR;
+    node->as.binary.opLine = parser.previous.line;
+    node->as.binary.left = left;
+    node->as.binary.right = parsePrecedence(PREC_OR);
+    node->line = parser.previous.line;
+    return node;
+}
+
+static Declaration newDeclaration(Token name)
+{
+    Declaration declaration;
+    declaration.name = name;
+    declaration.slot = -1;
+    declaration.isCaptured = false;
+    return declaration;
+}
+
+static Variable newVariable(Token name)
+{
+    Variable variable;
+    variable.name = name;
+    variable.kind = VAR_GLOBAL;
+    variable.index = 0;
+    return variable;
+}
+
+/**
+ * Starts at the current token and parses any expression at the given precedence level or higher.
+ *
+ * @details Pratt parsing algorithm
+ */
+static Node *parsePrecedence(Precedence precedence)
+{
+    advance();
+    PrefixFn prefixRule = getRule(parser.previous.type)->prefix;
+    if (prefixRule == NULL)
+    {
+        error("Expect expression.");
+        return newNode(nodes, NODE_NIL, parser.previous.line);
+    }
+
+    bool canAssign = precedence <= PREC_ASSIGNMENT;
+    Node *node = prefixRule(canAssign); // parse the left side of binary operator
+
+    while (precedence <= getRule(parser.current.type)->precedence)
+    {
+        advance();
+        InfixFn infixRule = getRule(parser.previous.type)->infix;
+        node = infixRule(node, canAssign); // parse the right side of binary operator
+    }
+
+    if (canAssign && match(TOKEN_EQUAL))
+    {
+        error("Invalid assignment target.");
+    }
+
+    return node;
+}
+
+static ParseRule *getRule(TokenType type)
+{
+    return &rules[type];
+}
+
+static void errorAtCurrent(const char *message)
+{
+    errorAt(&parser.current, message);
+}
+
+static void error(const char *message)
+{
+    errorAt(&parser.previous, message);
+}
+
+static void errorAt(Token *token, const char *message)
+{
+    if (parser.panicMode)
+    {
+        return;
+    }
+
+    parser.panicMode = true;
+    reportError(token, message);
+    parser.hadError = true;
+}
+
+static void synchronize()
+{
+    parser.panicMode = false;
+
+    while (TOKEN_EOF != parser.current.type)
+    {
+        if (TOKEN_SEMICOLON == parser.current.type)
+        {
+            return;
+        }
+
+        switch (parser.current.type)
+        {
+        case TOKEN_CLASS:
+        case TOKEN_FUN:
+        case TOKEN_VAR:
+        case TOKEN_FOR:
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+        case TOKEN_PRINT:
+        case TOKEN_RETURN:
+        {
+            return;
+        }
+        default:
+        { // Do nothing
+        }
+        }
+
+        advance();
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef clox_parser_h
+#define clox_parser_h
+
+#include "ast.h"
+
+Node *parse(Arena *arena, const char *source);
+void reportError(Token *token, const char *message);
+
+#endif
@@ -0,0 +1,630 @@
+#include <string.h>
+
+#include "common.h"
+#include "parser.h"
+#include "resolver.h"
+
+typedef struct
+{
+    /**
+     * Local variable name
+     */
+    Token name;
+    /**
+     * The scope depth of the block where the local variable was declared.
+     * `-1` is uninitialized variable
+     */
+    int depth;
+    /**
+     * Declaration marked when a nested function captures the local, NULL for hidden locals
+     */
+    Declaration *declaration;
+} Local;
+
+/**
+ * The variables visible in a function, in the order and registers the code generator will give them.
+ */
+typedef struct Resolver
+{
+    struct Resolver *enclosing;
+    FunctionNode *function;
+    /**
+     * Local `i` lives in register `i` of the frame.
+     */
+    Local locals[UINT8_COUNT];
+    int localCount;
+    Upvalue upvalues[UINT8_COUNT];
+    int upvalueCount;
+    /**
+     * Zero is the global scope, one is the first top-level block, two is inside that.
+     */
+    int scopeDepth;
+    /**
+     * Loops of the function around the statement being resolved, `break` and `continue` need one
+     */
+    int loopDepth;
+} Resolver;
+
+typedef struct ClassResolver
+{
+    struct ClassResolver *enclosing;
+    bool hasSuperclass;
+} ClassResolver;
+
+static Resolver *current = NULL;
+static ClassResolver *currentClass = NULL;
+/**
+ * Arena of the tree, the upvalues of the functions are allocated in it
+ */
+static Arena *nodes;
+static bool hadError;
+
+static void resolveFunction(FunctionNode *function);
+static void declaration(Node *node);
+static void classDeclaration(ClassNode *klass);
+static void statement(Node *node);
+static void statements(Node *node);
+static void expression(Node *node);
+static void super_(Node *node);
+static void beginScope();
+static void endScope();
+static void declareVariable(Declaration *declaration);
+static void addLocal(Token name, Declaration *declaration, Token *at);
+static void markInitialized();
+static void resolveVariable(Variable *variable);
+static bool identifiersEqual(Token *a, Token *b);
+static Token syntheticToken(const char *text);
+static int resolveLocal(Resolver *resolver, Token *name);
+static int resolveUpvalue(Resolver *resolver, Token *name);
+static int addUpvalue(Resolver *resolver, uint8_t index, bool isLocal, Token *name);
+static void error(Token *token, const char *message);
+
+/**
+ * Static analysis of the tree, second stage of `compile()`: resolve every variable to a local register, an upvalue or
+ * a global, mark the locals captured by closures and report the errors of misplaced `return`, `this`, `super`,
+ * `break` and `continue`.
+ *
+ * @details Locals are declared and dropped exactly where the code generator will reserve and release their registers,
+ * so the slots set here are the registers of the generated code.
+ *
+ * @return false when the tree has errors (they are reported on stderr)
+ */
+bool resolve(Arena *arena, Node *script)
+{
+    nodes = arena;
+    hadError = false;
+    resolveFunction(script->as.function);
+    return !hadError;
+}
+
+static void resolveFunction(FunctionNode *function)
+{
+    Resolver resolver;
+    resolver.enclosing = current;
+    resolver.function = function;
+    resolver.localCount = 0;
+    resolver.upvalueCount = 0;
+    resolver.scopeDepth = 0;
+    resolver.loopDepth = 0;
+    current = &resolver;
+
+    Local *local = &current->locals[current->localCount++];
+    local->depth = 0;
+    local->declaration = NULL;
+    if (function->type != TYPE_FUNCTION)
+    {
+        local->name.start = "this"; // Register 0 of a method's frame holds `this`.
+        local->name.length = 4;
+    }
+    else
+    {
+        local->name.start = "";
+        local->name.length = 0;
+    }
+
+    if (function->type != TYPE_SCRIPT)
+    {
+        beginScope(); // [no-end-scope]
+        for (int i = 0; i < function->arity; i++)
+        {
+            declareVariable(&function->params[i]);
+            markInitialized();
+        }
+    }
+
+    statements(function->body);
+
+    function->upvalueCount = current->upvalueCount;
+    function->upvalues = arenaAlloc(nodes, sizeof(Upvalue) * current->upvalueCount);
+    memcpy(function->upvalues, current->upvalues, sizeof(Upvalue) * current->upvalueCount);
+    current = current->enclosing;
+}
+
+static void declaration(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_CLASS:
+    {
+        classDeclaration(node->as.klass);
+        break;
+    }
+    case NODE_FUN:
+    {
+        declareVariable(&node->as.var.name);
+        markInitialized(); // a function can refer to itself
+        resolveFunction(node->as.var.initializer->as.function);
+        break;
+    }
+    case NODE_VAR:
+    {
+        declareVariable(&node->as.var.name);
+        if (node->as.var.initializer != NULL)
+        {
+            expression(node->as.var.initializer);
+        }
+        markInitialized();
+        break;
+    }
+    default:
+    {
+        statement(node);
+        break;
+    }
+    }
+}
+
+static void classDeclaration(ClassNode *klass)
+{
+    declareVariable(&klass->name);
+
+    bool isLocal = current->scopeDepth > 0;
+    if (isLocal)
+    {
+        markInitialized();
+    }
+
+    beginScope();
+    if (!isLocal)
+    {
+        addLocal(syntheticToken(""), NULL, &klass->name.name); // hidden local that holds a global class
+        markInitialized();
+    }
+
+    ClassResolver classResolver;
+    classResolver.hasSuperclass = false;
+    classResolver.enclosing = currentClass;
+    currentClass = &classResolver;
+
+    if (klass->superclass != NULL)
+    {
+        Variable *superclass = &klass->superclass->as.variable;
+        resolveVariable(superclass);
+        if (identifiersEqual(&klass->name.name, &superclass->name))
+        {
+            error(&superclass->name, "A class can't inherit from itself.");
+        }
+
+        addLocal(klass->super.name, &klass->super, &superclass->name); // `super` is an upvalue for all methods
+        markInitialized();
+        classResolver.hasSuperclass = true;
+    }
+
+    for (Node *method = klass->methods; method != NULL; method = method->next)
+    {
+        resolveFunction(method->as.function);
+    }
+
+    endScope();
+    currentClass = currentClass->enclosing;
+}
+
+static void statement(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_PRINT:
+    case NODE_EXPRESSION:
+    {
+        expression(node->as.expression);
+        break;
+    }
+    case NODE_IF:
+    {
+        expression(node->as.branch.condition);
+        statement(node->as.branch.body);
+        if (node->as.branch.elseBranch != NULL)
+        {
+            statement(node->as.branch.elseBranch);
+        }
+        break;
+    }
+    case NODE_WHILE:
+    case NODE_FOR:
+    {
+        beginScope();
+        current->loopDepth++;
+        if (node->as.branch.initializer != NULL)
+        {
+            declaration(node->as.branch.initializer);
+        }
+        if (node->as.branch.condition != NULL)
+        {
+            expression(node->as.branch.condition);
+        }
+        if (node->as.branch.increment != NULL)
+        {
+            expression(node->as.branch.increment);
+        }
+        statement(node->as.branch.body);
+        current->loopDepth--;
+        endScope();
+        break;
+    }
+    case NODE_BREAK:
+    {
+        if (current->loopDepth == 0)
+        {
+            error(&node->as.keyword, "Break statement can only be used inside loop body");
+        }
+        break;
+    }
+    case NODE_CONTINUE:
+    {
+        if (current->loopDepth == 0)
+        {
+            error(&node->as.keyword, "Continue statement can only be used inside loop body");
+        }
+        break;
+    }
+    case NODE_BLOCK:
+    {
+        beginScope();
+        statements(node->as.statements);
+        endScope();
+        break;
+    }
+    case NODE_RETURN:
+    {
+        if (current->function->type == TYPE_SCRIPT)
+        {
+            error(&node->as.ret.keyword, "Can't return from top-level code.");
+        }
+
+        if (node->as.ret.value != NULL)
+        {
+            if (current->function->type == TYPE_INITIALIZER)
+            {
+                error(&node->as.ret.keyword, "Can't return a value from an initializer.");
+            }
+            expression(node->as.ret.value);
+        }
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+}
+
+static void statements(Node *node)
+{
+    for (; node != NULL; node = node->next)
+    {
+        declaration(node);
+    }
+}
+
+/**
+ * @details Variables are resolved in the order the code generator emits their reads, which is the order upvalues get
+ * their indices in.
+ */
+static void expression(Node *node)
+{
+    switch (node->type)
+    {
+    case NODE_VARIABLE:
+    {
+        resolveVariable(&node->as.variable);
+        break;
+    }
+    case NODE_ASSIGN:
+    {
+        resolveVariable(&node->as.assign.variable);
+        expression(node->as.assign.value);
+        break;
+    }
+    case NODE_THIS:
+    {
+        if (currentClass == NULL)
+        {
+            error(&node->as.variable.name, "Can't use 'this' outside of a class.");
+            break;
+        }
+        resolveVariable(&node->as.variable);
+        break;
+    }
+    case NODE_SUPER:
+    {
+        super_(node);
+        break;
+    }
+    case NODE_UNARY:
+    {
+        expression(node->as.unary.operand);
+        break;
+    }
+    case NODE_BINARY:
+    case NODE_AND:
+    case NODE_OR:
+    {
+        expression(node->as.binary.left);
+        expression(node->as.binary.right);
+        break;
+    }
+    case NODE_CONDITIONAL:
+    {
+        expression(node->as.conditional.condition);
+        expression(node->as.conditional.thenBranch);
+        expression(node->as.conditional.elseBranch);
+        break;
+    }
+    case NODE_CALL:
+    {
+        expression(node->as.call.callee);
+        for (Node *argument = node->as.call.arguments; argument != NULL; argument = argument->next)
+        {
+            expression(argument);
+        }
+        break;
+    }
+    case NODE_GET:
+    case NODE_SET:
+    case NODE_INVOKE:
+    {
+        expression(node->as.property.object);
+        if (node->as.property.value != NULL)
+        {
+            expression(node->as.property.value);
+        }
+        for (Node *argument = node->as.property.arguments; argument != NULL; argument = argument->next)
+        {
+            expression(argument);
+        }
+        break;
+    }
+    case NODE_FUNCTION:
+    {
+        resolveFunction(node->as.function);
+        break;
+    }
+    default:
+    {
+        break;
+    }
+    }
+}
+
+static void super_(Node *node)
+{
+    SuperNode *super = node->as.super;
+    if (currentClass == NULL)
+    {
+        error(&super->superclass.name, "Can't use 'super' outside of a class.");
+    }
+    else if (!currentClass->hasSuperclass)
+    {
+        error(&super->superclass.name, "Can't use 'super' in a class with no superclass.");
+    }
+
+    resolveVariable(&super->receiver); // `this` goes to slot 0 of the callee
+    for (Node *argument = super->arguments; argument != NULL; argument = argument->next)
+    {
+        expression(argument);
+    }
+    resolveVariable(&super->superclass);
+}
+
+static void beginScope()
+{
+    current->scopeDepth++;
+}
+
+static void endScope()
+{
+    current->scopeDepth--;
+
+    while (
+        current->localCount > 0 &&
+        current->locals[current->localCount - 1].depth > current->scopeDepth)
+    {
+        current->localCount--;
+    }
+}
+
+/**
+ * Declare a variable in the current scope: a local takes the next register, a global is left to its name.
+ */
+static void declareVariable(Declaration *declaration)
+{
+    declaration->slot = -1;
+    declaration->isCaptured = false;
+    if (current->scopeDepth == 0)
+    {
+        return;
+    }
+
+    Token *name = &declaration->name;
+    for (int i = current->localCount - 1; i >= 0; i--)
+    {
+        Local *local = &(current->locals[i]);
+        if (local->depth != -1 && local->depth < current->scopeDepth)
+        {
+            break;
+        }
+
+        if (identifiersEqual(name, &local->name))
+        {
+            error(name, "Already a variable with this name in this scope.");
+        }
+    }
+
+    addLocal(*name, declaration, name);
+}
+
+static void addLocal(Token name, Declaration *declaration, Token *at)
+{
+    if (current->localCount >= UINT8_COUNT)
+    {
+        error(at, "Too many local variables in function.");
+        return;
+    }
+
+    Local *local = &current->locals[current->localCount++];
+    local->name = name;
+    local->depth = -1;
+    local->declaration = declaration;
+    if (declaration != NULL)
+    {
+        declaration->slot = current->localCount - 1;
+        declaration->isCaptured = false;
+    }
+}
+
+/**
+ * Mark latest local variable of current scope as initialized.
+ */
+static void markInitialized()
+{
+    if (current->scopeDepth == 0)
+    {
+        return;
+    }
+
+    current->locals[current->localCount - 1].depth = current->scopeDepth;
+}
+
+static void resolveVariable(Variable *variable)
+{
+    int arg = resolveLocal(current, &variable->name);
+    if (arg != -1) // local variable
+    {
+        variable->kind = VAR_LOCAL;
+        variable->index = arg;
+    }
+    else if ((arg = resolveUpvalue(current, &variable->name)) != -1) // Resolve upvalue for closure
+    {
+        variable->kind = VAR_UPVALUE;
+        variable->index = arg;
+    }
+    else // global variable
+    {
+        variable->kind = VAR_GLOBAL;
+        variable->index = 0;
+    }
+}
+
+static bool identifiersEqual(Token *a, Token *b)
+{
+    if (a->length != b->length)
+    {
+        return false;
+    }
+
+    return memcmp(a->start, b->start, a->length) == 0;
+}
+
+static Token syntheticToken(const char *text)
+{
+    Token token;
+    token.type = TOKEN_IDENTIFIER;
+    token.start = text;
+    token.length = (int)strlen(text);
+    token.line = 0;
+    return token;
+}
+
+/**
+ * Resolve register of local variable
+ */
+static int resolveLocal(Resolver *resolver, Token *name)
+{
+    for (int i = resolver->localCount - 1; i >= 0; i--)
+    {
+        Local *local = &(resolver->locals[i]);
+        if (identifiersEqual(name, &(local->name)))
+        {
+            if (local->depth == -1)
+            {
+                error(name, "Can't read local variable in its own initializer.");
+            }
+
+            return i; // The local variable’s index in the locals array is the same as its register.
+        }
+    }
+
+    return -1; // not found local variable
+}
+
+/**
+ * Resolve slot index of upvalue
+ */
+static int resolveUpvalue(Resolver *resolver, Token *name)
+{
+    if (resolver->enclosing == NULL)
+    {
+        return -1;
+    }
+
+    int local = resolveLocal(resolver->enclosing, name); // Find variable in parent scope
+    if (local != -1)
+    {
+        Declaration *declaration = resolver->enclosing->locals[local].declaration;
+        if (declaration != NULL)
+        {
+            declaration->isCaptured = true;
+        }
+        return addUpvalue(resolver, (uint8_t)local, true, name);
+    }
+
+    //< Recursive resolve upvalue from parent scope of parent scope
+    int upvalue = resolveUpvalue(resolver->enclosing, name);
+    if (upvalue != -1)
+    {
+        return addUpvalue(resolver, (uint8_t)upvalue, false, name);
+    }
+    //>
+
+    return -1;
+}
+
+static int addUpvalue(Resolver *resolver, uint8_t index, bool isLocal, Token *name)
+{
+    int upvalueCount = resolver->upvalueCount;
+
+    for (int i = 0; i < upvalueCount; i++)
+    {
+        Upvalue *upvalue = &resolver->upvalues[i];
+        if (upvalue->index == index && upvalue->isLocal == isLocal)
+        {
+            return i;
+        }
+    }
+
+    if (upvalueCount == UINT8_COUNT)
+    {
+        error(name, "Too many closure variables in function.");
+        return 0;
+    }
+
+    resolver->upvalues[upvalueCount].isLocal = isLocal;
+    resolver->upvalues[upvalueCount].index = index;
+    return resolver->upvalueCount++;
+}
+
+static void error(Token *token, const char *message)
+{
+    reportError(token, message);
+    hadError = true;
+}
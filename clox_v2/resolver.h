@@ -0,0 +1,8 @@
+#ifndef clox_resolver_h
+#define clox_resolver_h
+
+#include "ast.h"
+
+bool resolve(Arena *arena, Node *script);
+
+#endif
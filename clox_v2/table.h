@@ -0,0 +1,43 @@
+/**
+ *
+ * Implement a hash table
+ *
+ */
+
+#ifndef clox_table_h
+#define clox_table_h
+
+#include "common.h"
+#include "value.h"
+
+/**
+ * A key-value pair of hash table
+ */
+typedef struct
+{
+    ObjString *key;
+    Value value;
+} Entry;
+
+/**
+ * A hash table
+ */
+typedef struct
+{
+    DYNAMIC_ARRAY_STRUCT_COMMON_FIELD
+
+    Entry *entries;
+} Table;
+
+void initTable(Table *table);
+void freeTable(Table *table);
+bool tableGet(Table *table, ObjString *key, Value *value);
+bool tableSet(Table *table, ObjString *key, Value value);
+bool tableDelete(Table *table, ObjString *key);
+void tableAddAll(Table *from, Table *to);
+
+ObjString *tableFindString(Table *table, const char *chars, int length, uint32_t hash);
+void tableRemoveWhite(Table *table);
+void markTable(Table *table);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+#ifndef clox_value_h
+#define clox_value_h
+
+#include <string.h>
+
+#include "common.h"
+
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+
+#ifdef NAN_BOXING
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+/// @brief Quiet NaN representation
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1   // 01
+#define TAG_FALSE 2 // 10
+#define TAG_TRUE 3  // 11
+
+typedef uint64_t Value;
+
+#define IS_NIL(value) ((value) == NIL_VAL)
+/// @brief
+/// Potential states:
+/// - It was `FALSE_VAL` and has now been converted to `TRUE_VAL`.
+/// - It was `TRUE_VAL` and the `| 1` did nothing and it’s still `TRUE_VAL`.
+/// - It’s some other, non-Boolean value.
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) \
+    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+#define AS_OBJ(value) \
+    ((Obj *)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define NIL_VAL ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NUMBER_VAL(num) numToValue(num)
+#define OBJ_VAL(obj) \
+    (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+static inline double valueToNum(Value value)
+{
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+static inline Value numToValue(double num)
+{
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
+typedef enum
+{
+    VAL_BOOL,
+    VAL_NIL,
+    VAL_NUMBER,
+    VAL_OBJ,
+} ValueType;
+
+/**
+ * This typedef abstracts how Lox values are concretely represented in C.
+ *
+ * @details tagged union
+ */
+typedef struct
+{
+    ValueType type;
+    union
+    {
+        bool boolean;
+        double number;
+        Obj *obj;
+    } as;
+} Value;
+
+#define IS_BOOL(value) ((value).type == VAL_BOOL)
+#define IS_NIL(value) ((value).type == VAL_NIL)
+#define IS_NUMBER(value) ((value).type == VAL_NUMBER)
+#define IS_OBJ(value) ((value).type == VAL_OBJ)
+
+#define AS_BOOL(value) ((value).as.boolean)
+#define AS_NUMBER(value) ((value).as.number)
+#define AS_OBJ(value) ((value).as.obj)
+
+#define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
+#define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
+#define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define OBJ_VAL(value) ((Value){VAL_OBJ, {.obj = (Obj *)value}})
+
+#endif
+
+/**
+ * Constant pool
+ *
+ * @details constant pool is an array of values. The instruction to load a constant looks up the value by index in that array.
+ */
+typedef struct
+{
+    DYNAMIC_ARRAY_STRUCT_COMMON_FIELD
+
+    Value *values;
+} ValueArray;
+
+void initValueArray(ValueArray *array);
+void writeValueArray(ValueArray *array, Value value);
+void freeValueArray(ValueArray *array);
+void printValue(Value value);
+bool valuesEqual(Value a, Value b);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,935 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "compiler.h"
+#include "debug.h"
+#include "object.h"
+#include "memory.h"
+#include "vm.h"
+
+VM vm;
+
+static InterpretResult run();
+static void resetStack();
+static void runtimeError(const char *format, ...);
+static void defineNative(const char *name, NativeFn function);
+static ObjUpvalue *captureUpvalue(Value *local);
+static void closeUpvalues(Value *last);
+static bool isFalsey(Value value);
+static void concatenate(Value a, Value b, Value *dest);
+static bool call(ObjClosure *closure, int argCount, Value *slots);
+static Value clockNative(int argCount, Value *args);
+
+void initVM()
+{
+    resetStack();
+    vm.objects = NULL;
+    vm.bytesAllocated = 0;
+    vm.nextGC = 1024 * 1204;
+
+    vm.grayCount = 0;
+    vm.grayCapacity = 0;
+    vm.grayStack = NULL;
+
+    initTable(&(vm.globals));
+    initTable(&(vm.strings));
+
+    vm.initString = NULL;
+    vm.initString = copyString("init", 4);
+
+#ifdef DEBUG_COUNT_DISPATCH
+    vm.dispatchCount = 0;
+#endif
+
+    defineNative("clock", clockNative);
+}
+
+void freeVM()
+{
+#ifdef DEBUG_COUNT_DISPATCH
+    fprintf(stderr, "dispatches: %llu\n", (unsigned long long)vm.dispatchCount);
+#endif
+
+    freeTable(&(vm.globals));
+    freeTable(&(vm.strings));
+    vm.initString = NULL;
+    freeObjects();
+}
+
+static Value clockNative(int argCount, Value *args)
+{
+    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+}
+
+/**
+ * Execute the given chunk of instructions
+ */
+InterpretResult interpret(const char *source)
+{
+    ObjFunction *function = compile(source);
+    if (function == NULL)
+    {
+        return INTERPRET_COMPILE_ERROR;
+    }
+
+    push(OBJ_VAL(function));
+    ObjClosure *closure = newClosure(function);
+    pop();
+    push(OBJ_VAL(closure));
+    if (!call(closure, 0, vm.stackTop - 1))
+    {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    return run();
+}
+
+void push(Value value)
+{
+    *(vm.stackTop) = value;
+    vm.stackTop++;
+}
+
+Value pop()
+{
+    vm.stackTop--;
+    return *(vm.stackTop);
+}
+
+/**
+ * Setup stack frame for called function before executing it
+ *
+ * @details The callee is in `slots[0]` and the arguments follow it, they become register 0 and the parameters of the
+ * new frame. The rest of its registers are cleared, so the GC never sees stale values.
+ */
+static bool call(ObjClosure *closure, int argCount, Value *slots)
+{
+    ObjFunction *function = closure->function;
+    if (argCount != function->arity)
+    {
+        runtimeError("Expected %d arguments but got %d.", function->arity, argCount);
+        return false;
+    }
+
+    if (vm.frameCount == FRAMES_MAX || slots + function->maxSlots > vm.stack + STACK_MAX)
+    {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    for (Value *slot = slots + argCount + 1; slot < slots + function->maxSlots; slot++)
+    {
+        *slot = NIL_VAL;
+    }
+
+    CallFrame *frame = &vm.frames[vm.frameCount++]; // Get stack frame for function being called
+    frame->closure = closure;
+    frame->ip = function->chunk.code; // Set instruction pointer to the first instruction of function being called
+    frame->slots = slots;
+    vm.stackTop = slots + function->maxSlots;
+    return true;
+}
+
+static bool callValue(Value callee, int argCount, Value *slots)
+{
+    if (IS_OBJ(callee))
+    {
+        switch (OBJ_TYPE(callee))
+        {
+        case OBJ_BOUND_METHOD:
+        {
+            ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
+            slots[0] = bound->receiver; // Use register 0 of method's frame for saving `this` pointer.
+            return call(bound->method, argCount, slots);
+        }
+        case OBJ_CLASS: // Invoke constructor of a class
+        {
+            ObjClass *klass = AS_CLASS(callee);
+            slots[0] = OBJ_VAL(newInstance(klass));
+            Value initializer;
+            if (tableGet(&(klass->methods), vm.initString, &initializer))
+            {
+                return call(AS_CLOSURE(initializer), argCount, slots);
+            }
+            else if (argCount != 0)
+            {
+                runtimeError("Expected 0 arguments but got %d.", argCount);
+                return false;
+            }
+            return true;
+        }
+        case OBJ_CLOSURE:
+        {
+            return call(AS_CLOSURE(callee), argCount, slots);
+        }
+        case OBJ_NATIVE:
+        {
+            /**
+             * @details Invoke native function, its result replaces the callee
+             */
+
+            NativeFn native = AS_NATIVE(callee);
+            slots[0] = native(argCount, slots + 1);
+            return true;
+        }
+        default:
+        {
+            break;
+        }
+        }
+    }
+    runtimeError("Can only call functions and classes.");
+    return false;
+}
+
+static bool invokeFromClass(ObjClass *klass, ObjString *name, int argCount, Value *slots)
+{
+    Value method;
+    if (!tableGet(&(klass->methods), name, &method))
+    {
+        runtimeError("Undefined property '%s'.", name->chars);
+        return false;
+    }
+
+    return call(AS_CLOSURE(method), argCount, slots);
+}
+
+static bool invoke(ObjString *name, int argCount, Value *slots)
+{
+    Value receiver = slots[0];
+
+    if (!IS_INSTANCE(receiver))
+    {
+        runtimeError("Only instances have methods.");
+        return false;
+    }
+
+    ObjInstance *instance = AS_INSTANCE(receiver);
+
+    Value value;
+    if (tableGet(&instance->fields, name, &value))
+    {
+        slots[0] = value;
+        return callValue(value, argCount, slots);
+    }
+
+    return invokeFromClass(instance->klass, name, argCount, slots);
+}
+
+/**
+ * Bind method `name` of `klass` to `receiver` and write the bound method to `dest`
+ */
+static bool bindMethod(ObjClass *klass, ObjString *name, Value receiver, Value *dest)
+{
+    Value method;
+    if (!tableGet(&(klass->methods), name, &method))
+    {
+        runtimeError("Undefined property '%s'.", name->chars);
+        return false;
+    }
+
+    ObjBoundMethod *bound = newBoundMethod(receiver, AS_CLOSURE(method)); // the receiver is still in its register
+    *dest = OBJ_VAL(bound);
+    return true;
+}
+
+/**
+ * Capture upvalue and save it into a linked list
+ */
+static ObjUpvalue *captureUpvalue(Value *local)
+{
+    ObjUpvalue *preUpvalue = NULL;
+    ObjUpvalue *upvalue = vm.openUpvalues;
+    while (upvalue != NULL && upvalue->location > local)
+    {
+        preUpvalue = upvalue;
+        upvalue = upvalue->next;
+    }
+    if (upvalue != NULL && upvalue->location == local)
+    {
+        return upvalue;
+    }
+
+    ObjUpvalue *createdUpvalue = newUpvalue(local);
+    createdUpvalue->next = upvalue;
+
+    if (preUpvalue == NULL)
+    {
+        vm.openUpvalues = createdUpvalue;
+    }
+    else
+    {
+        preUpvalue->next = createdUpvalue;
+    }
+
+    return createdUpvalue;
+}
+
+/**
+ * @brief Allocate all upvalues into heap after out of scope
+ */
+static void closeUpvalues(Value *last)
+{
+    while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last)
+    {
+        ObjUpvalue *upvalue = vm.openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        vm.openUpvalues = upvalue->next;
+    }
+}
+
+static bool isFalsey(Value value)
+{
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * @note Both operands stay reachable during the allocation, they are registers or constants of the running function.
+ */
+static void concatenate(Value a, Value b, Value *dest)
+{
+    ObjString *left = AS_STRING(a);
+    ObjString *right = AS_STRING(b);
+
+    int length = left->length + right->length;
+    char *chars = ALLOCATE(char, length + 1);
+    memcpy(chars, left->chars, left->length);
+    memcpy(chars + left->length, right->chars, right->length);
+    chars[length] = '\0';
+
+    ObjString *result = takeString(chars, length);
+    *dest = OBJ_VAL(result);
+}
+
+/**
+ * @brief Interpreter state of `run()`
+ *
+ * @details The hot state of the interpreter lives in locals of `run()` so the C compiler can keep it in registers:
+ *
+ * - `frame`: the stack frame of current invoked function
+ * - `ip`: instruction pointer of `frame`
+ * - `base`: register 0 of `frame`
+ * - `constants`: constant pool of the function of `frame`
+ *
+ * Every register of a frame is below `vm.stackTop` for as long as the frame runs, so unlike the stack VM there is no
+ * stack pointer to keep: `frame->ip` is the only stale field while a handler runs. It is written back with
+ * `STORE_FRAME()` before calls, returns, runtime errors (the stack trace reads it) and allocations. After a spill
+ * point that may change the frames, `LOAD_FRAME()` reloads every local from `vm`.
+ */
+#define STORE_FRAME() (frame->ip = ip)
+
+#define LOAD_FRAME()                                                  \
+    do                                                                \
+    {                                                                 \
+        frame = &vm.frames[vm.frameCount - 1];                        \
+        ip = frame->ip;                                               \
+        base = frame->slots;                                          \
+        constants = frame->closure->function->chunk.constants.values; \
+    } while (false)
+
+/**
+ * Spill the state, report a runtime error and leave the interpreter loop
+ */
+#define RUNTIME_ERROR(...)              \
+    do                                  \
+    {                                   \
+        STORE_FRAME();                  \
+        runtimeError(__VA_ARGS__);      \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+
+/**
+ * Operands of the current instruction `i`, see `chunk.h`
+ */
+#define R(x) (base[(x)])
+#define K(x) (constants[(x)])
+#define RK(x) (IS_K(x) ? K(INDEX_K(x)) : R(x))
+#define READ_STRING(x) AS_STRING(K(x))
+
+/**
+ * Handle binary operators
+ */
+#define BINARY_OP(valueType, op)                        \
+    do                                                  \
+    {                                                   \
+        Value b = RK(GET_B(i));                         \
+        Value c = RK(GET_C(i));                         \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c))             \
+        {                                               \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        }                                               \
+        R(GET_A(i)) = valueType(AS_NUMBER(b) op AS_NUMBER(c)); \
+    } while (false)
+
+#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+/**
+ * Compare and take the `OP_JUMP` that follows when the result is `A`, or skip it
+ */
+#define TEST_OP(op)                                                         \
+    do                                                                      \
+    {                                                                       \
+        Value b = RK(GET_B(i));                                             \
+        Value c = RK(GET_C(i));                                             \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c))                                 \
+        {                                                                   \
+            RUNTIME_ERROR("Operands must be numbers.");                     \
+        }                                                                   \
+        if ((AS_NUMBER(b) op AS_NUMBER(c)) == GET_A(i))                     \
+        {                                                                   \
+            ip += GET_SBX(*ip) + 1;                                         \
+        }                                                                   \
+        else                                                                \
+        {                                                                   \
+            ip++;                                                           \
+        }                                                                   \
+    } while (false)
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void traceExecution(CallFrame *frame)
+{
+    printf("            ");
+    for (Value *slot = frame->slots; slot < vm.stackTop; slot++)
+    {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+
+    disassembleInstruction(&frame->closure->function->chunk,
+                           (int)(frame->ip - frame->closure->function->chunk.code));
+}
+#define TRACE_EXECUTION()      \
+    do                         \
+    {                          \
+        STORE_FRAME();         \
+        traceExecution(frame); \
+    } while (false)
+#else
+#define TRACE_EXECUTION() ((void)0)
+#endif
+
+#ifdef DEBUG_COUNT_DISPATCH
+#define COUNT_DISPATCH() (vm.dispatchCount++)
+#else
+#define COUNT_DISPATCH() ((void)0)
+#endif
+
+#if DISPATCH_ENGINE == DISPATCH_SWITCH
+#define OPCODE(op) case op:
+#define DISPATCH() continue
+#elif DISPATCH_ENGINE == DISPATCH_COMPUTED_GOTO
+#ifndef __GNUC__
+#error "DISPATCH_COMPUTED_GOTO requires the labels-as-values extension of GCC or Clang."
+#endif
+#define OPCODE(op) label_##op:
+#define DISPATCH()                              \
+    do                                          \
+    {                                           \
+        TRACE_EXECUTION();                      \
+        COUNT_DISPATCH();                       \
+        i = *ip++;                              \
+        goto *dispatchTable[GET_OP(i)];         \
+    } while (false)
+#else
+#error "Unknown DISPATCH_ENGINE, clox_v2 supports DISPATCH_SWITCH and DISPATCH_COMPUTED_GOTO."
+#endif
+
+/**
+ * Execute instructions stored in VM
+ *
+ * @details Every handler decodes its operands from the instruction word `i` and works on registers of the frame in
+ * place. The handlers are shared by both dispatch engines, `OPCODE()` opens a handler and `DISPATCH()` ends it:
+ *
+ * - Switch dispatch: every instruction goes back to the top of the loop and through the single indirect branch the
+ *   compiler generates for the `switch`.
+ * - Computed goto: the tail of every handler jumps through the label table on its own.
+ */
+static InterpretResult run()
+{
+    CallFrame *frame;
+    Instruction *ip;
+    Value *base;
+    Value *constants;
+    Instruction i;
+    LOAD_FRAME();
+
+#if DISPATCH_ENGINE == DISPATCH_COMPUTED_GOTO
+    static void *dispatchTable[] = {
+        [OP_MOVE] = &&label_OP_MOVE,
+        [OP_LOADK] = &&label_OP_LOADK,
+        [OP_LOADNIL] = &&label_OP_LOADNIL,
+        [OP_LOADBOOL] = &&label_OP_LOADBOOL,
+        [OP_GET_GLOBAL] = &&label_OP_GET_GLOBAL,
+        [OP_DEFINE_GLOBAL] = &&label_OP_DEFINE_GLOBAL,
+        [OP_SET_GLOBAL] = &&label_OP_SET_GLOBAL,
+        [OP_GET_UPVALUE] = &&label_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE] = &&label_OP_SET_UPVALUE,
+        [OP_GET_PROPERTY] = &&label_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY] = &&label_OP_SET_PROPERTY,
+        [OP_GET_SUPER] = &&label_OP_GET_SUPER,
+        [OP_EQUAL] = &&label_OP_EQUAL,
+        [OP_NOT_EQUAL] = &&label_OP_NOT_EQUAL,
+        [OP_GREATER] = &&label_OP_GREATER,
+        [OP_GREATER_EQUAL] = &&label_OP_GREATER_EQUAL,
+        [OP_LESS] = &&label_OP_LESS,
+        [OP_LESS_EQUAL] = &&label_OP_LESS_EQUAL,
+        [OP_ADD] = &&label_OP_ADD,
+        [OP_SUBTRACT] = &&label_OP_SUBTRACT,
+        [OP_MULTIPLY] = &&label_OP_MULTIPLY,
+        [OP_DIVIDE] = &&label_OP_DIVIDE,
+        [OP_NOT] = &&label_OP_NOT,
+        [OP_NEGATE] = &&label_OP_NEGATE,
+        [OP_PRINT] = &&label_OP_PRINT,
+        [OP_JUMP] = &&label_OP_JUMP,
+        [OP_JUMP_IF_FALSE] = &&label_OP_JUMP_IF_FALSE,
+        [OP_JUMP_IF_TRUE] = &&label_OP_JUMP_IF_TRUE,
+        [OP_TEST_EQUAL] = &&label_OP_TEST_EQUAL,
+        [OP_TEST_LESS] = &&label_OP_TEST_LESS,
+        [OP_TEST_GREATER] = &&label_OP_TEST_GREATER,
+        [OP_CALL] = &&label_OP_CALL,
+        [OP_INVOKE] = &&label_OP_INVOKE,
+        [OP_SUPER_INVOKE] = &&label_OP_SUPER_INVOKE,
+        [OP_CLOSURE] = &&label_OP_CLOSURE,
+        [OP_CLOSE_UPVALUE] = &&label_OP_CLOSE_UPVALUE,
+        [OP_RETURN] = &&label_OP_RETURN,
+        [OP_CLASS] = &&label_OP_CLASS,
+        [OP_INHERIT] = &&label_OP_INHERIT,
+        [OP_METHOD] = &&label_OP_METHOD,
+    };
+
+    DISPATCH();
+#else
+    for (;;)
+    {
+        TRACE_EXECUTION();
+        COUNT_DISPATCH();
+        i = *ip++;
+
+        switch (GET_OP(i))
+        {
+#endif
+
+    OPCODE(OP_MOVE)
+    {
+        R(GET_A(i)) = R(GET_B(i));
+        DISPATCH();
+    }
+    OPCODE(OP_LOADK)
+    {
+        R(GET_A(i)) = K(GET_BX(i));
+        DISPATCH();
+    }
+    OPCODE(OP_LOADNIL)
+    {
+        R(GET_A(i)) = NIL_VAL;
+        DISPATCH();
+    }
+    OPCODE(OP_LOADBOOL)
+    {
+        R(GET_A(i)) = BOOL_VAL(GET_B(i));
+        DISPATCH();
+    }
+    OPCODE(OP_GET_GLOBAL)
+    {
+        ObjString *name = READ_STRING(GET_BX(i));
+        if (!tableGet(&vm.globals, name, &R(GET_A(i))))
+        {
+            RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_DEFINE_GLOBAL)
+    {
+        ObjString *name = READ_STRING(GET_BX(i));
+        STORE_FRAME(); // The table can grow
+        tableSet(&vm.globals, name, R(GET_A(i)));
+        DISPATCH();
+    }
+    OPCODE(OP_SET_GLOBAL)
+    {
+        ObjString *name = READ_STRING(GET_BX(i));
+        STORE_FRAME(); // The table can grow
+        if (tableSet(&(vm.globals), name, R(GET_A(i))))
+        {
+            tableDelete(&(vm.globals), name);
+            RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_GET_UPVALUE)
+    {
+        R(GET_A(i)) = *frame->closure->upvalues[GET_B(i)]->location;
+        DISPATCH();
+    }
+    OPCODE(OP_SET_UPVALUE)
+    {
+        *frame->closure->upvalues[GET_B(i)]->location = R(GET_A(i));
+        DISPATCH();
+    }
+    OPCODE(OP_GET_PROPERTY)
+    {
+        Value object = R(GET_B(i));
+        if (!IS_INSTANCE(object))
+        {
+            RUNTIME_ERROR("Only instances have properties.");
+        }
+
+        ObjInstance *instance = AS_INSTANCE(object);
+        ObjString *name = READ_STRING(GET_C(i));
+
+        if (tableGet(&(instance->fields), name, &R(GET_A(i)))) // Lookup field
+        {
+            DISPATCH();
+        }
+
+        STORE_FRAME();
+        if (!bindMethod(instance->klass, name, object, &R(GET_A(i)))) // Lookup method
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_SET_PROPERTY)
+    {
+        Value object = R(GET_A(i));
+        if (!IS_INSTANCE(object))
+        {
+            RUNTIME_ERROR("Only instances have fields.");
+        }
+
+        ObjInstance *instance = AS_INSTANCE(object);
+        ObjString *name = READ_STRING(GET_B(i));
+        STORE_FRAME(); // The table can grow
+        tableSet(&(instance->fields), name, RK(GET_C(i)));
+        DISPATCH();
+    }
+    OPCODE(OP_GET_SUPER)
+    {
+        ObjString *name = READ_STRING(GET_C(i));
+        ObjClass *superclass = AS_CLASS(R(GET_B(i)));
+
+        STORE_FRAME();
+        if (!bindMethod(superclass, name, R(GET_A(i)), &R(GET_A(i))))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_EQUAL)
+    {
+        R(GET_A(i)) = BOOL_VAL(valuesEqual(RK(GET_B(i)), RK(GET_C(i))));
+        DISPATCH();
+    }
+    OPCODE(OP_NOT_EQUAL)
+    {
+        R(GET_A(i)) = BOOL_VAL(!valuesEqual(RK(GET_B(i)), RK(GET_C(i))));
+        DISPATCH();
+    }
+    OPCODE(OP_GREATER)
+    {
+        BINARY_OP(BOOL_VAL, >);
+        DISPATCH();
+    }
+    OPCODE(OP_GREATER_EQUAL)
+    {
+        BINARY_OP(NOT_BOOL_VAL, <); // `!(a < b)`, so NaN compares like `OP_LESS` and `OP_NOT` of the stack VM
+        DISPATCH();
+    }
+    OPCODE(OP_LESS)
+    {
+        BINARY_OP(BOOL_VAL, <);
+        DISPATCH();
+    }
+    OPCODE(OP_LESS_EQUAL)
+    {
+        BINARY_OP(NOT_BOOL_VAL, >);
+        DISPATCH();
+    }
+    OPCODE(OP_ADD)
+    {
+        Value b = RK(GET_B(i));
+        Value c = RK(GET_C(i));
+        if (IS_STRING(b) && IS_STRING(c))
+        {
+            STORE_FRAME();
+            concatenate(b, c, &R(GET_A(i)));
+        }
+        else if (IS_NUMBER(b) && IS_NUMBER(c))
+        {
+            R(GET_A(i)) = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+        }
+        else
+        {
+            RUNTIME_ERROR("Operands must be two numbers or two strings.");
+        }
+
+        DISPATCH();
+    }
+    OPCODE(OP_SUBTRACT)
+    {
+        BINARY_OP(NUMBER_VAL, -);
+        DISPATCH();
+    }
+    OPCODE(OP_MULTIPLY)
+    {
+        BINARY_OP(NUMBER_VAL, *);
+        DISPATCH();
+    }
+    OPCODE(OP_DIVIDE)
+    {
+        BINARY_OP(NUMBER_VAL, /);
+        DISPATCH();
+    }
+    OPCODE(OP_NOT)
+    {
+        R(GET_A(i)) = BOOL_VAL(isFalsey(R(GET_B(i))));
+        DISPATCH();
+    }
+    OPCODE(OP_NEGATE)
+    {
+        Value operand = R(GET_B(i));
+        if (!IS_NUMBER(operand))
+        {
+            RUNTIME_ERROR("Operand must be a number.");
+        }
+        R(GET_A(i)) = NUMBER_VAL(-(AS_NUMBER(operand)));
+        DISPATCH();
+    }
+    OPCODE(OP_PRINT)
+    {
+        printValue(R(GET_A(i)));
+        printf("\n");
+        DISPATCH();
+    }
+    OPCODE(OP_JUMP)
+    {
+        ip += GET_SBX(i);
+        DISPATCH();
+    }
+    OPCODE(OP_JUMP_IF_FALSE)
+    {
+        if (isFalsey(R(GET_A(i))))
+        {
+            ip += GET_SBX(i);
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_JUMP_IF_TRUE)
+    {
+        if (!isFalsey(R(GET_A(i))))
+        {
+            ip += GET_SBX(i);
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_TEST_EQUAL)
+    {
+        if (valuesEqual(RK(GET_B(i)), RK(GET_C(i))) == GET_A(i))
+        {
+            ip += GET_SBX(*ip) + 1;
+        }
+        else
+        {
+            ip++;
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_TEST_LESS)
+    {
+        TEST_OP(<);
+        DISPATCH();
+    }
+    OPCODE(OP_TEST_GREATER)
+    {
+        TEST_OP(>);
+        DISPATCH();
+    }
+    OPCODE(OP_CALL)
+    {
+        STORE_FRAME();
+        if (!callValue(R(GET_A(i)), GET_B(i), &R(GET_A(i))))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME(); // Switch to the stack frame of current invoked function.
+        DISPATCH();
+    }
+    OPCODE(OP_INVOKE)
+    {
+        ObjString *method = READ_STRING(GET_B(i));
+        STORE_FRAME();
+        if (!invoke(method, GET_C(i), &R(GET_A(i))))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    OPCODE(OP_SUPER_INVOKE)
+    {
+        ObjString *method = READ_STRING(GET_B(i));
+        int argCount = GET_C(i);
+        ObjClass *superclass = AS_CLASS(R(GET_A(i) + argCount + 1));
+        STORE_FRAME();
+        if (!invokeFromClass(superclass, method, argCount, &R(GET_A(i))))
+        {
+            return INTERPRET_RUNTIME_ERROR;
+        }
+        LOAD_FRAME();
+        DISPATCH();
+    }
+    OPCODE(OP_CLOSURE)
+    {
+        ObjFunction *function = AS_FUNCTION(K(GET_BX(i)));
+        STORE_FRAME();
+        ObjClosure *closure = newClosure(function);
+        R(GET_A(i)) = OBJ_VAL(closure); // Keep the closure reachable while capturing upvalues allocates
+        for (int j = 0; j < closure->upvalueCount; j++)
+        {
+            Instruction descriptor = *ip++;
+            if (UPVALUE_IS_LOCAL(descriptor))
+            {
+                closure->upvalues[j] = captureUpvalue(base + UPVALUE_INDEX(descriptor));
+            }
+            else
+            {
+                closure->upvalues[j] = frame->closure->upvalues[UPVALUE_INDEX(descriptor)];
+            }
+        }
+        DISPATCH();
+    }
+    OPCODE(OP_CLOSE_UPVALUE)
+    {
+        closeUpvalues(base + GET_A(i));
+        DISPATCH();
+    }
+    OPCODE(OP_RETURN)
+    {
+        Value result = GET_B(i) ? NIL_VAL : R(GET_A(i));
+        closeUpvalues(base);
+        vm.frameCount--;
+        if (vm.frameCount == 0)
+        {
+            vm.stackTop = vm.stack;
+            return INTERPRET_OK;
+        }
+
+        base[0] = result; // The result replaces the callee in the register of the caller
+        LOAD_FRAME();     // Switch to the stack frame of the caller after executing `return` statement.
+        vm.stackTop = base + frame->closure->function->maxSlots;
+        DISPATCH();
+    }
+    OPCODE(OP_CLASS)
+    {
+        ObjString *name = READ_STRING(GET_BX(i));
+        STORE_FRAME();
+        R(GET_A(i)) = OBJ_VAL(newClass(name));
+        DISPATCH();
+    }
+    OPCODE(OP_INHERIT)
+    {
+        Value superclass = R(GET_B(i));
+        if (!IS_CLASS(superclass))
+        {
+            RUNTIME_ERROR("Superclass must be a class.");
+        }
+
+        ObjClass *subclass = AS_CLASS(R(GET_A(i)));
+
+        /// @brief `copy-down inheritance`
+        ///
+        /// @note When the subclass is declared, we copy all of the inherited class’s methods down into the subclass’s own method table.
+        /// It’s simple and fast, but, like most optimizations, you get to use it only under certain constraints.
+        /// It works in Lox because Lox classes are closed. Once a class declaration is finished executing,
+        /// the set of methods for that class can never change.
+        STORE_FRAME(); // The method table can grow
+        tableAddAll(&(AS_CLASS(superclass)->methods), &(subclass->methods));
+        DISPATCH();
+    }
+    OPCODE(OP_METHOD)
+    {
+        ObjClass *klass = AS_CLASS(R(GET_A(i)));
+        ObjClosure *method = AS_CLOSURE(R(GET_B(i)));
+        STORE_FRAME(); // The method table can grow
+        tableSet(&(klass->methods), method->function->name, OBJ_VAL(method));
+        DISPATCH();
+    }
+
+#if DISPATCH_ENGINE == DISPATCH_SWITCH
+        }
+    }
+#endif
+}
+
+#undef OPCODE
+#undef DISPATCH
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef R
+#undef K
+#undef RK
+#undef READ_STRING
+#undef BINARY_OP
+#undef NOT_BOOL_VAL
+#undef TEST_OP
+#undef TRACE_EXECUTION
+#undef COUNT_DISPATCH
+
+static void resetStack()
+{
+    vm.stackTop = vm.stack;
+    vm.frameCount = 0;
+    vm.openUpvalues = NULL;
+}
+
+/**
+ * @details a variadic function
+ */
+static void runtimeError(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    //< print stack trace
+    for (int i = vm.frameCount - 1; i >= 0; i--)
+    {
+        CallFrame *frame = &vm.frames[i];
+        ObjFunction *function = frame->closure->function;
+        size_t instruction = frame->ip - function->chunk.code - 1;
+        fprintf(stderr, "[line %d] in ",
+                function->chunk.lines[instruction]);
+        if (function->name == NULL)
+        {
+            fprintf(stderr, "script\n");
+        }
+        else
+        {
+            fprintf(stderr, "%s()\n", function->name->chars);
+        }
+    }
+    //>
+
+    resetStack();
+}
+
+/**
+ * Define native function
+ */
+static void defineNative(const char *name, NativeFn function)
+{
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    push(OBJ_VAL(newNative(function)));
+    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    pop();
+    pop();
+}
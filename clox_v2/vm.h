@@ -0,0 +1,101 @@
+#ifndef clox_vm_h
+#define clox_vm_h
+
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "chunk.h"
+
+#define FRAMES_MAX 64
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+
+/**
+ * A stack frame
+ */
+typedef struct
+{
+    /**
+     * The function being called
+     */
+    ObjClosure *closure;
+    /**
+     * Caller's current instruction pointer. When we return from a function, the VM will jump to the ip of the caller’s CallFrame and resume from there.
+     *
+     * @note For the running frame, `run()` keeps the ip in a local and writes it back only at spill points.
+     */
+    Instruction *ip;
+    /**
+     * Register 0 of this stack frame, the window of `closure->function->maxSlots` registers starts here
+     */
+    Value *slots;
+} CallFrame;
+
+typedef struct
+{
+    /**
+     * Call stack
+     */
+    CallFrame frames[FRAMES_MAX];
+    /**
+     * Stack frame count
+     */
+    int frameCount;
+    Value stack[STACK_MAX];
+    /**
+     * End of the register window of the running frame
+     */
+    Value *stackTop;
+    /**
+     * Global variables
+     */
+    Table globals;
+    /**
+     * Global string pool for `string interning`
+     *
+     * @see https://craftinginterpreters.com/hash-tables.html#string-interning
+     */
+    Table strings;
+    /** Constant for `init` */
+    ObjString* initString;
+    ObjUpvalue *openUpvalues;
+    /**
+     * Bytes allocated in heap
+     */
+    size_t bytesAllocated;
+    /**
+     * The threshold of bytes allocated that triggers the next garbage collection.
+     */
+    size_t nextGC;
+    /**
+     * List of all objects stored in heap
+     */
+    Obj *objects;
+    //> Gray stack for tracing referenced object
+    int grayCount;
+    int grayCapacity;
+    Obj **grayStack;
+    //<
+#ifdef DEBUG_COUNT_DISPATCH
+    /**
+     * Number of dispatched instructions, reported by `freeVM()`
+     */
+    uint64_t dispatchCount;
+#endif
+} VM;
+
+typedef enum
+{
+    INTERPRET_OK,
+    INTERPRET_COMPILE_ERROR,
+    INTERPRET_RUNTIME_ERROR
+} InterpretResult;
+
+extern VM vm;
+
+void initVM();
+void freeVM();
+InterpretResult interpret(const char *source);
+void push(Value value);
+Value pop();
+
+#endif